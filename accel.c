@@ -0,0 +1,373 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "accel.h"
+
+const size_t ACCEL_LEAF_SIZE = 4;
+
+bool accel_build(accel_t *accel, const scene_t *scene)
+{
+    size_t        count = object_count(scene);
+    object_ref_t *all   = calloc(count > 0 ? count : 1, sizeof(object_ref_t));
+
+    if (!all)
+    {
+        memset(accel, 0, sizeof(*accel));
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        all[i] = object_by_number(scene, i);
+
+    bool ok = accel_build_objects(accel, scene, all, count);
+
+    free(all);
+    return ok;
+}
+
+bool accel_build_objects(accel_t *accel, const scene_t *scene, const object_ref_t *list,
+                         size_t count)
+{
+    memset(accel, 0, sizeof(*accel));
+
+    aabb_t       *bounds  = calloc(count > 0 ? count : 1, sizeof(aabb_t));
+    object_ref_t *objects = calloc(count > 0 ? count : 1, sizeof(object_ref_t));
+
+    if (!bounds || !objects)
+    {
+        free(bounds);
+        free(objects);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        bounds[i] = object_bounds(scene, list[i]);
+
+    if (!bvh_build_sah(&accel->bvh, bounds, count, ACCEL_LEAF_SIZE, scene->accel_build))
+    {
+        free(bounds);
+        free(objects);
+        return false;
+    }
+
+    accel->objects       = objects;
+    accel->objects_count = count;
+
+    free(bounds);
+
+    // lazy subtrees keep reordering indices, leaves refer to objects through them
+    if (accel->bvh.lazy)
+    {
+        memcpy(objects, list, count * sizeof(object_ref_t));
+        return true;
+    }
+
+    // store objects in leaf order, so leaves refer to them directly
+
+    for (size_t i = 0; i < count; i++)
+        objects[i] = list[accel->bvh.indices[i]];
+
+    free(accel->bvh.indices);
+    accel->bvh.indices       = NULL;
+    accel->bvh.indices_count = 0;
+
+    // binary hierarchy still works without it
+    accel_widen(accel);
+    return true;
+}
+
+static bool is_mapped(const accel_t *accel, const void *array)
+{
+    const char *begin = accel->mapping;
+    const char *ptr   = array;
+
+    return begin && ptr >= begin && ptr < begin + accel->mapping_size;
+}
+
+object_ref_t accel_object(const accel_t *accel, size_t slot)
+{
+    return accel->bvh.indices ? accel->objects[accel->bvh.indices[slot]] : accel->objects[slot];
+}
+
+void accel_complete(accel_t *accel)
+{
+    if (!accel->bvh.lazy)
+        return;
+
+    bvh_complete(&accel->bvh);
+
+    // objects go to leaf order in place, following cycles of the permutation,
+    // indices of visited slots are marked by the object count
+    uint32_t *indices = accel->bvh.indices;
+    uint32_t  done    = (uint32_t)accel->objects_count;
+
+    for (size_t i = 0; i < accel->objects_count; i++)
+    {
+        if (indices[i] == done)
+            continue;
+
+        object_ref_t first = accel->objects[i];
+        size_t       slot  = i;
+
+        while (indices[slot] != i)
+        {
+            size_t from = indices[slot];
+
+            accel->objects[slot] = accel->objects[from];
+            indices[slot]        = done;
+            slot                 = from;
+        }
+
+        accel->objects[slot] = first;
+        indices[slot]        = done;
+    }
+
+    free(accel->bvh.indices);
+    accel->bvh.indices       = NULL;
+    accel->bvh.indices_count = 0;
+
+    // binary hierarchy still works without it
+    accel_widen(accel);
+}
+
+bool accel_widen(accel_t *accel)
+{
+    // lazy hierarchy is traversed as it is until it's complete
+    if (accel->bvh.lazy)
+        return true;
+
+    accel_drop_wide(accel);
+
+    return bvh4_build(&accel->wide, &accel->bvh);
+}
+
+void accel_drop_wide(accel_t *accel)
+{
+    if (is_mapped(accel, accel->wide.nodes))
+        memset(&accel->wide, 0, sizeof(accel->wide));
+    else
+        bvh4_destroy(&accel->wide);
+}
+
+/**
+ * Heap copy of the array
+ */
+static void *copy_array(const void *array, size_t count, size_t size)
+{
+    void *copy = malloc((count > 0 ? count : 1) * size);
+
+    if (copy)
+        memcpy(copy, array, count * size);
+
+    return copy;
+}
+
+bool accel_own(accel_t *accel)
+{
+    if (!accel->mapping)
+        return true;
+
+    bvh_node_t   *nodes   = copy_array(accel->bvh.nodes, accel->bvh.nodes_count,
+                                       sizeof(bvh_node_t));
+    object_ref_t *objects = copy_array(accel->objects, accel->objects_count,
+                                       sizeof(object_ref_t));
+    bvh4_node_t  *wide    = accel->wide.nodes;
+    bool          remap   = is_mapped(accel, wide);
+
+    if (remap)
+        wide = copy_array(accel->wide.nodes, accel->wide.nodes_count, sizeof(bvh4_node_t));
+
+    if (!nodes || !objects || (remap && !wide))
+    {
+        free(nodes);
+        free(objects);
+        if (remap)
+            free(wide);
+
+        return false;
+    }
+
+    munmap(accel->mapping, accel->mapping_size);
+
+    accel->bvh.nodes    = nodes;
+    accel->objects      = objects;
+    accel->wide.nodes   = wide;
+    accel->mapping      = NULL;
+    accel->mapping_size = 0;
+
+    return true;
+}
+
+void accel_destroy(accel_t *accel)
+{
+    if (accel->mapping)
+    {
+        // the wide hierarchy may have been collapsed again on the heap
+        accel_drop_wide(accel);
+        munmap(accel->mapping, accel->mapping_size);
+    }
+    else
+    {
+        bvh_destroy(&accel->bvh);
+        bvh4_destroy(&accel->wide);
+        free(accel->objects);
+    }
+
+    memset(accel, 0, sizeof(*accel));
+}
+
+typedef struct scene_query
+{
+    const scene_t *scene;
+    const accel_t *accel;
+
+    vec3_t         ray_origin;
+    vec3_t         ray_dir;
+
+    hit_t          hit;
+    bool           found;
+} scene_query_t;
+
+static void accel_traverse(const accel_t *accel, vec3_t ray_origin, vec3_t ray_dir, float t_max,
+                           bvh_leaf_func_t leaf_func, void *ctx)
+{
+    if (accel->wide.nodes_count > 0)
+        bvh4_traverse(&accel->wide, ray_origin, ray_dir, t_max, leaf_func, ctx);
+    else
+        bvh_traverse(&accel->bvh, ray_origin, ray_dir, t_max, leaf_func, ctx);
+}
+
+static bool closest_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    scene_query_t *query = ctx;
+
+    for (uint32_t i = leaf->first; i < leaf->first + leaf->count; i++)
+    {
+        object_ref_t object = accel_object(query->accel, i);
+        uint32_t     prim   = 0;
+
+        if (object_intersect(query->scene, object, query->ray_origin, query->ray_dir,
+                             io_t_max, &prim))
+        {
+            query->hit   = (hit_t){ *io_t_max, object, prim };
+            query->found = true;
+        }
+    }
+
+    return false;
+}
+
+static bool any_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    (void)io_t_max;
+
+    scene_query_t *query = ctx;
+
+    for (uint32_t i = leaf->first; i < leaf->first + leaf->count; i++)
+    {
+        object_ref_t object = accel_object(query->accel, i);
+
+        if (object_casts_shadow(query->scene, object) &&
+            object_occluded(query->scene, object, query->ray_origin, query->ray_dir,
+                            query->hit.dist))
+        {
+            query->found = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Scenes of up to one leaf of objects are tested object by object,
+ * walking the hierarchy to its only leaf costs more than that
+ */
+static bool accel_worth(const scene_t *scene)
+{
+    return scene->accel && object_count(scene) > ACCEL_LEAF_SIZE;
+}
+
+bool scene_intersect(const scene_t *scene, vec3_t ray_origin, vec3_t ray_dir, float max_dist,
+                     hit_t *out_hit)
+{
+    scene_query_t query = { scene, scene->accel, ray_origin, ray_dir, { max_dist, { 0, 0 }, 0 },
+                            false };
+
+    if (accel_worth(scene))
+    {
+        accel_traverse(scene->accel, ray_origin, ray_dir, max_dist, closest_leaf, &query);
+    }
+    else
+    {
+        float  dist  = max_dist;
+        size_t count = object_count(scene);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            object_ref_t object = object_by_number(scene, i);
+            uint32_t     prim   = 0;
+
+            if (object_intersect(scene, object, ray_origin, ray_dir, &dist, &prim))
+            {
+                query.hit   = (hit_t){ dist, object, prim };
+                query.found = true;
+            }
+        }
+    }
+
+    if (query.found)
+        *out_hit = query.hit;
+
+    return query.found;
+}
+
+bool objects_intersect(const scene_t *scene, const object_ref_t *objects, size_t objects_count,
+                       vec3_t ray_origin, vec3_t ray_dir, float max_dist, hit_t *out_hit)
+{
+    float dist  = max_dist;
+    bool  found = false;
+
+    for (size_t i = 0; i < objects_count; i++)
+    {
+        uint32_t prim = 0;
+
+        if (object_intersect(scene, objects[i], ray_origin, ray_dir, &dist, &prim))
+        {
+            *out_hit = (hit_t){ dist, objects[i], prim };
+            found    = true;
+        }
+    }
+
+    return found;
+}
+
+bool accel_occluded(const scene_t *scene, const accel_t *accel, vec3_t ray_origin, vec3_t ray_dir,
+                    float max_dist)
+{
+    scene_query_t query = { scene, accel, ray_origin, ray_dir, { max_dist, { 0, 0 }, 0 },
+                            false };
+
+    // boxes are tested with the same tolerance as the objects
+    accel_traverse(accel, ray_origin, ray_dir, max_dist + EPS, any_leaf, &query);
+    return query.found;
+}
+
+bool scene_occluded(const scene_t *scene, vec3_t ray_origin, vec3_t ray_dir, float max_dist)
+{
+    if (accel_worth(scene))
+        return accel_occluded(scene, scene->accel, ray_origin, ray_dir, max_dist);
+
+    size_t count = object_count(scene);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        object_ref_t object = object_by_number(scene, i);
+
+        if (object_casts_shadow(scene, object) &&
+            object_occluded(scene, object, ray_origin, ray_dir, max_dist))
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,104 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include "bvh.h"
+#include "bvh4.h"
+#include "object.h"
+#include "rt.h"
+
+/**
+ * Top level acceleration structure:
+ * hierarchy over all objects of the scene. Meshes and mesh instances
+ * carry their own bottom level hierarchies, so instances of one prototype
+ * share it and only cost their placement
+ * Rays traverse the four wide hierarchy collapsed from the binary one,
+ * or the binary one while the wide one is not built or the binary one is lazy
+ */
+typedef struct accel
+{
+    bvh_t         bvh;
+    bvh4_t        wide;
+
+    // objects in leaf order, leaf first is the index of its first object,
+    // objects of a lazy hierarchy are in bvh indices order instead, see accel_object()
+    object_ref_t *objects;
+    size_t        objects_count;
+
+    // arrays above are in this private mapping of a cache file instead of the heap,
+    // if not NULL, see accel_own()
+    void         *mapping;
+    size_t        mapping_size;
+} accel_t;
+
+// objects per leaf of the top level hierarchy
+extern const size_t ACCEL_LEAF_SIZE;
+
+/**
+ * Builds hierarchy over all objects of the scene with scene->accel_build options
+ */
+bool accel_build(accel_t *accel, const scene_t *scene);
+
+/**
+ * Hierarchy over the given objects of the scene only
+ */
+bool accel_build_objects(accel_t *accel, const scene_t *scene, const object_ref_t *list,
+                         size_t count);
+
+void accel_destroy(accel_t *accel);
+
+/**
+ * Object of the slot a leaf refers to
+ */
+object_ref_t accel_object(const accel_t *accel, size_t slot);
+
+/**
+ * Builds the rest of a lazy hierarchy, puts objects in leaf order and collapses
+ * the wide hierarchy, so it can be edited or saved
+ */
+void accel_complete(accel_t *accel);
+
+/**
+ * Collapses the binary hierarchy into the wide one again, e.g. after it was edited
+ * Does nothing while the binary one is lazy
+ */
+bool accel_widen(accel_t *accel);
+
+/**
+ * Forgets the wide hierarchy once the binary one is edited
+ */
+void accel_drop_wide(accel_t *accel);
+
+/**
+ * Moves arrays mapped from a cache file to the heap, so they can grow
+ * Mapped arrays can be written in place, the file doesn't change
+ */
+bool accel_own(accel_t *accel);
+
+/**
+ * Finds the nearest object hit closer than max_dist
+ * Uses scene acceleration structure if there is one
+ * Ray direction must be normalized
+ */
+bool scene_intersect(const scene_t *scene, vec3_t ray_origin, vec3_t ray_dir, float max_dist,
+                     hit_t *out_hit);
+
+/**
+ * Finds the nearest hit among the given objects only
+ * Ray direction must be normalized
+ */
+bool objects_intersect(const scene_t *scene, const object_ref_t *objects, size_t objects_count,
+                       vec3_t ray_origin, vec3_t ray_dir, float max_dist, hit_t *out_hit);
+
+/**
+ * Checks if any shadow casting object is hit closer than max_dist
+ * Ray direction must be normalized
+ */
+bool scene_occluded(const scene_t *scene, vec3_t ray_origin, vec3_t ray_dir, float max_dist);
+
+/**
+ * Same as scene_occluded(), but only objects of the given hierarchy are tested
+ */
+bool accel_occluded(const scene_t *scene, const accel_t *accel, vec3_t ray_origin, vec3_t ray_dir,
+                    float max_dist);
+
+#endif
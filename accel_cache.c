@@ -0,0 +1,259 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "accel_cache.h"
+
+// bump when the file layout or the builders change
+static const uint64_t ACCEL_CACHE_VERSION  = 1;
+static const char     ACCEL_CACHE_MAGIC[8] = "rtaccel";
+// sections start at cache lines
+static const size_t   ACCEL_CACHE_ALIGN    = 64;
+
+typedef struct accel_cache_header
+{
+    char     magic[8];
+    uint64_t key;
+
+    uint64_t nodes_count;
+    uint64_t objects_count;
+    uint64_t wide_count;
+} accel_cache_header_t;
+
+/**
+ * Offsets of the binary nodes, objects and wide nodes, and the size of the file
+ */
+typedef struct accel_cache_layout
+{
+    size_t nodes;
+    size_t objects;
+    size_t wide;
+    size_t size;
+} accel_cache_layout_t;
+
+static size_t align_up(size_t offset)
+{
+    return (offset + ACCEL_CACHE_ALIGN - 1) / ACCEL_CACHE_ALIGN * ACCEL_CACHE_ALIGN;
+}
+
+static accel_cache_layout_t cache_layout(const accel_cache_header_t *header)
+{
+    accel_cache_layout_t layout;
+
+    layout.nodes   = align_up(sizeof(accel_cache_header_t));
+    layout.objects = align_up(layout.nodes   + header->nodes_count   * sizeof(bvh_node_t));
+    layout.wide    = align_up(layout.objects + header->objects_count * sizeof(object_ref_t));
+    layout.size    = layout.wide + header->wide_count * sizeof(bvh4_node_t);
+
+    return layout;
+}
+
+/**
+ * FNV-1a
+ */
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+
+    return hash;
+}
+
+/**
+ * Hash of everything the built hierarchy depends on
+ */
+static uint64_t scene_key(const scene_t *scene)
+{
+    size_t params[] =
+    {
+        ACCEL_CACHE_VERSION, sizeof(bvh_node_t), sizeof(object_ref_t), sizeof(bvh4_node_t),
+        ACCEL_LEAF_SIZE, scene->accel_build ? scene->accel_build->bins : 0,
+        scene->spheres_count, scene->planes_count, scene->meshes_count, scene->instances_count
+    };
+
+    uint64_t hash = hash_bytes(0xcbf29ce484222325ull, params, sizeof(params));
+
+    size_t count = object_count(scene);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        aabb_t bounds = object_bounds(scene, object_by_number(scene, i));
+        hash = hash_bytes(hash, &bounds, sizeof(bounds));
+    }
+
+    return hash;
+}
+
+static bool objects_valid(const scene_t *scene, const object_ref_t *objects, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t kind_count = 0;
+
+        switch (objects[i].kind)
+        {
+        case OBJECT_SPHERE:   kind_count = scene->spheres_count;   break;
+        case OBJECT_PLANE:    kind_count = scene->planes_count;    break;
+        case OBJECT_MESH:     kind_count = scene->meshes_count;    break;
+        case OBJECT_INSTANCE: kind_count = scene->instances_count; break;
+        }
+
+        if (objects[i].index >= kind_count)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Maps the file if it holds the hierarchy for the key and the scene
+ */
+static bool cache_load(accel_t *accel, const scene_t *scene, const char *path, uint64_t key)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(accel_cache_header_t))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+
+    // private writable pages, so the editor can refit the nodes in place
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    const accel_cache_header_t *header = map;
+    size_t                      count  = object_count(scene);
+
+    // counts are checked against the size first, so the layout can't overflow
+    bool ok = memcmp(header->magic, ACCEL_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+              header->key == key && header->objects_count == count &&
+              header->nodes_count <= size / sizeof(bvh_node_t) &&
+              header->wide_count  <= size / sizeof(bvh4_node_t) &&
+              cache_layout(header).size == size;
+
+    accel_t loaded = {0};
+
+    if (ok)
+    {
+        accel_cache_layout_t layout = cache_layout(header);
+        char                *base   = map;
+
+        loaded.bvh.nodes        = (bvh_node_t   *)(base + layout.nodes);
+        loaded.bvh.nodes_count  = header->nodes_count;
+        loaded.objects          = (object_ref_t *)(base + layout.objects);
+        loaded.objects_count    = header->objects_count;
+        loaded.wide.nodes       = header->wide_count > 0 ? (bvh4_node_t *)(base + layout.wide)
+                                                         : NULL;
+        loaded.wide.nodes_count = header->wide_count;
+        loaded.mapping          = map;
+        loaded.mapping_size     = size;
+
+        ok = bvh_valid(&loaded.bvh, count) && bvh4_valid(&loaded.wide, count) &&
+             objects_valid(scene, loaded.objects, count);
+    }
+
+    if (!ok)
+    {
+        munmap(map, size);
+        return false;
+    }
+
+    *accel = loaded;
+    return true;
+}
+
+/**
+ * Pads the file up to the offset and writes the section there
+ */
+static bool write_section(FILE *file, size_t offset, const void *data, size_t size)
+{
+    long position = ftell(file);
+    if (position < 0)
+        return false;
+
+    for (size_t i = (size_t)position; i < offset; i++)
+    {
+        if (fputc(0, file) == EOF)
+            return false;
+    }
+
+    return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+/**
+ * Writes a temporary file next to the cache and renames it over the cache,
+ * so other processes never map a partial one
+ */
+static bool cache_save(const accel_t *accel, const char *path, uint64_t key)
+{
+    accel_cache_header_t header = {0};
+
+    memcpy(header.magic, ACCEL_CACHE_MAGIC, sizeof(header.magic));
+    header.key           = key;
+    header.nodes_count   = accel->bvh.nodes_count;
+    header.objects_count = accel->objects_count;
+    header.wide_count    = accel->wide.nodes_count;
+
+    accel_cache_layout_t layout = cache_layout(&header);
+
+    char *temp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if (!temp_path)
+        return false;
+
+    sprintf(temp_path, "%s.tmp", path);
+
+    FILE *file = fopen(temp_path, "wb");
+
+    bool ok = file &&
+              write_section(file, 0, &header, sizeof(header)) &&
+              write_section(file, layout.nodes, accel->bvh.nodes,
+                            header.nodes_count * sizeof(bvh_node_t)) &&
+              write_section(file, layout.objects, accel->objects,
+                            header.objects_count * sizeof(object_ref_t)) &&
+              write_section(file, layout.wide, accel->wide.nodes,
+                            header.wide_count * sizeof(bvh4_node_t));
+
+    if (file && fclose(file) != 0)
+        ok = false;
+
+    ok = ok && rename(temp_path, path) == 0;
+
+    if (!ok)
+        remove(temp_path);
+
+    free(temp_path);
+    return ok;
+}
+
+bool accel_build_cached(accel_t *accel, const scene_t *scene, const char *path)
+{
+    uint64_t key = scene_key(scene);
+
+    if (cache_load(accel, scene, path, key))
+        return true;
+
+    if (!accel_build(accel, scene))
+        return false;
+
+    // the file holds whole hierarchies
+    accel_complete(accel);
+
+    if (!cache_save(accel, path, key))
+        fprintf(stderr, "Can't write acceleration structure cache %s\n", path);
+
+    return true;
+}
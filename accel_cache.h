@@ -0,0 +1,18 @@
+#ifndef ACCEL_CACHE_H
+#define ACCEL_CACHE_H
+
+#include "accel.h"
+#include "rt.h"
+
+/**
+ * Same as accel_build(), but the hierarchy is mapped from the cache file
+ * if it was saved there for the same scene, otherwise it is built and saved there
+ * The file is keyed by a hash of object bounds and build options, everything
+ * the hierarchy depends on, so a changed scene misses it and replaces it
+ * Startup with a matching file skips the build, pages are read as rays touch them
+ * A file which can't be written is skipped with a warning
+ * Lazy build is completed before it is saved
+ */
+bool accel_build_cached(accel_t *accel, const scene_t *scene, const char *path);
+
+#endif
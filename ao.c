@@ -0,0 +1,247 @@
+#include <math.h>
+#include <string.h>
+
+#include "accel.h"
+#include "ao.h"
+
+// hemisphere rays of one record, grid x grid strata, and their length
+static const int   AO_GRID     = 6;
+static const float AO_DISTANCE = 4.f;
+// record radius is clamped, so corners don't get too dense records
+static const float AO_MIN_RADIUS = 0.2f;
+// records are reused while the estimated error is below it,
+// so a record reaches points at AO_ERROR * radius at most
+static const float AO_ERROR = 0.3f;
+// record is not used for points this far behind its surface, relative to its radius
+static const float AO_BEHIND_TOLERANCE = 0.05f;
+
+static const size_t AO_INITIAL_CAPACITY = 1024;
+
+/**
+ * Reach of a record is at most one cell, so it is entered into 8 cells at most
+ */
+static float cell_size()
+{
+    return AO_ERROR * AO_DISTANCE;
+}
+
+static int32_t cell_coord(float coord)
+{
+    return (int32_t)floorf(coord / cell_size());
+}
+
+static uint32_t cell_hash(int32_t x, int32_t y, int32_t z, size_t buckets_count)
+{
+    uint32_t hash = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+
+    return hash & (uint32_t)(buckets_count - 1);
+}
+
+void ao_cache_destroy(ao_cache_t *cache)
+{
+    free(cache->records);
+    free(cache->entries);
+    free(cache->buckets);
+
+    memset(cache, 0, sizeof(*cache));
+}
+
+void ao_cache_clear(ao_cache_t *cache)
+{
+    cache->records_count = 0;
+    cache->entries_count = 0;
+
+    for (size_t i = 0; i < cache->buckets_count; i++)
+        cache->buckets[i] = UINT32_MAX;
+}
+
+/**
+ * Cosine weighted hemisphere rays from the point
+ * Gives the record of the point
+ */
+static ao_record_t sample_record(const scene_t *scene, vec3_t pos, vec3_t norm)
+{
+    vec3_t tangent = {0}, bitan = {0};
+    vec_basis(norm, &tangent, &bitan);
+
+    // slightly move ray origin along normal to ignore the surface itself
+    vec3_t origin = vec_add(pos, vec_mul_num(norm, SHADOW_BIAS));
+
+    uint32_t seed = random_seed(pos);
+
+    int   rays     = AO_GRID * AO_GRID;
+    int   unseen   = 0;
+    float inv_dist = 0.f;
+
+    for (int i = 0; i < rays; i++)
+    {
+        float u = ((float)(i % AO_GRID) + random_next(&seed)) / (float)AO_GRID;
+        float v = ((float)(i / AO_GRID) + random_next(&seed)) / (float)AO_GRID;
+
+        float radius = sqrtf(u);
+        float angle  = 2.f * (float)M_PI * v;
+
+        vec3_t dir = vec_add(vec_add(vec_mul_num(tangent, radius * cosf(angle)),
+                                     vec_mul_num(bitan  , radius * sinf(angle))),
+                             vec_mul_num(norm, sqrtf(1.f - u)));
+
+        hit_t hit = {0};
+        if (scene_intersect(scene, origin, vec_norm(dir), AO_DISTANCE, &hit))
+        {
+            unseen++;
+            inv_dist += 1.f / fmaxf(hit.dist, AO_MIN_RADIUS);
+        }
+        else
+            inv_dist += 1.f / AO_DISTANCE;
+    }
+
+    ao_record_t record = {0};
+
+    record.pos     = pos;
+    record.norm    = norm;
+    record.radius  = fmaxf((float)rays / inv_dist, AO_MIN_RADIUS);
+    record.ambient = 1.f - (float)unseen / (float)rays;
+
+    return record;
+}
+
+static bool rehash(ao_cache_t *cache, size_t buckets_count)
+{
+    uint32_t *buckets = malloc(buckets_count * sizeof(uint32_t));
+    if (!buckets)
+        return false;
+
+    for (size_t i = 0; i < buckets_count; i++)
+        buckets[i] = UINT32_MAX;
+
+    for (size_t i = 0; i < cache->entries_count; i++)
+    {
+        ao_entry_t *entry  = &cache->entries[i];
+        uint32_t    bucket = cell_hash(entry->cell_x, entry->cell_y, entry->cell_z, buckets_count);
+
+        entry->next     = buckets[bucket];
+        buckets[bucket] = (uint32_t)i;
+    }
+
+    free(cache->buckets);
+    cache->buckets       = buckets;
+    cache->buckets_count = buckets_count;
+    return true;
+}
+
+static bool reserve(void **io_array, size_t *io_capacity, size_t count, size_t item_size)
+{
+    if (count <= *io_capacity)
+        return true;
+
+    size_t capacity = *io_capacity > 0 ? *io_capacity : AO_INITIAL_CAPACITY;
+    while (capacity < count)
+        capacity *= 2;
+
+    void *array = realloc(*io_array, capacity * item_size);
+    if (!array)
+        return false;
+
+    *io_array    = array;
+    *io_capacity = capacity;
+    return true;
+}
+
+/**
+ * Record is just not cached if there is no memory
+ */
+static void insert_record(ao_cache_t *cache, ao_record_t record)
+{
+    float reach = AO_ERROR * record.radius;
+
+    int32_t x0 = cell_coord(record.pos.x - reach), x1 = cell_coord(record.pos.x + reach);
+    int32_t y0 = cell_coord(record.pos.y - reach), y1 = cell_coord(record.pos.y + reach);
+    int32_t z0 = cell_coord(record.pos.z - reach), z1 = cell_coord(record.pos.z + reach);
+
+    size_t cells = (size_t)(x1 - x0 + 1) * (size_t)(y1 - y0 + 1) * (size_t)(z1 - z0 + 1);
+
+    if (!reserve((void **)&cache->records, &cache->records_capacity, cache->records_count + 1,
+                 sizeof(ao_record_t)) ||
+        !reserve((void **)&cache->entries, &cache->entries_capacity, cache->entries_count + cells,
+                 sizeof(ao_entry_t)))
+        return;
+
+    // about one entry per bucket
+    if (cache->buckets_count < cache->entries_capacity &&
+        !rehash(cache, cache->entries_capacity))
+        return;
+
+    uint32_t index = (uint32_t)cache->records_count++;
+    cache->records[index] = record;
+
+    for (int32_t z = z0; z <= z1; z++)
+    {
+        for (int32_t y = y0; y <= y1; y++)
+        {
+            for (int32_t x = x0; x <= x1; x++)
+            {
+                uint32_t bucket = cell_hash(x, y, z, cache->buckets_count);
+
+                cache->entries[cache->entries_count] = (ao_entry_t){ x, y, z, index,
+                                                                     cache->buckets[bucket] };
+                cache->buckets[bucket] = (uint32_t)cache->entries_count++;
+            }
+        }
+    }
+}
+
+float ao_cache_ambient(ao_cache_t *cache, const scene_t *scene, vec3_t pos, vec3_t norm)
+{
+    cache->lookups++;
+
+    int32_t x = cell_coord(pos.x);
+    int32_t y = cell_coord(pos.y);
+    int32_t z = cell_coord(pos.z);
+
+    float weight_sum  = 0.f;
+    float ambient_sum = 0.f;
+
+    uint32_t head = cache->buckets_count > 0 ? cache->buckets[cell_hash(x, y, z,
+                                                                        cache->buckets_count)]
+                                             : UINT32_MAX;
+
+    for (uint32_t i = head; i != UINT32_MAX; i = cache->entries[i].next)
+    {
+        const ao_entry_t *entry = &cache->entries[i];
+
+        // other cell of the same bucket
+        if (entry->cell_x != x || entry->cell_y != y || entry->cell_z != z)
+            continue;
+
+        const ao_record_t *record = &cache->records[entry->record];
+
+        vec3_t offset = vec_sub(pos, record->pos);
+
+        if (vec_product(offset, vec_add(norm, record->norm)) <
+            -2.f * AO_BEHIND_TOLERANCE * record->radius)
+            continue;
+
+        // error estimate of Ward et al., weighted as by Tabellion and Lamorlette
+        float error = vec_length(offset) / record->radius +
+                      sqrtf(fmaxf(1.f - vec_product(norm, record->norm), 0.f));
+
+        if (error >= AO_ERROR)
+            continue;
+
+        // falls to zero at the edge of the reach, so records blend without seams
+        float weight = 1.f - error / AO_ERROR;
+
+        weight_sum  += weight;
+        ambient_sum += weight * record->ambient;
+    }
+
+    if (weight_sum > 0.f)
+        return ambient_sum / weight_sum;
+
+    ao_record_t record = sample_record(scene, pos, norm);
+
+    cache->sampled++;
+    insert_record(cache, record);
+
+    return record.ambient;
+}
@@ -0,0 +1,77 @@
+#ifndef AO_H
+#define AO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "rt.h"
+
+/**
+ * Ambient light reaching a surface point, sampled by hemisphere rays
+ */
+typedef struct ao_record
+{
+    vec3_t   pos;
+    vec3_t   norm;
+    // harmonic mean distance to the surrounding geometry, the record is reused
+    // at points closer than a fraction of it
+    float    radius;
+    // fraction of the ambient light, 1 if nothing is around
+    float    ambient;
+} ao_record_t;
+
+/**
+ * Record in one of the grid cells it reaches
+ */
+typedef struct ao_entry
+{
+    int32_t  cell_x;
+    int32_t  cell_y;
+    int32_t  cell_z;
+
+    uint32_t record;
+    // next entry of the same hash bucket, UINT32_MAX for the last one
+    uint32_t next;
+} ao_entry_t;
+
+/**
+ * Irradiance cache for ambient occlusion:
+ * sparse records in a hashed uniform grid, a point is interpolated from records
+ * around it on the same smooth surface, new record is sampled only if there are
+ * no such records. Records stay valid while geometry doesn't change
+ * Record is entered into every cell it reaches, so a lookup visits one cell
+ */
+typedef struct ao_cache
+{
+    ao_record_t *records;
+    size_t       records_count;
+    size_t       records_capacity;
+
+    ao_entry_t  *entries;
+    size_t       entries_count;
+    size_t       entries_capacity;
+
+    // heads of entry lists by grid cell hash, power of 2 of them
+    uint32_t    *buckets;
+    size_t       buckets_count;
+
+    // lookups, and those which sampled a new record
+    size_t       lookups;
+    size_t       sampled;
+} ao_cache_t;
+
+void ao_cache_destroy(ao_cache_t *cache);
+
+/**
+ * Drops all records, e.g. after geometry changed
+ */
+void ao_cache_clear(ao_cache_t *cache);
+
+/**
+ * Fraction of the ambient light reaching the point with unit normal
+ * If the cache has no records close enough, samples a new one and keeps it,
+ * so the result depends on what was looked up before
+ */
+float ao_cache_ambient(ao_cache_t *cache, const scene_t *scene, vec3_t pos, vec3_t norm);
+
+#endif
@@ -0,0 +1,123 @@
+#include <math.h>
+#include <string.h>
+
+#include "binning.h"
+
+/**
+ * Gives range of tiles covered by the object, returns false if it covers none
+ */
+static bool object_tiles(const tile_bins_t *bins, const scene_t *scene, object_ref_t object,
+                         size_t *out_x0, size_t *out_y0, size_t *out_x1, size_t *out_y1)
+{
+    const camera_t *camera = &scene->camera;
+
+    screen_rect_t rect = {0};
+    if (!object_screen_rect(scene, object, &rect))
+        return false;
+
+    // pixel is covered if its center is, one pixel margin absorbs rounding
+    float x0 = rect.x0 - (float)camera->crop_x0 - 1.f;
+    float y0 = rect.y0 - (float)camera->crop_y0 - 1.f;
+    float x1 = rect.x1 - (float)camera->crop_x0 + 1.f;
+    float y1 = rect.y1 - (float)camera->crop_y0 + 1.f;
+
+    float tile_size = (float)bins->tile_size;
+
+    if (x1 < 0.f || y1 < 0.f || x0 >= tile_size * (float)bins->tiles_x ||
+                                y0 >= tile_size * (float)bins->tiles_y)
+        return false;
+
+    *out_x0 = x0 > 0.f ? (size_t)(x0 / tile_size) : 0;
+    *out_y0 = y0 > 0.f ? (size_t)(y0 / tile_size) : 0;
+    *out_x1 = (size_t)fminf(x1 / tile_size, (float)(bins->tiles_x - 1));
+    *out_y1 = (size_t)fminf(y1 / tile_size, (float)(bins->tiles_y - 1));
+    return true;
+}
+
+bool tile_bins_build(tile_bins_t *bins, const scene_t *scene, size_t tile_size)
+{
+    memset(bins, 0, sizeof(*bins));
+
+    size_t width  = camera_crop_width (&scene->camera);
+    size_t height = camera_crop_height(&scene->camera);
+
+    bins->tile_size = tile_size;
+    bins->tiles_x   = (width  + tile_size - 1) / tile_size;
+    bins->tiles_y   = (height + tile_size - 1) / tile_size;
+
+    size_t tiles_count = bins->tiles_x * bins->tiles_y;
+
+    bins->offsets = calloc(tiles_count + 1, sizeof(uint32_t));
+    if (!bins->offsets)
+        return false;
+
+    size_t objects_count = object_count(scene);
+
+    // count objects per tile, then fill bins in the second pass
+
+    for (size_t i = 0; i < objects_count; i++)
+    {
+        size_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        if (!object_tiles(bins, scene, object_by_number(scene, i), &x0, &y0, &x1, &y1))
+            continue;
+
+        for (size_t y = y0; y <= y1; y++)
+        {
+            for (size_t x = x0; x <= x1; x++)
+                bins->offsets[y * bins->tiles_x + x + 1]++;
+        }
+    }
+
+    for (size_t tile = 0; tile < tiles_count; tile++)
+        bins->offsets[tile + 1] += bins->offsets[tile];
+
+    bins->objects_count = bins->offsets[tiles_count];
+    bins->objects       = calloc(bins->objects_count > 0 ? bins->objects_count : 1,
+                                 sizeof(object_ref_t));
+
+    uint32_t *fill = calloc(tiles_count > 0 ? tiles_count : 1, sizeof(uint32_t));
+
+    if (!bins->objects || !fill)
+    {
+        free(fill);
+        tile_bins_destroy(bins);
+        return false;
+    }
+
+    memcpy(fill, bins->offsets, tiles_count * sizeof(uint32_t));
+
+    for (size_t i = 0; i < objects_count; i++)
+    {
+        object_ref_t object = object_by_number(scene, i);
+
+        size_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        if (!object_tiles(bins, scene, object, &x0, &y0, &x1, &y1))
+            continue;
+
+        for (size_t y = y0; y <= y1; y++)
+        {
+            for (size_t x = x0; x <= x1; x++)
+                bins->objects[fill[y * bins->tiles_x + x]++] = object;
+        }
+    }
+
+    free(fill);
+    return true;
+}
+
+void tile_bins_destroy(tile_bins_t *bins)
+{
+    free(bins->offsets);
+    free(bins->objects);
+
+    memset(bins, 0, sizeof(*bins));
+}
+
+const object_ref_t *tile_bins_get(const tile_bins_t *bins, size_t tile_x, size_t tile_y,
+                                  size_t *out_count)
+{
+    size_t tile = tile_y * bins->tiles_x + tile_x;
+
+    *out_count = bins->offsets[tile + 1] - bins->offsets[tile];
+    return &bins->objects[bins->offsets[tile]];
+}
@@ -0,0 +1,40 @@
+#ifndef BINNING_H
+#define BINNING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "object.h"
+#include "rt.h"
+
+/**
+ * Objects binned into screen tiles of the camera crop window by their projected bounds
+ * Primary rays of the tile only need to test objects of its bin
+ */
+typedef struct tile_bins
+{
+    size_t        tile_size;
+    size_t        tiles_x;
+    size_t        tiles_y;
+
+    // objects of tile t are objects[offsets[t] .. offsets[t + 1])
+    uint32_t     *offsets;
+    object_ref_t *objects;
+    size_t        objects_count;
+} tile_bins_t;
+
+/**
+ * Bins all objects of the scene into tiles of the camera crop window
+ * Tile (0, 0) starts at the crop window corner
+ */
+bool tile_bins_build(tile_bins_t *bins, const scene_t *scene, size_t tile_size);
+
+void tile_bins_destroy(tile_bins_t *bins);
+
+/**
+ * Gives objects which may be visible in the tile
+ */
+const object_ref_t *tile_bins_get(const tile_bins_t *bins, size_t tile_x, size_t tile_y,
+                                  size_t *out_count);
+
+#endif
@@ -0,0 +1,1159 @@
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "bvh.h"
+#include "jobs.h"
+
+// deep enough for any tree built from 2^32 primitives by median split,
+// or by SAH splits down to BVH_SAH_MAX_DEPTH and median ones below
+#define BVH_STACK_SIZE 64
+
+aabb_t aabb_empty()
+{
+    return (aabb_t){ {  INFINITY,  INFINITY,  INFINITY },
+                     { -INFINITY, -INFINITY, -INFINITY } };
+}
+
+aabb_t aabb_union(aabb_t a, aabb_t b)
+{
+    return (aabb_t){ { fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y), fminf(a.min.z, b.min.z) },
+                     { fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y), fmaxf(a.max.z, b.max.z) } };
+}
+
+aabb_t aabb_intersection(aabb_t a, aabb_t b)
+{
+    return (aabb_t){ { fmaxf(a.min.x, b.min.x), fmaxf(a.min.y, b.min.y), fmaxf(a.min.z, b.min.z) },
+                     { fminf(a.max.x, b.max.x), fminf(a.max.y, b.max.y), fminf(a.max.z, b.max.z) } };
+}
+
+bool aabb_valid(aabb_t box)
+{
+    return box.min.x <= box.max.x && box.min.y <= box.max.y && box.min.z <= box.max.z;
+}
+
+aabb_t aabb_grow(aabb_t box, vec3_t point)
+{
+    return aabb_union(box, (aabb_t){ point, point });
+}
+
+vec3_t aabb_center(aabb_t box)
+{
+    return vec_mul_num(vec_add(box.min, box.max), 0.5f);
+}
+
+float aabb_half_area(aabb_t box)
+{
+    vec3_t size = vec_sub(box.max, box.min);
+
+    if (size.x < 0.f || size.y < 0.f || size.z < 0.f)
+        return 0.f;
+
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+bool ray_aabb_intersect(float *out_t_entry, vec3_t ray_origin, vec3_t ray_inv_dir,
+                        aabb_t box, float t_max)
+{
+    float tx1 = (box.min.x - ray_origin.x) * ray_inv_dir.x;
+    float tx2 = (box.max.x - ray_origin.x) * ray_inv_dir.x;
+    float ty1 = (box.min.y - ray_origin.y) * ray_inv_dir.y;
+    float ty2 = (box.max.y - ray_origin.y) * ray_inv_dir.y;
+    float tz1 = (box.min.z - ray_origin.z) * ray_inv_dir.z;
+    float tz2 = (box.max.z - ray_origin.z) * ray_inv_dir.z;
+
+    float t_entry = fmaxf(fmaxf(fminf(tx1, tx2), fminf(ty1, ty2)), fmaxf(fminf(tz1, tz2), 0.f));
+    float t_exit  = fminf(fminf(fmaxf(tx1, tx2), fmaxf(ty1, ty2)), fminf(fmaxf(tz1, tz2), t_max));
+
+    *out_t_entry = t_entry;
+    return t_entry <= t_exit;
+}
+
+// build
+
+// SAH splits stop at this depth, median splits below it keep the tree within BVH_STACK_SIZE
+static const size_t BVH_SAH_MAX_DEPTH = 30;
+// larger nodes are split by all threads together, smaller ones are built
+// as whole subtrees, one per thread
+static const size_t BVH_TASK_SIZE     = 8192;
+// primitives per item of parallel loops over a node
+static const size_t BVH_CHUNK_SIZE    = 4096;
+
+typedef struct bvh_bin
+{
+    aabb_t bounds;
+    size_t count;
+} bvh_bin_t;
+
+/**
+ * Primitives whose centers fall into bins below bin go to the left child
+ */
+typedef struct bvh_split
+{
+    // bins grid over centers of the node, its corner and bins per unit
+    vec3_t grid_min;
+    vec3_t grid_scale;
+
+    int    axis;
+    size_t bin;
+} bvh_split_t;
+
+/**
+ * Node whose subtree is left to build
+ */
+typedef struct bvh_task
+{
+    size_t node;
+    size_t first;
+    size_t count;
+    size_t depth;
+
+    // where its descendants go and how many there are
+    size_t nodes_first;
+    size_t nodes_count;
+} bvh_task_t;
+
+typedef struct bvh_builder
+{
+    bvh_t        *bvh;
+    const aabb_t *prim_bounds;
+    vec3_t       *centers;
+    size_t        max_leaf_size;
+
+    // SAH bins per axis, median splits if 0
+    size_t        bins;
+
+    // node split by all threads, its primitives are in chunks of BVH_CHUNK_SIZE
+    size_t        first;
+    size_t        count;
+    bvh_split_t   split;
+    size_t        left_count;
+
+    // per chunk: bounds and center bounds, 3 * bins bins, then left primitives
+    // before it once they are counted
+    aabb_t       *chunk_bounds;
+    bvh_bin_t    *chunk_bins;
+    size_t       *chunk_left;
+    // indices are partitioned out of place
+    uint32_t     *scratch;
+
+    // subtrees built in parallel
+    bvh_task_t   *tasks;
+    // tasks are left for later, their nodes may be read while they are built
+    bool          lazy;
+} bvh_builder_t;
+
+/**
+ * Subtrees of a lazy hierarchy left to build
+ */
+typedef struct bvh_lazy
+{
+    // keeps centers and tasks, its primitive bounds are the copy below
+    bvh_builder_t   builder;
+    aabb_t         *prim_bounds;
+
+    size_t          tasks_count;
+    size_t          built;
+
+    // held while a subtree is built
+    pthread_mutex_t lock;
+} bvh_lazy_t;
+
+static float vec_axis(vec3_t vec, int axis)
+{
+    return axis == 0 ? vec.x : (axis == 1 ? vec.y : vec.z);
+}
+
+static void range_bounds(const bvh_builder_t *builder, size_t first, size_t count,
+                         aabb_t *out_bounds, aabb_t *out_centers)
+{
+    const uint32_t *indices = builder->bvh->indices;
+
+    aabb_t bounds  = aabb_empty();
+    aabb_t centers = aabb_empty();
+
+    for (size_t i = first; i < first + count; i++)
+    {
+        bounds  = aabb_union(bounds, builder->prim_bounds[indices[i]]);
+        centers = aabb_grow(centers, builder->centers[indices[i]]);
+    }
+
+    *out_bounds  = bounds;
+    *out_centers = centers;
+}
+
+/**
+ * Partially sorts indices [first, last) by centers along axis,
+ * so the median element is in its place (quickselect)
+ */
+static void select_median(bvh_builder_t *builder, size_t first, size_t last, size_t median,
+                          int axis)
+{
+    uint32_t *indices = builder->bvh->indices;
+
+    while (last - first > 1)
+    {
+        float pivot = vec_axis(builder->centers[indices[(first + last) / 2]], axis);
+
+        size_t i = first, j = last - 1;
+        while (i <= j)
+        {
+            while (vec_axis(builder->centers[indices[i]], axis) < pivot)
+                i++;
+
+            while (vec_axis(builder->centers[indices[j]], axis) > pivot)
+                j--;
+
+            if (i <= j)
+            {
+                uint32_t tmp = indices[i];
+                indices[i] = indices[j];
+                indices[j] = tmp;
+
+                i++;
+                if (j == 0)
+                    break;
+                j--;
+            }
+        }
+
+        if (median <= j)
+            last = j + 1;
+        else if (median >= i)
+            first = i;
+        else
+            return;
+    }
+}
+
+/**
+ * Splits by median along the longest axis of centers, gives the left count
+ */
+static size_t median_split(bvh_builder_t *builder, size_t first, size_t count, aabb_t centers)
+{
+    vec3_t extent = vec_sub(centers.max, centers.min);
+
+    int axis = 0;
+    if (extent.y > extent.x)
+        axis = 1;
+    if (extent.z > vec_axis(extent, axis))
+        axis = 2;
+
+    size_t half = count / 2;
+    select_median(builder, first, first + count, first + half, axis);
+
+    return half;
+}
+
+static void build_node(bvh_builder_t *builder, size_t node_index, size_t first, size_t count)
+{
+    bvh_t *bvh = builder->bvh;
+
+    aabb_t bounds, centers;
+    range_bounds(builder, first, count, &bounds, &centers);
+
+    bvh_node_t *node = &bvh->nodes[node_index];
+    node->bounds = bounds;
+
+    if (count <= builder->max_leaf_size)
+    {
+        node->first = (uint32_t)first;
+        node->count = (uint32_t)count;
+        return;
+    }
+
+    size_t half = median_split(builder, first, count, centers);
+
+    size_t left = bvh->nodes_count;
+    bvh->nodes_count += 2;
+
+    node->first = (uint32_t)left;
+    node->count = 0;
+
+    build_node(builder, left    , first       , half);
+    build_node(builder, left + 1, first + half, count - half);
+}
+
+// SAH build
+
+/**
+ * Split with the bins grid over the centers, but no axis yet
+ */
+static bvh_split_t split_grid(const bvh_builder_t *builder, aabb_t centers)
+{
+    vec3_t extent = vec_sub(centers.max, centers.min);
+    float  bins   = (float)builder->bins;
+
+    bvh_split_t split = {0};
+    split.grid_min   = centers.min;
+    split.grid_scale = (vec3_t){ extent.x > 0.f ? bins / extent.x : 0.f,
+                                 extent.y > 0.f ? bins / extent.y : 0.f,
+                                 extent.z > 0.f ? bins / extent.z : 0.f };
+    split.axis       = -1;
+
+    return split;
+}
+
+static size_t bin_of(const bvh_builder_t *builder, const bvh_split_t *split, vec3_t center,
+                     int axis)
+{
+    float bin = (vec_axis(center, axis) - vec_axis(split->grid_min, axis)) *
+                vec_axis(split->grid_scale, axis);
+
+    if (bin <= 0.f)
+        return 0;
+
+    return bin < (float)builder->bins ? (size_t)bin : builder->bins - 1;
+}
+
+static void clear_bins(bvh_bin_t *bins, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        bins[i] = (bvh_bin_t){ aabb_empty(), 0 };
+}
+
+/**
+ * Adds primitives to bins of all three axes, bins of axis a start at a * builder->bins
+ */
+static void bin_range(const bvh_builder_t *builder, const bvh_split_t *split, size_t first,
+                      size_t count, bvh_bin_t *bins)
+{
+    const uint32_t *indices = builder->bvh->indices;
+
+    for (size_t i = first; i < first + count; i++)
+    {
+        uint32_t prim = indices[i];
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            size_t     index = bin_of(builder, split, builder->centers[prim], axis);
+            bvh_bin_t *bin   = &bins[axis * builder->bins + index];
+
+            bin->bounds = aabb_union(bin->bounds, builder->prim_bounds[prim]);
+            bin->count++;
+        }
+    }
+}
+
+/**
+ * Sets axis and bin of the split to the bin boundary with the lowest surface area heuristic,
+ * fails if no boundary has primitives on both sides
+ */
+static bool find_split(const bvh_builder_t *builder, const bvh_bin_t *bins, bvh_split_t *io_split)
+{
+    size_t count = builder->bins;
+    float  best  = INFINITY;
+
+    float  right_cost [BVH_MAX_BINS];
+    size_t right_count[BVH_MAX_BINS];
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const bvh_bin_t *axis_bins = &bins[axis * count];
+
+        if (vec_axis(io_split->grid_scale, axis) == 0.f)
+            continue;
+
+        aabb_t box   = aabb_empty();
+        size_t prims = 0;
+
+        for (size_t i = count - 1; i > 0; i--)
+        {
+            box    = aabb_union(box, axis_bins[i].bounds);
+            prims += axis_bins[i].count;
+
+            right_cost [i] = aabb_half_area(box) * (float)prims;
+            right_count[i] = prims;
+        }
+
+        box   = aabb_empty();
+        prims = 0;
+
+        for (size_t i = 1; i < count; i++)
+        {
+            box    = aabb_union(box, axis_bins[i - 1].bounds);
+            prims += axis_bins[i - 1].count;
+
+            if (prims == 0 || right_count[i] == 0)
+                continue;
+
+            float cost = aabb_half_area(box) * (float)prims + right_cost[i];
+            if (cost < best)
+            {
+                best           = cost;
+                io_split->axis = axis;
+                io_split->bin  = i;
+            }
+        }
+    }
+
+    return best < INFINITY;
+}
+
+static bool goes_left(const bvh_builder_t *builder, const bvh_split_t *split, uint32_t prim)
+{
+    return bin_of(builder, split, builder->centers[prim], split->axis) < split->bin;
+}
+
+/**
+ * Bins the node on the calling thread, gives the left count, 0 if there is no split
+ */
+static size_t sah_split(bvh_builder_t *builder, size_t first, size_t count, aabb_t centers)
+{
+    bvh_bin_t   bins[3 * BVH_MAX_BINS];
+    bvh_split_t split = split_grid(builder, centers);
+
+    clear_bins(bins, 3 * builder->bins);
+    bin_range(builder, &split, first, count, bins);
+
+    if (!find_split(builder, bins, &split))
+        return 0;
+
+    uint32_t *indices = builder->bvh->indices;
+    size_t    left    = first;
+
+    for (size_t i = first; i < first + count; i++)
+    {
+        if (!goes_left(builder, &split, indices[i]))
+            continue;
+
+        uint32_t tmp  = indices[i];
+        indices[i]    = indices[left];
+        indices[left] = tmp;
+        left++;
+    }
+
+    return left - first;
+}
+
+/**
+ * Builds the subtree on the calling thread, its descendants are numbered from *io_next
+ */
+static void build_sah_node(bvh_builder_t *builder, size_t node_index, size_t first, size_t count,
+                           size_t depth, size_t *io_next)
+{
+    aabb_t bounds, centers;
+    range_bounds(builder, first, count, &bounds, &centers);
+
+    bvh_node_t *node = &builder->bvh->nodes[node_index];
+    node->bounds = bounds;
+
+    if (count <= builder->max_leaf_size)
+    {
+        node->first = (uint32_t)first;
+        node->count = (uint32_t)count;
+        return;
+    }
+
+    size_t half = depth < BVH_SAH_MAX_DEPTH ? sah_split(builder, first, count, centers) : 0;
+
+    if (half == 0)
+        half = median_split(builder, first, count, centers);
+
+    size_t left = *io_next;
+    *io_next += 2;
+
+    node->first = (uint32_t)left;
+    node->count = 0;
+
+    build_sah_node(builder, left    , first       , half        , depth + 1, io_next);
+    build_sah_node(builder, left + 1, first + half, count - half, depth + 1, io_next);
+}
+
+static void build_task(void *ctx, size_t index)
+{
+    bvh_builder_t *builder = ctx;
+    bvh_task_t    *task    = &builder->tasks[index];
+    bvh_node_t    *nodes   = builder->bvh->nodes;
+
+    // root goes to the slot reserved before its descendants first,
+    // rays may be reading the task node of a lazy hierarchy meanwhile
+    size_t next = task->nodes_first + 1;
+    build_sah_node(builder, task->nodes_first, task->first, task->count, task->depth, &next);
+
+    task->nodes_count = next - task->nodes_first - 1;
+
+    const bvh_node_t *root = &nodes[task->nodes_first];
+
+    // bounds of lazy task nodes are set in advance
+    if (!builder->lazy)
+        nodes[task->node].bounds = root->bounds;
+
+    // count goes last, it tells readers the node is built
+    nodes[task->node].first = root->first;
+    __atomic_store_n(&nodes[task->node].count, root->count, __ATOMIC_RELEASE);
+}
+
+// parallel loops over chunks of the node split by all threads
+
+static size_t chunk_first(const bvh_builder_t *builder, size_t chunk)
+{
+    return builder->first + chunk * BVH_CHUNK_SIZE;
+}
+
+static size_t chunk_count(const bvh_builder_t *builder, size_t chunk)
+{
+    size_t offset = chunk * BVH_CHUNK_SIZE;
+
+    return builder->count - offset < BVH_CHUNK_SIZE ? builder->count - offset : BVH_CHUNK_SIZE;
+}
+
+static void chunk_centers(void *ctx, size_t chunk)
+{
+    bvh_builder_t *builder = ctx;
+    size_t         first   = chunk_first(builder, chunk);
+
+    for (size_t i = first; i < first + chunk_count(builder, chunk); i++)
+    {
+        builder->bvh->indices[i] = (uint32_t)i;
+        builder->centers[i]      = aabb_center(builder->prim_bounds[i]);
+    }
+}
+
+static void chunk_range_bounds(void *ctx, size_t chunk)
+{
+    bvh_builder_t *builder = ctx;
+
+    range_bounds(builder, chunk_first(builder, chunk), chunk_count(builder, chunk),
+                 &builder->chunk_bounds[2 * chunk], &builder->chunk_bounds[2 * chunk + 1]);
+}
+
+static void chunk_bin(void *ctx, size_t chunk)
+{
+    bvh_builder_t *builder = ctx;
+    bvh_bin_t     *bins    = &builder->chunk_bins[chunk * 3 * builder->bins];
+
+    clear_bins(bins, 3 * builder->bins);
+    bin_range(builder, &builder->split, chunk_first(builder, chunk), chunk_count(builder, chunk),
+              bins);
+}
+
+static void chunk_count_left(void *ctx, size_t chunk)
+{
+    bvh_builder_t  *builder = ctx;
+    const uint32_t *indices = builder->bvh->indices;
+    size_t          first   = chunk_first(builder, chunk);
+    size_t          left    = 0;
+
+    for (size_t i = first; i < first + chunk_count(builder, chunk); i++)
+    {
+        if (goes_left(builder, &builder->split, indices[i]))
+            left++;
+    }
+
+    builder->chunk_left[chunk] = left;
+}
+
+/**
+ * Moves primitives of the chunk to their side in scratch, keeping their order
+ */
+static void chunk_scatter(void *ctx, size_t chunk)
+{
+    bvh_builder_t  *builder = ctx;
+    const uint32_t *indices = builder->bvh->indices;
+    size_t          first   = chunk_first(builder, chunk);
+
+    size_t left  = builder->first + builder->chunk_left[chunk];
+    size_t right = builder->first + builder->left_count +
+                   chunk * BVH_CHUNK_SIZE - builder->chunk_left[chunk];
+
+    for (size_t i = first; i < first + chunk_count(builder, chunk); i++)
+    {
+        if (goes_left(builder, &builder->split, indices[i]))
+            builder->scratch[left++]  = indices[i];
+        else
+            builder->scratch[right++] = indices[i];
+    }
+}
+
+static void chunk_copy_back(void *ctx, size_t chunk)
+{
+    bvh_builder_t *builder = ctx;
+    size_t         first   = chunk_first(builder, chunk);
+
+    memcpy(&builder->bvh->indices[first], &builder->scratch[first],
+           chunk_count(builder, chunk) * sizeof(uint32_t));
+}
+
+static size_t chunks_count(size_t count)
+{
+    return (count + BVH_CHUNK_SIZE - 1) / BVH_CHUNK_SIZE;
+}
+
+/**
+ * Sets bounds of the node and splits it by all threads, gives the left count,
+ * 0 if there is no split
+ */
+static size_t parallel_split(bvh_builder_t *builder, job_pool_t *jobs, size_t node_index,
+                             size_t first, size_t count)
+{
+    builder->first = first;
+    builder->count = count;
+
+    size_t chunks = chunks_count(count);
+
+    job_pool_run(jobs, chunk_range_bounds, builder, chunks);
+
+    aabb_t bounds  = aabb_empty();
+    aabb_t centers = aabb_empty();
+
+    for (size_t i = 0; i < chunks; i++)
+    {
+        bounds  = aabb_union(bounds , builder->chunk_bounds[2 * i]);
+        centers = aabb_union(centers, builder->chunk_bounds[2 * i + 1]);
+    }
+
+    builder->bvh->nodes[node_index].bounds = bounds;
+
+    builder->split = split_grid(builder, centers);
+    job_pool_run(jobs, chunk_bin, builder, chunks);
+
+    // chunks are merged in order, so the bins don't depend on the threads
+    bvh_bin_t bins[3 * BVH_MAX_BINS];
+    clear_bins(bins, 3 * builder->bins);
+
+    for (size_t i = 0; i < chunks; i++)
+    {
+        const bvh_bin_t *chunk_bins = &builder->chunk_bins[i * 3 * builder->bins];
+
+        for (size_t j = 0; j < 3 * builder->bins; j++)
+        {
+            bins[j].bounds = aabb_union(bins[j].bounds, chunk_bins[j].bounds);
+            bins[j].count += chunk_bins[j].count;
+        }
+    }
+
+    if (!find_split(builder, bins, &builder->split))
+        return 0;
+
+    job_pool_run(jobs, chunk_count_left, builder, chunks);
+
+    size_t left = 0;
+    for (size_t i = 0; i < chunks; i++)
+    {
+        size_t chunk_left = builder->chunk_left[i];
+
+        builder->chunk_left[i] = left;
+        left += chunk_left;
+    }
+
+    builder->left_count = left;
+
+    job_pool_run(jobs, chunk_scatter, builder, chunks);
+    job_pool_run(jobs, chunk_copy_back, builder, chunks);
+
+    return left;
+}
+
+static bool push_task(bvh_task_t **tasks, size_t *count, size_t *capacity, bvh_task_t task)
+{
+    if (*count == *capacity)
+    {
+        size_t      new_capacity = *capacity > 0 ? 2 * *capacity : 16;
+        bvh_task_t *new_tasks    = realloc(*tasks, new_capacity * sizeof(bvh_task_t));
+
+        if (!new_tasks)
+            return false;
+
+        *tasks    = new_tasks;
+        *capacity = new_capacity;
+    }
+
+    (*tasks)[(*count)++] = task;
+    return true;
+}
+
+/**
+ * Splits nodes larger than BVH_TASK_SIZE by all threads, breadth first,
+ * and collects the nodes below them as tasks
+ */
+static bool split_top_levels(bvh_builder_t *builder, job_pool_t *jobs, size_t prims_count,
+                             size_t *out_tasks_count)
+{
+    bvh_t      *bvh       = builder->bvh;
+    bvh_task_t *queue     = NULL;
+    size_t      queue_count = 0, queue_capacity = 0;
+    size_t      tasks_count = 0, tasks_capacity = 0;
+
+    bool ok = push_task(&queue, &queue_count, &queue_capacity,
+                        (bvh_task_t){ 0, 0, prims_count, 0, 0, 0 });
+
+    for (size_t i = 0; ok && i < queue_count; i++)
+    {
+        bvh_task_t task = queue[i];
+        size_t     half = 0;
+
+        if (task.count > BVH_TASK_SIZE && task.depth < BVH_SAH_MAX_DEPTH)
+            half = parallel_split(builder, jobs, task.node, task.first, task.count);
+
+        if (half == 0)
+        {
+            ok = push_task(&builder->tasks, &tasks_count, &tasks_capacity, task);
+            continue;
+        }
+
+        size_t left = bvh->nodes_count;
+        bvh->nodes_count += 2;
+
+        bvh->nodes[task.node].first = (uint32_t)left;
+        bvh->nodes[task.node].count = 0;
+
+        ok = push_task(&queue, &queue_count, &queue_capacity,
+                       (bvh_task_t){ left, task.first, half, task.depth + 1, 0, 0 }) &&
+             push_task(&queue, &queue_count, &queue_capacity,
+                       (bvh_task_t){ left + 1, task.first + half, task.count - half,
+                                     task.depth + 1, 0, 0 });
+    }
+
+    free(queue);
+
+    *out_tasks_count = tasks_count;
+    return ok;
+}
+
+/**
+ * Reserves nodes for the largest possible subtree of each task after the top levels,
+ * and one more for its root in front of them
+ */
+static bool reserve_tasks(bvh_builder_t *builder, size_t tasks_count)
+{
+    bvh_t *bvh = builder->bvh;
+
+    // subtree over n primitives has at most 2 n - 2 nodes below its root
+    size_t next = bvh->nodes_count;
+    for (size_t i = 0; i < tasks_count; i++)
+    {
+        builder->tasks[i].nodes_first = next;
+        next += 2 * builder->tasks[i].count - 1;
+    }
+
+    bvh_node_t *nodes = realloc(bvh->nodes, (next > 0 ? next : 1) * sizeof(bvh_node_t));
+    if (!nodes)
+        return false;
+
+    bvh->nodes = nodes;
+    return true;
+}
+
+/**
+ * Moves descendants of the built tasks right after the top levels
+ */
+static void pack_tasks(bvh_builder_t *builder, size_t tasks_count)
+{
+    bvh_t *bvh = builder->bvh;
+
+    for (size_t i = 0; i < tasks_count; i++)
+    {
+        const bvh_task_t *task  = &builder->tasks[i];
+        size_t            first = task->nodes_first + 1;
+        uint32_t          shift = (uint32_t)(first - bvh->nodes_count);
+
+        if (bvh->nodes[task->node].count == 0)
+            bvh->nodes[task->node].first -= shift;
+
+        for (size_t j = first; j < first + task->nodes_count; j++)
+        {
+            if (bvh->nodes[j].count == 0)
+                bvh->nodes[j].first -= shift;
+        }
+
+        memmove(&bvh->nodes[bvh->nodes_count], &bvh->nodes[first],
+                task->nodes_count * sizeof(bvh_node_t));
+
+        bvh->nodes_count += task->nodes_count;
+    }
+}
+
+/**
+ * Sets the task node to its bounds and marks it for later
+ */
+static void defer_task(void *ctx, size_t index)
+{
+    bvh_builder_t    *builder = ctx;
+    const bvh_task_t *task    = &builder->tasks[index];
+
+    aabb_t bounds, centers;
+    range_bounds(builder, task->first, task->count, &bounds, &centers);
+
+    builder->bvh->nodes[task->node] = (bvh_node_t){ bounds, (uint32_t)index, BVH_LAZY };
+}
+
+static void builder_free(bvh_builder_t *builder)
+{
+    free(builder->centers);
+    free(builder->chunk_bounds);
+    free(builder->chunk_bins);
+    free(builder->chunk_left);
+    free(builder->scratch);
+    free(builder->tasks);
+}
+
+/**
+ * Allocates hierarchy for prims_count primitives and centers of the builder
+ */
+static bool builder_init(bvh_builder_t *builder, bvh_t *bvh, const aabb_t *prim_bounds,
+                         size_t prims_count, size_t max_leaf_size)
+{
+    memset(bvh, 0, sizeof(*bvh));
+    memset(builder, 0, sizeof(*builder));
+
+    builder->bvh           = bvh;
+    builder->prim_bounds   = prim_bounds;
+    builder->max_leaf_size = max_leaf_size > 0 ? max_leaf_size : 1;
+
+    // binary tree with at least one primitive per leaf
+    size_t max_nodes = prims_count > 0 ? 2 * prims_count - 1 : 1;
+
+    bvh->nodes        = calloc(max_nodes, sizeof(bvh_node_t));
+    bvh->indices      = calloc(prims_count > 0 ? prims_count : 1, sizeof(uint32_t));
+    builder->centers  = calloc(prims_count > 0 ? prims_count : 1, sizeof(vec3_t));
+
+    if (!bvh->nodes || !bvh->indices || !builder->centers)
+    {
+        builder_free(builder);
+        bvh_destroy(bvh);
+        return false;
+    }
+
+    bvh->indices_count = prims_count;
+    return true;
+}
+
+bool bvh_build(bvh_t *bvh, const aabb_t *prim_bounds, size_t prims_count, size_t max_leaf_size)
+{
+    bvh_builder_t builder;
+
+    if (!builder_init(&builder, bvh, prim_bounds, prims_count, max_leaf_size))
+        return false;
+
+    for (size_t i = 0; i < prims_count; i++)
+    {
+        bvh->indices[i]    = (uint32_t)i;
+        builder.centers[i] = aabb_center(prim_bounds[i]);
+    }
+
+    // empty hierarchy has no nodes at all, root with zero count would look internal
+    if (prims_count > 0)
+    {
+        bvh->nodes_count = 1;
+        build_node(&builder, 0, 0, prims_count);
+    }
+
+    builder_free(&builder);
+    return true;
+}
+
+/**
+ * Keeps the builder with the tasks and a copy of primitive bounds in the lazy state
+ */
+static bool defer_tasks(bvh_builder_t *builder, job_pool_t *jobs, size_t tasks_count)
+{
+    bvh_t      *bvh         = builder->bvh;
+    size_t      prims_count = bvh->indices_count;
+    bvh_lazy_t *lazy        = calloc(1, sizeof(bvh_lazy_t));
+    aabb_t     *prim_bounds = malloc(prims_count * sizeof(aabb_t));
+
+    if (!lazy || !prim_bounds)
+    {
+        free(lazy);
+        free(prim_bounds);
+        builder_free(builder);
+        bvh_destroy(bvh);
+        return false;
+    }
+
+    memcpy(prim_bounds, builder->prim_bounds, prims_count * sizeof(aabb_t));
+
+    job_pool_run(jobs, defer_task, builder, tasks_count);
+
+    // subtrees are built on the calling thread, parallel split buffers aren't needed
+    free(builder->chunk_bounds);
+    free(builder->chunk_bins);
+    free(builder->chunk_left);
+    free(builder->scratch);
+
+    builder->chunk_bounds = NULL;
+    builder->chunk_bins   = NULL;
+    builder->chunk_left   = NULL;
+    builder->scratch      = NULL;
+    builder->prim_bounds  = prim_bounds;
+    builder->lazy         = true;
+
+    lazy->builder     = *builder;
+    lazy->prim_bounds = prim_bounds;
+    lazy->tasks_count = tasks_count;
+    pthread_mutex_init(&lazy->lock, NULL);
+
+    bvh->lazy = lazy;
+    return true;
+}
+
+static void lazy_free(bvh_lazy_t *lazy)
+{
+    builder_free(&lazy->builder);
+    free(lazy->prim_bounds);
+    pthread_mutex_destroy(&lazy->lock);
+    free(lazy);
+}
+
+bool bvh_build_sah(bvh_t *bvh, const aabb_t *prim_bounds, size_t prims_count, size_t max_leaf_size,
+                   const bvh_build_options_t *opts)
+{
+    if (!opts || opts->bins == 0)
+        return bvh_build(bvh, prim_bounds, prims_count, max_leaf_size);
+
+    bvh_builder_t builder;
+
+    if (!builder_init(&builder, bvh, prim_bounds, prims_count, max_leaf_size))
+        return false;
+
+    // one bin is no split at all
+    builder.bins = opts->bins < 2 ? 2 : opts->bins > BVH_MAX_BINS ? BVH_MAX_BINS : opts->bins;
+
+    size_t chunks = chunks_count(prims_count);
+
+    builder.chunk_bounds = malloc((chunks > 0 ? 2 * chunks : 1) * sizeof(aabb_t));
+    builder.chunk_bins   = malloc((chunks > 0 ? 3 * builder.bins * chunks : 1) * sizeof(bvh_bin_t));
+    builder.chunk_left   = malloc((chunks > 0 ? chunks : 1) * sizeof(size_t));
+    builder.scratch      = malloc((prims_count > 0 ? prims_count : 1) * sizeof(uint32_t));
+
+    if (!builder.chunk_bounds || !builder.chunk_bins || !builder.chunk_left || !builder.scratch)
+    {
+        builder_free(&builder);
+        bvh_destroy(bvh);
+        return false;
+    }
+
+    builder.first = 0;
+    builder.count = prims_count;
+    job_pool_run(opts->jobs, chunk_centers, &builder, chunks);
+
+    size_t tasks_count = 0;
+
+    if (prims_count > 0)
+    {
+        bvh->nodes_count = 1;
+
+        if (!split_top_levels(&builder, opts->jobs, prims_count, &tasks_count) ||
+            !reserve_tasks(&builder, tasks_count))
+        {
+            builder_free(&builder);
+            bvh_destroy(bvh);
+            return false;
+        }
+
+        if (opts->lazy)
+            return defer_tasks(&builder, opts->jobs, tasks_count);
+
+        job_pool_run(opts->jobs, build_task, &builder, tasks_count);
+        pack_tasks(&builder, tasks_count);
+    }
+
+    builder_free(&builder);
+    return true;
+}
+
+/**
+ * Builds the task of the lazy node unless another thread did it while this one waited
+ */
+static void build_lazy(const bvh_t *bvh, const bvh_node_t *node)
+{
+    bvh_lazy_t *lazy = bvh->lazy;
+
+    pthread_mutex_lock(&lazy->lock);
+
+    if (__atomic_load_n(&node->count, __ATOMIC_ACQUIRE) == BVH_LAZY)
+    {
+        // the hierarchy may have been moved since the build, e.g. copied by value
+        lazy->builder.bvh = (bvh_t *)bvh;
+
+        build_task(&lazy->builder, node->first);
+        __atomic_store_n(&lazy->built, lazy->built + 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&lazy->lock);
+}
+
+static const bvh_node_t *node_built(const bvh_t *bvh, size_t index)
+{
+    const bvh_node_t *node = &bvh->nodes[index];
+
+    if (bvh->lazy && __atomic_load_n(&node->count, __ATOMIC_ACQUIRE) == BVH_LAZY)
+        build_lazy(bvh, node);
+
+    return node;
+}
+
+const bvh_node_t *bvh_node(const bvh_t *bvh, size_t index)
+{
+    return node_built(bvh, index);
+}
+
+void bvh_complete(bvh_t *bvh)
+{
+    bvh_lazy_t *lazy = bvh->lazy;
+
+    if (!lazy)
+        return;
+
+    for (size_t i = 0; i < lazy->tasks_count; i++)
+        node_built(bvh, lazy->builder.tasks[i].node);
+
+    lazy->builder.bvh = bvh;
+    pack_tasks(&lazy->builder, lazy->tasks_count);
+
+    lazy_free(lazy);
+    bvh->lazy = NULL;
+}
+
+void bvh_lazy_progress(const bvh_t *bvh, size_t *out_built, size_t *out_total)
+{
+    const bvh_lazy_t *lazy = bvh->lazy;
+
+    *out_built = 0;
+    *out_total = 0;
+
+    if (!lazy)
+        return;
+
+    *out_built = __atomic_load_n(&lazy->built, __ATOMIC_RELAXED);
+    *out_total = lazy->tasks_count;
+}
+
+void bvh_destroy(bvh_t *bvh)
+{
+    if (bvh->lazy)
+        lazy_free(bvh->lazy);
+
+    free(bvh->nodes);
+    free(bvh->indices);
+
+    memset(bvh, 0, sizeof(*bvh));
+}
+
+bool bvh_valid(const bvh_t *bvh, size_t prims_count)
+{
+    for (size_t i = 0; i < bvh->nodes_count; i++)
+    {
+        const bvh_node_t *node = &bvh->nodes[i];
+
+        // children after the parent, so traversal can't loop
+        if (node->count == 0 && (node->first <= i || (size_t)node->first + 1 >= bvh->nodes_count))
+            return false;
+
+        if (node->count > 0 && (size_t)node->first + node->count > prims_count)
+            return false;
+    }
+
+    return bvh_depth_valid(bvh);
+}
+
+bool bvh_depth_valid(const bvh_t *bvh)
+{
+    uint8_t *depths = calloc(bvh->nodes_count > 0 ? bvh->nodes_count : 1, sizeof(uint8_t));
+    if (!depths)
+        return false;
+
+    bool ok = true;
+
+    // parents come first, so their depths are known when children are reached
+    for (size_t i = 0; ok && i < bvh->nodes_count; i++)
+    {
+        const bvh_node_t *node = &bvh->nodes[i];
+        if (node->count > 0)
+            continue;
+
+        // traversal keeps a sibling of every node on the path and pushes both children
+        size_t depth = (size_t)depths[i] + 1;
+        ok = depth < BVH_STACK_SIZE;
+
+        for (size_t j = node->first; ok && j <= (size_t)node->first + 1; j++)
+            depths[j] = depths[j] > depth ? depths[j] : (uint8_t)depth;
+    }
+
+    free(depths);
+    return ok;
+}
+
+// traversal
+
+void bvh_traverse(const bvh_t *bvh, vec3_t ray_origin, vec3_t ray_dir, float t_max,
+                  bvh_leaf_func_t leaf_func, void *ctx)
+{
+    if (bvh->nodes_count > 0)
+        bvh_traverse_subtree(bvh, 0, ray_origin, ray_dir, t_max, leaf_func, ctx);
+}
+
+void bvh_traverse_subtree(const bvh_t *bvh, uint32_t root, vec3_t ray_origin, vec3_t ray_dir,
+                          float t_max, bvh_leaf_func_t leaf_func, void *ctx)
+{
+    vec3_t inv_dir = { 1.f / ray_dir.x, 1.f / ray_dir.y, 1.f / ray_dir.z };
+
+    float t_entry = 0.f;
+    if (!ray_aabb_intersect(&t_entry, ray_origin, inv_dir, bvh->nodes[root].bounds, t_max))
+        return;
+
+    uint32_t stack      [BVH_STACK_SIZE];
+    float    stack_entry[BVH_STACK_SIZE];
+    size_t   stack_size = 0;
+
+    stack      [stack_size] = root;
+    stack_entry[stack_size] = t_entry;
+    stack_size++;
+
+    while (stack_size > 0)
+    {
+        stack_size--;
+
+        // closer hit was found after the node was pushed
+        if (stack_entry[stack_size] > t_max)
+            continue;
+
+        const bvh_node_t *node = node_built(bvh, stack[stack_size]);
+
+        if (node->count > 0)
+        {
+            if (leaf_func(ctx, node, &t_max))
+                return;
+
+            continue;
+        }
+
+        uint32_t left  = node->first;
+        uint32_t right = node->first + 1;
+
+        float left_entry = 0.f, right_entry = 0.f;
+        bool  left_hit   = ray_aabb_intersect(&left_entry , ray_origin, inv_dir,
+                                              bvh->nodes[left ].bounds, t_max);
+        bool  right_hit  = ray_aabb_intersect(&right_entry, ray_origin, inv_dir,
+                                              bvh->nodes[right].bounds, t_max);
+
+        // push farther child first, so the nearer one is visited first
+        if (left_hit && right_hit && left_entry < right_entry)
+        {
+            stack      [stack_size] = right;
+            stack_entry[stack_size] = right_entry;
+            stack_size++;
+
+            stack      [stack_size] = left;
+            stack_entry[stack_size] = left_entry;
+            stack_size++;
+        }
+        else
+        {
+            if (left_hit)
+            {
+                stack      [stack_size] = left;
+                stack_entry[stack_size] = left_entry;
+                stack_size++;
+            }
+
+            if (right_hit)
+            {
+                stack      [stack_size] = right;
+                stack_entry[stack_size] = right_entry;
+                stack_size++;
+            }
+        }
+    }
+}
@@ -0,0 +1,170 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "math_lib.h"
+
+typedef struct aabb
+{
+    vec3_t min;
+    vec3_t max;
+} aabb_t;
+
+/**
+ * Gives box which contains nothing, growing it by anything gives that thing
+ */
+aabb_t aabb_empty();
+
+aabb_t aabb_union(aabb_t a, aabb_t b);
+
+/**
+ * Common part of the boxes, not valid if they don't overlap
+ */
+aabb_t aabb_intersection(aabb_t a, aabb_t b);
+
+/**
+ * Checks if the box contains anything, touching boxes give a flat valid one
+ */
+bool   aabb_valid(aabb_t box);
+
+aabb_t aabb_grow(aabb_t box, vec3_t point);
+
+vec3_t aabb_center(aabb_t box);
+
+/**
+ * Half of the surface area
+ */
+float  aabb_half_area(aabb_t box);
+
+/**
+ * Checks intersection of ray and box, ray is given by origin and reciprocal of direction
+ * Gives distance to the entry point if the box is hit closer than t_max
+ */
+bool   ray_aabb_intersect(float *out_t_entry, vec3_t ray_origin, vec3_t ray_inv_dir,
+                          aabb_t box, float t_max);
+
+typedef struct bvh_node
+{
+    aabb_t   bounds;
+
+    // internal node - index of the left child, the right one is next to it
+    // leaf          - index of the first primitive in bvh indices
+    uint32_t first;
+
+    // number of primitives in the leaf, 0 for internal nodes,
+    // BVH_LAZY for nodes whose subtree is not built yet
+    uint32_t count;
+} bvh_node_t;
+
+// count of a node left for later, its first is the number of its subtree build
+#define BVH_LAZY UINT32_MAX
+
+struct bvh_lazy;
+
+/**
+ * Binary bounding volume hierarchy over abstract primitives given by their boxes
+ * Root is nodes[0], hierarchy over no primitives has no nodes
+ */
+typedef struct bvh
+{
+    bvh_node_t *nodes;
+    size_t      nodes_count;
+
+    // primitive indices in leaf order
+    uint32_t   *indices;
+    size_t      indices_count;
+
+    // subtrees left to build, NULL once the hierarchy is complete
+    struct bvh_lazy *lazy;
+} bvh_t;
+
+/**
+ * Builds hierarchy over prims_count primitives
+ * Leaves contain at most max_leaf_size primitives
+ */
+bool bvh_build(bvh_t *bvh, const aabb_t *prim_bounds, size_t prims_count, size_t max_leaf_size);
+
+// most candidate splits per axis bvh_build_sah() tries
+#define BVH_MAX_BINS 64
+
+struct job_pool;
+
+typedef struct bvh_build_options
+{
+    // candidate splits per axis, more of them find better splits but take longer,
+    // 0 splits by median as bvh_build() does
+    size_t           bins;
+    // top levels and subtrees are built on these threads, NULL builds on the caller
+    struct job_pool *jobs;
+    // SAH builds split only the top levels, subtrees below them are built
+    // when a ray or a walk enters them first, see bvh_node()
+    bool             lazy;
+} bvh_build_options_t;
+
+/**
+ * Same as bvh_build(), but nodes are split where the surface area heuristic
+ * is lowest among bins of the primitive centers
+ * Large nodes are binned and partitioned by all threads together, then subtrees
+ * below them are built in parallel. The hierarchy doesn't depend on the number of threads
+ * Lazy build leaves those subtrees for later, nodes_count counts the top levels
+ * and indices of deferred subtrees are not in leaf order until they are built
+ * Completed lazy hierarchy is the same as the one built at once
+ */
+bool bvh_build_sah(bvh_t *bvh, const aabb_t *prim_bounds, size_t prims_count, size_t max_leaf_size,
+                   const bvh_build_options_t *opts);
+
+/**
+ * Builds subtrees the lazy hierarchy still misses and packs its nodes,
+ * must not run together with traversals
+ */
+void bvh_complete(bvh_t *bvh);
+
+/**
+ * Gives how many of the deferred subtrees are built, 0 of 0 for complete hierarchies
+ */
+void bvh_lazy_progress(const bvh_t *bvh, size_t *out_built, size_t *out_total);
+
+/**
+ * Gives the node, builds its subtree first if it was left for later
+ * Threads may walk one lazy hierarchy together, every subtree is built once
+ * Walks other than bvh_traverse() must reach nodes through it
+ */
+const bvh_node_t *bvh_node(const bvh_t *bvh, size_t index);
+
+void bvh_destroy(bvh_t *bvh);
+
+/**
+ * Checks that children follow their parents, leaves refer to existing primitives
+ * and the tree fits the traversal stack, e.g. for hierarchies read from files
+ */
+bool bvh_valid(const bvh_t *bvh, size_t prims_count);
+
+/**
+ * Checks that the hierarchy is not deeper than traversal can follow,
+ * its children must follow their parents already
+ */
+bool bvh_depth_valid(const bvh_t *bvh);
+
+/**
+ * Called for each leaf hit by the ray
+ * May shrink *io_t_max when closer hit is found
+ * Returns true to stop the traversal
+ */
+typedef bool (*bvh_leaf_func_t)(void *ctx, const bvh_node_t *leaf, float *io_t_max);
+
+/**
+ * Visits leaves hit by the ray closer than t_max, nearest first
+ * Ray direction must be normalized
+ */
+void bvh_traverse(const bvh_t *bvh, vec3_t ray_origin, vec3_t ray_dir, float t_max,
+                  bvh_leaf_func_t leaf_func, void *ctx);
+
+/**
+ * Same as bvh_traverse(), but only leaves below the given node are visited
+ */
+void bvh_traverse_subtree(const bvh_t *bvh, uint32_t root, vec3_t ray_origin, vec3_t ray_dir,
+                          float t_max, bvh_leaf_func_t leaf_func, void *ctx);
+
+#endif
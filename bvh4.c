@@ -0,0 +1,330 @@
+#include <math.h>
+#include <string.h>
+
+#include "bvh4.h"
+
+static const uint32_t BVH4_EMPTY       = UINT32_MAX;
+static const uint32_t BVH4_LEAF        = 1u << 31;
+static const int      BVH4_COUNT_SHIFT = 27;
+static const uint32_t BVH4_COUNT_MASK  = 0xfu;
+static const uint32_t BVH4_FIRST_MASK  = (1u << 27) - 1;
+
+// every pop pushes at most BVH4_WIDTH - 1 more entries than it takes
+#define BVH4_STACK_SIZE 256
+
+// build
+
+typedef struct bvh4_builder
+{
+    bvh4_t      *wide;
+    const bvh_t *bvh;
+} bvh4_builder_t;
+
+/**
+ * Grid steps from the origin, rounded down so the step is not above the value
+ */
+static uint8_t quantize_down(float value, float origin, float step)
+{
+    if (step <= 0.f)
+        return 0;
+
+    float q = fminf(fmaxf(floorf((value - origin) / step), 0.f), 255.f);
+
+    while (q > 0.f && origin + q * step > value)
+        q -= 1.f;
+
+    return (uint8_t)q;
+}
+
+/**
+ * Grid steps from the origin, rounded up so the step is not below the value
+ */
+static uint8_t quantize_up(float value, float origin, float step)
+{
+    if (step <= 0.f)
+        return 0;
+
+    float q = fminf(fmaxf(ceilf((value - origin) / step), 0.f), 255.f);
+
+    while (q < 255.f && origin + q * step < value)
+        q += 1.f;
+
+    return (uint8_t)q;
+}
+
+/**
+ * Step of the grid of 255 steps over the extent, the last step is not below max
+ */
+static float grid_step(float min, float max)
+{
+    float step = (max - min) / 255.f;
+
+    while (step > 0.f && min + 255.f * step < max)
+        step = nextafterf(step, INFINITY);
+
+    return step;
+}
+
+static void set_child_bounds(bvh4_node_t *node, int slot, aabb_t box)
+{
+    node->lo_x[slot] = quantize_down(box.min.x, node->origin.x, node->step.x);
+    node->lo_y[slot] = quantize_down(box.min.y, node->origin.y, node->step.y);
+    node->lo_z[slot] = quantize_down(box.min.z, node->origin.z, node->step.z);
+    node->hi_x[slot] = quantize_up  (box.max.x, node->origin.x, node->step.x);
+    node->hi_y[slot] = quantize_up  (box.max.y, node->origin.y, node->step.y);
+    node->hi_z[slot] = quantize_up  (box.max.z, node->origin.z, node->step.z);
+}
+
+/**
+ * Makes the wide node of the binary one: its children are opened,
+ * the largest internal one first, until there are four of them
+ * Returns false if a leaf can't be encoded
+ */
+static bool widen(bvh4_builder_t *builder, uint32_t binary_index, uint32_t wide_index)
+{
+    const bvh_node_t *nodes = builder->bvh->nodes;
+    const bvh_node_t *node  = &nodes[binary_index];
+
+    uint32_t children[BVH4_WIDTH];
+    int      count = 0;
+
+    if (node->count > 0)
+        children[count++] = binary_index;
+    else
+    {
+        children[count++] = node->first;
+        children[count++] = node->first + 1;
+    }
+
+    while (count < BVH4_WIDTH)
+    {
+        int   largest = -1;
+        float area    = -1.f;
+
+        for (int i = 0; i < count; i++)
+        {
+            const bvh_node_t *child = &nodes[children[i]];
+
+            if (child->count == 0 && aabb_half_area(child->bounds) > area)
+            {
+                largest = i;
+                area    = aabb_half_area(child->bounds);
+            }
+        }
+
+        if (largest < 0)
+            break;
+
+        uint32_t opened = children[largest];
+
+        children[largest]  = nodes[opened].first;
+        children[count++]  = nodes[opened].first + 1;
+    }
+
+    bvh4_node_t *wide = &builder->wide->nodes[wide_index];
+
+    wide->origin = node->bounds.min;
+    wide->step   = (vec3_t){ grid_step(node->bounds.min.x, node->bounds.max.x),
+                             grid_step(node->bounds.min.y, node->bounds.max.y),
+                             grid_step(node->bounds.min.z, node->bounds.max.z) };
+
+    for (int i = 0; i < BVH4_WIDTH; i++)
+        wide->child[i] = BVH4_EMPTY;
+
+    for (int i = 0; i < count; i++)
+    {
+        const bvh_node_t *child = &nodes[children[i]];
+
+        set_child_bounds(wide, i, child->bounds);
+
+        if (child->count > 0)
+        {
+            if (child->count - 1 > BVH4_COUNT_MASK || child->first > BVH4_FIRST_MASK)
+                return false;
+
+            wide->child[i] = BVH4_LEAF | (child->count - 1) << BVH4_COUNT_SHIFT | child->first;
+            continue;
+        }
+
+        uint32_t index = (uint32_t)builder->wide->nodes_count++;
+        wide->child[i] = index;
+
+        if (!widen(builder, children[i], index))
+            return false;
+    }
+
+    return true;
+}
+
+bool bvh4_build(bvh4_t *wide, const bvh_t *bvh)
+{
+    memset(wide, 0, sizeof(*wide));
+
+    if (bvh->nodes_count == 0)
+        return true;
+
+    // every wide node opens a distinct internal binary node, or is the root
+    wide->nodes = malloc(bvh->nodes_count * sizeof(bvh4_node_t));
+    if (!wide->nodes)
+        return false;
+
+    wide->nodes_count = 1;
+
+    bvh4_builder_t builder = { wide, bvh };
+
+    if (!widen(&builder, 0, 0))
+    {
+        bvh4_destroy(wide);
+        return false;
+    }
+
+    return true;
+}
+
+void bvh4_destroy(bvh4_t *wide)
+{
+    free(wide->nodes);
+
+    memset(wide, 0, sizeof(*wide));
+}
+
+bool bvh4_valid(const bvh4_t *wide, size_t prims_count)
+{
+    uint8_t *depths = calloc(wide->nodes_count > 0 ? wide->nodes_count : 1, sizeof(uint8_t));
+    if (!depths)
+        return false;
+
+    bool ok = true;
+
+    for (size_t i = 0; ok && i < wide->nodes_count; i++)
+    {
+        // traversal keeps the other children of every node on the path and pushes all of these
+        size_t depth = depths[i];
+        ok = (BVH4_WIDTH - 1) * depth + BVH4_WIDTH <= BVH4_STACK_SIZE;
+
+        for (int j = 0; ok && j < BVH4_WIDTH; j++)
+        {
+            uint32_t child = wide->nodes[i].child[j];
+
+            if (child == BVH4_EMPTY)
+                continue;
+
+            if (child & BVH4_LEAF)
+            {
+                size_t first = child & BVH4_FIRST_MASK;
+                size_t count = (child >> BVH4_COUNT_SHIFT & BVH4_COUNT_MASK) + 1;
+
+                ok = first + count <= prims_count;
+            }
+            // children after the parent, so their depth is known before they are reached
+            else if (child <= i || child >= wide->nodes_count)
+                ok = false;
+            else if (depths[child] < depth + 1)
+                depths[child] = (uint8_t)(depth + 1);
+        }
+    }
+
+    free(depths);
+    return ok;
+}
+
+// traversal
+
+void bvh4_traverse(const bvh4_t *wide, vec3_t ray_origin, vec3_t ray_dir, float t_max,
+                   bvh_leaf_func_t leaf_func, void *ctx)
+{
+    if (wide->nodes_count == 0)
+        return;
+
+    vec3_t inv_dir = { 1.f / ray_dir.x, 1.f / ray_dir.y, 1.f / ray_dir.z };
+
+    uint32_t stack      [BVH4_STACK_SIZE];
+    float    stack_entry[BVH4_STACK_SIZE];
+    size_t   stack_size = 0;
+
+    stack      [stack_size] = 0;
+    stack_entry[stack_size] = 0.f;
+    stack_size++;
+
+    while (stack_size > 0)
+    {
+        stack_size--;
+
+        // closer hit was found after the entry was pushed
+        if (stack_entry[stack_size] > t_max)
+            continue;
+
+        uint32_t entry = stack[stack_size];
+
+        if (entry & BVH4_LEAF)
+        {
+            bvh_node_t leaf = {0};
+            leaf.first = entry & BVH4_FIRST_MASK;
+            leaf.count = (entry >> BVH4_COUNT_SHIFT & BVH4_COUNT_MASK) + 1;
+
+            if (leaf_func(ctx, &leaf, &t_max))
+                return;
+
+            continue;
+        }
+
+        const bvh4_node_t *node = &wide->nodes[entry];
+
+        // slab tests of all children side by side
+
+        float t_entry[BVH4_WIDTH];
+        float t_exit [BVH4_WIDTH];
+
+        for (int i = 0; i < BVH4_WIDTH; i++)
+        {
+            vec3_t lo = { node->origin.x + node->lo_x[i] * node->step.x,
+                          node->origin.y + node->lo_y[i] * node->step.y,
+                          node->origin.z + node->lo_z[i] * node->step.z };
+            vec3_t hi = { node->origin.x + node->hi_x[i] * node->step.x,
+                          node->origin.y + node->hi_y[i] * node->step.y,
+                          node->origin.z + node->hi_z[i] * node->step.z };
+
+            float tx1 = (lo.x - ray_origin.x) * inv_dir.x;
+            float tx2 = (hi.x - ray_origin.x) * inv_dir.x;
+            float ty1 = (lo.y - ray_origin.y) * inv_dir.y;
+            float ty2 = (hi.y - ray_origin.y) * inv_dir.y;
+            float tz1 = (lo.z - ray_origin.z) * inv_dir.z;
+            float tz2 = (hi.z - ray_origin.z) * inv_dir.z;
+
+            t_entry[i] = fmaxf(fmaxf(fminf(tx1, tx2), fminf(ty1, ty2)),
+                               fmaxf(fminf(tz1, tz2), 0.f));
+            t_exit [i] = fminf(fminf(fmaxf(tx1, tx2), fmaxf(ty1, ty2)),
+                               fminf(fmaxf(tz1, tz2), t_max));
+        }
+
+        // hit children sorted by entry, farthest first
+        uint32_t hits      [BVH4_WIDTH];
+        float    hits_entry[BVH4_WIDTH];
+        int      hits_count = 0;
+
+        for (int i = 0; i < BVH4_WIDTH; i++)
+        {
+            if (node->child[i] == BVH4_EMPTY || t_entry[i] > t_exit[i])
+                continue;
+
+            int j = hits_count++;
+            while (j > 0 && hits_entry[j - 1] < t_entry[i])
+            {
+                hits      [j] = hits      [j - 1];
+                hits_entry[j] = hits_entry[j - 1];
+                j--;
+            }
+
+            hits      [j] = node->child[i];
+            hits_entry[j] = t_entry[i];
+        }
+
+        // so the nearest one is popped first
+        for (int i = 0; i < hits_count; i++)
+        {
+            stack      [stack_size] = hits      [i];
+            stack_entry[stack_size] = hits_entry[i];
+            stack_size++;
+        }
+    }
+}
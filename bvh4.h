@@ -0,0 +1,67 @@
+#ifndef BVH4_H
+#define BVH4_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bvh.h"
+
+#define BVH4_WIDTH 4
+
+/**
+ * Node with up to four children, one cache line:
+ * children bounds are quantized to 8 bits on the grid spanning the node bounds,
+ * rounded outwards, so they still contain everything the exact bounds do
+ */
+typedef struct bvh4_node
+{
+    // grid of the children bounds, its corner and the size of one step
+    vec3_t   origin;
+    vec3_t   step;
+
+    // children bounds in grid steps
+    uint8_t  lo_x[BVH4_WIDTH];
+    uint8_t  lo_y[BVH4_WIDTH];
+    uint8_t  lo_z[BVH4_WIDTH];
+    uint8_t  hi_x[BVH4_WIDTH];
+    uint8_t  hi_y[BVH4_WIDTH];
+    uint8_t  hi_z[BVH4_WIDTH];
+
+    // internal child - index of its node
+    // leaf child     - BVH4_LEAF flag, number of primitives minus one, and the first one
+    // unused slot    - BVH4_EMPTY
+    uint32_t child[BVH4_WIDTH];
+} bvh4_node_t;
+
+/**
+ * Four wide hierarchy collapsed from a binary one, traversal tests all children
+ * of the node at once. Leaves are the leaves of the binary hierarchy,
+ * so leaf functions of bvh_traverse() work as they are
+ * Root is nodes[0], hierarchy over no primitives has no nodes
+ */
+typedef struct bvh4
+{
+    bvh4_node_t *nodes;
+    size_t       nodes_count;
+} bvh4_t;
+
+/**
+ * Collapses the binary hierarchy, fails if there is no memory
+ * or a leaf doesn't fit the child encoding
+ */
+bool bvh4_build(bvh4_t *wide, const bvh_t *bvh);
+
+void bvh4_destroy(bvh4_t *wide);
+
+/**
+ * Same as bvh_valid()
+ */
+bool bvh4_valid(const bvh4_t *wide, size_t prims_count);
+
+/**
+ * Same as bvh_traverse(), leaves are passed with their first and count only
+ */
+void bvh4_traverse(const bvh4_t *wide, vec3_t ray_origin, vec3_t ray_dir, float t_max,
+                   bvh_leaf_func_t leaf_func, void *ctx);
+
+#endif
@@ -0,0 +1,207 @@
+#include <math.h>
+
+#include "camera.h"
+
+camera_t camera_default()
+{
+    camera_t camera = {0};
+
+    camera.position = (vec3_t){ 0.f,  0.f, -24.f };
+    camera.target   = (vec3_t){ 0.f,  0.f,   0.f };
+    // y axis of the scene points down
+    camera.up       = (vec3_t){ 0.f, -1.f,   0.f };
+
+    // old image plane was 9 units high at distance 17
+    camera.fov      = 2.f * atanf(4.5f / 17.f) * 180.f / (float)M_PI;
+
+    camera.width    = 3840;
+    camera.height   = 2160;
+
+    camera_update(&camera);
+    return camera;
+}
+
+void camera_update(camera_t *camera)
+{
+    if (camera->width == 0)
+        camera->width = 1;
+
+    if (camera->height == 0)
+        camera->height = 1;
+
+    if (camera->crop_x1 > camera->width)
+        camera->crop_x1 = camera->width;
+
+    if (camera->crop_y1 > camera->height)
+        camera->crop_y1 = camera->height;
+
+    if (camera->crop_x0 >= camera->crop_x1 || camera->crop_y0 >= camera->crop_y1)
+    {
+        camera->crop_x0 = 0;
+        camera->crop_y0 = 0;
+        camera->crop_x1 = camera->width;
+        camera->crop_y1 = camera->height;
+    }
+
+    float aspect = camera->aspect;
+    if (aspect <= 0.f)
+        aspect = (float)camera->width / (float)camera->height;
+
+    float half_height = tanf(camera->fov * (float)M_PI / 360.f);
+    float half_width  = half_height * aspect;
+
+    camera->forward = vec_norm(vec_sub(camera->target, camera->position));
+
+    vec3_t right    = vec_norm(vec_cross(camera->forward, camera->up));
+    vec3_t upward   = vec_cross(right, camera->forward);
+
+    camera->right   = vec_mul_num(right , half_width);
+    camera->upward  = vec_mul_num(upward, half_height);
+}
+
+vec3_t camera_ray_dir(const camera_t *camera, float x, float y)
+{
+    float ndc_x = 2.f * x / (float)camera->width - 1.f;
+    float ndc_y = 1.f - 2.f * y / (float)camera->height;
+
+    return vec_add(camera->forward, vec_add(vec_mul_num(camera->right , ndc_x),
+                                            vec_mul_num(camera->upward, ndc_y)));
+}
+
+/**
+ * Camera space coordinates: x - to the right, y - up, z - forward
+ */
+static vec3_t camera_space(const camera_t *camera, vec3_t point)
+{
+    vec3_t rel = vec_sub(point, camera->position);
+
+    return (vec3_t){ vec_product(rel, vec_norm(camera->right )),
+                     vec_product(rel, vec_norm(camera->upward)),
+                     vec_product(rel, camera->forward) };
+}
+
+static screen_rect_t whole_frame(const camera_t *camera)
+{
+    return (screen_rect_t){ 0.f, 0.f, (float)camera->width, (float)camera->height };
+}
+
+/**
+ * Tangents of the lines from the camera touching the circle in (u, z) plane
+ * Circle must lie in front of the camera
+ */
+static void circle_tangents(float u, float z, float radius, float *out_min, float *out_max)
+{
+    float a = sqrtf(u * u + z * z - radius * radius);
+
+    *out_min = (u * a - radius * z) / (z * a + radius * u);
+    *out_max = (u * a + radius * z) / (z * a - radius * u);
+}
+
+/**
+ * Tangents of view angle are mapped to the frame, y axis of the frame points down
+ */
+static screen_rect_t tangents_to_rect(const camera_t *camera, float tan_x_min, float tan_x_max,
+                                      float tan_y_min, float tan_y_max)
+{
+    float half_width  = vec_length(camera->right);
+    float half_height = vec_length(camera->upward);
+
+    float width  = (float)camera->width;
+    float height = (float)camera->height;
+
+    return (screen_rect_t){ (tan_x_min / half_width  + 1.f) * 0.5f * width,
+                            (1.f - tan_y_max / half_height) * 0.5f * height,
+                            (tan_x_max / half_width  + 1.f) * 0.5f * width,
+                            (1.f - tan_y_min / half_height) * 0.5f * height };
+}
+
+bool camera_project(const camera_t *camera, vec3_t point, float *out_x, float *out_y)
+{
+    vec3_t local = camera_space(camera, point);
+
+    if (local.z <= EPS)
+        return false;
+
+    float tan_x = local.x / local.z;
+    float tan_y = local.y / local.z;
+
+    screen_rect_t rect = tangents_to_rect(camera, tan_x, tan_x, tan_y, tan_y);
+
+    *out_x = rect.x0;
+    *out_y = rect.y0;
+    return true;
+}
+
+bool camera_sphere_rect(const camera_t *camera, vec3_t center, float radius,
+                        screen_rect_t *out_rect)
+{
+    vec3_t local = camera_space(camera, center);
+
+    if (local.z + radius <= 0.f)
+        return false;
+
+    if (local.z - radius <= EPS)
+    {
+        *out_rect = whole_frame(camera);
+        return true;
+    }
+
+    float tan_x_min = 0.f, tan_x_max = 0.f, tan_y_min = 0.f, tan_y_max = 0.f;
+
+    circle_tangents(local.x, local.z, radius, &tan_x_min, &tan_x_max);
+    circle_tangents(local.y, local.z, radius, &tan_y_min, &tan_y_max);
+
+    *out_rect = tangents_to_rect(camera, tan_x_min, tan_x_max, tan_y_min, tan_y_max);
+    return true;
+}
+
+bool camera_box_rect(const camera_t *camera, vec3_t box_min, vec3_t box_max,
+                     screen_rect_t *out_rect)
+{
+    float tan_x_min =  INFINITY, tan_x_max = -INFINITY;
+    float tan_y_min =  INFINITY, tan_y_max = -INFINITY;
+
+    int behind = 0;
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vec3_t point = { corner & 1 ? box_max.x : box_min.x,
+                         corner & 2 ? box_max.y : box_min.y,
+                         corner & 4 ? box_max.z : box_min.z };
+
+        vec3_t local = camera_space(camera, point);
+
+        if (local.z <= EPS)
+        {
+            behind++;
+            continue;
+        }
+
+        tan_x_min = fminf(tan_x_min, local.x / local.z);
+        tan_x_max = fmaxf(tan_x_max, local.x / local.z);
+        tan_y_min = fminf(tan_y_min, local.y / local.z);
+        tan_y_max = fmaxf(tan_y_max, local.y / local.z);
+    }
+
+    if (behind == 8)
+        return false;
+
+    if (behind > 0)
+    {
+        *out_rect = whole_frame(camera);
+        return true;
+    }
+
+    *out_rect = tangents_to_rect(camera, tan_x_min, tan_x_max, tan_y_min, tan_y_max);
+    return true;
+}
+
+size_t camera_crop_width(const camera_t *camera)
+{
+    return camera->crop_x1 - camera->crop_x0;
+}
+
+size_t camera_crop_height(const camera_t *camera)
+{
+    return camera->crop_y1 - camera->crop_y0;
+}
@@ -0,0 +1,89 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <stdlib.h>
+
+#include "math_lib.h"
+
+typedef struct camera
+{
+    vec3_t position;
+    vec3_t target;
+    vec3_t up;
+
+    // vertical field of view in degrees
+    float  fov;
+    // width / height of the image plane, 0 means width / height of the frame
+    float  aspect;
+
+    size_t width;
+    size_t height;
+
+    // crop window in pixels - [crop_x0, crop_x1) x [crop_y0, crop_y1)
+    // empty window means the whole frame
+    size_t crop_x0;
+    size_t crop_y0;
+    size_t crop_x1;
+    size_t crop_y1;
+
+    // derived by camera_update()
+    vec3_t forward;
+    vec3_t right;
+    vec3_t upward;
+} camera_t;
+
+/**
+ * Rectangle on the frame in pixels, bounds are inclusive
+ */
+typedef struct screen_rect
+{
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+} screen_rect_t;
+
+/**
+ * Gives camera which looks like the old hardcoded one:
+ * 3840x2160 frame, origin at (0, 0, -24), looking along z axis
+ */
+camera_t camera_default();
+
+/**
+ * Recalculates camera basis and clamps crop window to the frame
+ * Must be called after any change of camera parameters
+ */
+void camera_update(camera_t *camera);
+
+/**
+ * Gives direction of the ray through point (x, y) of the frame, in pixels
+ * Result is not normalized
+ */
+vec3_t camera_ray_dir(const camera_t *camera, float x, float y);
+
+/**
+ * Gives position of the point projection on the frame, in pixels
+ * Returns false if the point is behind the camera
+ */
+bool camera_project(const camera_t *camera, vec3_t point, float *out_x, float *out_y);
+
+/**
+ * Gives exact bounds of the sphere projection on the frame
+ * Returns false if the sphere is behind the camera
+ * Sphere which crosses the camera plane covers the whole frame
+ */
+bool camera_sphere_rect(const camera_t *camera, vec3_t center, float radius,
+                        screen_rect_t *out_rect);
+
+/**
+ * Gives bounds of the box projection on the frame, by projection of its corners
+ * Returns false if the box is behind the camera
+ * Box which crosses the camera plane covers the whole frame
+ */
+bool camera_box_rect(const camera_t *camera, vec3_t box_min, vec3_t box_max,
+                     screen_rect_t *out_rect);
+
+size_t camera_crop_width (const camera_t *camera);
+size_t camera_crop_height(const camera_t *camera);
+
+#endif
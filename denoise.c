@@ -0,0 +1,159 @@
+#include <math.h>
+#include <string.h>
+
+#include "accel.h"
+#include "denoise.h"
+#include "object.h"
+
+// neighbourhood is (2 * radius + 1)^2 pixels
+static const int   DENOISE_RADIUS           = 2;
+static const float DENOISE_SPATIAL_SIGMA    = 1.5f;
+// weight of the neighbour normal is cos^(2^squarings) of the angle between normals
+static const int   DENOISE_NORMAL_SQUARINGS = 5;
+// relative to the pixel depth
+static const float DENOISE_DEPTH_SIGMA      = 0.02f;
+// keeps highlights and texture edges, shadow noise of a few samples is below it
+static const float DENOISE_COLOR_SIGMA      = 0.1f;
+
+typedef struct guide
+{
+    vec3_t       norm;
+    // INF for background, it is left as is
+    float        depth;
+    object_ref_t object;
+} guide_t;
+
+static void trace_guides(const scene_t *scene, size_t width, size_t height, guide_t *out_guides)
+{
+    const camera_t *camera = &scene->camera;
+
+    for (size_t y = 0; y < height; y++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            guide_t *guide = &out_guides[y * width + x];
+
+            vec3_t ray_dir = vec_norm(camera_ray_dir(camera, (float)(camera->crop_x0 + x) + 0.5f,
+                                                             (float)(camera->crop_y0 + y) + 0.5f));
+
+            hit_t hit = {0};
+            if (!scene_intersect(scene, camera->position, ray_dir, INF, &hit))
+            {
+                guide->depth = INF;
+                continue;
+            }
+
+            vec3_t            pos = {0};
+            const material_t *mat = NULL;
+            object_surface(scene, &hit, camera->position, ray_dir, &pos, &guide->norm, &mat);
+
+            guide->depth  = hit.dist;
+            guide->object = hit.object;
+        }
+    }
+}
+
+static float neighbour_weight(const guide_t *center, const guide_t *other, const float *center_color,
+                              const float *other_color, float spatial)
+{
+    if (other->depth >= INF || other->object.kind  != center->object.kind ||
+                               other->object.index != center->object.index)
+        return 0.f;
+
+    float cos_norm = vec_product(center->norm, other->norm);
+    if (cos_norm <= 0.f)
+        return 0.f;
+
+    for (int i = 0; i < DENOISE_NORMAL_SQUARINGS; i++)
+        cos_norm *= cos_norm;
+
+    float depth = (other->depth - center->depth) / (center->depth * DENOISE_DEPTH_SIGMA);
+
+    float color = 0.f;
+    for (int channel = 0; channel < 3; channel++)
+    {
+        float diff = (other_color[channel] - center_color[channel]) / DENOISE_COLOR_SIGMA;
+        color += diff * diff;
+    }
+
+    return spatial * cos_norm * expf(-0.5f * (depth * depth + color));
+}
+
+bool denoise(const scene_t *scene, float *io_rows, size_t width, size_t height)
+{
+    guide_t *guides   = calloc(width * height, sizeof(guide_t));
+    float   *filtered = calloc(width * height * 3, sizeof(float));
+
+    if (!guides || !filtered)
+    {
+        free(guides);
+        free(filtered);
+        return false;
+    }
+
+    trace_guides(scene, width, height, guides);
+
+    float spatial[2 * DENOISE_RADIUS + 1][2 * DENOISE_RADIUS + 1];
+
+    for (int dy = -DENOISE_RADIUS; dy <= DENOISE_RADIUS; dy++)
+    {
+        for (int dx = -DENOISE_RADIUS; dx <= DENOISE_RADIUS; dx++)
+            spatial[dy + DENOISE_RADIUS][dx + DENOISE_RADIUS] =
+                expf(-(float)(dx * dx + dy * dy) /
+                     (2.f * DENOISE_SPATIAL_SIGMA * DENOISE_SPATIAL_SIGMA));
+    }
+
+    for (size_t y = 0; y < height; y++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            size_t         pixel  = y * width + x;
+            const guide_t *center = &guides[pixel];
+            const float   *color  = &io_rows[3 * pixel];
+
+            if (center->depth >= INF)
+            {
+                memcpy(&filtered[3 * pixel], color, 3 * sizeof(float));
+                continue;
+            }
+
+            float sum[3]     = {0};
+            float weight_sum = 0.f;
+
+            for (int dy = -DENOISE_RADIUS; dy <= DENOISE_RADIUS; dy++)
+            {
+                for (int dx = -DENOISE_RADIUS; dx <= DENOISE_RADIUS; dx++)
+                {
+                    long other_x = (long)x + dx;
+                    long other_y = (long)y + dy;
+
+                    if (other_x < 0 || other_y < 0 || other_x >= (long)width ||
+                                                      other_y >= (long)height)
+                        continue;
+
+                    size_t       other       = (size_t)other_y * width + (size_t)other_x;
+                    const float *other_color = &io_rows[3 * other];
+
+                    float weight = neighbour_weight(center, &guides[other], color, other_color,
+                                                    spatial[dy + DENOISE_RADIUS]
+                                                           [dx + DENOISE_RADIUS]);
+
+                    for (int channel = 0; channel < 3; channel++)
+                        sum[channel] += weight * other_color[channel];
+
+                    weight_sum += weight;
+                }
+            }
+
+            // the pixel itself always has weight 1
+            for (int channel = 0; channel < 3; channel++)
+                filtered[3 * pixel + channel] = sum[channel] / weight_sum;
+        }
+    }
+
+    memcpy(io_rows, filtered, width * height * 3 * sizeof(float));
+
+    free(guides);
+    free(filtered);
+    return true;
+}
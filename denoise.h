@@ -0,0 +1,18 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "rt.h"
+
+/**
+ * Edge-aware filter for noise of sampled soft shadows
+ * Pixel is averaged with neighbours on the same surface only: weights fall off
+ * with screen distance and with difference of normal, depth and color
+ * Normals and depths are found by tracing primary rays of the camera crop window
+ * io_rows is row-major RGB image of the crop window
+ */
+bool denoise(const scene_t *scene, float *io_rows, size_t width, size_t height);
+
+#endif
@@ -0,0 +1,206 @@
+#include <math.h>
+#include <string.h>
+
+#include "accel.h"
+#include "dirty.h"
+#include "shadow.h"
+
+void dirty_region_destroy(dirty_region_t *dirty)
+{
+    free(dirty->rects);
+
+    memset(dirty, 0, sizeof(*dirty));
+}
+
+void dirty_region_clear(dirty_region_t *dirty)
+{
+    dirty->rects_count = 0;
+    dirty->whole_frame = false;
+}
+
+void dirty_mark_whole_frame(dirty_region_t *dirty)
+{
+    dirty->whole_frame = true;
+}
+
+void dirty_mark_rect(dirty_region_t *dirty, screen_rect_t rect)
+{
+    if (dirty->whole_frame)
+        return;
+
+    if (dirty->rects_count == dirty->rects_capacity)
+    {
+        size_t capacity = dirty->rects_capacity > 0 ? 2 * dirty->rects_capacity : 16;
+
+        screen_rect_t *rects = realloc(dirty->rects, capacity * sizeof(screen_rect_t));
+        if (!rects)
+        {
+            // losing the rectangle is not an option
+            dirty->whole_frame = true;
+            return;
+        }
+
+        dirty->rects          = rects;
+        dirty->rects_capacity = capacity;
+    }
+
+    dirty->rects[dirty->rects_count++] = rect;
+}
+
+static void mark_box(dirty_region_t *dirty, const camera_t *camera, aabb_t box)
+{
+    screen_rect_t rect = {0};
+
+    if (camera_box_rect(camera, box.min, box.max, &rect))
+        dirty_mark_rect(dirty, rect);
+}
+
+void dirty_mark_footprint(dirty_region_t *dirty, const scene_t *scene, object_ref_t object)
+{
+    screen_rect_t rect = {0};
+
+    if (object_screen_rect(scene, object, &rect))
+        dirty_mark_rect(dirty, rect);
+}
+
+static aabb_t scene_bounds(const scene_t *scene)
+{
+    if (scene->accel && scene->accel->bvh.nodes_count > 0)
+        return scene->accel->bvh.nodes[0].bounds;
+
+    aabb_t bounds = aabb_empty();
+    size_t count  = object_count(scene);
+
+    for (size_t i = 0; i < count; i++)
+        bounds = aabb_union(bounds, object_bounds(scene, object_by_number(scene, i)));
+
+    return bounds;
+}
+
+// receivers of one shadow segment marked one by one, more of them are marked by their common bounds
+static const size_t SHADOW_MAX_RECEIVERS = 64;
+
+typedef struct shadow_marker
+{
+    dirty_region_t *dirty;
+    const scene_t  *scene;
+    // its own shadow is inside its footprint
+    object_ref_t    caster;
+    aabb_t          volume;
+    size_t          receivers;
+} shadow_marker_t;
+
+/**
+ * Marks parts of the volume occupied by objects under the node
+ * Returns false if there are too many of them
+ */
+static bool mark_receivers(shadow_marker_t *marker, uint32_t node_index)
+{
+    const accel_t    *accel = marker->scene->accel;
+    const bvh_node_t *node  = bvh_node(&accel->bvh, node_index);
+
+    if (!aabb_valid(aabb_intersection(node->bounds, marker->volume)))
+        return true;
+
+    if (node->count == 0)
+        return mark_receivers(marker, node->first) && mark_receivers(marker, node->first + 1);
+
+    for (uint32_t i = node->first; i < node->first + node->count; i++)
+    {
+        object_ref_t object = accel_object(accel, i);
+        if (object.kind == marker->caster.kind && object.index == marker->caster.index)
+            continue;
+
+        aabb_t part = aabb_intersection(object_bounds(marker->scene, object),
+                                        marker->volume);
+        if (!aabb_valid(part))
+            continue;
+
+        if (++marker->receivers > SHADOW_MAX_RECEIVERS)
+            return false;
+
+        mark_box(marker->dirty, &marker->scene->camera, part);
+    }
+
+    return true;
+}
+
+/**
+ * Only objects inside the shadow volume can receive the shadow,
+ * so they are marked where they overlap it
+ */
+static void mark_shadow(dirty_region_t *dirty, const scene_t *scene, object_ref_t caster,
+                        const light_t *light, aabb_t receivers)
+{
+    shadow_volume_t volume = shadow_volume(object_bounds(scene, caster), light, receivers);
+
+    if (volume.everywhere)
+    {
+        dirty_mark_whole_frame(dirty);
+        return;
+    }
+
+    for (int i = 0; i < SHADOW_SEGMENTS; i++)
+    {
+        aabb_t segment = shadow_volume_segment(&volume, i);
+        if (!aabb_valid(segment))
+            continue;
+
+        shadow_marker_t marker = { dirty, scene, caster, segment, 0 };
+
+        if (!scene->accel || scene->accel->bvh.nodes_count == 0 || !mark_receivers(&marker, 0))
+            mark_box(dirty, &scene->camera, segment);
+    }
+}
+
+void dirty_mark_object(dirty_region_t *dirty, const scene_t *scene, object_ref_t object)
+{
+    if (dirty->whole_frame)
+        return;
+
+    dirty_mark_footprint(dirty, scene, object);
+
+    if (!object_casts_shadow(scene, object))
+        return;
+
+    aabb_t receivers = aabb_union(scene_bounds(scene), object_bounds(scene, object));
+
+    for (size_t i = 0; i < scene->lights_count; i++)
+        mark_shadow(dirty, scene, object, &scene->lights[i], receivers);
+}
+
+void dirty_region_tiles(const dirty_region_t *dirty, const camera_t *camera, size_t tile_size,
+                        size_t tiles_x, size_t tiles_y, bool *out_tiles)
+{
+    memset(out_tiles, dirty->whole_frame, tiles_x * tiles_y * sizeof(bool));
+
+    if (dirty->whole_frame)
+        return;
+
+    float size = (float)tile_size;
+
+    for (size_t i = 0; i < dirty->rects_count; i++)
+    {
+        screen_rect_t rect = dirty->rects[i];
+
+        // one pixel margin absorbs rounding, as for tile bins
+        float x0 = rect.x0 - (float)camera->crop_x0 - 1.f;
+        float y0 = rect.y0 - (float)camera->crop_y0 - 1.f;
+        float x1 = rect.x1 - (float)camera->crop_x0 + 1.f;
+        float y1 = rect.y1 - (float)camera->crop_y0 + 1.f;
+
+        if (x1 < 0.f || y1 < 0.f || x0 >= size * (float)tiles_x || y0 >= size * (float)tiles_y)
+            continue;
+
+        size_t tx0 = x0 > 0.f ? (size_t)(x0 / size) : 0;
+        size_t ty0 = y0 > 0.f ? (size_t)(y0 / size) : 0;
+        size_t tx1 = (size_t)fminf(x1 / size, (float)(tiles_x - 1));
+        size_t ty1 = (size_t)fminf(y1 / size, (float)(tiles_y - 1));
+
+        for (size_t y = ty0; y <= ty1; y++)
+        {
+            for (size_t x = tx0; x <= tx1; x++)
+                out_tiles[y * tiles_x + x] = true;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include <stdlib.h>
+
+#include "object.h"
+#include "rt.h"
+
+/**
+ * Part of the frame which may look different since the previous frame
+ * Collected as screen rectangles while the scene is edited
+ */
+typedef struct dirty_region
+{
+    screen_rect_t *rects;
+    size_t         rects_count;
+    size_t         rects_capacity;
+
+    // everything may have changed, e.g. a light moved
+    bool           whole_frame;
+} dirty_region_t;
+
+void dirty_region_destroy(dirty_region_t *dirty);
+
+/**
+ * Forgets all changes, called once the frame is rendered
+ */
+void dirty_region_clear(dirty_region_t *dirty);
+
+void dirty_mark_whole_frame(dirty_region_t *dirty);
+
+void dirty_mark_rect(dirty_region_t *dirty, screen_rect_t rect);
+
+/**
+ * Marks pixels which may see the object
+ */
+void dirty_mark_footprint(dirty_region_t *dirty, const scene_t *scene, object_ref_t object);
+
+/**
+ * Marks pixels which may see the object or its shadow from any light
+ * Must be called both before and after the object changes
+ */
+void dirty_mark_object(dirty_region_t *dirty, const scene_t *scene, object_ref_t object);
+
+/**
+ * Flags tiles of the camera crop window which overlap the region
+ * out_tiles has tiles_x * tiles_y entries, row by row
+ */
+void dirty_region_tiles(const dirty_region_t *dirty, const camera_t *camera, size_t tile_size,
+                        size_t tiles_x, size_t tiles_y, bool *out_tiles);
+
+#endif
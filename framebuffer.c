@@ -0,0 +1,175 @@
+#include <string.h>
+
+#include "framebuffer.h"
+
+bool pixel_order_parse(const char *name, pixel_order_t *out_order)
+{
+    if (strcmp(name, "scanline") == 0)
+        *out_order = ORDER_SCANLINE;
+    else if (strcmp(name, "morton") == 0)
+        *out_order = ORDER_MORTON;
+    else if (strcmp(name, "hilbert") == 0)
+        *out_order = ORDER_HILBERT;
+    else
+        return false;
+
+    return true;
+}
+
+// space filling curves
+
+/**
+ * Takes even bits of the code
+ */
+static uint32_t compact_bits(uint64_t code)
+{
+    code &= 0x5555555555555555ull;
+    code  = (code | (code >> 1 )) & 0x3333333333333333ull;
+    code  = (code | (code >> 2 )) & 0x0f0f0f0f0f0f0f0full;
+    code  = (code | (code >> 4 )) & 0x00ff00ff00ff00ffull;
+    code  = (code | (code >> 8 )) & 0x0000ffff0000ffffull;
+    code  = (code | (code >> 16)) & 0x00000000ffffffffull;
+
+    return (uint32_t)code;
+}
+
+static void morton_decode(uint64_t code, uint32_t *out_x, uint32_t *out_y)
+{
+    *out_x = compact_bits(code);
+    *out_y = compact_bits(code >> 1);
+}
+
+/**
+ * Position of the d-th cell of Hilbert curve filling side x side square
+ * side must be power of 2
+ */
+static void hilbert_decode(uint64_t side, uint64_t d, uint32_t *out_x, uint32_t *out_y)
+{
+    uint64_t x = 0, y = 0;
+
+    for (uint64_t s = 1; s < side; s *= 2)
+    {
+        uint64_t rx = 1 & (d / 2);
+        uint64_t ry = 1 & (d ^ rx);
+
+        // rotate quadrant
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+
+            uint64_t tmp = x;
+            x = y;
+            y = tmp;
+        }
+
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+
+    *out_x = (uint32_t)x;
+    *out_y = (uint32_t)y;
+}
+
+void grid_order(pixel_order_t order, size_t width, size_t height,
+                uint32_t *out_x, uint32_t *out_y)
+{
+    if (order == ORDER_SCANLINE)
+    {
+        for (size_t y = 0; y < height; y++)
+        {
+            for (size_t x = 0; x < width; x++)
+            {
+                out_x[y * width + x] = (uint32_t)x;
+                out_y[y * width + x] = (uint32_t)y;
+            }
+        }
+
+        return;
+    }
+
+    // walk the curve over the enclosing power of 2 square, skipping cells outside the grid
+
+    uint64_t side = 1;
+    while (side < width || side < height)
+        side *= 2;
+
+    size_t cell = 0;
+
+    for (uint64_t d = 0; d < side * side && cell < width * height; d++)
+    {
+        uint32_t x = 0, y = 0;
+
+        if (order == ORDER_MORTON)
+            morton_decode(d, &x, &y);
+        else
+            hilbert_decode(side, d, &x, &y);
+
+        if (x >= width || y >= height)
+            continue;
+
+        out_x[cell] = x;
+        out_y[cell] = y;
+        cell++;
+    }
+}
+
+// framebuffer
+
+bool framebuffer_init(framebuffer_t *fb, size_t width, size_t height, size_t tile_size)
+{
+    memset(fb, 0, sizeof(*fb));
+
+    if (tile_size == 0)
+        tile_size = 1;
+
+    fb->width     = width;
+    fb->height    = height;
+    fb->tile_size = tile_size;
+    fb->tiles_x   = (width  + tile_size - 1) / tile_size;
+    fb->tiles_y   = (height + tile_size - 1) / tile_size;
+
+    fb->pixels    = calloc(fb->tiles_x * fb->tiles_y * tile_size * tile_size * 3,
+                           sizeof(float));
+
+    return fb->pixels != NULL;
+}
+
+void framebuffer_destroy(framebuffer_t *fb)
+{
+    free(fb->pixels);
+
+    memset(fb, 0, sizeof(*fb));
+}
+
+float *framebuffer_pixel(const framebuffer_t *fb, size_t x, size_t y)
+{
+    size_t tile_size = fb->tile_size;
+    size_t tile      = (y / tile_size) * fb->tiles_x + x / tile_size;
+    size_t in_tile   = (y % tile_size) * tile_size   + x % tile_size;
+
+    return &fb->pixels[3 * (tile * tile_size * tile_size + in_tile)];
+}
+
+void framebuffer_to_rows(const framebuffer_t *fb, float *out_rows)
+{
+    size_t tile_size = fb->tile_size;
+
+    for (size_t y = 0; y < fb->height; y++)
+    {
+        // copy row by runs which lie in one tile
+        for (size_t x = 0; x < fb->width; x += tile_size)
+        {
+            size_t run = fb->width - x;
+            if (run > tile_size)
+                run = tile_size;
+
+            memcpy(&out_rows[3 * (y * fb->width + x)], framebuffer_pixel(fb, x, y),
+                   3 * run * sizeof(float));
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum pixel_order
+{
+    ORDER_SCANLINE,
+    ORDER_MORTON,
+    ORDER_HILBERT,
+} pixel_order_t;
+
+/**
+ * Gives order by its name ("scanline", "morton" or "hilbert")
+ */
+bool pixel_order_parse(const char *name, pixel_order_t *out_order);
+
+/**
+ * Lists cells of width x height grid in the given order
+ * out_x and out_y must have room for width * height cells
+ */
+void grid_order(pixel_order_t order, size_t width, size_t height,
+                uint32_t *out_x, uint32_t *out_y);
+
+/**
+ * Linear float RGB framebuffer split into square tiles
+ * Each tile is stored contiguously (row-major inside the tile),
+ * tiles on the right and bottom edges are padded up to the full size
+ */
+typedef struct framebuffer
+{
+    size_t         width;
+    size_t         height;
+
+    size_t         tile_size;
+    size_t         tiles_x;
+    size_t         tiles_y;
+
+    float         *pixels;
+} framebuffer_t;
+
+bool framebuffer_init(framebuffer_t *fb, size_t width, size_t height, size_t tile_size);
+
+void framebuffer_destroy(framebuffer_t *fb);
+
+/**
+ * Gives pointer to RGB triple of the pixel
+ */
+float *framebuffer_pixel(const framebuffer_t *fb, size_t x, size_t y);
+
+/**
+ * Converts tiled layout to plain row-major RGB image
+ */
+void framebuffer_to_rows(const framebuffer_t *fb, float *out_rows);
+
+#endif
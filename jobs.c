@@ -0,0 +1,135 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "jobs.h"
+
+size_t job_cpu_count()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (size_t)count : 1;
+}
+
+/**
+ * Does items of the current loop while there are any left, lock is held around
+ */
+static void take_items(job_pool_t *pool)
+{
+    while (pool->func && pool->next < pool->count)
+    {
+        size_t     index = pool->next++;
+        job_func_t func  = pool->func;
+        void      *ctx   = pool->ctx;
+
+        pthread_mutex_unlock(&pool->lock);
+        func(ctx, index);
+        pthread_mutex_lock(&pool->lock);
+
+        pool->finished++;
+        if (pool->finished == pool->count)
+            pthread_cond_broadcast(&pool->done);
+    }
+}
+
+static void *worker(void *arg)
+{
+    job_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true)
+    {
+        while (!pool->quit && (!pool->func || pool->next >= pool->count))
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if (pool->quit)
+            break;
+
+        take_items(pool);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+bool job_pool_init(job_pool_t *pool, size_t threads_count)
+{
+    memset(pool, 0, sizeof(*pool));
+
+    size_t workers = threads_count > 1 ? threads_count - 1 : 0;
+
+    pool->threads = calloc(workers > 0 ? workers : 1, sizeof(pthread_t));
+    if (!pool->threads)
+        return false;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (size_t i = 0; i < workers; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0)
+        {
+            job_pool_destroy(pool);
+            return false;
+        }
+
+        pool->threads_count++;
+    }
+
+    return true;
+}
+
+void job_pool_destroy(job_pool_t *pool)
+{
+    if (!pool->threads)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->threads_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+
+    memset(pool, 0, sizeof(*pool));
+}
+
+void job_pool_run(job_pool_t *pool, job_func_t func, void *ctx, size_t count)
+{
+    if (!pool || pool->threads_count == 0)
+    {
+        for (size_t i = 0; i < count; i++)
+            func(ctx, i);
+
+        return;
+    }
+
+    if (count == 0)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->func     = func;
+    pool->ctx      = ctx;
+    pool->count    = count;
+    pool->next     = 0;
+    pool->finished = 0;
+
+    pthread_cond_broadcast(&pool->start);
+
+    take_items(pool);
+
+    while (pool->finished < pool->count)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    pool->func = NULL;
+
+    pthread_mutex_unlock(&pool->lock);
+}
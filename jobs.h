@@ -0,0 +1,58 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * Does item index of the parallel loop
+ */
+typedef void (*job_func_t)(void *ctx, size_t index);
+
+/**
+ * Worker threads which run parallel loops together with the calling thread
+ * Items are handed out one by one, so they should be coarse: chunks of
+ * primitives or whole subtrees. Loops don't nest
+ */
+typedef struct job_pool
+{
+    pthread_t      *threads;
+    size_t          threads_count;
+
+    pthread_mutex_t lock;
+    // new loop or quit for the workers
+    pthread_cond_t  start;
+    // all items of the loop are done
+    pthread_cond_t  done;
+
+    // current loop, no loop if func is NULL
+    job_func_t      func;
+    void           *ctx;
+    size_t          count;
+    // next item to hand out and items finished
+    size_t          next;
+    size_t          finished;
+
+    bool            quit;
+} job_pool_t;
+
+/**
+ * Number of processors online, at least 1
+ */
+size_t job_cpu_count();
+
+/**
+ * Starts threads_count - 1 workers, the caller of job_pool_run() is the last one
+ */
+bool job_pool_init(job_pool_t *pool, size_t threads_count);
+
+void job_pool_destroy(job_pool_t *pool);
+
+/**
+ * Calls func for items [0, count) and waits for all of them
+ * Runs them on the calling thread in order if pool is NULL
+ */
+void job_pool_run(job_pool_t *pool, job_func_t func, void *ctx, size_t count);
+
+#endif
@@ -0,0 +1,331 @@
+#include <math.h>
+#include <string.h>
+
+#include "lightmap.h"
+#include "shadow.h"
+
+static bool vec_same(vec3_t a, vec3_t b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool box_same(aabb_t a, aabb_t b)
+{
+    return vec_same(a.min, b.min) && vec_same(a.max, b.max);
+}
+
+static void map_destroy(lightmap_t *map)
+{
+    free(map->visibility);
+
+    memset(map, 0, sizeof(*map));
+}
+
+/**
+ * Lays the texel grid over the disc, all texels are left to bake
+ */
+static bool map_init(lightmap_t *map, const plane_t *plane, float density, size_t lights_count)
+{
+    map_destroy(map);
+
+    map->position = plane->position;
+    map->norm     = plane->norm;
+    map->radius   = plane->radius;
+
+    vec_basis(vec_norm(plane->norm), &map->axis_u, &map->axis_v);
+
+    float side = 2.f * plane->radius;
+
+    map->size   = (size_t)fmaxf(ceilf(side * density), 1.f);
+    map->texel  = side / (float)map->size;
+    map->origin = vec_sub(plane->position,
+                          vec_mul_num(vec_add(map->axis_u, map->axis_v), plane->radius));
+
+    size_t count = lights_count * map->size * map->size;
+
+    map->visibility = malloc((count > 0 ? count : 1) * sizeof(float));
+    if (!map->visibility)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+        map->visibility[i] = -1.f;
+
+    return true;
+}
+
+static bool map_matches(const lightmap_t *map, const plane_t *plane)
+{
+    return vec_same(map->position, plane->position) && vec_same(map->norm, plane->norm) &&
+           map->radius == plane->radius;
+}
+
+static vec3_t texel_center(const lightmap_t *map, size_t x, size_t y)
+{
+    return vec_add(map->origin,
+                   vec_add(vec_mul_num(map->axis_u, ((float)x + 0.5f) * map->texel),
+                           vec_mul_num(map->axis_v, ((float)y + 0.5f) * map->texel)));
+}
+
+static aabb_t map_bounds(const lightmap_t *map)
+{
+    vec3_t side_u = vec_mul_num(map->axis_u, map->texel * (float)map->size);
+    vec3_t side_v = vec_mul_num(map->axis_v, map->texel * (float)map->size);
+
+    aabb_t bounds = aabb_grow(aabb_empty(), map->origin);
+    bounds = aabb_grow(bounds, vec_add(map->origin, side_u));
+    bounds = aabb_grow(bounds, vec_add(map->origin, side_v));
+    bounds = aabb_grow(bounds, vec_add(map->origin, vec_add(side_u, side_v)));
+
+    return bounds;
+}
+
+/**
+ * Texel coordinate of the point along the side, texel centers are whole
+ */
+static float texel_coord(const lightmap_t *map, vec3_t axis, vec3_t point)
+{
+    return vec_product(vec_sub(point, map->origin), axis) / map->texel - 0.5f;
+}
+
+/**
+ * Marks texels of the light whose centers may be inside the box
+ */
+static void invalidate_box(lightmap_t *map, size_t light, aabb_t box)
+{
+    float u_min = INFINITY, u_max = -INFINITY;
+    float v_min = INFINITY, v_max = -INFINITY;
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vec3_t point = { corner & 1 ? box.max.x : box.min.x,
+                         corner & 2 ? box.max.y : box.min.y,
+                         corner & 4 ? box.max.z : box.min.z };
+
+        float u = texel_coord(map, map->axis_u, point);
+        float v = texel_coord(map, map->axis_v, point);
+
+        u_min = fminf(u_min, u);
+        u_max = fmaxf(u_max, u);
+        v_min = fminf(v_min, v);
+        v_max = fmaxf(v_max, v);
+    }
+
+    float last = (float)(map->size - 1);
+
+    if (u_max < 0.f || v_max < 0.f || u_min > last || v_min > last)
+        return;
+
+    size_t x0 = (size_t)fmaxf(floorf(u_min), 0.f);
+    size_t y0 = (size_t)fmaxf(floorf(v_min), 0.f);
+    size_t x1 = (size_t)fminf(ceilf(u_max), last);
+    size_t y1 = (size_t)fminf(ceilf(v_max), last);
+
+    float *layer = &map->visibility[light * map->size * map->size];
+
+    for (size_t y = y0; y <= y1; y++)
+    {
+        for (size_t x = x0; x <= x1; x++)
+            layer[y * map->size + x] = -1.f;
+    }
+}
+
+/**
+ * Marks texels of the light the shadow of the box may fall on
+ */
+static void invalidate_shadow(lightmap_t *map, size_t light_index, const light_t *light,
+                              aabb_t box)
+{
+    aabb_t          bounds = map_bounds(map);
+    shadow_volume_t volume = shadow_volume(box, light, bounds);
+
+    if (volume.everywhere)
+    {
+        invalidate_box(map, light_index, bounds);
+        return;
+    }
+
+    for (int i = 0; i < SHADOW_SEGMENTS; i++)
+    {
+        aabb_t segment = shadow_volume_segment(&volume, i);
+
+        if (aabb_valid(segment))
+            invalidate_box(map, light_index, segment);
+    }
+}
+
+/**
+ * Shades texels which are marked for baking, gives their number
+ */
+static size_t map_bake(lightmap_t *map, const scene_t *scene, size_t plane)
+{
+    object_ref_t receiver = { (uint32_t)plane, OBJECT_PLANE };
+    vec3_t       norm     = vec_norm(map->norm);
+    size_t       baked    = 0;
+
+    for (size_t i = 0; i < scene->lights_count; i++)
+    {
+        float *layer = &map->visibility[i * map->size * map->size];
+
+        for (size_t y = 0; y < map->size; y++)
+        {
+            for (size_t x = 0; x < map->size; x++)
+            {
+                if (layer[y * map->size + x] >= 0.f)
+                    continue;
+
+                vec3_t pos       = texel_center(map, x, y);
+                vec3_t light_vec = vec_norm(vec_sub(scene->lights[i].position, pos));
+
+                layer[y * map->size + x] = light_visibility(scene, i, &receiver, pos, norm,
+                                                            light_vec);
+                baked++;
+            }
+        }
+    }
+
+    return baked;
+}
+
+void lightmap_cache_destroy(lightmap_cache_t *cache)
+{
+    for (size_t i = 0; i < cache->maps_count; i++)
+        map_destroy(&cache->maps[i]);
+
+    free(cache->maps);
+    free(cache->lights);
+    free(cache->bounds);
+
+    float density = cache->density;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->density = density;
+}
+
+/**
+ * Forgets all maps and lays out new ones for the scene
+ */
+static bool cache_reset(lightmap_cache_t *cache, const scene_t *scene, size_t objects_count)
+{
+    lightmap_cache_destroy(cache);
+
+    cache->maps   = calloc(scene->planes_count > 0 ? scene->planes_count : 1, sizeof(lightmap_t));
+    cache->lights = calloc(scene->lights_count > 0 ? scene->lights_count : 1, sizeof(light_t));
+    cache->bounds = calloc(objects_count > 0 ? objects_count : 1, sizeof(aabb_t));
+
+    if (!cache->maps || !cache->lights || !cache->bounds)
+    {
+        lightmap_cache_destroy(cache);
+        return false;
+    }
+
+    cache->maps_count   = scene->planes_count;
+    cache->lights_count = scene->lights_count;
+    cache->bounds_count = objects_count;
+
+    for (size_t i = 0; i < cache->maps_count; i++)
+    {
+        if (!map_init(&cache->maps[i], &scene->planes[i], cache->density, scene->lights_count))
+        {
+            lightmap_cache_destroy(cache);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool lightmap_cache_update(lightmap_cache_t *cache, const scene_t *scene)
+{
+    size_t objects_count = object_count(scene);
+
+    // added or removed objects renumber the rest
+    if (!cache->maps || cache->maps_count != scene->planes_count ||
+        cache->lights_count != scene->lights_count || cache->bounds_count != objects_count)
+    {
+        if (!cache_reset(cache, scene, objects_count))
+            return false;
+    }
+
+    for (size_t i = 0; i < cache->maps_count; i++)
+    {
+        lightmap_t *map = &cache->maps[i];
+
+        if (!map_matches(map, &scene->planes[i]) &&
+            !map_init(map, &scene->planes[i], cache->density, scene->lights_count))
+        {
+            lightmap_cache_destroy(cache);
+            return false;
+        }
+
+        for (size_t j = 0; j < scene->lights_count; j++)
+        {
+            if (memcmp(&cache->lights[j], &scene->lights[j], sizeof(light_t)) != 0)
+                invalidate_box(map, j, map_bounds(map));
+        }
+    }
+
+    for (size_t i = 0; i < objects_count; i++)
+    {
+        object_ref_t object = object_by_number(scene, i);
+        aabb_t       bounds = object_bounds(scene, object);
+
+        if (box_same(bounds, cache->bounds[i]) || !object_casts_shadow(scene, object))
+            continue;
+
+        // where the shadow was and where it goes
+        for (size_t j = 0; j < cache->maps_count; j++)
+        {
+            for (size_t k = 0; k < scene->lights_count; k++)
+            {
+                invalidate_shadow(&cache->maps[j], k, &scene->lights[k], cache->bounds[i]);
+                invalidate_shadow(&cache->maps[j], k, &scene->lights[k], bounds);
+            }
+        }
+    }
+
+    memcpy(cache->lights, scene->lights, scene->lights_count * sizeof(light_t));
+
+    for (size_t i = 0; i < objects_count; i++)
+        cache->bounds[i] = object_bounds(scene, object_by_number(scene, i));
+
+    // baking must trace the shadows, not read them from the maps
+    scene_t bake_scene = *scene;
+    bake_scene.lightmaps = NULL;
+
+    cache->baked = 0;
+
+    for (size_t i = 0; i < cache->maps_count; i++)
+        cache->baked += map_bake(&cache->maps[i], &bake_scene, i);
+
+    return true;
+}
+
+bool lightmap_covers(const lightmap_cache_t *cache, object_ref_t object)
+{
+    return object.kind == OBJECT_PLANE && object.index < cache->maps_count &&
+           cache->maps[object.index].visibility;
+}
+
+float lightmap_visibility(const lightmap_cache_t *cache, size_t plane, size_t light, vec3_t pos)
+{
+    const lightmap_t *map = &cache->maps[plane];
+
+    float  last = (float)(map->size - 1);
+    float  u    = fminf(fmaxf(texel_coord(map, map->axis_u, pos), 0.f), last);
+    float  v    = fminf(fmaxf(texel_coord(map, map->axis_v, pos), 0.f), last);
+
+    size_t x0   = (size_t)u;
+    size_t y0   = (size_t)v;
+    size_t x1   = x0 + 1 < map->size ? x0 + 1 : x0;
+    size_t y1   = y0 + 1 < map->size ? y0 + 1 : y0;
+
+    float  fu   = u - (float)x0;
+    float  fv   = v - (float)y0;
+
+    const float *layer = &map->visibility[light * map->size * map->size];
+
+    float top    = layer[y0 * map->size + x0] * (1.f - fu) + layer[y0 * map->size + x1] * fu;
+    float bottom = layer[y1 * map->size + x0] * (1.f - fu) + layer[y1 * map->size + x1] * fu;
+
+    return top * (1.f - fv) + bottom * fv;
+}
@@ -0,0 +1,75 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <stdlib.h>
+
+#include "bvh.h"
+#include "object.h"
+#include "rt.h"
+
+/**
+ * Visibility of every light baked over one disc:
+ * square grid of texels around the disc in its own plane, texels are
+ * shaded at their centers and looked up bilinearly
+ */
+typedef struct lightmap
+{
+    // disc the map was baked for
+    vec3_t position;
+    vec3_t norm;
+    float  radius;
+
+    // corner of the square, its unit sides, and the texel size
+    vec3_t origin;
+    vec3_t axis_u;
+    vec3_t axis_v;
+    float  texel;
+    size_t size;
+
+    // fraction of each light seen from the texel, light after light, row by row,
+    // negative for texels which must be baked again
+    float *visibility;
+} lightmap_t;
+
+/**
+ * Lightmaps of all discs of the scene, baked before the frame
+ * Lights and objects are compared with what the maps were baked for:
+ * changed disc or light is baked again as a whole, moved object only where
+ * its shadow volumes before and after the move cross the disc
+ */
+typedef struct lightmap_cache
+{
+    lightmap_t *maps;
+    size_t      maps_count;
+
+    // texels per unit of length
+    float       density;
+
+    // scene the maps were baked for, object bounds are kept by object number
+    light_t    *lights;
+    size_t      lights_count;
+    aabb_t     *bounds;
+    size_t      bounds_count;
+
+    // texels baked by the last update
+    size_t      baked;
+} lightmap_cache_t;
+
+void lightmap_cache_destroy(lightmap_cache_t *cache);
+
+/**
+ * Finds what changed since the last update and bakes it again
+ */
+bool lightmap_cache_update(lightmap_cache_t *cache, const scene_t *scene);
+
+/**
+ * Checks if the object is a disc with a baked map
+ */
+bool lightmap_covers(const lightmap_cache_t *cache, object_ref_t object);
+
+/**
+ * Fraction of the light seen from the point of the disc
+ */
+float lightmap_visibility(const lightmap_cache_t *cache, size_t plane, size_t light, vec3_t pos);
+
+#endif
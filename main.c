@@ -1,67 +1,626 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
+#include "ao.h"
+#include "jobs.h"
+#include "lightmap.h"
 #include "math_lib.h"
 #include "rt.h"
+#include "render.h"
+#include "scene_edit.h"
+#include "shadow.h"
+#include "shadowmap.h"
+#include "stress.h"
+
+// particles per chunk of streamed clouds
+static const size_t STREAM_CHUNK_SIZE = 4096;
 
-static void render(scene_t scene, size_t frame_cnt)
+typedef struct options
 {
-    size_t raster_rect_width = 3840, raster_rect_height = 2160;
+    render_options_t render;
+
+    const char      *obj_file;
+    vec3_t           obj_offset;
+    float            obj_scale;
+
+    size_t           crowd_size;
+    // spheres of the cloud above the crowd
+    size_t           particles;
+    // the cloud is one instance of quantized particles instead of separate spheres
+    bool             pack_cloud;
+    // the cloud is read from this file in chunks, written there first if particles > 0
+    const char      *stream_file;
+    // megabytes of chunks held in memory
+    size_t           stream_budget;
+    // generated scene replaces the default one if it has spheres
+    stress_options_t stress;
+
+    // SAH bins per axis of top level hierarchy builds, median splits if 0
+    size_t           accel_bins;
+    // threads of parallel builds, all processors if 0
+    size_t           threads;
+    // file the first hierarchy is mapped from or saved to, none if NULL
+    const char      *accel_cache;
+    // top level subtrees are built when rays first enter them
+    bool             lazy_accel;
+
+    // frames of animation, the first sphere moves between them
+    size_t           frames;
+    // camera moves by this every frame instead of the sphere, if not zero
+    vec3_t           fly;
+    // trace whole frames instead of tiles changed since the previous one
+    bool             no_dirty;
+
+    // shape of both lights, point by default
+    light_kind_t     light_kind;
+    float            light_radius;
+    float            light_width;
+    float            light_depth;
 
-    unsigned char *bitmap = calloc(raster_rect_width * raster_rect_height * 3, sizeof(unsigned char));
+    // ambient occlusion, its cache is kept between frames
+    bool             ao;
+    // per light shadow caster lists, rebuilt when the scene changes
+    bool             casters;
+    // texels per unit of baked disc lightmaps, none if 0
+    float            lightmap_density;
+    // texels per side of cube shadow map faces, none if 0
+    size_t           shadow_map_size;
+} options_t;
 
-    // camera config
+static bool parse_vec(const char *str, vec3_t *out_vec)
+{
+    return sscanf(str, "%f,%f,%f", &out_vec->x, &out_vec->y, &out_vec->z) == 3;
+}
 
-    vec3_t raster_rect_vert1 = { -8.f, -4.5f, 0.f };
-    vec3_t raster_rect_vert2 = {  8.f,  4.5f, 0.f };
-    vec3_t camera_origin     = {  0.f,  0.f, -24.f };
+static double time_now()
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    for (size_t y = 0; y < raster_rect_height; y++)
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void print_usage(const char *prog_name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -w, --width N            frame width in pixels\n"
+            "  -h, --height N           frame height in pixels\n"
+            "  -f, --fov DEG            vertical field of view\n"
+            "  -a, --aspect A           image plane aspect ratio (default: width / height)\n"
+            "  -p, --look-from X,Y,Z    camera position\n"
+            "  -t, --look-at X,Y,Z      point the camera looks at\n"
+            "  -u, --up X,Y,Z           camera up vector\n"
+            "  -c, --crop X0,Y0,X1,Y1   render only [X0, X1) x [Y0, Y1) part of the frame\n"
+            "      --wavefront          use wavefront ray tracer\n"
+            "      --obj FILE           add triangle mesh from Wavefront OBJ file\n"
+            "      --obj-place X,Y,Z,S  move the mesh to X,Y,Z and scale it by S\n"
+            "      --stress N           replace the spheres by N generated ones\n"
+            "      --layout L           place them uniform, clustered or grid (default: uniform)\n"
+            "      --lights M           spread M copies of the first light above them\n"
+            "                           (default: 2)\n"
+            "      --discs K            add K discs among them\n"
+            "      --seed S             seed of the generated scene (default: 1)\n"
+            "      --overlap F          sphere diameter over neighbour distance (default: 0.5)\n"
+            "      --depth D            spheres a primary ray passes through (default: 2)\n"
+            "      --crowd N            add N x N grid of instances behind the spheres\n"
+            "      --particles N        add cloud of N small spheres above the crowd\n"
+            "      --pack-cloud         store the cloud quantized, smaller but slower to trace\n"
+            "      --stream FILE        read the cloud from FILE as rays reach it, write it first\n"
+            "                           if --particles is given, traced by the wavefront tracer,\n"
+            "                           not with --raster or --reproject\n"
+            "      --stream-mb M        hold at most M MB of the streamed cloud (default: 64)\n"
+            "      --accel-bins N       build hierarchy by SAH over N bins (default: 16),\n"
+            "                           by median splits if 0\n"
+            "      --threads N          threads of parallel builds (default: all processors)\n"
+            "      --accel-cache FILE   load hierarchy from FILE if it matches the scene,\n"
+            "                           save it there otherwise\n"
+            "      --lazy-accel         build subtrees of the hierarchy when rays reach them\n"
+            "      --tile N             framebuffer tile size in pixels\n"
+            "      --tile-order ORDER   order of tiles: scanline, morton or hilbert\n"
+            "      --pixel-order ORDER  order of pixels inside the tile: scanline, morton or hilbert\n"
+            "      --frames N           render N frames, moving the first sphere between them\n"
+            "      --fly X,Y,Z          move the camera by X,Y,Z every frame instead of the sphere\n"
+            "      --reproject T        reuse the previous frame, trace it again if more than\n"
+            "                           T of its hits are hidden (0 - 1),\n"
+            "                           not with --raster or --wavefront\n"
+            "      --no-dirty           trace whole frames instead of changed tiles\n"
+            "      --raster             find primary hits by rasterization into ID buffer\n"
+            "      --fast-math          shade with approximate pow and normalization\n"
+            "      --validate           with --raster, compare it with traced image,\n"
+            "                           with --fast-math, report error against exact shading\n"
+            "      --no-binning         don't bin objects into tiles for primary rays\n"
+            "      --light-size R       make lights spheres of radius R for soft shadows\n"
+            "      --light-rect W,D     make lights horizontal W x D rectangles for soft shadows\n"
+            "      --denoise            smooth noise of soft shadows\n"
+            "      --ao                 occlude ambient light through irradiance cache\n"
+            "      --casters            trace shadow rays against per light caster lists\n"
+            "      --lightmap D         bake shadows on discs at D texels per unit\n"
+            "      --shadow-map N       look up point light shadows in N x N cube maps\n"
+            "      --exposure E         multiply colors by E before conversion to 8 bits\n"
+            "      --tonemap            compress bright colors by Reinhard operator\n"
+            "      --gamma G            gamma of the PNG image (default: 1, linear)\n"
+            "      --pfm                also write float image to test<N>.pfm\n"
+            "      --stats              print timings\n",
+            prog_name);
+}
+
+enum
+{
+    OPT_WAVEFRONT = 256,
+    OPT_OBJ,
+    OPT_OBJ_PLACE,
+    OPT_STRESS,
+    OPT_LAYOUT,
+    OPT_LIGHTS,
+    OPT_DISCS,
+    OPT_SEED,
+    OPT_OVERLAP,
+    OPT_DEPTH,
+    OPT_CROWD,
+    OPT_PARTICLES,
+    OPT_PACK_CLOUD,
+    OPT_STREAM,
+    OPT_STREAM_MB,
+    OPT_ACCEL_BINS,
+    OPT_THREADS,
+    OPT_ACCEL_CACHE,
+    OPT_LAZY_ACCEL,
+    OPT_TILE,
+    OPT_TILE_ORDER,
+    OPT_PIXEL_ORDER,
+    OPT_NO_BINNING,
+    OPT_FRAMES,
+    OPT_NO_DIRTY,
+    OPT_FLY,
+    OPT_REPROJECT,
+    OPT_RASTER,
+    OPT_FAST_MATH,
+    OPT_VALIDATE,
+    OPT_LIGHT_SIZE,
+    OPT_LIGHT_RECT,
+    OPT_DENOISE,
+    OPT_AO,
+    OPT_CASTERS,
+    OPT_LIGHTMAP,
+    OPT_SHADOW_MAP,
+    OPT_EXPOSURE,
+    OPT_TONEMAP,
+    OPT_GAMMA,
+    OPT_PFM,
+    OPT_STATS,
+};
+
+/**
+ * Applies command line options on top of camera from the scene
+ */
+static bool parse_args(int argc, char **argv, camera_t *camera, options_t *opts)
+{
+    static const struct option long_options[] =
     {
-        for (size_t x = 0; x < raster_rect_width; x++)
+        { "width"      , required_argument, NULL, 'w'             },
+        { "height"     , required_argument, NULL, 'h'             },
+        { "fov"        , required_argument, NULL, 'f'             },
+        { "aspect"     , required_argument, NULL, 'a'             },
+        { "look-from"  , required_argument, NULL, 'p'             },
+        { "look-at"    , required_argument, NULL, 't'             },
+        { "up"         , required_argument, NULL, 'u'             },
+        { "crop"       , required_argument, NULL, 'c'             },
+        { "wavefront"  , no_argument      , NULL, OPT_WAVEFRONT   },
+        { "obj"        , required_argument, NULL, OPT_OBJ         },
+        { "obj-place"  , required_argument, NULL, OPT_OBJ_PLACE   },
+        { "stress"     , required_argument, NULL, OPT_STRESS      },
+        { "layout"     , required_argument, NULL, OPT_LAYOUT      },
+        { "lights"     , required_argument, NULL, OPT_LIGHTS      },
+        { "discs"      , required_argument, NULL, OPT_DISCS       },
+        { "seed"       , required_argument, NULL, OPT_SEED        },
+        { "overlap"    , required_argument, NULL, OPT_OVERLAP     },
+        { "depth"      , required_argument, NULL, OPT_DEPTH       },
+        { "crowd"      , required_argument, NULL, OPT_CROWD       },
+        { "particles"  , required_argument, NULL, OPT_PARTICLES   },
+        { "pack-cloud" , no_argument      , NULL, OPT_PACK_CLOUD  },
+        { "stream"     , required_argument, NULL, OPT_STREAM      },
+        { "stream-mb"  , required_argument, NULL, OPT_STREAM_MB   },
+        { "accel-bins" , required_argument, NULL, OPT_ACCEL_BINS  },
+        { "threads"    , required_argument, NULL, OPT_THREADS     },
+        { "accel-cache", required_argument, NULL, OPT_ACCEL_CACHE },
+        { "lazy-accel" , no_argument      , NULL, OPT_LAZY_ACCEL  },
+        { "tile"       , required_argument, NULL, OPT_TILE        },
+        { "tile-order" , required_argument, NULL, OPT_TILE_ORDER  },
+        { "pixel-order", required_argument, NULL, OPT_PIXEL_ORDER },
+        { "no-binning" , no_argument      , NULL, OPT_NO_BINNING  },
+        { "frames"     , required_argument, NULL, OPT_FRAMES      },
+        { "no-dirty"   , no_argument      , NULL, OPT_NO_DIRTY    },
+        { "fly"        , required_argument, NULL, OPT_FLY         },
+        { "reproject"  , required_argument, NULL, OPT_REPROJECT   },
+        { "raster"     , no_argument      , NULL, OPT_RASTER      },
+        { "fast-math"  , no_argument      , NULL, OPT_FAST_MATH   },
+        { "validate"   , no_argument      , NULL, OPT_VALIDATE    },
+        { "light-size" , required_argument, NULL, OPT_LIGHT_SIZE  },
+        { "light-rect" , required_argument, NULL, OPT_LIGHT_RECT  },
+        { "denoise"    , no_argument      , NULL, OPT_DENOISE     },
+        { "ao"         , no_argument      , NULL, OPT_AO          },
+        { "casters"    , no_argument      , NULL, OPT_CASTERS     },
+        { "lightmap"   , required_argument, NULL, OPT_LIGHTMAP    },
+        { "shadow-map" , required_argument, NULL, OPT_SHADOW_MAP  },
+        { "exposure"   , required_argument, NULL, OPT_EXPOSURE    },
+        { "tonemap"    , no_argument      , NULL, OPT_TONEMAP     },
+        { "gamma"      , required_argument, NULL, OPT_GAMMA       },
+        { "pfm"        , no_argument      , NULL, OPT_PFM         },
+        { "stats"      , no_argument      , NULL, OPT_STATS       },
+        { NULL         , 0                , NULL, 0               }
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "w:h:f:a:p:t:u:c:", long_options, NULL)) != -1)
+    {
+        bool ok = true;
+
+        switch (opt)
         {
-            vec3_t raster_rect_dir = vec_sub(raster_rect_vert2, raster_rect_vert1);
+        case 'w':
+            camera->width  = strtoul(optarg, NULL, 10);
+            break;
 
-            float pixel_width  = raster_rect_dir.x / raster_rect_width;
-            float pixel_height = raster_rect_dir.y / raster_rect_height;
+        case 'h':
+            camera->height = strtoul(optarg, NULL, 10);
+            break;
 
-            vec3_t pixel_pos = { raster_rect_vert1.x + pixel_width  * ((float)x + 0.5f),
-                                 raster_rect_vert1.y + pixel_height * ((float)y + 0.5f),
-                                 -7.f };
+        case 'f':
+            camera->fov    = strtof(optarg, NULL);
+            break;
 
-            vec3_t ray_dir = vec_sub(pixel_pos, camera_origin);
+        case 'a':
+            camera->aspect = strtof(optarg, NULL);
+            break;
 
-            color_t color = ray_trace(camera_origin, ray_dir, scene);
+        case 'p':
+            ok = parse_vec(optarg, &camera->position);
+            break;
 
-            if (255 * color.x > 255.f)
-                bitmap[y * 3 * raster_rect_width + 3 * x] = 255;
-            else
-                bitmap[y * 3 * raster_rect_width + 3 * x] = 255 * color.x;
-            
-            if (255 * color.y > 255.f)
-                bitmap[y * 3 * raster_rect_width + 3 * x + 1] = 255;
-            else
-                bitmap[y * 3 * raster_rect_width + 3 * x + 1] = 255 * color.y;
+        case 't':
+            ok = parse_vec(optarg, &camera->target);
+            break;
 
-            if (255 * color.z > 255.f)
-                bitmap[y * 3 * raster_rect_width + 3 * x + 2] = 255;
-            else
-                bitmap[y * 3 * raster_rect_width + 3 * x + 2] = 255 * color.z;
+        case 'u':
+            ok = parse_vec(optarg, &camera->up);
+            break;
+
+        case 'c':
+            ok = sscanf(optarg, "%zu,%zu,%zu,%zu", &camera->crop_x0, &camera->crop_y0,
+                                                   &camera->crop_x1, &camera->crop_y1) == 4;
+            break;
+
+        case OPT_WAVEFRONT:
+            opts->render.wavefront = true;
+            break;
+
+        case OPT_OBJ:
+            opts->obj_file = optarg;
+            break;
+
+        case OPT_OBJ_PLACE:
+            ok = sscanf(optarg, "%f,%f,%f,%f", &opts->obj_offset.x, &opts->obj_offset.y,
+                                               &opts->obj_offset.z, &opts->obj_scale) == 4;
+            break;
+
+        case OPT_STRESS:
+            opts->stress.spheres = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_LAYOUT:
+            ok = stress_layout_parse(optarg, &opts->stress.layout);
+            break;
+
+        case OPT_LIGHTS:
+            opts->stress.lights = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_DISCS:
+            opts->stress.discs = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_SEED:
+            opts->stress.seed = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_OVERLAP:
+            opts->stress.overlap = strtof(optarg, NULL);
+            ok = opts->stress.overlap > 0.f;
+            break;
+
+        case OPT_DEPTH:
+            opts->stress.depth = strtof(optarg, NULL);
+            ok = opts->stress.depth > 0.f;
+            break;
+
+        case OPT_CROWD:
+            opts->crowd_size = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_PARTICLES:
+            opts->particles = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_PACK_CLOUD:
+            opts->pack_cloud = true;
+            break;
+
+        case OPT_STREAM:
+            opts->stream_file = optarg;
+            break;
+
+        case OPT_STREAM_MB:
+            opts->stream_budget = strtoul(optarg, NULL, 10);
+            ok = opts->stream_budget > 0;
+            break;
+
+        case OPT_ACCEL_BINS:
+            opts->accel_bins = strtoul(optarg, NULL, 10);
+            ok = opts->accel_bins != 1 && opts->accel_bins <= BVH_MAX_BINS;
+            break;
+
+        case OPT_THREADS:
+            opts->threads = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_ACCEL_CACHE:
+            opts->accel_cache = optarg;
+            break;
+
+        case OPT_LAZY_ACCEL:
+            opts->lazy_accel = true;
+            break;
+
+        case OPT_TILE:
+            opts->render.tile_size = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_TILE_ORDER:
+            ok = pixel_order_parse(optarg, &opts->render.tile_order);
+            break;
+
+        case OPT_PIXEL_ORDER:
+            ok = pixel_order_parse(optarg, &opts->render.pixel_order);
+            break;
+
+        case OPT_NO_BINNING:
+            opts->render.binning = false;
+            break;
+
+        case OPT_FRAMES:
+            opts->frames = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_NO_DIRTY:
+            opts->no_dirty = true;
+            break;
+
+        case OPT_FLY:
+            ok = parse_vec(optarg, &opts->fly);
+            break;
+
+        case OPT_REPROJECT:
+            opts->render.reproject           = true;
+            opts->render.reproject_threshold = strtof(optarg, NULL);
+            break;
+
+        case OPT_RASTER:
+            opts->render.raster = true;
+            break;
+
+        case OPT_FAST_MATH:
+            opts->render.fast_math = true;
+            break;
+
+        case OPT_VALIDATE:
+            opts->render.validate = true;
+            break;
+
+        case OPT_LIGHT_SIZE:
+            opts->light_kind   = LIGHT_SPHERE;
+            opts->light_radius = strtof(optarg, NULL);
+            ok = opts->light_radius > 0.f;
+            break;
+
+        case OPT_LIGHT_RECT:
+            opts->light_kind = LIGHT_RECT;
+            ok = sscanf(optarg, "%f,%f", &opts->light_width, &opts->light_depth) == 2;
+            break;
+
+        case OPT_DENOISE:
+            opts->render.denoise = true;
+            break;
+
+        case OPT_AO:
+            opts->ao = true;
+            break;
+
+        case OPT_CASTERS:
+            opts->casters = true;
+            break;
+
+        case OPT_LIGHTMAP:
+            opts->lightmap_density = strtof(optarg, NULL);
+            ok = opts->lightmap_density > 0.f;
+            break;
+
+        case OPT_SHADOW_MAP:
+            opts->shadow_map_size = strtoul(optarg, NULL, 10);
+            ok = opts->shadow_map_size > 0;
+            break;
+
+        case OPT_EXPOSURE:
+            opts->render.tonemap.exposure = strtof(optarg, NULL);
+            break;
+
+        case OPT_TONEMAP:
+            opts->render.tonemap.reinhard = true;
+            break;
+
+        case OPT_GAMMA:
+            opts->render.tonemap.gamma = strtof(optarg, NULL);
+            ok = opts->render.tonemap.gamma > 0.f;
+            break;
+
+        case OPT_PFM:
+            opts->render.pfm = true;
+            break;
+
+        case OPT_STATS:
+            opts->render.stats = true;
+            break;
+
+        default:
+            ok = false;
+            break;
+        }
+
+        if (!ok)
+        {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+
+    // reprojection traces by itself, it would silently take their place
+    if (opts->render.reproject && (opts->render.raster || opts->render.wavefront))
+    {
+        fprintf(stderr, "--reproject can't be combined with --raster or --wavefront\n");
+        print_usage(argv[0]);
+        return false;
+    }
+
+    // only the wavefront tracer traces other rays while chunks are read, the others wait for them
+    if (opts->stream_file && (opts->render.raster || opts->render.reproject))
+    {
+        fprintf(stderr, "--stream can't be combined with --raster or --reproject\n");
+        print_usage(argv[0]);
+        return false;
+    }
+
+    if (opts->stream_file)
+        opts->render.wavefront = true;
+
+    camera_update(camera);
+    return true;
+}
+
+/**
+ * Fills grid of instances standing on the floor behind the spheres
+ * Every instance refers to one of the prototypes and one of the materials
+ */
+static instance_t *build_crowd(size_t size, size_t prototypes_count, size_t materials_count)
+{
+    instance_t *instances = calloc(size * size, sizeof(instance_t));
+    if (!instances)
+        return NULL;
+
+    // deterministic pseudo random jitter
+    unsigned int seed = 42;
+
+    for (size_t z = 0; z < size; z++)
+    {
+        for (size_t x = 0; x < size; x++)
+        {
+            instance_t *instance = &instances[z * size + x];
+
+            seed = seed * 1103515245u + 12345u;
+            float jitter = (float)(seed >> 16 & 0x7fff) / 32768.f;
+
+            float cell  = 40.f / (float)size;
+            float scale = cell * (0.3f + 0.15f * jitter);
+
+            instance->position  = (vec3_t){ -20.f + cell * ((float)x + 0.5f),
+                                             7.f - scale,
+                                             20.f + cell * ((float)z + 0.5f) };
+            instance->scale     = scale;
+            instance->rotation  = quat_axis_angle((vec3_t){ 0.f, 1.f, 0.f }, 6.28f * jitter);
+            instance->prototype = (uint32_t)((x + z) % prototypes_count);
+            instance->material  = (uint16_t)((x + 2 * z) % materials_count);
         }
     }
 
-    char file_name[16];
-    snprintf(file_name, 15, "test%zu.png", frame_cnt);
+    return instances;
+}
+
+/**
+ * Size of the top level hierarchy: binary and wide nodes and object references
+ */
+static double accel_megabytes(const accel_t *accel)
+{
+    size_t bytes = accel->bvh.nodes_count  * sizeof(bvh_node_t) +
+                   accel->wide.nodes_count * sizeof(bvh4_node_t) +
+                   accel->objects_count    * sizeof(object_ref_t);
+
+    return (double)bytes / (1024. * 1024.);
+}
+
+/**
+ * Places the last prototype of the scene once, as it is, particles keep their own materials
+ */
+static bool add_cloud_instance(scene_t *scene, instance_t **io_instances)
+{
+    size_t      count     = scene->instances_count;
+    instance_t *instances = realloc(*io_instances, (count + 1) * sizeof(instance_t));
+
+    if (!instances)
+        return false;
+
+    instances[count].position  = (vec3_t){ 0.f, 0.f, 0.f };
+    instances[count].scale     = 1.f;
+    instances[count].rotation  = quat_axis_angle((vec3_t){ 0.f, 1.f, 0.f }, 0.f);
+    instances[count].prototype = (uint32_t)scene->prototypes_count++;
+    instances[count].material  = 0;
+
+    *io_instances          = instances;
+    scene->instances       = instances;
+    scene->instances_count = count + 1;
+    return true;
+}
+
+/**
+ * Scatters particles of log uniform radii in a box above the crowd,
+ * sized so the cloud stays about as dense for any count
+ */
+static particle_t *build_cloud(size_t count, size_t materials_count)
+{
+    particle_t *particles = calloc(count, sizeof(particle_t));
+    if (!particles)
+        return NULL;
+
+    const vec3_t min  = { -20.f, -6.f, 20.f };
+    const vec3_t size = {  40.f, 10.f, 40.f };
+
+    float cell = cbrtf(size.x * size.y * size.z / (float)count);
+
+    // deterministic pseudo random positions
+    unsigned int seed = 7;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        float random[4];
+        for (size_t j = 0; j < 4; j++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            random[j] = (float)(seed >> 16 & 0x7fff) / 32768.f;
+        }
 
-    stbi_write_png(file_name, raster_rect_width, raster_rect_height, 3, bitmap, 0);
+        particles[i].position = (vec3_t){ min.x + size.x * random[0],
+                                          min.y + size.y * random[1],
+                                          min.z + size.z * random[2] };
+        particles[i].radius   = cell * 0.05f * exp2f(2.f * random[3]);
+        particles[i].material = (uint16_t)(i % materials_count);
+    }
 
-    free(bitmap);
+    return particles;
 }
 
-int main()
+int main(int argc, char **argv)
 {
 
     // materials
@@ -87,16 +646,21 @@ int main()
     mate_blue.specular  = (vec3_t){ 0.1f, 0.1f, 0.1f  };
     mate_blue.shininess = 64.f;
 
+    // objects refer to materials by index
+    enum { MATTE, GLOSS, MATE_BLUE };
+
+    material_t materials[3] = { matte, gloss, mate_blue };
+
     // spheres
 
     sphere_t spheres[2] = {};
     spheres[0].position = (vec3_t){  7.f, -1.f, 10.f };
     spheres[0].radius   = 6.f;
-    spheres[0].material = matte;
 
     spheres[1].position = (vec3_t){ -7.f, -1.f, 10.f };
     spheres[1].radius   = 6.f;
-    spheres[1].material = gloss;
+
+    uint16_t sphere_materials[2] = { MATTE, GLOSS };
 
     // plane
 
@@ -104,7 +668,7 @@ int main()
     plane.position = (vec3_t){ 0.f,  7.f, 15.f };
     plane.norm     = (vec3_t){ 0.f, -1.f,  0.f };
     plane.radius   = 20.f;
-    plane.material = mate_blue;
+    plane.material = MATE_BLUE;
 
     // light
 
@@ -123,8 +687,12 @@ int main()
     scene_t scene = {0};
     scene.ambient_color = (vec3_t){ 0.1f, 0.1f, 0.1f };
 
-    scene.spheres       = spheres;
-    scene.spheres_count = 2;
+    scene.materials        = materials;
+    scene.materials_count  = 3;
+
+    scene.spheres          = spheres;
+    scene.sphere_materials = sphere_materials;
+    scene.spheres_count    = 2;
 
     scene.planes        = &plane;
     scene.planes_count  = 1;
@@ -132,6 +700,329 @@ int main()
     scene.lights        = lights;
     scene.lights_count  = 2;
 
-    render(scene, 0);
-    return 0;
+    // camera
+
+    scene.camera = camera_default();
+
+    options_t opts = {0};
+    opts.render        = render_options_default();
+    opts.obj_scale     = 1.f;
+    opts.frames        = 1;
+    opts.accel_bins    = 16;
+    opts.stream_budget = 64;
+    opts.stress        = stress_options_default();
+
+    if (!parse_args(argc, argv, &scene.camera, &opts))
+        return 1;
+
+    for (size_t i = 0; i < scene.lights_count; i++)
+    {
+        lights[i].kind   = opts.light_kind;
+        lights[i].radius = opts.light_radius;
+        lights[i].half_u = (vec3_t){ opts.light_width / 2.f, 0.f, 0.f };
+        lights[i].half_v = (vec3_t){ 0.f, 0.f, opts.light_depth / 2.f };
+    }
+
+    // mesh
+
+    mesh_t mesh = {0};
+
+    if (opts.obj_file)
+    {
+        if (!mesh_load_obj(&mesh, opts.obj_file))
+        {
+            fprintf(stderr, "Can't load %s\n", opts.obj_file);
+            return 1;
+        }
+
+        mesh_transform(&mesh, opts.obj_scale, opts.obj_offset);
+        mesh.material = MATTE;
+
+        if (!mesh_build(&mesh))
+        {
+            fprintf(stderr, "Not enough memory for %s\n", opts.obj_file);
+            mesh_destroy(&mesh);
+            return 1;
+        }
+
+        scene.meshes       = &mesh;
+        scene.meshes_count = 1;
+    }
+
+    // generated scene
+
+    stress_scene_t stress = {0};
+
+    if (opts.stress.spheres > 0)
+    {
+        if (!stress_scene_add(&stress, &scene, &opts.stress))
+        {
+            fprintf(stderr, "Not enough memory for %zu spheres\n", opts.stress.spheres);
+            mesh_destroy(&mesh);
+            return 1;
+        }
+
+        if (opts.render.stats)
+            fprintf(stderr, "stress: %zu spheres of radius %.3f in %.1f deep box, "
+                    "%zu lights, %zu discs\n", scene.spheres_count, stress.radius,
+                    stress.box_depth, scene.lights_count, opts.stress.discs);
+    }
+
+    // instances
+
+    prototype_t prototypes[3] = {0};
+    prototypes[0].kind   = PROTOTYPE_SPHERE;
+    prototypes[0].radius = 1.f;
+
+    // mesh is already placed, so its instances are placed relative to it
+    prototypes[1].kind   = PROTOTYPE_MESH;
+    prototypes[1].mesh   = &mesh;
+
+    scene.prototypes       = prototypes;
+    scene.prototypes_count = opts.obj_file ? 2 : 1;
+
+    instance_t *instances = NULL;
+
+    if (opts.crowd_size > 0)
+    {
+        instances = build_crowd(opts.crowd_size, scene.prototypes_count, scene.materials_count);
+        if (!instances)
+        {
+            fprintf(stderr, "Not enough memory for instances\n");
+            stress_scene_destroy(&stress);
+            mesh_destroy(&mesh);
+            return 1;
+        }
+
+        scene.instances       = instances;
+        scene.instances_count = opts.crowd_size * opts.crowd_size;
+    }
+
+    // particles, one instance of the packed or streamed cloud or plain spheres after the others
+
+    particles_t       cloud           = {0};
+    particle_stream_t stream          = {0};
+    sphere_t         *cloud_spheres   = NULL;
+    uint16_t         *cloud_materials = NULL;
+
+    if (opts.particles > 0 || opts.stream_file)
+    {
+        particle_t *particles = opts.particles > 0 ? build_cloud(opts.particles,
+                                                                 scene.materials_count)
+                                                   : NULL;
+        bool        added     = false;
+
+        if (opts.stream_file)
+        {
+            // new cloud is written to the file first, otherwise the file is read as it is
+            if (opts.particles > 0 &&
+                (!particles || !particle_stream_write(opts.stream_file, particles, opts.particles,
+                                                      STREAM_CHUNK_SIZE, scene.materials_count)))
+            {
+                fprintf(stderr, "Can't write %s\n", opts.stream_file);
+            }
+            else if (!particle_stream_open(&stream, opts.stream_file,
+                                           opts.stream_budget * 1024 * 1024,
+                                           scene.materials_count))
+            {
+                fprintf(stderr, "Can't read %s\n", opts.stream_file);
+            }
+            else
+            {
+                prototypes[scene.prototypes_count].kind   = PROTOTYPE_STREAM;
+                prototypes[scene.prototypes_count].stream = &stream;
+
+                added = add_cloud_instance(&scene, &instances);
+            }
+        }
+        else if (particles && opts.pack_cloud)
+        {
+            if (particles_build(&cloud, particles, opts.particles))
+            {
+                prototypes[scene.prototypes_count].kind      = PROTOTYPE_PARTICLES;
+                prototypes[scene.prototypes_count].particles = &cloud;
+
+                added = add_cloud_instance(&scene, &instances);
+            }
+        }
+        else if (particles)
+        {
+            size_t count    = scene.spheres_count + opts.particles;
+            cloud_spheres   = malloc(count * sizeof(sphere_t));
+            cloud_materials = malloc(count * sizeof(uint16_t));
+
+            if (cloud_spheres && cloud_materials)
+            {
+                memcpy(cloud_spheres, scene.spheres, scene.spheres_count * sizeof(sphere_t));
+                memcpy(cloud_materials, scene.sphere_materials,
+                       scene.spheres_count * sizeof(uint16_t));
+
+                for (size_t i = 0; i < opts.particles; i++)
+                {
+                    cloud_spheres[scene.spheres_count + i]   = (sphere_t){ particles[i].position,
+                                                                           particles[i].radius };
+                    cloud_materials[scene.spheres_count + i] = particles[i].material;
+                }
+
+                scene.spheres          = cloud_spheres;
+                scene.sphere_materials = cloud_materials;
+                scene.spheres_count    = count;
+                added = true;
+            }
+        }
+
+        free(particles);
+
+        if (!added)
+        {
+            if (!opts.stream_file)
+                fprintf(stderr, "Not enough memory for particles\n");
+
+            free(instances);
+            free(cloud_spheres);
+            free(cloud_materials);
+            stress_scene_destroy(&stress);
+            particles_destroy(&cloud);
+            particle_stream_close(&stream);
+            mesh_destroy(&mesh);
+            return 1;
+        }
+
+        if (opts.render.stats && opts.stream_file)
+            fprintf(stderr, "particles: %zu chunks streamed in %zu MB\n", stream.chunks_count,
+                    opts.stream_budget);
+        else if (opts.render.stats && opts.pack_cloud)
+            fprintf(stderr, "particles: %zu packed in %.2f MB\n", opts.particles,
+                    (double)particles_memory(&cloud) / (1024. * 1024.));
+        else if (opts.render.stats)
+            fprintf(stderr, "particles: %zu spheres in %.2f MB without their hierarchy\n",
+                    opts.particles,
+                    (double)(opts.particles * (sizeof(sphere_t) + sizeof(uint16_t))) /
+                    (1024. * 1024.));
+    }
+
+    // hierarchies are built on all threads
+
+    size_t     threads = opts.threads > 0 ? opts.threads : job_cpu_count();
+    job_pool_t jobs    = {0};
+
+    if (threads > 1 && !job_pool_init(&jobs, threads))
+    {
+        fprintf(stderr, "Can't start threads, building on one\n");
+        threads = 1;
+    }
+
+    bvh_build_options_t accel_build = {0};
+    accel_build.bins = opts.accel_bins;
+    accel_build.jobs = &jobs;
+    accel_build.lazy = opts.lazy_accel;
+
+    scene.accel_build = &accel_build;
+    scene.accel_cache = opts.accel_cache;
+
+    // editor keeps its own copy of the scene and builds acceleration structure for it
+
+    scene_editor_t editor = {0};
+
+    double build_start = time_now();
+
+    bool ok = scene_editor_init(&editor, &scene);
+    free(instances);
+    free(cloud_spheres);
+    free(cloud_materials);
+    stress_scene_destroy(&stress);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Not enough memory for acceleration structure\n");
+        job_pool_destroy(&jobs);
+        particles_destroy(&cloud);
+        particle_stream_close(&stream);
+        mesh_destroy(&mesh);
+        return 1;
+    }
+
+    if (opts.render.stats && editor.accel.mapping)
+        fprintf(stderr, "accel: %zu nodes in %.2f MB, %.3f s mapped from %s\n",
+                editor.accel.bvh.nodes_count, accel_megabytes(&editor.accel),
+                time_now() - build_start, opts.accel_cache);
+    else if (opts.render.stats && editor.accel.bvh.lazy)
+        fprintf(stderr, "accel: %zu top nodes, %.3f s build on %zu threads\n",
+                editor.accel.bvh.nodes_count, time_now() - build_start, threads);
+    else if (opts.render.stats)
+        fprintf(stderr, "accel: %zu nodes in %.2f MB, %.3f s build on %zu threads\n",
+                editor.accel.bvh.nodes_count, accel_megabytes(&editor.accel),
+                time_now() - build_start, threads);
+
+    frame_history_t history = {0};
+
+    ao_cache_t ao_cache = {0};
+    if (opts.ao)
+        scene.ao = &ao_cache;
+
+    shadow_casters_t casters = {0};
+    if (opts.casters)
+        scene.casters = &casters;
+
+    lightmap_cache_t lightmaps = {0};
+    lightmaps.density = opts.lightmap_density;
+    if (opts.lightmap_density > 0.f)
+        scene.lightmaps = &lightmaps;
+
+    shadow_maps_t shadow_maps = {0};
+    shadow_maps.resolution = opts.shadow_map_size;
+    if (opts.shadow_map_size > 0)
+        scene.shadow_maps = &shadow_maps;
+
+    for (size_t frame = 0; ok && frame < opts.frames; frame++)
+    {
+        bool fly = opts.fly.x != 0.f || opts.fly.y != 0.f || opts.fly.z != 0.f;
+
+        if (frame > 0 && fly)
+        {
+            scene.camera.position = vec_add(scene.camera.position, opts.fly);
+            scene.camera.target   = vec_add(scene.camera.target  , opts.fly);
+            camera_update(&scene.camera);
+        }
+        else if (frame > 0 && scene.spheres_count > 0)
+        {
+            vec3_t position = scene.spheres[0].position;
+            position.x -= 0.25f;
+
+            scene_move_object(&editor, (object_ref_t){ 0, OBJECT_SPHERE }, position);
+        }
+
+        ok = render(scene, &opts.render, opts.no_dirty ? NULL : &history, &editor.dirty, frame);
+        dirty_region_clear(&editor.dirty);
+
+        if (opts.render.stats && editor.accel.bvh.lazy)
+        {
+            size_t built = 0, total = 0;
+            bvh_lazy_progress(&editor.accel.bvh, &built, &total);
+
+            fprintf(stderr, "accel: %zu of %zu subtrees built\n", built, total);
+        }
+
+        if (opts.render.stats && opts.stream_file)
+        {
+            particle_stream_stats_t stats = particle_stream_stats(&stream);
+
+            fprintf(stderr, "stream: %zu chunks read ahead, %zu rays waited, %zu idle waits, "
+                    "%zu evicted, %zu chunks in %.2f MB\n", stats.prefetched, stats.stalls,
+                    stats.waits, stats.evictions, stats.resident_chunks,
+                    (double)stats.resident_bytes / (1024. * 1024.));
+        }
+    }
+
+    frame_history_destroy(&history);
+    ao_cache_destroy(&ao_cache);
+    shadow_casters_destroy(&casters);
+    lightmap_cache_destroy(&lightmaps);
+    shadow_maps_destroy(&shadow_maps);
+    scene_editor_destroy(&editor);
+    job_pool_destroy(&jobs);
+    particles_destroy(&cloud);
+    particle_stream_close(&stream);
+    mesh_destroy(&mesh);
+    return ok ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "math_lib.h"
+
+typedef vec3_t color_t;
+
+typedef struct material
+{
+    color_t ambient;
+    color_t diffuse;
+    color_t specular;
+
+    float   shininess;
+} material_t;
+
+#endif
@@ -1,4 +1,6 @@
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "math_lib.h"
 #include "rt.h"
@@ -28,6 +30,30 @@ vec3_t vec_norm(vec3_t src_vec)
                      src_vec.z / length };
 }
 
+/**
+ * Initial guess from the float bits, refined by two Newton steps
+ */
+static float rsqrt_approx(float num)
+{
+    uint32_t bits = 0;
+    memcpy(&bits, &num, sizeof(bits));
+
+    bits = 0x5f375a86u - (bits >> 1);
+
+    float root = 0.f;
+    memcpy(&root, &bits, sizeof(root));
+
+    root = root * (1.5f - 0.5f * num * root * root);
+    root = root * (1.5f - 0.5f * num * root * root);
+
+    return root;
+}
+
+vec3_t vec_norm_approx(vec3_t src_vec)
+{
+    return vec_mul_num(src_vec, rsqrt_approx(vec_product(src_vec, src_vec)));
+}
+
 vec3_t vec_mul(vec3_t a, vec3_t b)
 {
     return (vec3_t){ a.x * b.x,
@@ -57,6 +83,111 @@ float vec_product(vec3_t a, vec3_t b)
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
+vec3_t vec_cross(vec3_t a, vec3_t b)
+{
+    return (vec3_t){ a.y * b.z - a.z * b.y,
+                     a.z * b.x - a.x * b.z,
+                     a.x * b.y - a.y * b.x };
+}
+
+void vec_basis(vec3_t axis, vec3_t *out_tangent, vec3_t *out_bitangent)
+{
+    vec3_t helper = fabsf(axis.x) < 0.9f ? (vec3_t){ 1.f, 0.f, 0.f } : (vec3_t){ 0.f, 1.f, 0.f };
+
+    *out_tangent   = vec_norm(vec_cross(axis, helper));
+    *out_bitangent = vec_cross(axis, *out_tangent);
+}
+
+uint32_t random_seed(vec3_t point)
+{
+    uint32_t bits[3];
+    memcpy(bits, &point, sizeof(bits));
+
+    uint32_t seed = bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+
+    seed ^= seed >> 16;
+    seed *= 0x7feb352du;
+    seed ^= seed >> 15;
+
+    return seed;
+}
+
+float random_next(uint32_t *io_state)
+{
+    *io_state = *io_state * 1664525u + 1013904223u;
+
+    return (float)(*io_state >> 8) / 16777216.f;
+}
+
+quat_t quat_axis_angle(vec3_t axis, float angle)
+{
+    vec3_t imag = vec_mul_num(vec_norm(axis), sinf(angle / 2.f));
+
+    return (quat_t){ imag.x, imag.y, imag.z, cosf(angle / 2.f) };
+}
+
+quat_t quat_conj(quat_t q)
+{
+    return (quat_t){ -q.x, -q.y, -q.z, q.w };
+}
+
+/**
+ * v' = v + 2w (u x v) + 2 u x (u x v), where u is the imaginary part
+ */
+vec3_t quat_rotate(quat_t q, vec3_t vec)
+{
+    vec3_t imag  = { q.x, q.y, q.z };
+    vec3_t cross = vec_mul_num(vec_cross(imag, vec), 2.f);
+
+    return vec_add(vec_add(vec, vec_mul_num(cross, q.w)), vec_cross(imag, cross));
+}
+
+/**
+ * log2(1 + t) and 2^t for t in [0, 1), least squares fits
+ */
+static float log2_poly(float t)
+{
+    return t * (1.44159208f + t * (-0.70725343f + t * (0.41156148f +
+           t * (-0.18983245f + t * 0.04392863f)))) + 1.439e-5f;
+}
+
+static float exp2_poly(float t)
+{
+    return 1.00000360f + t * (0.69296955f + t * (0.24162132f +
+           t * (0.05171774f + t * 0.01368398f)));
+}
+
+float pow_approx(float base, float exp)
+{
+    if (base <= 0.f)
+        return 0.f;
+
+    // base = 2^e * (1 + t)
+    uint32_t bits = 0;
+    memcpy(&bits, &base, sizeof(bits));
+
+    int      e         = (int)(bits >> 23) - 127;
+    uint32_t mant_bits = (bits & 0x007fffffu) | 0x3f800000u;
+
+    float mant = 0.f;
+    memcpy(&mant, &mant_bits, sizeof(mant));
+
+    float power = exp * ((float)e + log2_poly(mant - 1.f));
+
+    // below the smallest normal float
+    if (power < -126.f)
+        return 0.f;
+
+    float whole = floorf(power);
+
+    uint32_t scale_bits = (uint32_t)((int)whole + 127) << 23;
+
+    float scale = 0.f;
+    memcpy(&scale, &scale_bits, sizeof(scale));
+
+    return scale * exp2_poly(power - whole);
+}
+
 bool less(float a, float b)
 {
     return a - b < -EPS;
@@ -95,16 +226,14 @@ bool equal(float a, float b)
  * so gets quadratic equation with unknown parameter
  * least positive solution is parameter of intersection point
  */
-bool ray_sphere_intersect(vec3_t *out_intersect_point,vec3_t ray_origin, vec3_t ray_dir,
-                          sphere_t sphere)
+bool ray_sphere_dist(float *out_dist, vec3_t ray_origin, vec3_t ray_dir,
+                     vec3_t center, float radius)
 {
-    ray_dir = vec_norm(ray_dir);
-
-    vec3_t s = vec_sub(ray_origin, sphere.position);
+    vec3_t s = vec_sub(ray_origin, center);
 
     float a = vec_product(ray_dir, ray_dir);
     float b = 2 * vec_product(s, ray_dir);
-    float c = vec_product(s, s) - sphere.radius * sphere.radius;
+    float c = vec_product(s, s) - radius * radius;
 
     float d = b * b - 4 * a * c;
 
@@ -131,27 +260,52 @@ bool ray_sphere_intersect(vec3_t *out_intersect_point,vec3_t ray_origin, vec3_t
     if (equal(t, 0))
         return false;
 
-    *out_intersect_point = vec_add(ray_origin, vec_mul_num(ray_dir, t));
+    *out_dist = t;
     return true;
 }
 
-bool ray_plane_intersect(vec3_t *out_intersect_point,vec3_t ray_origin, vec3_t ray_dir,
-                         plane_t plane)
+bool ray_disc_dist(float *out_dist, vec3_t ray_origin, vec3_t ray_dir,
+                   vec3_t center, vec3_t norm, float radius)
 {
-    ray_dir = vec_norm(ray_dir);
-
-    float num   = vec_product(vec_sub(plane.position, ray_origin), plane.norm);
-    float denom = vec_product(ray_dir, plane.norm);
+    float num   = vec_product(vec_sub(center, ray_origin), norm);
+    float denom = vec_product(ray_dir, norm);
 
     float param = num / denom;
 
     if (less_or_eq(param, 0))
         return false;
 
-    *out_intersect_point = vec_add(ray_origin, vec_mul_num(ray_dir, param));
+    vec3_t intersect_point = vec_add(ray_origin, vec_mul_num(ray_dir, param));
+
+    if (more(vec_length(vec_sub(intersect_point, center)), radius))
+        return false;
+
+    *out_dist = param;
+    return true;
+}
+
+bool ray_sphere_intersect(vec3_t *out_intersect_point,vec3_t ray_origin, vec3_t ray_dir,
+                          sphere_t sphere)
+{
+    ray_dir = vec_norm(ray_dir);
+
+    float t = 0;
+    if (!ray_sphere_dist(&t, ray_origin, ray_dir, sphere.position, sphere.radius))
+        return false;
+
+    *out_intersect_point = vec_add(ray_origin, vec_mul_num(ray_dir, t));
+    return true;
+}
+
+bool ray_plane_intersect(vec3_t *out_intersect_point,vec3_t ray_origin, vec3_t ray_dir,
+                         plane_t plane)
+{
+    ray_dir = vec_norm(ray_dir);
 
-    if (more(vec_length(vec_sub(*out_intersect_point, plane.position)), plane.radius))
+    float t = 0;
+    if (!ray_disc_dist(&t, ray_origin, ray_dir, plane.position, plane.norm, plane.radius))
         return false;
 
+    *out_intersect_point = vec_add(ray_origin, vec_mul_num(ray_dir, t));
     return true;
-}
\ No newline at end of file
+}
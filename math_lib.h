@@ -2,6 +2,7 @@
 #define MATH_LIB_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct vec3
 {
@@ -10,6 +11,17 @@ typedef struct vec3
     float z;
 } vec3_t;
 
+/**
+ * Rotation quaternion, w is the real part
+ */
+typedef struct quat
+{
+    float x;
+    float y;
+    float z;
+    float w;
+} quat_t;
+
 /**
  * Adds two vectors
  */
@@ -35,6 +47,12 @@ vec3_t vec_mul_num(vec3_t vec, float num);
  */
 vec3_t vec_norm(vec3_t src_vec);
 
+/**
+ * Normalizes vector by approximate reciprocal square root,
+ * relative error of the length is below 1e-5
+ */
+vec3_t vec_norm_approx(vec3_t src_vec);
+
 /**
  * Returns length of the vector
  */
@@ -50,6 +68,50 @@ vec3_t vec_reflect(vec3_t src_vec, vec3_t norm);
  */
 float vec_product(vec3_t a, vec3_t b);
 
+/**
+ * Calculates cross product
+ */
+vec3_t vec_cross(vec3_t a, vec3_t b);
+
+/**
+ * Gives two unit vectors perpendicular to the unit axis and to each other
+ */
+void vec_basis(vec3_t axis, vec3_t *out_tangent, vec3_t *out_bitangent);
+
+/**
+ * Seed of the point's own random sequence, so anything sampled at the point
+ * gets the same samples whichever way the point is rendered
+ */
+uint32_t random_seed(vec3_t point);
+
+/**
+ * Next number of the sequence, uniform in [0, 1)
+ */
+float random_next(uint32_t *io_state);
+
+/**
+ * Gives quaternion of rotation around axis by angle in radians
+ */
+quat_t quat_axis_angle(vec3_t axis, float angle);
+
+/**
+ * Gives inverse rotation of the unit quaternion
+ */
+quat_t quat_conj(quat_t q);
+
+/**
+ * Rotates vector by unit quaternion
+ */
+vec3_t quat_rotate(quat_t q, vec3_t vec);
+
+extern const float EPS;
+
+/**
+ * Approximates base^exp by polynomials for log2 and exp2
+ * base must be in [0, 1] and exp positive, relative error is about 1e-5 * exp
+ */
+float pow_approx(float base, float exp);
+
 bool less      (float a, float b);
 bool more      (float a, float b);
 bool less_or_eq(float a, float b);
@@ -59,6 +121,22 @@ bool equal     (float a, float b);
 struct sphere;
 struct plane;
 
+/**
+ * Checks intersection of ray and sphere given by center and radius
+ * Ray direction must be normalized
+ * Gives distance to the intersection point if intersects
+ */
+bool ray_sphere_dist(float *out_dist, vec3_t ray_origin, vec3_t ray_dir,
+                     vec3_t center, float radius);
+
+/**
+ * Checks intersection of ray and plane clipped by circle
+ * Ray direction must be normalized
+ * Gives distance to the intersection point if intersects
+ */
+bool ray_disc_dist(float *out_dist, vec3_t ray_origin, vec3_t ray_dir,
+                   vec3_t center, vec3_t norm, float radius);
+
 /**
  * Checks intersection of ray and sphere
  * Gives intersection point if intersects
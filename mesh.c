@@ -0,0 +1,416 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mesh.h"
+
+typedef float   float_packet_t __attribute__((vector_size(TRI_PACKET_WIDTH * sizeof(float))));
+typedef int32_t int_packet_t   __attribute__((vector_size(TRI_PACKET_WIDTH * sizeof(int32_t))));
+
+// OBJ loading
+
+/**
+ * Makes room for at least need elements, growing capacity geometrically
+ */
+static bool reserve(void **buffer, size_t *capacity, size_t need, size_t elem_size)
+{
+    if (need <= *capacity)
+        return true;
+
+    size_t new_capacity = *capacity > 0 ? *capacity : 1024;
+    while (new_capacity < need)
+        new_capacity *= 2;
+
+    void *new_buffer = realloc(*buffer, new_capacity * elem_size);
+    if (!new_buffer)
+        return false;
+
+    *buffer   = new_buffer;
+    *capacity = new_capacity;
+    return true;
+}
+
+/**
+ * Parses vertex reference of a face ("v", "v/vt", "v//vn" or "v/vt/vn")
+ * Gives zero-based vertex index
+ */
+static bool parse_face_vertex(const char **str, size_t vertices_count, uint32_t *out_index)
+{
+    char *end = NULL;
+    long index = strtol(*str, &end, 10);
+
+    if (end == *str)
+        return false;
+
+    // skip texture coordinate and normal indices
+    while (*end != '\0' && *end != ' ' && *end != '\t' && *end != '\r' && *end != '\n')
+        end++;
+
+    *str = end;
+
+    if (index < 0)
+        index += (long)vertices_count;
+    else
+        index -= 1;
+
+    if (index < 0 || (size_t)index >= vertices_count)
+        return false;
+
+    *out_index = (uint32_t)index;
+    return true;
+}
+
+bool mesh_load_obj(mesh_t *mesh, const char *file_name)
+{
+    memset(mesh, 0, sizeof(*mesh));
+
+    FILE *file = fopen(file_name, "r");
+    if (!file)
+        return false;
+
+    size_t vertices_capacity = 0, indices_capacity = 0;
+
+    char  *line      = NULL;
+    size_t line_size = 0;
+    bool   ok        = true;
+
+    while (ok && getline(&line, &line_size, file) != -1)
+    {
+        const char *str = line;
+        while (*str == ' ' || *str == '\t')
+            str++;
+
+        if (str[0] == 'v' && (str[1] == ' ' || str[1] == '\t'))
+        {
+            vec3_t vertex = {0};
+            if (sscanf(str + 2, "%f %f %f", &vertex.x, &vertex.y, &vertex.z) != 3)
+            {
+                ok = false;
+                break;
+            }
+
+            ok = reserve((void **)&mesh->vertices, &vertices_capacity, mesh->vertices_count + 1,
+                         sizeof(vec3_t));
+            if (ok)
+                mesh->vertices[mesh->vertices_count++] = vertex;
+        }
+        else if (str[0] == 'f' && (str[1] == ' ' || str[1] == '\t'))
+        {
+            // triangulate polygon as a fan around its first vertex
+
+            str += 2;
+
+            uint32_t first = 0, prev = 0, curr = 0;
+            size_t   face_vertices = 0;
+
+            while (ok)
+            {
+                while (*str == ' ' || *str == '\t')
+                    str++;
+
+                if (*str == '\0' || *str == '\r' || *str == '\n')
+                    break;
+
+                ok = parse_face_vertex(&str, mesh->vertices_count, &curr);
+                if (!ok)
+                    break;
+
+                if (face_vertices == 0)
+                    first = curr;
+                else if (face_vertices >= 2)
+                {
+                    ok = reserve((void **)&mesh->indices, &indices_capacity,
+                                 3 * (mesh->triangles_count + 1), sizeof(uint32_t));
+                    if (!ok)
+                        break;
+
+                    uint32_t *triangle = &mesh->indices[3 * mesh->triangles_count++];
+                    triangle[0] = first;
+                    triangle[1] = prev;
+                    triangle[2] = curr;
+                }
+
+                prev = curr;
+                face_vertices++;
+            }
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    if (!ok)
+        mesh_destroy(mesh);
+
+    return ok;
+}
+
+void mesh_transform(mesh_t *mesh, float scale, vec3_t offset)
+{
+    for (size_t i = 0; i < mesh->vertices_count; i++)
+        mesh->vertices[i] = vec_add(vec_mul_num(mesh->vertices[i], scale), offset);
+}
+
+// build
+
+static void fill_packet(tri_packet_t *packet, const mesh_t *mesh, const uint32_t *triangles,
+                        size_t count)
+{
+    memset(packet, 0, sizeof(*packet));
+
+    for (size_t lane = 0; lane < count; lane++)
+    {
+        const uint32_t *indices = &mesh->indices[3 * triangles[lane]];
+
+        vec3_t v0 = mesh->vertices[indices[0]];
+        vec3_t e1 = vec_sub(mesh->vertices[indices[1]], v0);
+        vec3_t e2 = vec_sub(mesh->vertices[indices[2]], v0);
+
+        packet->v0_x[lane] = v0.x;
+        packet->v0_y[lane] = v0.y;
+        packet->v0_z[lane] = v0.z;
+
+        packet->e1_x[lane] = e1.x;
+        packet->e1_y[lane] = e1.y;
+        packet->e1_z[lane] = e1.z;
+
+        packet->e2_x[lane] = e2.x;
+        packet->e2_y[lane] = e2.y;
+        packet->e2_z[lane] = e2.z;
+
+        packet->triangle[lane] = triangles[lane];
+    }
+}
+
+bool mesh_build(mesh_t *mesh)
+{
+    aabb_t *triangle_bounds = calloc(mesh->triangles_count > 0 ? mesh->triangles_count : 1,
+                                     sizeof(aabb_t));
+    if (!triangle_bounds)
+        return false;
+
+    for (size_t i = 0; i < mesh->triangles_count; i++)
+    {
+        const uint32_t *indices = &mesh->indices[3 * i];
+
+        aabb_t bounds = aabb_empty();
+        bounds = aabb_grow(bounds, mesh->vertices[indices[0]]);
+        bounds = aabb_grow(bounds, mesh->vertices[indices[1]]);
+        bounds = aabb_grow(bounds, mesh->vertices[indices[2]]);
+
+        triangle_bounds[i] = bounds;
+    }
+
+    bool ok = bvh_build(&mesh->bvh, triangle_bounds, mesh->triangles_count, TRI_PACKET_WIDTH);
+    free(triangle_bounds);
+
+    if (!ok)
+        return false;
+
+    size_t leaves_count = 0;
+    for (size_t i = 0; i < mesh->bvh.nodes_count; i++)
+    {
+        if (mesh->bvh.nodes[i].count > 0)
+            leaves_count++;
+    }
+
+    mesh->packets = calloc(leaves_count > 0 ? leaves_count : 1, sizeof(tri_packet_t));
+    if (!mesh->packets)
+    {
+        bvh_destroy(&mesh->bvh);
+        return false;
+    }
+
+    // each leaf turns into one packet, triangle indices of the hierarchy are not needed anymore
+
+    mesh->packets_count = 0;
+    for (size_t i = 0; i < mesh->bvh.nodes_count; i++)
+    {
+        bvh_node_t *node = &mesh->bvh.nodes[i];
+        if (node->count == 0)
+            continue;
+
+        fill_packet(&mesh->packets[mesh->packets_count], mesh, &mesh->bvh.indices[node->first],
+                    node->count);
+
+        node->first = (uint32_t)mesh->packets_count++;
+    }
+
+    free(mesh->bvh.indices);
+    mesh->bvh.indices       = NULL;
+    mesh->bvh.indices_count = 0;
+
+    return true;
+}
+
+void mesh_destroy(mesh_t *mesh)
+{
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->packets);
+    bvh_destroy(&mesh->bvh);
+
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+aabb_t mesh_bounds(const mesh_t *mesh)
+{
+    if (mesh->bvh.nodes_count > 0)
+        return mesh->bvh.nodes[0].bounds;
+
+    aabb_t bounds = aabb_empty();
+    for (size_t i = 0; i < mesh->vertices_count; i++)
+        bounds = aabb_grow(bounds, mesh->vertices[i]);
+
+    return bounds;
+}
+
+vec3_t mesh_triangle_norm(const mesh_t *mesh, uint32_t triangle)
+{
+    const uint32_t *indices = &mesh->indices[3 * triangle];
+
+    vec3_t v0 = mesh->vertices[indices[0]];
+    vec3_t e1 = vec_sub(mesh->vertices[indices[1]], v0);
+    vec3_t e2 = vec_sub(mesh->vertices[indices[2]], v0);
+
+    return vec_cross(e1, e2);
+}
+
+vec3_t mesh_facing_norm(const mesh_t *mesh, uint32_t triangle, vec3_t ray_dir)
+{
+    vec3_t norm = vec_norm(mesh_triangle_norm(mesh, triangle));
+
+    if (vec_product(norm, ray_dir) > 0.f)
+        norm = vec_mul_num(norm, -1.f);
+
+    return norm;
+}
+
+// ray queries
+
+// packet fields are plain float arrays, so loads must not assume vector alignment
+typedef float_packet_t float_packet_unaligned_t __attribute__((aligned(4), may_alias));
+
+#define LOAD_PACKET(lanes) (*(const float_packet_unaligned_t *)(lanes))
+
+/**
+ * Moller-Trumbore test of the ray against all triangles of the packet at once
+ * Gives mask of lanes hit closer than t_max and their distances
+ */
+static void packet_intersect(const tri_packet_t *packet, vec3_t ray_origin, vec3_t ray_dir,
+                             float t_max, float_packet_t *out_t, int_packet_t *out_mask)
+{
+    float_packet_t e1_x = LOAD_PACKET(packet->e1_x);
+    float_packet_t e1_y = LOAD_PACKET(packet->e1_y);
+    float_packet_t e1_z = LOAD_PACKET(packet->e1_z);
+
+    float_packet_t e2_x = LOAD_PACKET(packet->e2_x);
+    float_packet_t e2_y = LOAD_PACKET(packet->e2_y);
+    float_packet_t e2_z = LOAD_PACKET(packet->e2_z);
+
+    float_packet_t p_x  = ray_dir.y * e2_z - ray_dir.z * e2_y;
+    float_packet_t p_y  = ray_dir.z * e2_x - ray_dir.x * e2_z;
+    float_packet_t p_z  = ray_dir.x * e2_y - ray_dir.y * e2_x;
+
+    float_packet_t det  = e1_x * p_x + e1_y * p_y + e1_z * p_z;
+    float_packet_t inv  = 1.f / det;
+
+    float_packet_t s_x  = ray_origin.x - LOAD_PACKET(packet->v0_x);
+    float_packet_t s_y  = ray_origin.y - LOAD_PACKET(packet->v0_y);
+    float_packet_t s_z  = ray_origin.z - LOAD_PACKET(packet->v0_z);
+
+    float_packet_t u    = (s_x * p_x + s_y * p_y + s_z * p_z) * inv;
+
+    float_packet_t q_x  = s_y * e1_z - s_z * e1_y;
+    float_packet_t q_y  = s_z * e1_x - s_x * e1_z;
+    float_packet_t q_z  = s_x * e1_y - s_y * e1_x;
+
+    float_packet_t v    = (ray_dir.x * q_x + ray_dir.y * q_y + ray_dir.z * q_z) * inv;
+    float_packet_t t    = (e2_x * q_x + e2_y * q_y + e2_z * q_z) * inv;
+
+    *out_t    = t;
+
+    // degenerate (and unused) lanes are rejected by det test whatever the other tests give
+    *out_mask = (det * det > 1e-20f) & (u >= 0.f) & (v >= 0.f) & (u + v <= 1.f) &
+                (t > EPS) & (t < t_max);
+}
+
+typedef struct mesh_query
+{
+    const mesh_t *mesh;
+
+    vec3_t        ray_origin;
+    vec3_t        ray_dir;
+
+    float         dist;
+    uint32_t      triangle;
+    bool          hit;
+} mesh_query_t;
+
+static bool closest_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    mesh_query_t       *query  = ctx;
+    const tri_packet_t *packet = &query->mesh->packets[leaf->first];
+
+    float_packet_t t;
+    int_packet_t   mask;
+    packet_intersect(packet, query->ray_origin, query->ray_dir, *io_t_max, &t, &mask);
+
+    for (size_t lane = 0; lane < TRI_PACKET_WIDTH; lane++)
+    {
+        if (mask[lane] && t[lane] < *io_t_max)
+        {
+            *io_t_max       = t[lane];
+            query->dist     = t[lane];
+            query->triangle = packet->triangle[lane];
+            query->hit      = true;
+        }
+    }
+
+    return false;
+}
+
+static bool any_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    mesh_query_t       *query  = ctx;
+    const tri_packet_t *packet = &query->mesh->packets[leaf->first];
+
+    float_packet_t t;
+    int_packet_t   mask;
+    packet_intersect(packet, query->ray_origin, query->ray_dir, *io_t_max, &t, &mask);
+
+    for (size_t lane = 0; lane < TRI_PACKET_WIDTH; lane++)
+    {
+        if (mask[lane])
+        {
+            query->hit = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool mesh_intersect(const mesh_t *mesh, vec3_t ray_origin, vec3_t ray_dir,
+                    float *io_dist, uint32_t *out_triangle)
+{
+    mesh_query_t query = { mesh, ray_origin, ray_dir, *io_dist, 0, false };
+
+    bvh_traverse(&mesh->bvh, ray_origin, ray_dir, *io_dist, closest_leaf, &query);
+
+    if (!query.hit)
+        return false;
+
+    *io_dist      = query.dist;
+    *out_triangle = query.triangle;
+    return true;
+}
+
+bool mesh_occluded(const mesh_t *mesh, vec3_t ray_origin, vec3_t ray_dir, float max_dist)
+{
+    mesh_query_t query = { mesh, ray_origin, ray_dir, max_dist, 0, false };
+
+    bvh_traverse(&mesh->bvh, ray_origin, ray_dir, max_dist, any_leaf, &query);
+
+    return query.hit;
+}
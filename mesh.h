@@ -0,0 +1,103 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bvh.h"
+#include "math_lib.h"
+
+// triangles tested at once by the intersection kernel
+#define TRI_PACKET_WIDTH 8
+
+/**
+ * Triangles prepared for Moller-Trumbore test in SoA layout
+ * Unused lanes are degenerate triangles which are never hit
+ */
+typedef struct tri_packet
+{
+    float    v0_x[TRI_PACKET_WIDTH];
+    float    v0_y[TRI_PACKET_WIDTH];
+    float    v0_z[TRI_PACKET_WIDTH];
+
+    float    e1_x[TRI_PACKET_WIDTH];
+    float    e1_y[TRI_PACKET_WIDTH];
+    float    e1_z[TRI_PACKET_WIDTH];
+
+    float    e2_x[TRI_PACKET_WIDTH];
+    float    e2_y[TRI_PACKET_WIDTH];
+    float    e2_z[TRI_PACKET_WIDTH];
+
+    uint32_t triangle[TRI_PACKET_WIDTH];
+} tri_packet_t;
+
+/**
+ * Indexed triangle mesh
+ */
+typedef struct mesh
+{
+    vec3_t       *vertices;
+    size_t        vertices_count;
+
+    // three vertex indices per triangle
+    uint32_t     *indices;
+    size_t        triangles_count;
+
+    // index in scene materials
+    uint16_t      material;
+
+    // built by mesh_build()
+    // leaves of the hierarchy refer to packets - leaf first is the packet index
+    tri_packet_t *packets;
+    size_t        packets_count;
+    bvh_t         bvh;
+} mesh_t;
+
+/**
+ * Loads vertices and faces from Wavefront OBJ file
+ * Polygons are triangulated, everything except vertices and faces is ignored
+ * Mesh is not built
+ */
+bool mesh_load_obj(mesh_t *mesh, const char *file_name);
+
+/**
+ * Scales mesh vertices and moves them by offset
+ * Must be called before mesh_build()
+ */
+void mesh_transform(mesh_t *mesh, float scale, vec3_t offset);
+
+/**
+ * Builds hierarchy and triangle packets for ray queries
+ */
+bool mesh_build(mesh_t *mesh);
+
+void mesh_destroy(mesh_t *mesh);
+
+aabb_t mesh_bounds(const mesh_t *mesh);
+
+/**
+ * Geometric normal of the triangle, not normalized
+ */
+vec3_t mesh_triangle_norm(const mesh_t *mesh, uint32_t triangle);
+
+/**
+ * Normalized geometric normal of the triangle turned to the side the ray comes from,
+ * so triangles are two-sided whatever the winding order in the file is
+ */
+vec3_t mesh_facing_norm(const mesh_t *mesh, uint32_t triangle, vec3_t ray_dir);
+
+/**
+ * Finds the nearest triangle hit closer than *io_dist
+ * Ray direction must be normalized
+ * Updates *io_dist and gives the triangle index if hit
+ */
+bool mesh_intersect(const mesh_t *mesh, vec3_t ray_origin, vec3_t ray_dir,
+                    float *io_dist, uint32_t *out_triangle);
+
+/**
+ * Checks if any triangle is hit closer than max_dist
+ * Ray direction must be normalized
+ */
+bool mesh_occluded(const mesh_t *mesh, vec3_t ray_origin, vec3_t ray_dir, float max_dist);
+
+#endif
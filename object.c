@@ -0,0 +1,419 @@
+#include <math.h>
+
+#include "object.h"
+
+size_t object_count(const scene_t *scene)
+{
+    return scene->spheres_count + scene->planes_count + scene->meshes_count +
+           scene->instances_count;
+}
+
+object_ref_t object_by_number(const scene_t *scene, size_t number)
+{
+    if (number < scene->spheres_count)
+        return (object_ref_t){ (uint32_t)number, OBJECT_SPHERE };
+    number -= scene->spheres_count;
+
+    if (number < scene->planes_count)
+        return (object_ref_t){ (uint32_t)number, OBJECT_PLANE };
+    number -= scene->planes_count;
+
+    if (number < scene->meshes_count)
+        return (object_ref_t){ (uint32_t)number, OBJECT_MESH };
+    number -= scene->meshes_count;
+
+    return (object_ref_t){ (uint32_t)number, OBJECT_INSTANCE };
+}
+
+// bounds
+
+static aabb_t sphere_bounds(vec3_t center, float radius)
+{
+    vec3_t extent = { radius, radius, radius };
+
+    return (aabb_t){ vec_sub(center, extent), vec_add(center, extent) };
+}
+
+/**
+ * Extent of the disc along axis i is radius * sqrt(1 - norm_i^2)
+ */
+static aabb_t disc_bounds(vec3_t center, vec3_t norm, float radius)
+{
+    norm = vec_norm(norm);
+
+    vec3_t extent = { radius * sqrtf(fmaxf(1.f - norm.x * norm.x, 0.f)),
+                      radius * sqrtf(fmaxf(1.f - norm.y * norm.y, 0.f)),
+                      radius * sqrtf(fmaxf(1.f - norm.z * norm.z, 0.f)) };
+
+    return (aabb_t){ vec_sub(center, extent), vec_add(center, extent) };
+}
+
+static aabb_t prototype_bounds(const prototype_t *prototype)
+{
+    switch (prototype->kind)
+    {
+    case PROTOTYPE_SPHERE:
+        return sphere_bounds((vec3_t){0}, prototype->radius);
+
+    case PROTOTYPE_DISC:
+        return disc_bounds((vec3_t){0}, prototype->norm, prototype->radius);
+
+    case PROTOTYPE_MESH:
+        return mesh_bounds(prototype->mesh);
+
+    case PROTOTYPE_PARTICLES:
+        return particles_bounds(prototype->particles);
+
+    case PROTOTYPE_STREAM:
+        return particle_stream_bounds(prototype->stream);
+    }
+
+    return aabb_empty();
+}
+
+static vec3_t instance_to_world(const instance_t *instance, vec3_t point)
+{
+    return vec_add(quat_rotate(instance->rotation, vec_mul_num(point, instance->scale)),
+                   instance->position);
+}
+
+static aabb_t instance_bounds(const scene_t *scene, const instance_t *instance)
+{
+    aabb_t local  = prototype_bounds(&scene->prototypes[instance->prototype]);
+    aabb_t bounds = aabb_empty();
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vec3_t point = { corner & 1 ? local.max.x : local.min.x,
+                         corner & 2 ? local.max.y : local.min.y,
+                         corner & 4 ? local.max.z : local.min.z };
+
+        bounds = aabb_grow(bounds, instance_to_world(instance, point));
+    }
+
+    return bounds;
+}
+
+aabb_t object_bounds(const scene_t *scene, object_ref_t object)
+{
+    switch (object.kind)
+    {
+    case OBJECT_SPHERE:
+        return sphere_bounds(scene->spheres[object.index].position,
+                             scene->spheres[object.index].radius);
+
+    case OBJECT_PLANE:
+        return disc_bounds(scene->planes[object.index].position, scene->planes[object.index].norm,
+                           scene->planes[object.index].radius);
+
+    case OBJECT_MESH:
+        return mesh_bounds(&scene->meshes[object.index]);
+
+    case OBJECT_INSTANCE:
+        return instance_bounds(scene, &scene->instances[object.index]);
+    }
+
+    return aabb_empty();
+}
+
+bool object_screen_rect(const scene_t *scene, object_ref_t object, screen_rect_t *out_rect)
+{
+    const camera_t *camera = &scene->camera;
+
+    if (object.kind == OBJECT_SPHERE)
+    {
+        const sphere_t *sphere = &scene->spheres[object.index];
+        return camera_sphere_rect(camera, sphere->position, sphere->radius, out_rect);
+    }
+
+    if (object.kind == OBJECT_INSTANCE)
+    {
+        const instance_t  *instance  = &scene->instances[object.index];
+        const prototype_t *prototype = &scene->prototypes[instance->prototype];
+
+        if (prototype->kind == PROTOTYPE_SPHERE)
+            return camera_sphere_rect(camera, instance->position,
+                                      prototype->radius * instance->scale, out_rect);
+    }
+
+    aabb_t bounds = object_bounds(scene, object);
+    return camera_box_rect(camera, bounds.min, bounds.max, out_rect);
+}
+
+bool object_casts_shadow(const scene_t *scene, object_ref_t object)
+{
+    if (object.kind == OBJECT_PLANE)
+        return false;
+
+    if (object.kind == OBJECT_INSTANCE)
+    {
+        const instance_t *instance = &scene->instances[object.index];
+        return scene->prototypes[instance->prototype].kind != PROTOTYPE_DISC;
+    }
+
+    return true;
+}
+
+// ray queries
+
+/**
+ * Ray in the coordinate system of the instance prototype
+ * Direction stays normalized, so distances are divided by scale
+ */
+static void ray_to_instance(const instance_t *instance, vec3_t *io_origin, vec3_t *io_dir)
+{
+    quat_t inv_rotation = quat_conj(instance->rotation);
+
+    *io_origin = vec_mul_num(quat_rotate(inv_rotation, vec_sub(*io_origin, instance->position)),
+                             1.f / instance->scale);
+    *io_dir    = quat_rotate(inv_rotation, *io_dir);
+}
+
+static bool prototype_intersect(const prototype_t *prototype, vec3_t ray_origin, vec3_t ray_dir,
+                                float *io_dist, uint32_t *out_prim)
+{
+    float dist = 0.f;
+
+    switch (prototype->kind)
+    {
+    case PROTOTYPE_SPHERE:
+        if (!ray_sphere_dist(&dist, ray_origin, ray_dir, (vec3_t){0}, prototype->radius) ||
+            dist >= *io_dist)
+            return false;
+
+        *io_dist  = dist;
+        *out_prim = 0;
+        return true;
+
+    case PROTOTYPE_DISC:
+        if (!ray_disc_dist(&dist, ray_origin, ray_dir, (vec3_t){0}, prototype->norm,
+                           prototype->radius) || dist >= *io_dist)
+            return false;
+
+        *io_dist  = dist;
+        *out_prim = 0;
+        return true;
+
+    case PROTOTYPE_MESH:
+        return mesh_intersect(prototype->mesh, ray_origin, ray_dir, io_dist, out_prim);
+
+    case PROTOTYPE_PARTICLES:
+        return particles_intersect(prototype->particles, ray_origin, ray_dir, io_dist, out_prim);
+
+    case PROTOTYPE_STREAM:
+        return particle_stream_intersect(prototype->stream, ray_origin, ray_dir, io_dist,
+                                         out_prim);
+    }
+
+    return false;
+}
+
+bool object_intersect(const scene_t *scene, object_ref_t object, vec3_t ray_origin, vec3_t ray_dir,
+                      float *io_dist, uint32_t *out_prim)
+{
+    float dist = 0.f;
+
+    switch (object.kind)
+    {
+    case OBJECT_SPHERE:
+    {
+        const sphere_t *sphere = &scene->spheres[object.index];
+
+        if (!ray_sphere_dist(&dist, ray_origin, ray_dir, sphere->position, sphere->radius) ||
+            dist >= *io_dist)
+            return false;
+
+        *io_dist  = dist;
+        *out_prim = 0;
+        return true;
+    }
+
+    case OBJECT_PLANE:
+    {
+        const plane_t *plane = &scene->planes[object.index];
+
+        if (!ray_disc_dist(&dist, ray_origin, ray_dir, plane->position, plane->norm,
+                           plane->radius) || dist >= *io_dist)
+            return false;
+
+        *io_dist  = dist;
+        *out_prim = 0;
+        return true;
+    }
+
+    case OBJECT_MESH:
+        return mesh_intersect(&scene->meshes[object.index], ray_origin, ray_dir, io_dist, out_prim);
+
+    case OBJECT_INSTANCE:
+    {
+        const instance_t *instance = &scene->instances[object.index];
+
+        ray_to_instance(instance, &ray_origin, &ray_dir);
+
+        dist = *io_dist / instance->scale;
+        if (!prototype_intersect(&scene->prototypes[instance->prototype], ray_origin, ray_dir,
+                                 &dist, out_prim))
+            return false;
+
+        *io_dist = dist * instance->scale;
+        return true;
+    }
+    }
+
+    return false;
+}
+
+bool object_prefetch(const scene_t *scene, object_ref_t object, vec3_t ray_origin,
+                     vec3_t ray_dir, float max_dist)
+{
+    if (object.kind != OBJECT_INSTANCE)
+        return false;
+
+    const instance_t  *instance  = &scene->instances[object.index];
+    const prototype_t *prototype = &scene->prototypes[instance->prototype];
+
+    if (prototype->kind != PROTOTYPE_STREAM)
+        return false;
+
+    ray_to_instance(instance, &ray_origin, &ray_dir);
+    return particle_stream_prefetch(prototype->stream, ray_origin, ray_dir,
+                                    max_dist / instance->scale);
+}
+
+void object_wait(const scene_t *scene, object_ref_t object)
+{
+    if (object.kind != OBJECT_INSTANCE)
+        return;
+
+    const prototype_t *prototype = &scene->prototypes[scene->instances[object.index].prototype];
+
+    if (prototype->kind == PROTOTYPE_STREAM)
+        particle_stream_wait(prototype->stream);
+}
+
+bool object_occluded(const scene_t *scene, object_ref_t object, vec3_t ray_origin, vec3_t ray_dir,
+                     float max_dist)
+{
+    if (object.kind == OBJECT_MESH)
+        return mesh_occluded(&scene->meshes[object.index], ray_origin, ray_dir, max_dist);
+
+    if (object.kind == OBJECT_INSTANCE)
+    {
+        const instance_t  *instance  = &scene->instances[object.index];
+        const prototype_t *prototype = &scene->prototypes[instance->prototype];
+
+        if (prototype->kind == PROTOTYPE_MESH)
+        {
+            ray_to_instance(instance, &ray_origin, &ray_dir);
+            return mesh_occluded(prototype->mesh, ray_origin, ray_dir, max_dist / instance->scale);
+        }
+
+        if (prototype->kind == PROTOTYPE_PARTICLES)
+        {
+            ray_to_instance(instance, &ray_origin, &ray_dir);
+            return particles_occluded(prototype->particles, ray_origin, ray_dir,
+                                      max_dist / instance->scale);
+        }
+
+        if (prototype->kind == PROTOTYPE_STREAM)
+        {
+            ray_to_instance(instance, &ray_origin, &ray_dir);
+            return particle_stream_occluded(prototype->stream, ray_origin, ray_dir,
+                                            max_dist / instance->scale);
+        }
+    }
+
+    // same tolerance as the old shadow test
+    float    dist = max_dist + EPS;
+    uint32_t prim = 0;
+
+    return object_intersect(scene, object, ray_origin, ray_dir, &dist, &prim);
+}
+
+void object_surface(const scene_t *scene, const hit_t *hit, vec3_t ray_origin, vec3_t ray_dir,
+                    vec3_t *out_pos, vec3_t *out_norm, const material_t **out_mat)
+{
+    vec3_t pos = vec_add(ray_origin, vec_mul_num(ray_dir, hit->dist));
+    *out_pos = pos;
+
+    switch (hit->object.kind)
+    {
+    case OBJECT_SPHERE:
+    {
+        const sphere_t *sphere = &scene->spheres[hit->object.index];
+
+        *out_norm = vec_norm(vec_sub(pos, sphere->position));
+        *out_mat  = &scene->materials[scene->sphere_materials[hit->object.index]];
+        return;
+    }
+
+    case OBJECT_PLANE:
+    {
+        const plane_t *plane = &scene->planes[hit->object.index];
+
+        *out_norm = vec_norm(plane->norm);
+        *out_mat  = &scene->materials[plane->material];
+        return;
+    }
+
+    case OBJECT_MESH:
+    {
+        const mesh_t *mesh = &scene->meshes[hit->object.index];
+
+        *out_norm = mesh_facing_norm(mesh, hit->prim, ray_dir);
+        *out_mat  = &scene->materials[mesh->material];
+        return;
+    }
+
+    case OBJECT_INSTANCE:
+    {
+        const instance_t  *instance  = &scene->instances[hit->object.index];
+        const prototype_t *prototype = &scene->prototypes[instance->prototype];
+
+        vec3_t local_dir = quat_rotate(quat_conj(instance->rotation), ray_dir);
+        vec3_t local_pos = vec_mul_num(quat_rotate(quat_conj(instance->rotation),
+                                                   vec_sub(pos, instance->position)),
+                                       1.f / instance->scale);
+        vec3_t   local_norm = {0};
+        uint16_t material   = instance->material;
+
+        switch (prototype->kind)
+        {
+        case PROTOTYPE_SPHERE:
+            local_norm = local_pos;
+            break;
+
+        case PROTOTYPE_DISC:
+            local_norm = prototype->norm;
+            break;
+
+        case PROTOTYPE_MESH:
+            local_norm = mesh_facing_norm(prototype->mesh, hit->prim, local_dir);
+            break;
+
+        case PROTOTYPE_PARTICLES:
+        {
+            particle_t particle = particles_get(prototype->particles, hit->prim);
+
+            local_norm = vec_sub(local_pos, particle.position);
+            material   = particle.material;
+            break;
+        }
+
+        case PROTOTYPE_STREAM:
+        {
+            particle_t particle = particle_stream_get(prototype->stream, hit->prim);
+
+            local_norm = vec_sub(local_pos, particle.position);
+            material   = particle.material;
+            break;
+        }
+        }
+
+        // scale is uniform, so rotation alone carries normals
+        *out_norm = vec_norm(quat_rotate(instance->rotation, local_norm));
+        *out_mat  = &scene->materials[material];
+        return;
+    }
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdint.h>
+
+#include "bvh.h"
+#include "rt.h"
+
+/**
+ * Anything which can be placed at the top level of the scene
+ */
+typedef enum object_kind
+{
+    OBJECT_SPHERE,
+    OBJECT_PLANE,
+    OBJECT_MESH,
+    OBJECT_INSTANCE,
+} object_kind_t;
+
+typedef struct object_ref
+{
+    uint32_t index;
+    uint32_t kind;
+} object_ref_t;
+
+typedef struct hit
+{
+    float        dist;
+    object_ref_t object;
+    // triangle of the mesh, if the object is mesh or mesh instance
+    uint32_t     prim;
+} hit_t;
+
+/**
+ * Total number of top level objects in the scene
+ */
+size_t object_count(const scene_t *scene);
+
+/**
+ * Gives reference to the object by its position in the list of all objects
+ * (spheres, planes, meshes, instances)
+ */
+object_ref_t object_by_number(const scene_t *scene, size_t number);
+
+/**
+ * Bounding box in world space
+ */
+aabb_t object_bounds(const scene_t *scene, object_ref_t object);
+
+/**
+ * Gives bounds of the object projection on the camera frame
+ * Exact for spheres and sphere instances, projected bounding box for the rest
+ * Returns false if the object is behind the camera
+ */
+bool object_screen_rect(const scene_t *scene, object_ref_t object, screen_rect_t *out_rect);
+
+/**
+ * Discs don't cast shadows
+ */
+bool object_casts_shadow(const scene_t *scene, object_ref_t object);
+
+/**
+ * Checks if the ray hits the object closer than *io_dist
+ * Ray direction must be normalized
+ * Updates *io_dist and gives hit primitive if hit
+ */
+bool object_intersect(const scene_t *scene, object_ref_t object, vec3_t ray_origin, vec3_t ray_dir,
+                      float *io_dist, uint32_t *out_prim);
+
+/**
+ * Checks if the ray hits the object closer than max_dist
+ * Ray direction must be normalized
+ */
+bool object_occluded(const scene_t *scene, object_ref_t object, vec3_t ray_origin, vec3_t ray_dir,
+                     float max_dist);
+
+/**
+ * Asks for the streamed geometry of the object the ray reaches closer than max_dist,
+ * returns true if the ray has to wait for some, false for other objects
+ */
+bool object_prefetch(const scene_t *scene, object_ref_t object, vec3_t ray_origin,
+                     vec3_t ray_dir, float max_dist);
+
+/**
+ * Waits until more streamed geometry of the object comes to memory,
+ * returns right away for other objects or if none is being read
+ */
+void object_wait(const scene_t *scene, object_ref_t object);
+
+/**
+ * Gives position, normal and material at the hit point of the ray
+ */
+void object_surface(const scene_t *scene, const hit_t *hit, vec3_t ray_origin, vec3_t ray_dir,
+                    vec3_t *out_pos, vec3_t *out_norm, const material_t **out_mat);
+
+#endif
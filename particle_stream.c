@@ -0,0 +1,910 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "particle_stream.h"
+
+// bump when the file layout or the particle format change
+static const uint64_t STREAM_VERSION  = 2;
+static const char     STREAM_MAGIC[8] = "rtcloud";
+// chunks and their sections start at cache lines
+static const size_t   STREAM_ALIGN    = 64;
+
+// no chunk, end of the LRU list
+static const size_t   STREAM_NONE     = SIZE_MAX;
+
+// decoded hits kept for shading, as many as rays of a wavefront batch
+static const size_t   STREAM_HITS     = 1 << 16;
+// slot of the hits which holds no particle
+static const uint32_t STREAM_NO_HIT   = UINT32_MAX;
+
+typedef struct stream_header
+{
+    char     magic[8];
+    uint64_t version;
+
+    // layout of the chunk data depends on these
+    uint64_t particle_size;
+    uint64_t cluster_size;
+    uint64_t node_size;
+    uint64_t cluster_particles;
+
+    // particles refer to materials of the scene the file was written for
+    uint64_t materials_count;
+
+    uint64_t chunks_count;
+} stream_header_t;
+
+/**
+ * Chunk as it is described in the file, right after the header
+ */
+typedef struct stream_record
+{
+    aabb_t   bounds;
+    uint64_t offset;
+
+    uint64_t count;
+    uint64_t clusters_count;
+    uint64_t nodes_count;
+
+    float    log_min;
+    float    log_step;
+} stream_record_t;
+
+/**
+ * Offsets of packed particles, clusters and nodes in the chunk data, and its size
+ */
+typedef struct chunk_layout
+{
+    size_t packed;
+    size_t clusters;
+    size_t nodes;
+    size_t size;
+} chunk_layout_t;
+
+static size_t align_up(size_t offset)
+{
+    return (offset + STREAM_ALIGN - 1) / STREAM_ALIGN * STREAM_ALIGN;
+}
+
+static chunk_layout_t chunk_layout(size_t count, size_t clusters_count, size_t nodes_count)
+{
+    chunk_layout_t layout;
+
+    layout.packed   = 0;
+    layout.clusters = align_up(count * sizeof(packed_particle_t));
+    layout.nodes    = align_up(layout.clusters + clusters_count * sizeof(particle_cluster_t));
+    layout.size     = layout.nodes + nodes_count * sizeof(bvh_node_t);
+
+    return layout;
+}
+
+// writing
+
+/**
+ * Pads the file up to the offset and writes the section there
+ */
+static bool write_section(FILE *file, size_t offset, const void *data, size_t size)
+{
+    long position = ftell(file);
+    if (position < 0)
+        return false;
+
+    for (size_t i = (size_t)position; i < offset; i++)
+    {
+        if (fputc(0, file) == EOF)
+            return false;
+    }
+
+    return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+/**
+ * Packs the particles of one leaf of the split hierarchy and writes them at the offset
+ */
+static bool write_chunk(FILE *file, stream_record_t *record, size_t offset,
+                        const particle_t *source, const uint32_t *indices, size_t count,
+                        particle_t *scratch)
+{
+    for (size_t i = 0; i < count; i++)
+        scratch[i] = source[indices[i]];
+
+    particles_t particles;
+    if (!particles_build(&particles, scratch, count))
+        return false;
+
+    chunk_layout_t layout = chunk_layout(particles.count, particles.clusters_count,
+                                         particles.bvh.nodes_count);
+
+    record->bounds         = particles_bounds(&particles);
+    record->offset         = offset;
+    record->count          = particles.count;
+    record->clusters_count = particles.clusters_count;
+    record->nodes_count    = particles.bvh.nodes_count;
+    record->log_min        = particles.log_min;
+    record->log_step       = particles.log_step;
+
+    bool ok = write_section(file, offset + layout.packed, particles.packed,
+                            particles.count * sizeof(packed_particle_t)) &&
+              write_section(file, offset + layout.clusters, particles.clusters,
+                            particles.clusters_count * sizeof(particle_cluster_t)) &&
+              write_section(file, offset + layout.nodes, particles.bvh.nodes,
+                            particles.bvh.nodes_count * sizeof(bvh_node_t));
+
+    particles_destroy(&particles);
+    return ok;
+}
+
+bool particle_stream_write(const char *path, const particle_t *particles, size_t count,
+                           size_t chunk_size, size_t materials_count)
+{
+    aabb_t *bounds = calloc(count > 0 ? count : 1, sizeof(aabb_t));
+    if (!bounds)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        vec3_t radius = { particles[i].radius, particles[i].radius, particles[i].radius };
+
+        bounds[i] = (aabb_t){ vec_sub(particles[i].position, radius),
+                              vec_add(particles[i].position, radius) };
+    }
+
+    // chunks are the leaves of the split hierarchy
+    bvh_t split = {0};
+
+    bool ok = bvh_build(&split, bounds, count, chunk_size > 0 ? chunk_size : 1);
+    free(bounds);
+
+    if (!ok)
+        return false;
+
+    size_t chunks_count = 0;
+    size_t largest      = 1;
+
+    for (size_t i = 0; i < split.nodes_count; i++)
+    {
+        if (split.nodes[i].count > 0)
+        {
+            chunks_count++;
+            largest = split.nodes[i].count > largest ? split.nodes[i].count : largest;
+        }
+    }
+
+    stream_record_t *records = calloc(chunks_count > 0 ? chunks_count : 1,
+                                      sizeof(stream_record_t));
+    particle_t      *scratch = calloc(largest, sizeof(particle_t));
+    FILE            *file    = fopen(path, "wb");
+
+    ok = records && scratch && file;
+
+    size_t offset = align_up(sizeof(stream_header_t) + chunks_count * sizeof(stream_record_t));
+    size_t chunk  = 0;
+
+    for (size_t i = 0; ok && i < split.nodes_count; i++)
+    {
+        const bvh_node_t *node = &split.nodes[i];
+        if (node->count == 0)
+            continue;
+
+        stream_record_t *record = &records[chunk++];
+
+        ok = write_chunk(file, record, offset, particles, &split.indices[node->first], node->count,
+                         scratch);
+
+        offset = align_up(offset + chunk_layout(record->count, record->clusters_count,
+                                                record->nodes_count).size);
+    }
+
+    // header and records go first, now that the chunks are known
+    if (ok)
+    {
+        stream_header_t header = {0};
+
+        memcpy(header.magic, STREAM_MAGIC, sizeof(header.magic));
+        header.version           = STREAM_VERSION;
+        header.particle_size     = sizeof(packed_particle_t);
+        header.cluster_size      = sizeof(particle_cluster_t);
+        header.node_size         = sizeof(bvh_node_t);
+        header.cluster_particles = PARTICLE_CLUSTER_SIZE;
+        header.materials_count   = materials_count;
+        header.chunks_count      = chunks_count;
+
+        ok = fseek(file, 0, SEEK_SET) == 0 &&
+             fwrite(&header, sizeof(header), 1, file) == 1 &&
+             (chunks_count == 0 ||
+              fwrite(records, sizeof(stream_record_t), chunks_count, file) == chunks_count);
+    }
+
+    if (file && fclose(file) != 0)
+        ok = false;
+
+    if (!ok && file)
+        remove(path);
+
+    free(records);
+    free(scratch);
+    bvh_destroy(&split);
+    return ok;
+}
+
+// cache, the lock is held by the callers
+
+static void lru_unlink(particle_stream_t *stream, size_t index)
+{
+    stream_chunk_t *chunk = &stream->chunks[index];
+
+    if (chunk->lru_prev != STREAM_NONE)
+        stream->chunks[chunk->lru_prev].lru_next = chunk->lru_next;
+    else
+        stream->lru_first = chunk->lru_next;
+
+    if (chunk->lru_next != STREAM_NONE)
+        stream->chunks[chunk->lru_next].lru_prev = chunk->lru_prev;
+    else
+        stream->lru_last = chunk->lru_prev;
+
+    chunk->lru_prev = STREAM_NONE;
+    chunk->lru_next = STREAM_NONE;
+}
+
+static void lru_push_first(particle_stream_t *stream, size_t index)
+{
+    stream_chunk_t *chunk = &stream->chunks[index];
+
+    chunk->lru_prev = STREAM_NONE;
+    chunk->lru_next = stream->lru_first;
+
+    if (stream->lru_first != STREAM_NONE)
+        stream->chunks[stream->lru_first].lru_prev = index;
+    else
+        stream->lru_last = index;
+
+    stream->lru_first = index;
+}
+
+/**
+ * Frees least recently used chunks nobody traces until size more bytes fit in the budget
+ */
+static void evict(particle_stream_t *stream, size_t size)
+{
+    size_t index = stream->lru_last;
+
+    while (index != STREAM_NONE && stream->stats.resident_bytes + size > stream->budget)
+    {
+        stream_chunk_t *chunk = &stream->chunks[index];
+        size_t          prev  = chunk->lru_prev;
+
+        if (chunk->pins == 0)
+        {
+            lru_unlink(stream, index);
+
+            free(chunk->data);
+            chunk->data                = NULL;
+            chunk->particles.packed    = NULL;
+            chunk->particles.clusters  = NULL;
+            chunk->particles.bvh.nodes = NULL;
+
+            stream->stats.resident_bytes -= chunk->size;
+            stream->stats.resident_chunks--;
+            stream->stats.evictions++;
+        }
+
+        index = prev;
+    }
+}
+
+/**
+ * Chunk which rays can trace right away
+ */
+static bool chunk_ready(const stream_chunk_t *chunk)
+{
+    return chunk->data || chunk->broken;
+}
+
+/**
+ * Checks that clusters and nodes of the chunk read from the file refer to its own data
+ * and particles to materials of the scene
+ */
+static bool chunk_valid(const particles_t *particles, size_t materials_count)
+{
+    for (size_t i = 0; i < particles->count; i++)
+    {
+        if (particles->packed[i].material >= materials_count)
+            return false;
+    }
+
+    for (size_t i = 0; i < particles->clusters_count; i++)
+    {
+        const particle_cluster_t *cluster = &particles->clusters[i];
+
+        if (cluster->count == 0 || cluster->count > PARTICLE_CLUSTER_SIZE ||
+            (size_t)cluster->first + cluster->count > particles->count)
+            return false;
+    }
+
+    const bvh_t *bvh = &particles->bvh;
+
+    for (size_t i = 0; i < bvh->nodes_count; i++)
+    {
+        const bvh_node_t *node = &bvh->nodes[i];
+
+        // children after the parent, so traversal can't loop
+        if (node->count == 0 && (node->first <= i || (size_t)node->first + 1 >= bvh->nodes_count))
+            return false;
+
+        if (node->count > 0 && node->first >= particles->clusters_count)
+            return false;
+    }
+
+    return bvh_depth_valid(bvh);
+}
+
+/**
+ * Reads the chunk data, the lock is not held
+ * Gives NULL if it can't be read
+ */
+static void *chunk_read(const particle_stream_t *stream, const stream_chunk_t *chunk)
+{
+    char *data = malloc(chunk->size > 0 ? chunk->size : 1);
+    if (!data)
+        return NULL;
+
+    size_t done = 0;
+
+    while (done < chunk->size)
+    {
+        ssize_t got = pread(stream->fd, data + done, chunk->size - done,
+                            (off_t)(chunk->offset + done));
+        if (got <= 0)
+        {
+            free(data);
+            return NULL;
+        }
+
+        done += (size_t)got;
+    }
+
+    return data;
+}
+
+/**
+ * Puts the read data in the cache, chunk which can't be read or is broken is left out
+ */
+static void chunk_install(particle_stream_t *stream, size_t index, void *data)
+{
+    stream_chunk_t *chunk     = &stream->chunks[index];
+    particles_t    *particles = &chunk->particles;
+
+    chunk_layout_t layout = chunk_layout(particles->count, particles->clusters_count,
+                                         particles->bvh.nodes_count);
+
+    if (data)
+    {
+        particles->packed    = (packed_particle_t  *)((char *)data + layout.packed);
+        particles->clusters  = (particle_cluster_t *)((char *)data + layout.clusters);
+        particles->bvh.nodes = (bvh_node_t         *)((char *)data + layout.nodes);
+    }
+
+    chunk->loading = false;
+
+    if (!data || !chunk_valid(particles, stream->materials_count))
+    {
+        fprintf(stderr, "Can't read particle chunk %zu\n", index);
+        free(data);
+
+        chunk->broken              = true;
+        particles->count           = 0;
+        particles->clusters_count  = 0;
+        particles->bvh.nodes_count = 0;
+        particles->packed          = NULL;
+        particles->clusters        = NULL;
+        particles->bvh.nodes       = NULL;
+
+        pthread_cond_broadcast(&stream->loaded);
+        return;
+    }
+
+    evict(stream, chunk->size);
+
+    chunk->data = data;
+
+    lru_push_first(stream, index);
+
+    stream->stats.resident_bytes += chunk->size;
+    stream->stats.resident_chunks++;
+
+    pthread_cond_broadcast(&stream->loaded);
+}
+
+/**
+ * Gives the chunk pinned in memory, reads it or waits for the loader first if it isn't there
+ */
+static const particles_t *chunk_acquire(particle_stream_t *stream, size_t index)
+{
+    stream_chunk_t *chunk = &stream->chunks[index];
+
+    pthread_mutex_lock(&stream->lock);
+
+    if (!chunk_ready(chunk))
+        stream->stats.stalls++;
+
+    while (!chunk_ready(chunk))
+    {
+        if (chunk->loading)
+        {
+            pthread_cond_wait(&stream->loaded, &stream->lock);
+            continue;
+        }
+
+        // queued chunk is read right away, the loader skips it then
+        chunk->loading = true;
+
+        pthread_mutex_unlock(&stream->lock);
+        void *data = chunk_read(stream, chunk);
+        pthread_mutex_lock(&stream->lock);
+
+        chunk_install(stream, index, data);
+    }
+
+    if (chunk->data)
+    {
+        chunk->pins++;
+
+        lru_unlink(stream, index);
+        lru_push_first(stream, index);
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+    return &chunk->particles;
+}
+
+static void chunk_release(particle_stream_t *stream, size_t index)
+{
+    pthread_mutex_lock(&stream->lock);
+
+    if (stream->chunks[index].data)
+        stream->chunks[index].pins--;
+
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static void *loader(void *arg)
+{
+    particle_stream_t *stream = arg;
+
+    pthread_mutex_lock(&stream->lock);
+
+    while (true)
+    {
+        while (!stream->quit && stream->queue_count == 0)
+            pthread_cond_wait(&stream->request, &stream->lock);
+
+        if (stream->quit)
+            break;
+
+        size_t index = stream->queue[stream->queue_head];
+
+        stream_chunk_t *chunk = &stream->chunks[index];
+
+        stream->queue_head = (stream->queue_head + 1) % stream->chunks_count;
+        stream->queue_count--;
+        stream->queue_bytes -= chunk->size;
+
+        chunk->requested = false;
+
+        // a ray may have read it already, the tracer waiting for it is woken anyway
+        if (chunk_ready(chunk) || chunk->loading)
+        {
+            pthread_cond_broadcast(&stream->loaded);
+            continue;
+        }
+
+        chunk->loading  = true;
+        stream->reading = true;
+
+        pthread_mutex_unlock(&stream->lock);
+        void *data = chunk_read(stream, chunk);
+        pthread_mutex_lock(&stream->lock);
+
+        stream->reading = false;
+
+        chunk_install(stream, index, data);
+        stream->stats.prefetched++;
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+// opening
+
+static bool header_valid(const stream_header_t *header, size_t materials_count)
+{
+    return memcmp(header->magic, STREAM_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version           == STREAM_VERSION &&
+           header->particle_size     == sizeof(packed_particle_t) &&
+           header->cluster_size      == sizeof(particle_cluster_t) &&
+           header->node_size         == sizeof(bvh_node_t) &&
+           header->cluster_particles == PARTICLE_CLUSTER_SIZE &&
+           header->materials_count   == materials_count;
+}
+
+/**
+ * Fills chunks from the records, counts are checked against the file size first,
+ * so the layout can't overflow
+ */
+static bool read_chunks(particle_stream_t *stream, const stream_record_t *records, size_t size)
+{
+    size_t first = 0;
+
+    for (size_t i = 0; i < stream->chunks_count; i++)
+    {
+        const stream_record_t *record = &records[i];
+        stream_chunk_t        *chunk  = &stream->chunks[i];
+
+        if (record->count          > size / sizeof(packed_particle_t) ||
+            record->clusters_count > size / sizeof(particle_cluster_t) ||
+            record->nodes_count    > size / sizeof(bvh_node_t))
+            return false;
+
+        chunk_layout_t layout = chunk_layout(record->count, record->clusters_count,
+                                             record->nodes_count);
+
+        if (record->offset > size || layout.size > size - record->offset)
+            return false;
+
+        chunk->bounds   = record->bounds;
+        chunk->offset   = record->offset;
+        chunk->size     = layout.size;
+        chunk->first    = (uint32_t)first;
+        chunk->lru_prev = STREAM_NONE;
+        chunk->lru_next = STREAM_NONE;
+
+        chunk->particles.count           = record->count;
+        chunk->particles.clusters_count  = record->clusters_count;
+        chunk->particles.bvh.nodes_count = record->nodes_count;
+        chunk->particles.log_min         = record->log_min;
+        chunk->particles.log_step        = record->log_step;
+
+        // hit indices must fit in 32 bits
+        first += record->clusters_count * PARTICLE_CLUSTER_SIZE;
+        if (first > UINT32_MAX)
+            return false;
+    }
+
+    stream->indices_count = first;
+    return true;
+}
+
+/**
+ * Frees the stream once its loader is stopped or didn't start
+ */
+static void stream_free(particle_stream_t *stream)
+{
+    for (size_t i = 0; i < stream->chunks_count; i++)
+        free(stream->chunks[i].data);
+
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->request);
+    pthread_cond_destroy(&stream->loaded);
+
+    close(stream->fd);
+    free(stream->chunks);
+    free(stream->queue);
+    free(stream->hits);
+    bvh_destroy(&stream->bvh);
+
+    memset(stream, 0, sizeof(*stream));
+}
+
+bool particle_stream_open(particle_stream_t *stream, const char *path, size_t budget,
+                          size_t materials_count)
+{
+    memset(stream, 0, sizeof(*stream));
+
+    stream->fd = open(path, O_RDONLY);
+    if (stream->fd < 0)
+        return false;
+
+    struct stat     st;
+    stream_header_t header = {0};
+
+    bool ok = fstat(stream->fd, &st) == 0 &&
+              pread(stream->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+              header_valid(&header, materials_count) &&
+              header.chunks_count <= (size_t)st.st_size / sizeof(stream_record_t);
+
+    size_t           chunks_count = ok ? header.chunks_count : 0;
+    size_t           records_size = chunks_count * sizeof(stream_record_t);
+    stream_record_t *records      = ok ? malloc(records_size > 0 ? records_size : 1) : NULL;
+
+    stream->chunks          = ok ? calloc(chunks_count > 0 ? chunks_count : 1,
+                                          sizeof(stream_chunk_t)) : NULL;
+    stream->queue           = ok ? calloc(chunks_count > 0 ? chunks_count : 1,
+                                          sizeof(size_t)) : NULL;
+    stream->hits            = ok ? calloc(STREAM_HITS, sizeof(stream_hit_t)) : NULL;
+    stream->chunks_count    = chunks_count;
+    stream->budget          = budget;
+    stream->materials_count = materials_count;
+    stream->lru_first       = STREAM_NONE;
+    stream->lru_last        = STREAM_NONE;
+
+    for (size_t i = 0; stream->hits && i < STREAM_HITS; i++)
+        stream->hits[i].index = STREAM_NO_HIT;
+
+    ok = ok && records && stream->chunks && stream->queue && stream->hits &&
+         pread(stream->fd, records, records_size, sizeof(header)) == (ssize_t)records_size &&
+         read_chunks(stream, records, (size_t)st.st_size);
+
+    aabb_t *bounds = ok ? calloc(chunks_count > 0 ? chunks_count : 1, sizeof(aabb_t)) : NULL;
+
+    for (size_t i = 0; bounds && i < chunks_count; i++)
+        bounds[i] = stream->chunks[i].bounds;
+
+    ok = ok && bounds && bvh_build(&stream->bvh, bounds, chunks_count, 1);
+
+    free(bounds);
+    free(records);
+
+    if (!ok)
+    {
+        close(stream->fd);
+        free(stream->chunks);
+        free(stream->queue);
+        free(stream->hits);
+        bvh_destroy(&stream->bvh);
+
+        memset(stream, 0, sizeof(*stream));
+        return false;
+    }
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->request, NULL);
+    pthread_cond_init(&stream->loaded, NULL);
+
+    if (pthread_create(&stream->loader, NULL, loader, stream) != 0)
+    {
+        stream_free(stream);
+        return false;
+    }
+
+    return true;
+}
+
+void particle_stream_close(particle_stream_t *stream)
+{
+    if (!stream->chunks)
+        return;
+
+    pthread_mutex_lock(&stream->lock);
+    stream->quit = true;
+    pthread_cond_broadcast(&stream->request);
+    pthread_mutex_unlock(&stream->lock);
+
+    pthread_join(stream->loader, NULL);
+
+    stream_free(stream);
+}
+
+aabb_t particle_stream_bounds(const particle_stream_t *stream)
+{
+    if (stream->bvh.nodes_count > 0)
+        return stream->bvh.nodes[0].bounds;
+
+    return aabb_empty();
+}
+
+particle_stream_stats_t particle_stream_stats(particle_stream_t *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    particle_stream_stats_t stats = stream->stats;
+    pthread_mutex_unlock(&stream->lock);
+
+    return stats;
+}
+
+// ray queries
+
+typedef struct stream_query
+{
+    particle_stream_t *stream;
+
+    vec3_t             ray_origin;
+    vec3_t             ray_dir;
+
+    float              dist;
+    uint32_t           particle;
+    bool               hit;
+
+    // closest hit decoded while its chunk is in memory
+    particle_t         decoded;
+
+    // prefetch only, the ray waits for a chunk
+    bool               missing;
+} stream_query_t;
+
+/**
+ * Query of the ray, nothing is hit or missing yet
+ */
+static stream_query_t stream_query(particle_stream_t *stream, vec3_t ray_origin, vec3_t ray_dir,
+                                   float dist)
+{
+    stream_query_t query = {0};
+
+    query.stream     = stream;
+    query.ray_origin = ray_origin;
+    query.ray_dir    = ray_dir;
+    query.dist       = dist;
+
+    return query;
+}
+
+static bool prefetch_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    (void)io_t_max;
+
+    stream_query_t    *query  = ctx;
+    particle_stream_t *stream = query->stream;
+
+    for (uint32_t i = 0; i < leaf->count; i++)
+    {
+        size_t          index = stream->bvh.indices[leaf->first + i];
+        stream_chunk_t *chunk = &stream->chunks[index];
+
+        if (chunk_ready(chunk))
+            continue;
+
+        query->missing = true;
+
+        // chunks read ahead fill at most half the budget, so they don't evict each other
+        // before the rays waiting for them are traced, the ray asks again later otherwise
+        if (!chunk->requested && !chunk->loading &&
+            (stream->queue_count == 0 || stream->queue_bytes + chunk->size <= stream->budget / 2))
+        {
+            chunk->requested = true;
+
+            stream->queue[(stream->queue_head + stream->queue_count) % stream->chunks_count] =
+                index;
+            stream->queue_count++;
+            stream->queue_bytes += chunk->size;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+static bool closest_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    stream_query_t    *query  = ctx;
+    particle_stream_t *stream = query->stream;
+
+    for (uint32_t i = 0; i < leaf->count; i++)
+    {
+        size_t             index     = stream->bvh.indices[leaf->first + i];
+        const particles_t *particles = chunk_acquire(stream, index);
+        uint32_t particle = 0;
+        if (particles_intersect(particles, query->ray_origin, query->ray_dir, io_t_max, &particle))
+        {
+            query->dist     = *io_t_max;
+            query->particle = stream->chunks[index].first + particle;
+            query->hit      = true;
+            query->decoded  = particles_get(particles, particle);
+        }
+
+        chunk_release(stream, index);
+    }
+
+    return false;
+}
+
+static bool any_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    stream_query_t    *query  = ctx;
+    particle_stream_t *stream = query->stream;
+
+    for (uint32_t i = 0; i < leaf->count && !query->hit; i++)
+    {
+        size_t             index     = stream->bvh.indices[leaf->first + i];
+        const particles_t *particles = chunk_acquire(stream, index);
+        query->hit = particles_occluded(particles, query->ray_origin, query->ray_dir, *io_t_max);
+
+        chunk_release(stream, index);
+    }
+
+    return query->hit;
+}
+
+bool particle_stream_prefetch(particle_stream_t *stream, vec3_t ray_origin, vec3_t ray_dir,
+                              float max_dist)
+{
+    stream_query_t query = stream_query(stream, ray_origin, ray_dir, max_dist);
+
+    pthread_mutex_lock(&stream->lock);
+
+    size_t queued = stream->queue_count;
+    bvh_traverse(&stream->bvh, ray_origin, ray_dir, max_dist, prefetch_leaf, &query);
+
+    if (stream->queue_count > queued)
+        pthread_cond_signal(&stream->request);
+
+    pthread_mutex_unlock(&stream->lock);
+
+    return query.missing;
+}
+
+bool particle_stream_intersect(particle_stream_t *stream, vec3_t ray_origin, vec3_t ray_dir,
+                               float *io_dist, uint32_t *out_particle)
+{
+    stream_query_t query = stream_query(stream, ray_origin, ray_dir, *io_dist);
+
+    bvh_traverse(&stream->bvh, ray_origin, ray_dir, *io_dist, closest_leaf, &query);
+
+    if (!query.hit)
+        return false;
+
+    pthread_mutex_lock(&stream->lock);
+    stream->hits[query.particle % STREAM_HITS] = (stream_hit_t){ query.particle, query.decoded };
+    pthread_mutex_unlock(&stream->lock);
+
+    *io_dist      = query.dist;
+    *out_particle = query.particle;
+    return true;
+}
+
+bool particle_stream_occluded(particle_stream_t *stream, vec3_t ray_origin, vec3_t ray_dir,
+                              float max_dist)
+{
+    stream_query_t query = stream_query(stream, ray_origin, ray_dir, max_dist);
+
+    bvh_traverse(&stream->bvh, ray_origin, ray_dir, max_dist, any_leaf, &query);
+
+    return query.hit;
+}
+
+void particle_stream_wait(particle_stream_t *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+
+    if (stream->queue_count > 0 || stream->reading)
+    {
+        stream->stats.waits++;
+        pthread_cond_wait(&stream->loaded, &stream->lock);
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+}
+
+particle_t particle_stream_get(particle_stream_t *stream, uint32_t index)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream_hit_t hit = stream->hits[index % STREAM_HITS];
+    pthread_mutex_unlock(&stream->lock);
+
+    if (hit.index == index)
+        return hit.particle;
+
+    // last chunk starting at or before the index
+    size_t low  = 0;
+    size_t high = stream->chunks_count;
+
+    while (high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+
+        if (stream->chunks[middle].first <= index)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    const particles_t *particles = chunk_acquire(stream, low);
+    particle_t particle = particles_get(particles, index - stream->chunks[low].first);
+
+    chunk_release(stream, low);
+    return particle;
+}
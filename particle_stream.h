@@ -0,0 +1,178 @@
+#ifndef PARTICLE_STREAM_H
+#define PARTICLE_STREAM_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bvh.h"
+#include "particles.h"
+
+/**
+ * Packed particles of one spatial part of the cloud, read from the file as a whole
+ */
+typedef struct stream_chunk
+{
+    aabb_t      bounds;
+
+    // place of the chunk in the file
+    uint64_t    offset;
+    uint64_t    size;
+
+    // particle indices of the chunk start here
+    uint32_t    first;
+
+    // view of the data while the chunk is in memory, data is NULL otherwise
+    void       *data;
+    particles_t particles;
+
+    // rays tracing the chunk now, pinned chunks are not evicted
+    uint32_t    pins;
+    // waits in the loader queue or is being read
+    bool        requested;
+    bool        loading;
+    // couldn't be read, rays pass through it
+    bool        broken;
+
+    // neighbours in the list of chunks in memory, most recently used first
+    size_t      lru_prev;
+    size_t      lru_next;
+} stream_chunk_t;
+
+/**
+ * Particle decoded when a ray hit it
+ */
+typedef struct stream_hit
+{
+    uint32_t   index;
+    particle_t particle;
+} stream_hit_t;
+
+/**
+ * Counters since the stream was opened
+ */
+typedef struct particle_stream_stats
+{
+    // chunks read by the loader ahead of the rays and by the rays themselves
+    size_t prefetched;
+    size_t stalls;
+    // tracer had nothing to do but wait for the loader
+    size_t waits;
+    size_t evictions;
+
+    size_t resident_bytes;
+    size_t resident_chunks;
+} particle_stream_stats_t;
+
+/**
+ * Particle cloud kept in a file and read in chunks when rays reach them,
+ * so the cloud may be larger than memory
+ * Only the chunk bounds stay in memory, chunks are held in a cache of
+ * budget bytes and the least recently used ones are evicted first
+ * A loader thread reads chunks asked for by particle_stream_prefetch(),
+ * a ray reaching a chunk which is not in memory yet reads it by itself,
+ * tracers which don't wait check rays by particle_stream_prefetch() and trace others first
+ * Chunks are the same packed particles as particles_t,
+ * traced by the same kernel
+ */
+typedef struct particle_stream
+{
+    int              fd;
+
+    stream_chunk_t  *chunks;
+    size_t           chunks_count;
+    // particle indices of all chunks, including unused cluster lanes
+    size_t           indices_count;
+
+    // hierarchy over chunk bounds, leaves refer to chunks through its indices
+    bvh_t            bvh;
+
+    size_t           budget;
+    // particles of chunks with other materials are not traced
+    size_t           materials_count;
+
+    pthread_mutex_t  lock;
+    // new requests or quit for the loader
+    pthread_cond_t   request;
+    // a chunk came to memory
+    pthread_cond_t   loaded;
+
+    pthread_t        loader;
+    bool             quit;
+    // the loader is reading a chunk
+    bool             reading;
+
+    // chunks asked for, in order
+    size_t          *queue;
+    size_t           queue_head;
+    size_t           queue_count;
+    size_t           queue_bytes;
+
+    // list of chunks in memory
+    size_t           lru_first;
+    size_t           lru_last;
+
+    // latest hits by particle index modulo STREAM_HITS,
+    // so shading them doesn't read their chunks again
+    stream_hit_t    *hits;
+
+    particle_stream_stats_t stats;
+} particle_stream_t;
+
+/**
+ * Splits the particles into chunks of about chunk_size ones close to each other,
+ * packs each chunk and writes them all to the file
+ * Particle materials index the scene's materials_count ones
+ */
+bool particle_stream_write(const char *path, const particle_t *particles, size_t count,
+                           size_t chunk_size, size_t materials_count);
+
+/**
+ * Reads chunk bounds from the file written by particle_stream_write()
+ * and starts the loader, chunks are held in budget bytes
+ * The budget is exceeded only if rays trace more chunks at once than fit in it
+ * File written for another count of materials is refused, chunk with a material
+ * out of range is left out as one which can't be read
+ */
+bool particle_stream_open(particle_stream_t *stream, const char *path, size_t budget,
+                          size_t materials_count);
+
+void particle_stream_close(particle_stream_t *stream);
+
+aabb_t particle_stream_bounds(const particle_stream_t *stream);
+
+/**
+ * Asks the loader for the nearest chunk reached by the ray closer than max_dist
+ * which is not in memory yet, returns false if there is none
+ * Farther ones may not be needed if the ray hits that one
+ */
+bool particle_stream_prefetch(particle_stream_t *stream, vec3_t ray_origin, vec3_t ray_dir,
+                                float max_dist);
+
+/**
+ * Waits until the loader brings a chunk to memory,
+ * returns right away if it has nothing to read
+ */
+void particle_stream_wait(particle_stream_t *stream);
+
+/**
+ * Same as particles_intersect(), waits for the chunks which are not in memory
+ */
+bool particle_stream_intersect(particle_stream_t *stream, vec3_t ray_origin, vec3_t ray_dir,
+                               float *io_dist, uint32_t *out_particle);
+
+/**
+ * Same as particles_occluded(), waits for the chunks which are not in memory
+ */
+bool particle_stream_occluded(particle_stream_t *stream, vec3_t ray_origin, vec3_t ray_dir,
+                              float max_dist);
+
+/**
+ * Decoded particle, index is the one given by particle_stream_intersect()
+ * Particles hit lately are kept decoded, others wait for their chunks
+ */
+particle_t particle_stream_get(particle_stream_t *stream, uint32_t index);
+
+particle_stream_stats_t particle_stream_stats(particle_stream_t *stream);
+
+#endif
@@ -0,0 +1,315 @@
+#include <math.h>
+#include <string.h>
+
+#include "particles.h"
+
+// largest grid coordinate and radius code
+static const float PARTICLE_CODE_MAX = 65535.f;
+
+// build
+
+static uint16_t quantize(float value)
+{
+    if (!(value > 0.f))
+        return 0;
+
+    return value < PARTICLE_CODE_MAX ? (uint16_t)lrintf(value) : (uint16_t)PARTICLE_CODE_MAX;
+}
+
+static float decode_radius(const particles_t *particles, const packed_particle_t *packed)
+{
+    return exp2f(particles->log_min + (float)packed->radius * particles->log_step);
+}
+
+static vec3_t decode_center(const particle_cluster_t *cluster, const packed_particle_t *packed)
+{
+    return (vec3_t){ cluster->origin.x + (float)packed->x * cluster->step.x,
+                     cluster->origin.y + (float)packed->y * cluster->step.y,
+                     cluster->origin.z + (float)packed->z * cluster->step.z };
+}
+
+/**
+ * Quantizes the particles of a leaf into the cluster, gives bounds of the decoded ones
+ */
+static aabb_t fill_cluster(particles_t *particles, particle_cluster_t *cluster,
+                           const particle_t *source, const uint32_t *indices)
+{
+    aabb_t centers = aabb_empty();
+
+    for (size_t i = 0; i < cluster->count; i++)
+        centers = aabb_grow(centers, source[indices[i]].position);
+
+    vec3_t extent = vec_sub(centers.max, centers.min);
+
+    cluster->origin = centers.min;
+    cluster->step   = (vec3_t){ extent.x / PARTICLE_CODE_MAX, extent.y / PARTICLE_CODE_MAX,
+                                extent.z / PARTICLE_CODE_MAX };
+
+    aabb_t bounds = aabb_empty();
+
+    for (size_t i = 0; i < cluster->count; i++)
+    {
+        const particle_t  *particle = &source[indices[i]];
+        packed_particle_t *packed   = &particles->packed[cluster->first + i];
+        vec3_t             offset   = vec_sub(particle->position, cluster->origin);
+
+        packed->x        = cluster->step.x > 0.f ? quantize(offset.x / cluster->step.x) : 0;
+        packed->y        = cluster->step.y > 0.f ? quantize(offset.y / cluster->step.y) : 0;
+        packed->z        = cluster->step.z > 0.f ? quantize(offset.z / cluster->step.z) : 0;
+        packed->material = particle->material;
+
+        packed->radius   = particles->log_step > 0.f
+                         ? quantize((log2f(particle->radius) - particles->log_min) /
+                                    particles->log_step)
+                         : 0;
+
+        vec3_t center = decode_center(cluster, packed);
+        float  radius = decode_radius(particles, packed);
+
+        bounds = aabb_union(bounds, (aabb_t){ vec_sub(center, (vec3_t){ radius, radius, radius }),
+                                              vec_add(center, (vec3_t){ radius, radius, radius }) });
+    }
+
+    return bounds;
+}
+
+bool particles_build(particles_t *particles, const particle_t *source, size_t count)
+{
+    memset(particles, 0, sizeof(*particles));
+
+    aabb_t *bounds = calloc(count > 0 ? count : 1, sizeof(aabb_t));
+    if (!bounds)
+        return false;
+
+    float log_min = count > 0 ? INFINITY : 0.f;
+    float log_max = count > 0 ? -INFINITY : 0.f;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        vec3_t center = source[i].position;
+        float  radius = source[i].radius;
+
+        bounds[i] = (aabb_t){ vec_sub(center, (vec3_t){ radius, radius, radius }),
+                              vec_add(center, (vec3_t){ radius, radius, radius }) };
+
+        log_min = fminf(log_min, log2f(radius));
+        log_max = fmaxf(log_max, log2f(radius));
+    }
+
+    particles->log_min  = log_min;
+    particles->log_step = (log_max - log_min) / PARTICLE_CODE_MAX;
+
+    bool ok = bvh_build(&particles->bvh, bounds, count, PARTICLE_CLUSTER_SIZE);
+    free(bounds);
+
+    if (!ok)
+        return false;
+
+    bvh_t *bvh = &particles->bvh;
+
+    size_t leaves_count = 0;
+    for (size_t i = 0; i < bvh->nodes_count; i++)
+    {
+        if (bvh->nodes[i].count > 0)
+            leaves_count++;
+    }
+
+    particles->packed   = calloc(count > 0 ? count : 1, sizeof(packed_particle_t));
+    particles->clusters = calloc(leaves_count > 0 ? leaves_count : 1, sizeof(particle_cluster_t));
+
+    if (!particles->packed || !particles->clusters)
+    {
+        particles_destroy(particles);
+        return false;
+    }
+
+    // each leaf turns into one cluster, particles are stored cluster by cluster
+
+    size_t next = 0;
+    for (size_t i = 0; i < bvh->nodes_count; i++)
+    {
+        bvh_node_t *node = &bvh->nodes[i];
+        if (node->count == 0)
+            continue;
+
+        particle_cluster_t *cluster = &particles->clusters[particles->clusters_count];
+        cluster->first = (uint32_t)next;
+        cluster->count = node->count;
+
+        node->bounds = fill_cluster(particles, cluster, source, &bvh->indices[node->first]);
+        node->first  = (uint32_t)particles->clusters_count++;
+
+        next += cluster->count;
+    }
+
+    particles->count = count;
+
+    free(bvh->indices);
+    bvh->indices       = NULL;
+    bvh->indices_count = 0;
+
+    // decoded particles may stick out of the boxes of the exact ones a little,
+    // children follow their parents, so parents are refit after them
+    for (size_t i = bvh->nodes_count; i-- > 0;)
+    {
+        bvh_node_t *node = &bvh->nodes[i];
+
+        if (node->count == 0)
+            node->bounds = aabb_union(bvh->nodes[node->first].bounds,
+                                      bvh->nodes[node->first + 1].bounds);
+    }
+
+    return true;
+}
+
+void particles_destroy(particles_t *particles)
+{
+    free(particles->packed);
+    free(particles->clusters);
+    bvh_destroy(&particles->bvh);
+
+    memset(particles, 0, sizeof(*particles));
+}
+
+size_t particles_memory(const particles_t *particles)
+{
+    return particles->count          * sizeof(packed_particle_t) +
+           particles->clusters_count * sizeof(particle_cluster_t) +
+           particles->bvh.nodes_count * sizeof(bvh_node_t);
+}
+
+aabb_t particles_bounds(const particles_t *particles)
+{
+    if (particles->bvh.nodes_count > 0)
+        return particles->bvh.nodes[0].bounds;
+
+    return aabb_empty();
+}
+
+particle_t particles_get(const particles_t *particles, uint32_t index)
+{
+    const particle_cluster_t *cluster = &particles->clusters[index / PARTICLE_CLUSTER_SIZE];
+    const packed_particle_t  *packed  = &particles->packed[cluster->first +
+                                                           index % PARTICLE_CLUSTER_SIZE];
+
+    return (particle_t){ decode_center(cluster, packed), decode_radius(particles, packed),
+                         packed->material };
+}
+
+// ray queries
+
+/**
+ * Decodes the cluster and tests the ray against all its particles at once,
+ * gives distances of hits closer than t_max, infinity for the missed lanes
+ */
+static void cluster_intersect(const particles_t *particles, const particle_cluster_t *cluster,
+                              vec3_t ray_origin, vec3_t ray_dir, float t_max,
+                              float out_t[PARTICLE_CLUSTER_SIZE])
+{
+    const packed_particle_t *packed = &particles->packed[cluster->first];
+
+    // ray origin relative to the cluster, grid offsets are small then
+    vec3_t origin = vec_sub(ray_origin, cluster->origin);
+
+    for (size_t lane = 0; lane < PARTICLE_CLUSTER_SIZE; lane++)
+    {
+        // unused lanes repeat the last particle
+        const packed_particle_t *particle = &packed[lane < cluster->count ? lane
+                                                                          : cluster->count - 1];
+
+        float s_x    = origin.x - (float)particle->x * cluster->step.x;
+        float s_y    = origin.y - (float)particle->y * cluster->step.y;
+        float s_z    = origin.z - (float)particle->z * cluster->step.z;
+        float radius = decode_radius(particles, particle);
+
+        float b = s_x * ray_dir.x + s_y * ray_dir.y + s_z * ray_dir.z;
+        float c = s_x * s_x + s_y * s_y + s_z * s_z - radius * radius;
+        float d = b * b - c;
+
+        float sqrt_d = sqrtf(d > 0.f ? d : 0.f);
+        float t1     = -b - sqrt_d;
+        float t2     = -b + sqrt_d;
+        float t      = t1 > EPS ? t1 : t2;
+
+        out_t[lane] = d >= 0.f && t > EPS && t < t_max ? t : INFINITY;
+    }
+}
+
+typedef struct particles_query
+{
+    const particles_t *particles;
+
+    vec3_t             ray_origin;
+    vec3_t             ray_dir;
+
+    float              dist;
+    uint32_t           particle;
+    bool               hit;
+} particles_query_t;
+
+static bool closest_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    particles_query_t *query = ctx;
+
+    float t[PARTICLE_CLUSTER_SIZE];
+    cluster_intersect(query->particles, &query->particles->clusters[leaf->first],
+                      query->ray_origin, query->ray_dir, *io_t_max, t);
+
+    for (size_t lane = 0; lane < PARTICLE_CLUSTER_SIZE; lane++)
+    {
+        if (t[lane] < *io_t_max)
+        {
+            *io_t_max       = t[lane];
+            query->dist     = t[lane];
+            query->particle = leaf->first * PARTICLE_CLUSTER_SIZE + (uint32_t)lane;
+            query->hit      = true;
+        }
+    }
+
+    return false;
+}
+
+static bool any_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    particles_query_t *query = ctx;
+
+    float t[PARTICLE_CLUSTER_SIZE];
+    cluster_intersect(query->particles, &query->particles->clusters[leaf->first],
+                      query->ray_origin, query->ray_dir, *io_t_max, t);
+
+    for (size_t lane = 0; lane < PARTICLE_CLUSTER_SIZE; lane++)
+    {
+        if (t[lane] < INFINITY)
+        {
+            query->hit = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool particles_intersect(const particles_t *particles, vec3_t ray_origin, vec3_t ray_dir,
+                         float *io_dist, uint32_t *out_particle)
+{
+    particles_query_t query = { particles, ray_origin, ray_dir, *io_dist, 0, false };
+
+    bvh_traverse(&particles->bvh, ray_origin, ray_dir, *io_dist, closest_leaf, &query);
+
+    if (!query.hit)
+        return false;
+
+    *io_dist      = query.dist;
+    *out_particle = query.particle;
+    return true;
+}
+
+bool particles_occluded(const particles_t *particles, vec3_t ray_origin, vec3_t ray_dir,
+                        float max_dist)
+{
+    particles_query_t query = { particles, ray_origin, ray_dir, max_dist, 0, false };
+
+    bvh_traverse(&particles->bvh, ray_origin, ray_dir, max_dist, any_leaf, &query);
+
+    return query.hit;
+}
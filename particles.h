@@ -0,0 +1,107 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bvh.h"
+#include "math_lib.h"
+
+// particles per cluster, the leaves of the cloud hierarchy
+#define PARTICLE_CLUSTER_SIZE 8
+
+/**
+ * Sphere given to particles_build() or decoded back by particles_get()
+ */
+typedef struct particle
+{
+    vec3_t   position;
+    float    radius;
+    // index in scene materials
+    uint16_t material;
+} particle_t;
+
+/**
+ * Particle quantized inside its cluster: center on the 16 bit grid of the cluster,
+ * radius as 16 bit code of its logarithm over the radii of the cloud
+ * 10 bytes instead of 18 of a sphere with its material index
+ */
+typedef struct packed_particle
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t z;
+    uint16_t radius;
+    uint16_t material;
+} packed_particle_t;
+
+/**
+ * Up to PARTICLE_CLUSTER_SIZE particles close to each other
+ */
+typedef struct particle_cluster
+{
+    // center of a particle is origin + step * its grid coordinates
+    vec3_t   origin;
+    vec3_t   step;
+
+    uint32_t first;
+    uint32_t count;
+} particle_cluster_t;
+
+/**
+ * Many spheres stored compressed, geometry of instance prototypes
+ * Particles are decoded on the fly by the intersection kernel, which costs some speed
+ * for about 22 bytes per particle with the hierarchy
+ * Leaves of the hierarchy refer to clusters - leaf first is the cluster index
+ */
+typedef struct particles
+{
+    packed_particle_t  *packed;
+    size_t              count;
+
+    particle_cluster_t *clusters;
+    size_t              clusters_count;
+
+    // radius is exp2(log_min + code * log_step)
+    float               log_min;
+    float               log_step;
+
+    bvh_t               bvh;
+} particles_t;
+
+/**
+ * Quantizes count spheres and builds hierarchy over them
+ * Radii must be positive, particle indices are not kept
+ */
+bool particles_build(particles_t *particles, const particle_t *source, size_t count);
+
+void particles_destroy(particles_t *particles);
+
+/**
+ * Bytes taken by particles, clusters and the hierarchy
+ */
+size_t particles_memory(const particles_t *particles);
+
+aabb_t particles_bounds(const particles_t *particles);
+
+/**
+ * Decoded particle, index is the one given by particles_intersect()
+ */
+particle_t particles_get(const particles_t *particles, uint32_t index);
+
+/**
+ * Finds the nearest particle hit closer than *io_dist
+ * Ray direction must be normalized
+ * Updates *io_dist and gives the particle index if hit
+ */
+bool particles_intersect(const particles_t *particles, vec3_t ray_origin, vec3_t ray_dir,
+                         float *io_dist, uint32_t *out_particle);
+
+/**
+ * Checks if any particle is hit closer than max_dist
+ * Ray direction must be normalized
+ */
+bool particles_occluded(const particles_t *particles, vec3_t ray_origin, vec3_t ray_dir,
+                        float max_dist);
+
+#endif
@@ -0,0 +1,98 @@
+#include <math.h>
+#include <string.h>
+
+#include "raster.h"
+
+/**
+ * Depth tests the object against pixels of its footprint
+ * Footprint gets one pixel margin, the ray test decides coverage exactly
+ */
+static void rasterize_object(id_buffer_t *buffer, const scene_t *scene, object_ref_t object)
+{
+    const camera_t *camera = &scene->camera;
+
+    screen_rect_t rect = {0};
+    if (!object_screen_rect(scene, object, &rect))
+        return;
+
+    // pixel centers are at +0.5
+    float x0 = floorf(rect.x0 - (float)camera->crop_x0 - 1.f);
+    float y0 = floorf(rect.y0 - (float)camera->crop_y0 - 1.f);
+    float x1 = ceilf (rect.x1 - (float)camera->crop_x0 + 1.f);
+    float y1 = ceilf (rect.y1 - (float)camera->crop_y0 + 1.f);
+
+    if (x1 < 0.f || y1 < 0.f || x0 >= (float)buffer->width || y0 >= (float)buffer->height)
+        return;
+
+    size_t px0 = x0 > 0.f ? (size_t)x0 : 0;
+    size_t py0 = y0 > 0.f ? (size_t)y0 : 0;
+    size_t px1 = (size_t)fminf(x1, (float)(buffer->width  - 1));
+    size_t py1 = (size_t)fminf(y1, (float)(buffer->height - 1));
+
+    for (size_t y = py0; y <= py1; y++)
+    {
+        for (size_t x = px0; x <= px1; x++)
+        {
+            size_t pixel = y * buffer->width + x;
+
+            vec3_t ray_dir = vec_norm(camera_ray_dir(camera, (float)(camera->crop_x0 + x) + 0.5f,
+                                                             (float)(camera->crop_y0 + y) + 0.5f));
+
+            if (object_intersect(scene, object, camera->position, ray_dir,
+                                 &buffer->depth[pixel], &buffer->prims[pixel]))
+                buffer->objects[pixel] = object;
+        }
+    }
+}
+
+bool id_buffer_build(id_buffer_t *buffer, const scene_t *scene)
+{
+    memset(buffer, 0, sizeof(*buffer));
+
+    buffer->width  = camera_crop_width (&scene->camera);
+    buffer->height = camera_crop_height(&scene->camera);
+
+    size_t pixels_count = buffer->width * buffer->height;
+
+    buffer->depth   = calloc(pixels_count, sizeof(float));
+    buffer->objects = calloc(pixels_count, sizeof(object_ref_t));
+    buffer->prims   = calloc(pixels_count, sizeof(uint32_t));
+
+    if (!buffer->depth || !buffer->objects || !buffer->prims)
+    {
+        id_buffer_destroy(buffer);
+        return false;
+    }
+
+    for (size_t pixel = 0; pixel < pixels_count; pixel++)
+        buffer->depth[pixel] = INF;
+
+    size_t objects_count = object_count(scene);
+
+    for (size_t i = 0; i < objects_count; i++)
+        rasterize_object(buffer, scene, object_by_number(scene, i));
+
+    return true;
+}
+
+void id_buffer_destroy(id_buffer_t *buffer)
+{
+    free(buffer->depth);
+    free(buffer->objects);
+    free(buffer->prims);
+
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+bool id_buffer_hit(const id_buffer_t *buffer, size_t x, size_t y, hit_t *out_hit)
+{
+    size_t pixel = y * buffer->width + x;
+
+    if (buffer->depth[pixel] >= INF)
+        return false;
+
+    out_hit->dist   = buffer->depth[pixel];
+    out_hit->object = buffer->objects[pixel];
+    out_hit->prim   = buffer->prims[pixel];
+    return true;
+}
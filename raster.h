@@ -0,0 +1,40 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "object.h"
+#include "rt.h"
+
+/**
+ * Nearest hit of the primary ray of every pixel of the camera crop window
+ * Built by rasterization of object footprints with depth test instead of tracing
+ */
+typedef struct id_buffer
+{
+    size_t        width;
+    size_t        height;
+
+    // INF if the pixel sees background
+    float        *depth;
+    object_ref_t *objects;
+    uint32_t     *prims;
+} id_buffer_t;
+
+/**
+ * Rasterizes all objects of the scene into the buffer
+ * Each object covers pixels of its screen bounds which primary rays hit it,
+ * so the buffer holds the same hits as traced primary rays
+ */
+bool id_buffer_build(id_buffer_t *buffer, const scene_t *scene);
+
+void id_buffer_destroy(id_buffer_t *buffer);
+
+/**
+ * Gives hit of the pixel, relative to the crop window corner
+ * Returns false if the pixel sees background
+ */
+bool id_buffer_hit(const id_buffer_t *buffer, size_t x, size_t y, hit_t *out_hit);
+
+#endif
@@ -0,0 +1,928 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "accel.h"
+#include "ao.h"
+#include "binning.h"
+#include "denoise.h"
+#include "lightmap.h"
+#include "raster.h"
+#include "render.h"
+#include "shadow.h"
+#include "shadowmap.h"
+#include "wavefront.h"
+
+// rays per wavefront batch
+static const size_t WAVEFRONT_BATCH = 1 << 16;
+
+// moved sample is reused if the new ray hits it this close, relative to the distance
+static const float REPROJECT_TOLERANCE = 1e-2f;
+// and if it was shaded from view direction which differs at most by this angle, in degrees
+static const float REPROJECT_MAX_ANGLE = 1.f;
+
+// tiles with longer bins trace primary rays through the whole scene acceleration structure
+static const size_t BIN_MAX_OBJECTS = 32;
+
+render_options_t render_options_default()
+{
+    render_options_t opts = {0};
+
+    opts.tile_size   = 16;
+    opts.tile_order  = ORDER_HILBERT;
+    opts.pixel_order = ORDER_MORTON;
+    opts.binning     = true;
+
+    opts.reproject_threshold = 0.25f;
+
+    opts.tonemap     = tonemap_default();
+
+    return opts;
+}
+
+static double time_now()
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void store_pixel(float *pixel, color_t color)
+{
+    pixel[0] = color.x;
+    pixel[1] = color.y;
+    pixel[2] = color.z;
+}
+
+static color_t load_pixel(const float *pixel)
+{
+    return (color_t){ pixel[0], pixel[1], pixel[2] };
+}
+
+/**
+ * 8-bit output of one color, for comparisons only, images are converted by whole rows
+ */
+static void quantize_pixel(const tonemap_t *tm, color_t color, unsigned char *out)
+{
+    float values[3] = { color.x, color.y, color.z };
+    tonemap_apply(tm, values, 3, out);
+}
+
+/**
+ * Order of tiles over the framebuffer and of pixels inside one tile
+ */
+typedef struct traversal
+{
+    uint32_t *tile_x;
+    uint32_t *tile_y;
+    size_t    tiles_count;
+
+    uint32_t *pixel_x;
+    uint32_t *pixel_y;
+    size_t    pixels_count;
+} traversal_t;
+
+static void traversal_destroy(traversal_t *traversal)
+{
+    free(traversal->tile_x);
+    free(traversal->tile_y);
+    free(traversal->pixel_x);
+    free(traversal->pixel_y);
+}
+
+static bool traversal_init(traversal_t *traversal, const framebuffer_t *fb,
+                           const render_options_t *opts)
+{
+    traversal->tiles_count  = fb->tiles_x * fb->tiles_y;
+    traversal->pixels_count = fb->tile_size * fb->tile_size;
+
+    traversal->tile_x  = calloc(traversal->tiles_count , sizeof(uint32_t));
+    traversal->tile_y  = calloc(traversal->tiles_count , sizeof(uint32_t));
+    traversal->pixel_x = calloc(traversal->pixels_count, sizeof(uint32_t));
+    traversal->pixel_y = calloc(traversal->pixels_count, sizeof(uint32_t));
+
+    if (!traversal->tile_x || !traversal->tile_y || !traversal->pixel_x || !traversal->pixel_y)
+    {
+        traversal_destroy(traversal);
+        return false;
+    }
+
+    grid_order(opts->tile_order , fb->tiles_x  , fb->tiles_y  ,
+               traversal->tile_x , traversal->tile_y );
+    grid_order(opts->pixel_order, fb->tile_size, fb->tile_size,
+               traversal->pixel_x, traversal->pixel_y);
+    return true;
+}
+
+/**
+ * Drops tiles which are out of the dirty region from the traversal
+ */
+static bool traversal_keep_dirty(traversal_t *traversal, const framebuffer_t *fb,
+                                 const dirty_region_t *dirty, const camera_t *camera)
+{
+    bool *tiles = calloc(fb->tiles_x * fb->tiles_y, sizeof(bool));
+    if (!tiles)
+        return false;
+
+    dirty_region_tiles(dirty, camera, fb->tile_size, fb->tiles_x, fb->tiles_y, tiles);
+
+    size_t kept = 0;
+
+    for (size_t tile = 0; tile < traversal->tiles_count; tile++)
+    {
+        if (!tiles[traversal->tile_y[tile] * fb->tiles_x + traversal->tile_x[tile]])
+            continue;
+
+        traversal->tile_x[kept] = traversal->tile_x[tile];
+        traversal->tile_y[kept] = traversal->tile_y[tile];
+        kept++;
+    }
+
+    traversal->tiles_count = kept;
+
+    free(tiles);
+    return true;
+}
+
+/**
+ * Gives bin of the tile if it is short enough to test primary rays against it
+ */
+static bool tile_bin(const tile_bins_t *bins, size_t tile_x, size_t tile_y,
+                     const object_ref_t **out_objects, size_t *out_count)
+{
+    if (!bins)
+        return false;
+
+    *out_objects = tile_bins_get(bins, tile_x, tile_y, out_count);
+    return *out_count <= BIN_MAX_OBJECTS;
+}
+
+static void render_scalar(scene_t scene, framebuffer_t *fb, const traversal_t *traversal,
+                          const tile_bins_t *bins)
+{
+    const camera_t *camera = &scene.camera;
+
+    for (size_t tile = 0; tile < traversal->tiles_count; tile++)
+    {
+        size_t tile_x0 = traversal->tile_x[tile] * fb->tile_size;
+        size_t tile_y0 = traversal->tile_y[tile] * fb->tile_size;
+
+        const object_ref_t *objects       = NULL;
+        size_t              objects_count = 0;
+
+        bool binned = tile_bin(bins, traversal->tile_x[tile], traversal->tile_y[tile],
+                               &objects, &objects_count);
+
+        for (size_t pixel = 0; pixel < traversal->pixels_count; pixel++)
+        {
+            size_t x = tile_x0 + traversal->pixel_x[pixel];
+            size_t y = tile_y0 + traversal->pixel_y[pixel];
+
+            if (x >= fb->width || y >= fb->height)
+                continue;
+
+            vec3_t ray_dir = camera_ray_dir(camera, (float)(camera->crop_x0 + x) + 0.5f,
+                                                    (float)(camera->crop_y0 + y) + 0.5f);
+
+            color_t color = scene.ambient_color;
+
+            if (!binned)
+                color = ray_trace(camera->position, ray_dir, &scene);
+            else if (objects_count > 0)
+                color = ray_trace_objects(camera->position, ray_dir, &scene, objects,
+                                          objects_count);
+
+            store_pixel(framebuffer_pixel(fb, x, y), color);
+        }
+    }
+}
+
+/**
+ * Compares the image with the same primary rays traced in the exact scene,
+ * which has approximations of the image turned off
+ * Gives the largest difference of one channel and number of pixels which differ
+ */
+static void image_error(scene_t exact, const framebuffer_t *fb, const tonemap_t *tm,
+                        int *out_max_error, size_t *out_differ)
+{
+    const camera_t *camera = &exact.camera;
+
+    int    max_error = 0;
+    size_t differ    = 0;
+
+    for (size_t y = 0; y < fb->height; y++)
+    {
+        for (size_t x = 0; x < fb->width; x++)
+        {
+            vec3_t ray_dir = camera_ray_dir(camera, (float)(camera->crop_x0 + x) + 0.5f,
+                                                    (float)(camera->crop_y0 + y) + 0.5f);
+
+            unsigned char truth[3], out[3];
+            quantize_pixel(tm, ray_trace(camera->position, ray_dir, &exact), truth);
+            quantize_pixel(tm, load_pixel(framebuffer_pixel(fb, x, y)), out);
+
+            if (memcmp(truth, out, sizeof(truth)) != 0)
+                differ++;
+
+            for (int channel = 0; channel < 3; channel++)
+            {
+                int error = abs((int)truth[channel] - (int)out[channel]);
+                if (error > max_error)
+                    max_error = error;
+            }
+        }
+    }
+
+    *out_max_error = max_error;
+    *out_differ    = differ;
+}
+
+/**
+ * Shades primary hits from the ID buffer, shadow rays are still traced
+ * With validation primary rays are traced too, returns number of pixels which differ
+ */
+static size_t render_raster(scene_t scene, framebuffer_t *fb, const traversal_t *traversal,
+                            const id_buffer_t *ids, bool validate)
+{
+    const camera_t *camera = &scene.camera;
+
+    size_t mismatches = 0;
+
+    for (size_t tile = 0; tile < traversal->tiles_count; tile++)
+    {
+        size_t tile_x0 = traversal->tile_x[tile] * fb->tile_size;
+        size_t tile_y0 = traversal->tile_y[tile] * fb->tile_size;
+
+        for (size_t pixel = 0; pixel < traversal->pixels_count; pixel++)
+        {
+            size_t x = tile_x0 + traversal->pixel_x[pixel];
+            size_t y = tile_y0 + traversal->pixel_y[pixel];
+
+            if (x >= fb->width || y >= fb->height)
+                continue;
+
+            vec3_t ray_dir = camera_ray_dir(camera, (float)(camera->crop_x0 + x) + 0.5f,
+                                                    (float)(camera->crop_y0 + y) + 0.5f);
+
+            color_t color = scene.ambient_color;
+
+            hit_t hit = {0};
+            if (id_buffer_hit(ids, x, y, &hit))
+                color = ray_shade(camera->position, vec_norm(ray_dir), &hit, &scene);
+
+            store_pixel(framebuffer_pixel(fb, x, y), color);
+
+            if (validate)
+            {
+                color_t traced = ray_trace(camera->position, ray_dir, &scene);
+
+                if (traced.x != color.x || traced.y != color.y || traced.z != color.z)
+                    mismatches++;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+/**
+ * Moves samples of the previous image to pixels of the new camera, nearest one wins
+ * Gives distance of the moved hit from the new camera, INF where nothing landed
+ */
+static void reproject_samples(const scene_t *scene, const framebuffer_t *fb,
+                              const frame_history_t *history, float *out_depth,
+                              pixel_sample_t *out_samples, color_t *out_colors)
+{
+    const camera_t *old_camera = &history->camera;
+    const camera_t *camera     = &scene->camera;
+
+    for (size_t pixel = 0; pixel < fb->width * fb->height; pixel++)
+        out_depth[pixel] = INF;
+
+    for (size_t y = 0; y < fb->height; y++)
+    {
+        for (size_t x = 0; x < fb->width; x++)
+        {
+            const pixel_sample_t *sample = &history->samples[y * fb->width + x];
+            if (sample->hit.dist >= INF)
+                continue;
+
+            vec3_t old_dir = vec_norm(camera_ray_dir(old_camera,
+                                                     (float)(old_camera->crop_x0 + x) + 0.5f,
+                                                     (float)(old_camera->crop_y0 + y) + 0.5f));
+            vec3_t pos     = vec_add(old_camera->position, vec_mul_num(old_dir, sample->hit.dist));
+
+            float new_x = 0.f, new_y = 0.f;
+            if (!camera_project(camera, pos, &new_x, &new_y))
+                continue;
+
+            new_x -= (float)camera->crop_x0;
+            new_y -= (float)camera->crop_y0;
+
+            if (new_x < 0.f || new_y < 0.f || new_x >= (float)fb->width ||
+                                              new_y >= (float)fb->height)
+                continue;
+
+            size_t target = (size_t)new_y * fb->width + (size_t)new_x;
+            float  depth  = vec_length(vec_sub(pos, camera->position));
+
+            if (depth >= out_depth[target])
+                continue;
+
+            out_depth  [target] = depth;
+            out_samples[target] = *sample;
+            out_colors [target] = load_pixel(framebuffer_pixel(fb, x, y));
+        }
+    }
+}
+
+/**
+ * Checks if the moved sample can be reused by the new primary ray:
+ * the ray, cut right behind the sample, hits its object first, and the color
+ * was shaded from a close enough direction to keep highlights in place
+ * Gives the new hit
+ */
+static bool sample_valid(const scene_t *scene, vec3_t ray_dir, float depth,
+                         const pixel_sample_t *sample, hit_t *out_hit)
+{
+    const camera_t *camera = &scene->camera;
+
+    if (!scene_intersect(scene, camera->position, ray_dir, depth * (1.f + REPROJECT_TOLERANCE),
+                         out_hit))
+        return false;
+
+    if (out_hit->object.kind  != sample->hit.object.kind  ||
+        out_hit->object.index != sample->hit.object.index ||
+        out_hit->dist < depth * (1.f - REPROJECT_TOLERANCE))
+        return false;
+
+    vec3_t pos      = vec_add(camera->position, vec_mul_num(ray_dir, out_hit->dist));
+    vec3_t view_old = vec_norm(vec_sub(pos, sample->eye));
+
+    return vec_product(view_old, ray_dir) >= cosf(REPROJECT_MAX_ANGLE * (float)M_PI / 180.f);
+}
+
+/**
+ * Reuses colors of the previous image where its samples are still valid,
+ * the rest is traced
+ * Gives number of traced pixels
+ */
+static bool render_reproject(scene_t scene, framebuffer_t *fb, const traversal_t *traversal,
+                             frame_history_t *history, bool warp, float threshold,
+                             size_t *out_traced)
+{
+    const camera_t *camera = &scene.camera;
+
+    size_t pixels_count = fb->width * fb->height;
+
+    float          *depth   = calloc(pixels_count, sizeof(float));
+    pixel_sample_t *samples = calloc(pixels_count, sizeof(pixel_sample_t));
+    color_t        *colors  = calloc(pixels_count, sizeof(color_t));
+
+    if (!depth || !samples || !colors)
+    {
+        free(depth);
+        free(samples);
+        free(colors);
+        return false;
+    }
+
+    if (warp)
+        reproject_samples(&scene, fb, history, depth, samples, colors);
+    else
+    {
+        for (size_t pixel = 0; pixel < pixels_count; pixel++)
+            depth[pixel] = INF;
+    }
+
+    size_t landed = 0, rejected = 0;
+
+    for (size_t pixel = 0; pixel < pixels_count; pixel++)
+    {
+        if (depth[pixel] >= INF)
+            continue;
+
+        size_t x = pixel % fb->width;
+        size_t y = pixel / fb->width;
+
+        vec3_t ray_dir = vec_norm(camera_ray_dir(camera, (float)(camera->crop_x0 + x) + 0.5f,
+                                                         (float)(camera->crop_y0 + y) + 0.5f));
+
+        hit_t hit = {0};
+        landed++;
+
+        if (sample_valid(&scene, ray_dir, depth[pixel], &samples[pixel], &hit))
+        {
+            samples[pixel].hit = hit;
+            continue;
+        }
+
+        depth[pixel] = INF;
+        rejected++;
+    }
+
+    // reprojection is too poor, the camera moved too far
+    if ((float)rejected > threshold * (float)landed)
+    {
+        for (size_t pixel = 0; pixel < pixels_count; pixel++)
+            depth[pixel] = INF;
+    }
+
+    size_t traced = 0;
+
+    for (size_t tile = 0; tile < traversal->tiles_count; tile++)
+    {
+        size_t tile_x0 = traversal->tile_x[tile] * fb->tile_size;
+        size_t tile_y0 = traversal->tile_y[tile] * fb->tile_size;
+
+        for (size_t pixel = 0; pixel < traversal->pixels_count; pixel++)
+        {
+            size_t x = tile_x0 + traversal->pixel_x[pixel];
+            size_t y = tile_y0 + traversal->pixel_y[pixel];
+
+            if (x >= fb->width || y >= fb->height)
+                continue;
+
+            size_t index = y * fb->width + x;
+
+            if (depth[index] < INF)
+            {
+                store_pixel(framebuffer_pixel(fb, x, y), colors[index]);
+                history->samples[index] = samples[index];
+                continue;
+            }
+
+            vec3_t ray_dir = vec_norm(camera_ray_dir(camera, (float)(camera->crop_x0 + x) + 0.5f,
+                                                             (float)(camera->crop_y0 + y) + 0.5f));
+
+            hit_t   hit   = {0};
+            color_t color = scene.ambient_color;
+
+            if (scene_intersect(&scene, camera->position, ray_dir, INF, &hit))
+                color = ray_shade(camera->position, ray_dir, &hit, &scene);
+            else
+                hit.dist = INF;
+
+            store_pixel(framebuffer_pixel(fb, x, y), color);
+            history->samples[index] = (pixel_sample_t){ hit, camera->position };
+            traced++;
+        }
+    }
+
+    free(depth);
+    free(samples);
+    free(colors);
+
+    *out_traced = traced;
+    return true;
+}
+
+/**
+ * Wavefront batches are filled with whole tiles in traversal order
+ * Tiles with empty bins are filled with background right away
+ */
+static bool render_wavefront(scene_t scene, framebuffer_t *fb, const traversal_t *traversal,
+                             const tile_bins_t *bins)
+{
+    const camera_t *camera = &scene.camera;
+
+    wavefront_t wf = {0};
+
+    color_t  *colors  = calloc(WAVEFRONT_BATCH, sizeof(color_t));
+    uint32_t *batch_x = calloc(WAVEFRONT_BATCH, sizeof(uint32_t));
+    uint32_t *batch_y = calloc(WAVEFRONT_BATCH, sizeof(uint32_t));
+
+    if (!colors || !batch_x || !batch_y || !wavefront_init(&wf, WAVEFRONT_BATCH))
+    {
+        free(colors);
+        free(batch_x);
+        free(batch_y);
+        return false;
+    }
+
+    size_t batch = 0;
+
+    for (size_t tile = 0; tile <= traversal->tiles_count; tile++)
+    {
+        bool last = tile == traversal->tiles_count;
+
+        if (last || batch + traversal->pixels_count > WAVEFRONT_BATCH)
+        {
+            wavefront_render(&wf, scene, batch_x, batch_y, batch, colors);
+
+            for (size_t i = 0; i < batch; i++)
+                store_pixel(framebuffer_pixel(fb, batch_x[i] - camera->crop_x0,
+                                                  batch_y[i] - camera->crop_y0), colors[i]);
+
+            batch = 0;
+        }
+
+        if (last)
+            break;
+
+        size_t tile_x0 = traversal->tile_x[tile] * fb->tile_size;
+        size_t tile_y0 = traversal->tile_y[tile] * fb->tile_size;
+
+        const object_ref_t *objects       = NULL;
+        size_t              objects_count = 0;
+
+        bool empty = tile_bin(bins, traversal->tile_x[tile], traversal->tile_y[tile],
+                              &objects, &objects_count) && objects_count == 0;
+
+        for (size_t pixel = 0; pixel < traversal->pixels_count; pixel++)
+        {
+            size_t x = tile_x0 + traversal->pixel_x[pixel];
+            size_t y = tile_y0 + traversal->pixel_y[pixel];
+
+            if (x >= fb->width || y >= fb->height)
+                continue;
+
+            if (empty)
+            {
+                store_pixel(framebuffer_pixel(fb, x, y), scene.ambient_color);
+                continue;
+            }
+
+            batch_x[batch] = (uint32_t)(camera->crop_x0 + x);
+            batch_y[batch] = (uint32_t)(camera->crop_y0 + y);
+            batch++;
+        }
+    }
+
+    wavefront_destroy(&wf);
+    free(colors);
+    free(batch_x);
+    free(batch_y);
+    return true;
+}
+
+/**
+ * Writes linear colors as little endian PFM, its rows go from bottom to top
+ */
+static bool write_pfm(const char *file_name, const float *rows, size_t width, size_t height)
+{
+    FILE *file = fopen(file_name, "wb");
+    if (!file)
+        return false;
+
+    bool ok = fprintf(file, "PF\n%zu %zu\n-1.0\n", width, height) > 0;
+
+    for (size_t y = height; ok && y-- > 0;)
+        ok = fwrite(&rows[3 * y * width], sizeof(float), 3 * width, file) == 3 * width;
+
+    return fclose(file) == 0 && ok;
+}
+
+void frame_history_destroy(frame_history_t *history)
+{
+    framebuffer_destroy(&history->fb);
+    free(history->samples);
+
+    memset(history, 0, sizeof(*history));
+}
+
+static bool vec_same(vec3_t a, vec3_t b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool camera_equal(const camera_t *a, const camera_t *b)
+{
+    return vec_same(a->position, b->position) && vec_same(a->target, b->target) &&
+           vec_same(a->up, b->up) && a->fov == b->fov && a->aspect == b->aspect &&
+           a->width   == b->width   && a->height  == b->height  &&
+           a->crop_x0 == b->crop_x0 && a->crop_y0 == b->crop_y0 &&
+           a->crop_x1 == b->crop_x1 && a->crop_y1 == b->crop_y1;
+}
+
+bool render(scene_t scene, const render_options_t *opts, frame_history_t *history,
+            const dirty_region_t *dirty, size_t frame_cnt)
+{
+    size_t crop_width  = camera_crop_width (&scene.camera);
+    size_t crop_height = camera_crop_height(&scene.camera);
+
+    scene.fast_math = opts->fast_math;
+
+    size_t tile_size = opts->tile_size;
+
+    // a tile must fit in one wavefront batch
+    while (tile_size * tile_size > WAVEFRONT_BATCH)
+        tile_size /= 2;
+
+    framebuffer_t  local_fb  = {0};
+    framebuffer_t *fb        = history ? &history->fb : &local_fb;
+    traversal_t    traversal = {0};
+
+    bool reproject = opts->reproject && history;
+
+    bool same_size = history && history->valid && fb->width == crop_width &&
+                     fb->height == crop_height && fb->tile_size == tile_size;
+    bool unchanged = !dirty || (!dirty->whole_frame && dirty->rects_count == 0);
+
+    // previous image can be patched only if it was taken by the same camera,
+    // reprojection keeps samples of every pixel, so it never patches,
+    // nor does ambient occlusion which reaches past the dirty region
+    bool patch = same_size && !reproject && dirty && !dirty->whole_frame && !scene.ao &&
+                 camera_equal(&history->camera, &scene.camera);
+
+    // or warped to the new camera if the scene didn't change
+    bool warp  = same_size && reproject && history->samples && unchanged;
+
+    if (history)
+        history->valid = false;
+
+    // cached occlusion is valid only for the same geometry
+    if (scene.ao)
+    {
+        if (!unchanged)
+            ao_cache_clear(scene.ao);
+
+        scene.ao->lookups = 0;
+        scene.ao->sampled = 0;
+    }
+
+    // scene edits leave only the binary hierarchy
+    if (scene.accel && scene.accel->wide.nodes_count == 0 && scene.accel->bvh.nodes_count > 0 &&
+        !accel_widen(scene.accel))
+        fprintf(stderr, "Not enough memory for wide hierarchy, traversing the binary one\n");
+
+    // caster lists are valid only for the same geometry and lights
+    double casters_elapsed = 0.;
+
+    if (scene.casters && (!unchanged || !scene.casters->built))
+    {
+        double casters_start = time_now();
+
+        if (!shadow_casters_build(scene.casters, &scene))
+        {
+            fprintf(stderr, "Not enough memory for shadow casters, testing all objects\n");
+            scene.casters = NULL;
+        }
+
+        casters_elapsed = time_now() - casters_start;
+    }
+
+    // lightmaps bake whatever changed since the previous frame
+    double bake_elapsed = 0.;
+
+    if (scene.lightmaps)
+    {
+        double bake_start = time_now();
+
+        if (!lightmap_cache_update(scene.lightmaps, &scene))
+        {
+            fprintf(stderr, "Not enough memory for lightmaps, tracing shadows of discs\n");
+            scene.lightmaps = NULL;
+        }
+
+        bake_elapsed = time_now() - bake_start;
+    }
+
+    // shadow maps are rendered for every frame
+    double maps_elapsed = 0.;
+
+    if (scene.shadow_maps)
+    {
+        double maps_start = time_now();
+
+        if (!shadow_maps_build(scene.shadow_maps, &scene))
+        {
+            fprintf(stderr, "Not enough memory for shadow maps, tracing shadow rays\n");
+            scene.shadow_maps = NULL;
+        }
+
+        maps_elapsed = time_now() - maps_start;
+    }
+
+    if (reproject && !warp)
+    {
+        free(history->samples);
+        history->samples = calloc(crop_width * crop_height, sizeof(pixel_sample_t));
+
+        if (!history->samples)
+        {
+            fprintf(stderr, "Not enough memory for reprojection\n");
+            return false;
+        }
+    }
+
+    if (!patch && !warp)
+    {
+        framebuffer_destroy(fb);
+
+        if (!framebuffer_init(fb, crop_width, crop_height, tile_size))
+        {
+            fprintf(stderr, "Not enough memory for framebuffer\n");
+            return false;
+        }
+    }
+
+    if (!traversal_init(&traversal, fb, opts))
+    {
+        fprintf(stderr, "Not enough memory for framebuffer\n");
+        framebuffer_destroy(fb);
+        return false;
+    }
+
+    double start = time_now();
+
+    // all tiles are traced again if there is no memory to sort them out
+    size_t tiles_count = traversal.tiles_count;
+    if (patch && !traversal_keep_dirty(&traversal, fb, dirty, &scene.camera))
+        patch = false;
+
+    tile_bins_t  bins     = {0};
+    tile_bins_t *bins_ptr = NULL;
+
+    id_buffer_t  ids      = {0};
+    bool         ok       = true;
+
+    // reprojection traces by itself
+    if (opts->raster && !reproject)
+    {
+        ok = id_buffer_build(&ids, &scene);
+        if (!ok)
+            fprintf(stderr, "Not enough memory for ID buffer\n");
+    }
+    else if (opts->binning && !reproject)
+    {
+        if (tile_bins_build(&bins, &scene, fb->tile_size))
+            bins_ptr = &bins;
+        else
+            fprintf(stderr, "Not enough memory for tile bins, tracing without them\n");
+    }
+
+    double prepass_elapsed = time_now() - start;
+
+    size_t mismatches = 0;
+    size_t traced     = 0;
+
+    if (reproject)
+    {
+        ok = render_reproject(scene, fb, &traversal, history, warp, opts->reproject_threshold,
+                              &traced);
+        if (!ok)
+            fprintf(stderr, "Not enough memory for reprojection\n");
+    }
+    else if (opts->raster)
+    {
+        if (ok)
+            mismatches = render_raster(scene, fb, &traversal, &ids, opts->validate);
+    }
+    else if (opts->wavefront)
+    {
+        ok = render_wavefront(scene, fb, &traversal, bins_ptr);
+        if (!ok)
+            fprintf(stderr, "Not enough memory for wavefront queues\n");
+    }
+    else
+        render_scalar(scene, fb, &traversal, bins_ptr);
+
+    double elapsed = time_now() - start;
+
+    if (ok && opts->raster && !reproject && opts->validate)
+    {
+        fprintf(stderr, "raster validation: %zu of %zu pixels differ from traced\n",
+                mismatches, crop_width * crop_height);
+    }
+
+    if (ok && opts->fast_math && opts->validate)
+    {
+        scene_t exact = scene;
+        exact.fast_math = false;
+
+        int    max_error = 0;
+        size_t differ    = 0;
+        image_error(exact, fb, &opts->tonemap, &max_error, &differ);
+
+        fprintf(stderr, "fast math: max channel error %d of 255, %zu of %zu pixels differ\n",
+                max_error, differ, crop_width * crop_height);
+    }
+
+    if (ok && scene.shadow_maps && opts->validate)
+    {
+        scene_t exact = scene;
+        exact.shadow_maps = NULL;
+
+        int    max_error = 0;
+        size_t differ    = 0;
+        image_error(exact, fb, &opts->tonemap, &max_error, &differ);
+
+        fprintf(stderr, "shadow maps: max channel error %d of 255, %zu of %zu pixels differ\n",
+                max_error, differ, crop_width * crop_height);
+    }
+
+    if (ok && opts->stats)
+    {
+        if (patch)
+            fprintf(stderr, "dirty: %zu of %zu tiles\n", traversal.tiles_count, tiles_count);
+
+        if (reproject)
+            fprintf(stderr, "reprojection: %zu of %zu pixels traced\n", traced,
+                    crop_width * crop_height);
+
+        if (scene.ao)
+            fprintf(stderr, "ao cache: %zu records, %zu of %zu lookups sampled\n",
+                    scene.ao->records_count, scene.ao->sampled, scene.ao->lookups);
+
+        if (scene.casters)
+            fprintf(stderr, "shadow casters: %zu of %zu light and object pairs, %.3f s\n",
+                    scene.casters->casters_count,
+                    scene.casters->objects_count * scene.casters->lights_count, casters_elapsed);
+
+        if (scene.lightmaps)
+            fprintf(stderr, "lightmaps: %zu texels baked, %.3f s\n", scene.lightmaps->baked,
+                    bake_elapsed);
+
+        if (scene.shadow_maps)
+            fprintf(stderr, "shadow maps: %zu rays, %.3f s\n", scene.shadow_maps->rays,
+                    maps_elapsed);
+
+        if (opts->raster)
+            fprintf(stderr, "raster: %.3f s\n", prepass_elapsed);
+
+        if (bins_ptr)
+        {
+            size_t empty_tiles = 0;
+            for (size_t tile = 0; tile < bins.tiles_x * bins.tiles_y; tile++)
+            {
+                if (bins.offsets[tile] == bins.offsets[tile + 1])
+                    empty_tiles++;
+            }
+
+            fprintf(stderr, "binning: %.3f s, %zu of %zu tiles empty, %zu references\n",
+                    prepass_elapsed, empty_tiles, bins.tiles_x * bins.tiles_y,
+                    bins.objects_count);
+        }
+
+        fprintf(stderr, "render: %zux%zu, %.3f s, %.2f Mpix/s\n", crop_width, crop_height,
+                elapsed, (double)(crop_width * crop_height) / elapsed * 1e-6);
+    }
+
+    id_buffer_destroy(&ids);
+    tile_bins_destroy(&bins);
+    traversal_destroy(&traversal);
+
+    float         *rows   = ok ? calloc(crop_width * crop_height * 3, sizeof(float))         : NULL;
+    unsigned char *bitmap = ok ? calloc(crop_width * crop_height * 3, sizeof(unsigned char)) : NULL;
+
+    if (rows && bitmap)
+    {
+        framebuffer_to_rows(fb, rows);
+
+        if (opts->denoise)
+        {
+            double denoise_start = time_now();
+
+            if (!denoise(&scene, rows, crop_width, crop_height))
+                fprintf(stderr, "Not enough memory for denoising\n");
+            else if (opts->stats)
+                fprintf(stderr, "denoise: %.3f s\n", time_now() - denoise_start);
+        }
+
+        char file_name[32];
+
+        if (opts->pfm)
+        {
+            snprintf(file_name, sizeof(file_name), "test%zu.pfm", frame_cnt);
+
+            if (!write_pfm(file_name, rows, crop_width, crop_height))
+                fprintf(stderr, "Can't write %s\n", file_name);
+        }
+
+        double tonemap_start = time_now();
+
+        for (size_t y = 0; y < crop_height; y++)
+            tonemap_apply(&opts->tonemap, &rows[3 * y * crop_width], 3 * crop_width,
+                          &bitmap[3 * y * crop_width]);
+
+        if (opts->stats)
+            fprintf(stderr, "tonemap: %.3f s\n", time_now() - tonemap_start);
+
+        snprintf(file_name, sizeof(file_name), "test%zu.png", frame_cnt);
+
+        stbi_write_png(file_name, crop_width, crop_height, 3, bitmap, 0);
+    }
+    else if (ok)
+    {
+        fprintf(stderr, "Not enough memory for image\n");
+        ok = false;
+    }
+
+    free(rows);
+    free(bitmap);
+
+    if (history)
+    {
+        history->camera = scene.camera;
+        history->valid  = ok;
+    }
+
+    framebuffer_destroy(&local_fb);
+    return ok;
+}
@@ -0,0 +1,88 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdlib.h>
+
+#include "dirty.h"
+#include "framebuffer.h"
+#include "object.h"
+#include "rt.h"
+#include "tonemap.h"
+
+typedef struct render_options
+{
+    bool          wavefront;
+
+    // framebuffer tiles and order of their traversal
+    size_t        tile_size;
+    pixel_order_t tile_order;
+    // order of pixels inside the tile
+    pixel_order_t pixel_order;
+
+    // bin objects into tiles by their projection before tracing primary rays
+    bool          binning;
+
+    // find primary hits by rasterization into ID buffer instead of tracing
+    bool          raster;
+    // shade with approximate pow and normalization
+    bool          fast_math;
+    // trace primary rays too and report pixels where raster result differs,
+    // with fast math report error of the image against exact shading
+    bool          validate;
+
+    // reuse colors of the previous frame where its hits are still visible
+    bool          reproject;
+    // whole frame is traced if more than this fraction of moved samples can't be reused
+    float         reproject_threshold;
+
+    // smooth noise of area light shadows by edge-aware filter of the image
+    bool          denoise;
+
+    // conversion of the float framebuffer to the PNG image
+    tonemap_t     tonemap;
+    // also write the float framebuffer as is to test<frame_cnt>.pfm
+    bool          pfm;
+
+    // print timings to stderr
+    bool          stats;
+} render_options_t;
+
+render_options_t render_options_default();
+
+/**
+ * What the pixel saw, kept for reprojection
+ */
+typedef struct pixel_sample
+{
+    // primary hit, INF distance for background
+    hit_t  hit;
+    // camera position the color was shaded from
+    vec3_t eye;
+} pixel_sample_t;
+
+/**
+ * Image of the previous frame kept for the next one
+ */
+typedef struct frame_history
+{
+    framebuffer_t   fb;
+    // camera the image was taken with
+    camera_t        camera;
+    bool            valid;
+
+    // samples of pixels row by row, kept only for reprojection
+    pixel_sample_t *samples;
+} frame_history_t;
+
+void frame_history_destroy(frame_history_t *history);
+
+/**
+ * Renders crop window of the scene camera and writes it to test<frame_cnt>.png
+ * With history, only tiles of the dirty region are traced into the previous image,
+ * unless the camera changed. With reprojection, the previous image is warped
+ * to the new camera instead, the scene must not change. history and dirty may be NULL
+ */
+bool render(scene_t scene, const render_options_t *opts, frame_history_t *history,
+            const dirty_region_t *dirty, size_t frame_cnt);
+
+#endif
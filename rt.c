@@ -1,125 +1,240 @@
 #include <math.h>
 
+#include "accel.h"
+#include "ao.h"
+#include "lightmap.h"
 #include "rt.h"
+#include "shadow.h"
+#include "shadowmap.h"
 
-const float INF = 1e9;
+const float INF         = 1e9;
+const float SHADOW_BIAS = 1e-1;
+
+// shadow rays to an area light: strata of the first round, and of the second one
+// which is cast only if the first round disagrees
+static const int SOFT_SHADOW_GRID     = 2;
+static const int PENUMBRA_SHADOW_GRID = 4;
 
 // TODO: plane has normal view only at "right side" of normal vector - fix it
 
+void light_phong(color_t *out_ambient, color_t *out_direct, vec3_t frag_pos, vec3_t norm,
+                 vec3_t light_vec, const material_t *mat, const light_t *light, vec3_t view_pos,
+                 bool fast_math)
+{
+    float  diffuse_intensity  = vec_product(norm, light_vec);
+
+    vec3_t view_vec           = {0};
+    vec3_t reflect_vec        = vec_reflect(vec_mul_num(light_vec, -1.f), norm);
+
+    // reflection of the unit vector is already unit
+    if (fast_math)
+        view_vec    = vec_norm_approx(vec_sub(frag_pos, view_pos));
+    else
+    {
+        view_vec    = vec_norm(vec_sub(frag_pos, view_pos));
+        reflect_vec = vec_norm(reflect_vec);
+    }
+
+    float  specular_intensity = vec_product(vec_mul_num(view_vec , -1.f), reflect_vec);
+
+    if (diffuse_intensity < 0)
+        diffuse_intensity = 0;
+
+    if (specular_intensity < 0)
+        specular_intensity = 0;
+
+    if (fast_math)
+        specular_intensity = pow_approx(specular_intensity, mat->shininess);
+    else
+        specular_intensity = powf(specular_intensity, mat->shininess);
+
+    color_t diffuse  = vec_mul(light->diffuse,
+                               vec_mul_num(mat->diffuse, diffuse_intensity));
+    color_t specular = vec_mul(light->specular,
+                               vec_mul_num(mat->specular, specular_intensity));
+
+    *out_ambient = vec_mul(light->ambient, mat->ambient);
+    *out_direct  = vec_add(diffuse, specular);
+}
+
+aabb_t light_bounds(const light_t *light)
+{
+    vec3_t extent = {0};
+
+    if (light->kind == LIGHT_SPHERE)
+        extent = (vec3_t){ light->radius, light->radius, light->radius };
+    else if (light->kind == LIGHT_RECT)
+        extent = (vec3_t){ fabsf(light->half_u.x) + fabsf(light->half_v.x),
+                           fabsf(light->half_u.y) + fabsf(light->half_v.y),
+                           fabsf(light->half_u.z) + fabsf(light->half_v.z) };
+
+    return (aabb_t){ vec_sub(light->position, extent), vec_add(light->position, extent) };
+}
+
+/**
+ * Point of the light for u, v in [0, 1)
+ * Sphere is sampled by its disc facing the fragment
+ */
+static vec3_t light_sample(const light_t *light, vec3_t frag_pos, float u, float v)
+{
+    if (light->kind == LIGHT_RECT)
+        return vec_add(light->position,
+                       vec_add(vec_mul_num(light->half_u, 2.f * u - 1.f),
+                               vec_mul_num(light->half_v, 2.f * v - 1.f)));
+
+    vec3_t tangent = {0}, bitan = {0};
+    vec_basis(vec_norm(vec_sub(frag_pos, light->position)), &tangent, &bitan);
+
+    float radius = light->radius * sqrtf(u);
+    float angle  = 2.f * (float)M_PI * v;
+
+    return vec_add(light->position,
+                   vec_add(vec_mul_num(tangent, radius * cosf(angle)),
+                           vec_mul_num(bitan  , radius * sinf(angle))));
+}
+
+/**
+ * Shadow rays to the light through grid x grid jittered strata
+ * Gives number of unoccluded ones
+ */
+static int light_seen_samples(const scene_t *scene, size_t light_index,
+                              const object_ref_t *receiver, vec3_t frag_pos, vec3_t test_point,
+                              int grid, uint32_t *io_seed)
+{
+    const light_t *light = &scene->lights[light_index];
+
+    int seen = 0;
+
+    for (int i = 0; i < grid * grid; i++)
+    {
+        float u = ((float)(i % grid) + random_next(io_seed)) / (float)grid;
+        float v = ((float)(i / grid) + random_next(io_seed)) / (float)grid;
+
+        vec3_t to_light = vec_sub(light_sample(light, frag_pos, u, v), test_point);
+        float  dist     = vec_length(to_light);
+
+        if (!light_occluded(scene, light_index, receiver, test_point,
+                            vec_mul_num(to_light, 1.f / dist), dist))
+            seen++;
+    }
+
+    return seen;
+}
+
+float light_visibility(const scene_t *scene, size_t light_index, const object_ref_t *receiver,
+                       vec3_t frag_pos, vec3_t norm, vec3_t light_vec)
+{
+    const light_t *light = &scene->lights[light_index];
+
+    if (scene->lightmaps && receiver && lightmap_covers(scene->lightmaps, *receiver))
+        return lightmap_visibility(scene->lightmaps, receiver->index, light_index, frag_pos);
+
+    // slightly move test point along normal to ignore testing surface
+    vec3_t test_point = vec_add(frag_pos, vec_mul_num(norm, SHADOW_BIAS));
+
+    if (scene->shadow_maps && shadow_maps_cover(scene->shadow_maps, scene, light_index))
+        return shadow_maps_visibility(scene->shadow_maps, scene, light_index, test_point);
+
+    if (light->kind == LIGHT_POINT)
+    {
+        float light_dist = vec_length(vec_sub(light->position, test_point));
+        return light_occluded(scene, light_index, receiver, test_point, light_vec, light_dist) ?
+               0.f : 1.f;
+    }
+
+    uint32_t seed = random_seed(frag_pos);
+
+    int count = SOFT_SHADOW_GRID * SOFT_SHADOW_GRID;
+    int seen  = light_seen_samples(scene, light_index, receiver, frag_pos, test_point,
+                                   SOFT_SHADOW_GRID, &seed);
+
+    if (seen == 0 || seen == count)
+        return (float)seen / (float)count;
+
+    // penumbra, both rounds are stratified, so they are simply pooled
+    count += PENUMBRA_SHADOW_GRID * PENUMBRA_SHADOW_GRID;
+    seen  += light_seen_samples(scene, light_index, receiver, frag_pos, test_point,
+                                PENUMBRA_SHADOW_GRID, &seed);
+
+    return (float)seen / (float)count;
+}
+
 /**
  * Kinda fragment shader:
  * common code to calculate color of fragment
  */
-static color_t fragment_shader(vec3_t frag_pos, vec3_t norm, material_t mat, scene_t scene)
+static color_t fragment_shader(vec3_t frag_pos, vec3_t norm, const material_t *mat,
+                               const object_ref_t *object, const scene_t *scene)
 {
-    norm = vec_norm(norm);
+    vec3_t (*norm_fn)(vec3_t) = scene->fast_math ? vec_norm_approx : vec_norm;
+
+    norm = norm_fn(norm);
+
+    float ambient_scale = scene->ao ? ao_cache_ambient(scene->ao, scene, frag_pos, norm) : 1.f;
 
     color_t result_color = {0};
 
     // calculate pixel color
 
-    for (size_t i = 0; i < scene.lights_count; i++)
+    for (size_t i = 0; i < scene->lights_count; i++)
     {
-        vec3_t light_vec = vec_norm(vec_sub(scene.lights[i].position, frag_pos));
+        vec3_t light_vec = norm_fn(vec_sub(scene->lights[i].position, frag_pos));
 
         // check for shadow
 
-        bool shadowed = false;
-
-        for (size_t j = 0; j < scene.spheres_count; j++)
-        {
-            // slightly move test point along normal to ignore testing surface
-            vec3_t test_point = vec_add(frag_pos, vec_mul_num(norm, 1e-1));
-            
-            vec3_t intersect_point = {0};
-            if (ray_sphere_intersect(&intersect_point, test_point, light_vec, scene.spheres[j]))
-            {
-                float light_dist     = vec_length(vec_sub(scene.lights[i].position, test_point));
-                float intersect_dist = vec_length(vec_sub(intersect_point         , test_point));
-
-                if (less_or_eq(intersect_dist, light_dist))
-                {
-                    shadowed = true;
-                    break;
-                }
-            }
-        }
-        
-        float  diffuse_intensity  = vec_product(norm, light_vec);
-
-        vec3_t view_vec           = vec_norm(vec_sub(frag_pos, scene.camera_pos));
-        vec3_t reflect_vec        = vec_norm(vec_reflect(vec_mul_num(light_vec, -1.f), norm));
-        float  specular_intensity = vec_product(vec_mul_num(view_vec , -1.f), reflect_vec);
-
-        if (diffuse_intensity < 0)
-            diffuse_intensity = 0;
-
-        if (specular_intensity < 0)
-            specular_intensity = 0;
-
-        specular_intensity = powf(specular_intensity, mat.shininess);
-
-        color_t ambient  = vec_mul(scene.lights[i].ambient, mat.ambient);
-        color_t diffuse  = vec_mul(scene.lights[i].diffuse,
-                                   vec_mul_num(mat.diffuse, diffuse_intensity));
-        color_t specular = vec_mul(scene.lights[i].specular,
-                                   vec_mul_num(mat.specular, specular_intensity));
-
-        if (shadowed)
+        float visibility = light_visibility(scene, i, object, frag_pos, norm, light_vec);
+
+        color_t ambient = {0}, direct = {0};
+        light_phong(&ambient, &direct, frag_pos, norm, light_vec, mat, &scene->lights[i],
+                    scene->camera.position, scene->fast_math);
+
+        if (scene->ao)
+            ambient = vec_mul_num(ambient, ambient_scale);
+
+        if (visibility == 0.f)
             result_color = vec_add(result_color, ambient);
+        else if (visibility == 1.f)
+            result_color = vec_add(result_color, vec_add(ambient, direct));
         else
-            result_color = vec_add(result_color, vec_add(vec_add(ambient, diffuse), specular));
+            result_color = vec_add(result_color,
+                                   vec_add(ambient, vec_mul_num(direct, visibility)));
     }
 
     return result_color;
 }
 
-color_t ray_trace(vec3_t ray_origin, vec3_t ray_dir, scene_t scene)
+color_t ray_shade(vec3_t ray_origin, vec3_t ray_dir, const hit_t *hit, const scene_t *scene)
 {
-    material_t nearest_frag_mat  = {0};
-    vec3_t     nearest_frag_pos  = {0};
-    vec3_t     nearest_frag_norm = {0};
-    float      nearest_frag_dist = INF;
+    vec3_t            frag_pos  = {0};
+    vec3_t            frag_norm = {0};
+    const material_t *frag_mat  = NULL;
 
-    // find nearest sphere or plane which intersects with ray
+    object_surface(scene, hit, ray_origin, ray_dir, &frag_pos, &frag_norm, &frag_mat);
 
-    for (size_t i = 0; i < scene.spheres_count; i++)
-    {
-        vec3_t intersect_point = {0};
-        if (ray_sphere_intersect(&intersect_point, ray_origin, ray_dir, scene.spheres[i]))
-        {
-            float dist = vec_length(vec_sub(intersect_point, ray_origin));
-            if (dist < nearest_frag_dist)
-            {
-                nearest_frag_dist  = dist;
-                nearest_frag_mat   = scene.spheres[i].material;
-                nearest_frag_pos   = intersect_point;
-                nearest_frag_norm  = vec_norm(vec_sub(intersect_point, scene.spheres[i].position));
-            }
-        }
-    }
+    return fragment_shader(frag_pos, frag_norm, frag_mat, &hit->object, scene);
+}
 
-    for (size_t i = 0; i < scene.planes_count; i++)
-    {
-        vec3_t intersect_point = {0};
-        if (ray_plane_intersect(&intersect_point, ray_origin, ray_dir, scene.planes[i]))
-        {
-            float dist = vec_length(vec_sub(intersect_point, ray_origin));
-            if (dist < nearest_frag_dist)
-            {
-                nearest_frag_dist  = dist;
-                nearest_frag_mat   = scene.planes[i].material;
-                nearest_frag_pos   = intersect_point;
-                nearest_frag_norm  = scene.planes[i].norm;
-            }
-        }
-    }
+color_t ray_trace(vec3_t ray_origin, vec3_t ray_dir, const scene_t *scene)
+{
+    ray_dir = vec_norm(ray_dir);
+
+    // find nearest object which intersects with ray
+
+    hit_t hit = {0};
+    if (!scene_intersect(scene, ray_origin, ray_dir, INF, &hit))
+        return scene->ambient_color;
+
+    return ray_shade(ray_origin, ray_dir, &hit, scene);
+}
+
+color_t ray_trace_objects(vec3_t ray_origin, vec3_t ray_dir, const scene_t *scene,
+                          const object_ref_t *objects, size_t objects_count)
+{
+    ray_dir = vec_norm(ray_dir);
 
-    if (equal(nearest_frag_dist, INF))
-        return scene.ambient_color;
+    hit_t hit = {0};
+    if (!objects_intersect(scene, objects, objects_count, ray_origin, ray_dir, INF, &hit))
+        return scene->ambient_color;
 
-    return fragment_shader(nearest_frag_pos,
-                           nearest_frag_norm,
-                           nearest_frag_mat,
-                           scene);
-}
\ No newline at end of file
+    return ray_shade(ray_origin, ray_dir, &hit, scene);
+}
@@ -1,64 +1,221 @@
 #ifndef RT_H
 #define RT_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "math_lib.h"
+#include "camera.h"
+#include "material.h"
+#include "mesh.h"
+#include "particle_stream.h"
+#include "particles.h"
 
-typedef vec3_t color_t;
-
-typedef struct material
+typedef enum light_kind
 {
-    color_t ambient;
-    color_t diffuse;
-    color_t specular;
-
-    float   shininess;
-} material_t;
-
+    LIGHT_POINT,
+    LIGHT_SPHERE,
+    LIGHT_RECT,
+} light_kind_t;
+
+/**
+ * Shading takes direction to the light from its position,
+ * the area of sphere and rectangle lights only softens shadows
+ */
 typedef struct light
 {
-    vec3_t  position;
-
-    color_t ambient;
-    color_t diffuse;
-    color_t specular;
+    vec3_t       position;
+
+    color_t      ambient;
+    color_t      diffuse;
+    color_t      specular;
+
+    light_kind_t kind;
+    // sphere only
+    float        radius;
+    // rectangle only, centered at the position, sides are 2 * half_u and 2 * half_v
+    vec3_t       half_u;
+    vec3_t       half_v;
 } light_t;
 
+/**
+ * Only the shape, four spheres fill a cache line,
+ * material of each one is in scene sphere materials
+ */
 typedef struct sphere
 {
-    vec3_t     position;
-    float      radius;
-    
-    material_t material;
+    vec3_t   position;
+    float    radius;
 } sphere_t;
 
 // plane is clipped by circle
 typedef struct plane
 {
-    vec3_t     position;
-    vec3_t     norm;
-    float      radius;
-    
-    material_t material;
+    vec3_t   position;
+    vec3_t   norm;
+    float    radius;
+
+    // index in scene materials
+    uint16_t material;
 } plane_t;
 
+typedef enum prototype_kind
+{
+    PROTOTYPE_SPHERE,
+    PROTOTYPE_DISC,
+    PROTOTYPE_MESH,
+    PROTOTYPE_PARTICLES,
+    PROTOTYPE_STREAM,
+} prototype_kind_t;
+
+/**
+ * Geometry shared by instances, given in its own coordinate system
+ * Sphere and disc are centered at the origin
+ */
+typedef struct prototype
+{
+    prototype_kind_t kind;
+
+    float            radius;
+    // disc only
+    vec3_t           norm;
+
+    // mesh only, its hierarchy is the bottom level structure of the prototype
+    const mesh_t    *mesh;
+    // particles only, the same, materials of particles replace the one of the instance
+    const particles_t *particles;
+    // stream only, particles read from the file as rays reach them
+    particle_stream_t *stream;
+} prototype_t;
+
+/**
+ * Placement of the prototype in the scene:
+ * uniform scale, then rotation, then translation
+ */
+typedef struct instance
+{
+    vec3_t   position;
+    float    scale;
+    quat_t   rotation;
+
+    uint32_t prototype;
+    // index in scene materials
+    uint16_t material;
+} instance_t;
+
+struct accel;
+struct ao_cache;
+struct lightmap_cache;
+struct shadow_casters;
+struct shadow_maps;
+
 typedef struct scene
 {
-    sphere_t *spheres;
-    size_t    spheres_count;
+    sphere_t     *spheres;
+    // index in materials of each sphere
+    uint16_t     *sphere_materials;
+    size_t        spheres_count;
+
+    plane_t      *planes;
+    size_t        planes_count;
+
+    mesh_t       *meshes;
+    size_t        meshes_count;
+
+    prototype_t  *prototypes;
+    size_t        prototypes_count;
+
+    instance_t   *instances;
+    size_t        instances_count;
+
+    // materials of spheres, planes, meshes and instances, each one once
+    material_t   *materials;
+    size_t        materials_count;
+
+    light_t      *lights;
+    size_t        lights_count;
+
+    color_t       ambient_color;
+
+    camera_t      camera;
+
+    // top level acceleration structure, scene is traced by brute force if NULL
+    struct accel *accel;
+    // top level hierarchies are built by SAH with these options if not NULL,
+    // by median splits otherwise
+    struct bvh_build_options *accel_build;
+    // scene editor maps its first hierarchy from this cache file if it matches the scene,
+    // and saves it there otherwise, if not NULL
+    const char   *accel_cache;
+
+    // shade with approximate pow and normalization, see light_phong()
+    bool          fast_math;
 
-    plane_t  *planes;
-    size_t    planes_count;
+    // ambient light is occluded by the geometry around through this cache if not NULL
+    struct ao_cache *ao;
 
-    light_t  *lights;
-    size_t    lights_count;
+    // shadow rays of each light are tested against its possible casters only if not NULL
+    struct shadow_casters *casters;
 
-    color_t   ambient_color;
+    // shadows on discs are read from their baked lightmaps if not NULL
+    struct lightmap_cache *lightmaps;
 
-    vec3_t    camera_pos;
+    // shadows of point lights are looked up in their cube maps if not NULL
+    struct shadow_maps *shadow_maps;
 } scene_t;
 
-color_t ray_trace(vec3_t ray_origin, vec3_t ray_dir, scene_t scene);
+extern const float INF;
+
+/**
+ * Distance the shadow ray origin is moved along the surface normal
+ * to not intersect the surface itself
+ */
+extern const float SHADOW_BIAS;
+
+color_t ray_trace(vec3_t ray_origin, vec3_t ray_dir, const scene_t *scene);
+
+/**
+ * Box around all points of the light
+ */
+aabb_t light_bounds(const light_t *light);
+
+struct object_ref;
+
+/**
+ * Fraction of the light seen from the fragment of the receiver object,
+ * light_vec points to the light position
+ * Point light is seen or not, area light is sampled adaptively:
+ * a few shadow rays first, more of them only if those disagree (penumbra)
+ * Baked discs are looked up in their lightmaps instead,
+ * and so are point lights in their shadow maps
+ */
+float light_visibility(const scene_t *scene, size_t light, const struct object_ref *receiver,
+                       vec3_t frag_pos, vec3_t norm, vec3_t light_vec);
+
+/**
+ * Same as ray_trace(), but the ray can hit only the given objects
+ * Shadows are still cast by the whole scene
+ */
+color_t ray_trace_objects(vec3_t ray_origin, vec3_t ray_dir, const scene_t *scene,
+                          const struct object_ref *objects, size_t objects_count);
+
+struct hit;
+
+/**
+ * Color of the ray which is already known to hit the scene at hit
+ * Ray direction must be normalized
+ */
+color_t ray_shade(vec3_t ray_origin, vec3_t ray_dir, const struct hit *hit,
+                  const scene_t *scene);
+
+/**
+ * Phong lighting of the fragment by one light, shadows are not checked
+ * Gives ambient term and direct (diffuse + specular) term separately,
+ * so the caller can drop the direct one if the fragment is shadowed
+ * With fast_math specular power and view vector are approximated
+ */
+void light_phong(color_t *out_ambient, color_t *out_direct, vec3_t frag_pos, vec3_t norm,
+                 vec3_t light_vec, const material_t *mat, const light_t *light, vec3_t view_pos,
+                 bool fast_math);
 
 #endif
\ No newline at end of file
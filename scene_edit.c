@@ -0,0 +1,797 @@
+#include <string.h>
+
+#include "accel_cache.h"
+#include "scene_edit.h"
+
+// no node, no slot or no leaf
+static const uint32_t NONE = UINT32_MAX;
+
+// traversal stack holds 64 nodes, inserted leaves deeper than this trigger rebuild
+static const size_t EDIT_MAX_DEPTH = 48;
+
+// moved object is kept in its leaf while the leaf area grows at most this much
+static const float REFIT_MAX_GROWTH = 2.f;
+
+// storage
+
+/**
+ * Makes room for count elements in two arrays which share capacity
+ * Capacity grows geometrically, so appends cost O(1) on average
+ */
+static bool reserve(void **io_first, size_t first_size, void **io_second, size_t second_size,
+                    size_t *io_capacity, size_t count)
+{
+    if (count <= *io_capacity)
+        return true;
+
+    size_t capacity = *io_capacity > 0 ? *io_capacity : 16;
+    while (capacity < count)
+        capacity *= 2;
+
+    void *first = realloc(*io_first, capacity * first_size);
+    if (!first)
+        return false;
+    *io_first = first;
+
+    void *second = realloc(*io_second, capacity * second_size);
+    if (!second)
+        return false;
+    *io_second = second;
+
+    *io_capacity = capacity;
+    return true;
+}
+
+/**
+ * Makes room for count spheres, their materials and their slots
+ */
+static bool reserve_spheres(scene_editor_t *editor, size_t count)
+{
+    scene_t *scene    = editor->scene;
+    size_t   capacity = editor->spheres_capacity;
+
+    if (count <= capacity)
+        return true;
+
+    if (!reserve((void **)&scene->spheres, sizeof(sphere_t), (void **)&editor->sphere_slots,
+                 sizeof(uint32_t), &capacity, count))
+        return false;
+
+    // capacity is kept until the materials grow too, so a failure here is retried
+    uint16_t *materials = realloc(scene->sphere_materials, capacity * sizeof(uint16_t));
+    if (!materials)
+        return false;
+
+    scene->sphere_materials  = materials;
+    editor->spheres_capacity = capacity;
+    return true;
+}
+
+static void *copy_array(const void *array, size_t count, size_t elem_size)
+{
+    void *copy = malloc((count > 0 ? count : 1) * elem_size);
+
+    if (copy && count > 0)
+        memcpy(copy, array, count * elem_size);
+
+    return copy;
+}
+
+static uint32_t *object_slot(scene_editor_t *editor, object_ref_t object)
+{
+    switch (object.kind)
+    {
+    case OBJECT_SPHERE:
+        return &editor->sphere_slots[object.index];
+
+    case OBJECT_PLANE:
+        return &editor->plane_slots[object.index];
+
+    case OBJECT_MESH:
+        return &editor->mesh_slots[object.index];
+
+    default:
+        return &editor->instance_slots[object.index];
+    }
+}
+
+static void place_object(scene_editor_t *editor, uint32_t slot, object_ref_t object,
+                         uint32_t leaf)
+{
+    editor->accel.objects[slot] = object;
+    editor->slot_leaves[slot]   = leaf;
+
+    *object_slot(editor, object) = slot;
+}
+
+/**
+ * Allocates parents of nodes_count nodes and leaves of slots_count slots
+ */
+static bool alloc_index(size_t nodes_count, size_t slots_count, uint32_t **out_parents,
+                        uint32_t **out_slot_leaves)
+{
+    *out_parents     = malloc((nodes_count > 0 ? nodes_count : 1) * sizeof(uint32_t));
+    *out_slot_leaves = malloc((slots_count > 0 ? slots_count : 1) * sizeof(uint32_t));
+
+    if (!*out_parents || !*out_slot_leaves)
+    {
+        free(*out_parents);
+        free(*out_slot_leaves);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Fills parents and slot leaves of the complete hierarchy of the editor
+ */
+static void index_tree(scene_editor_t *editor)
+{
+    const accel_t *accel = &editor->accel;
+
+    editor->nodes_capacity = accel->bvh.nodes_count;
+    editor->slots_capacity = accel->objects_count;
+
+    if (accel->bvh.nodes_count > 0)
+        editor->parents[0] = NONE;
+
+    for (uint32_t i = 0; i < accel->bvh.nodes_count; i++)
+    {
+        const bvh_node_t *node = &accel->bvh.nodes[i];
+
+        if (node->count == 0)
+        {
+            editor->parents[node->first]     = i;
+            editor->parents[node->first + 1] = i;
+            continue;
+        }
+
+        for (uint32_t slot = node->first; slot < node->first + node->count; slot++)
+            place_object(editor, slot, accel->objects[slot], i);
+    }
+}
+
+/**
+ * Full rebuild of the acceleration structure and its bookkeeping,
+ * through the cache file if the path is not NULL
+ * Lazy hierarchy gets its bookkeeping with the first edit, see complete_lazy()
+ */
+static bool rebuild(scene_editor_t *editor, const char *cache_path)
+{
+    accel_t accel = {0};
+
+    bool ok = cache_path ? accel_build_cached(&accel, editor->scene, cache_path)
+                         : accel_build(&accel, editor->scene);
+    if (!ok)
+        return false;
+
+    uint32_t *parents     = NULL;
+    uint32_t *slot_leaves = NULL;
+
+    if (!accel.bvh.lazy &&
+        !alloc_index(accel.bvh.nodes_count, accel.objects_count, &parents, &slot_leaves))
+    {
+        accel_destroy(&accel);
+        return false;
+    }
+
+    accel_destroy(&editor->accel);
+    free(editor->parents);
+    free(editor->slot_leaves);
+
+    editor->accel          = accel;
+    editor->parents        = parents;
+    editor->slot_leaves    = slot_leaves;
+    editor->nodes_capacity = 0;
+    editor->slots_capacity = 0;
+    editor->garbage        = 0;
+
+    editor->scene->accel   = &editor->accel;
+
+    if (!accel.bvh.lazy)
+        index_tree(editor);
+
+    return true;
+}
+
+/**
+ * Builds the rest of a lazy hierarchy and its bookkeeping, edits need the whole tree
+ */
+static bool complete_lazy(scene_editor_t *editor)
+{
+    if (!editor->accel.bvh.lazy)
+        return true;
+
+    accel_complete(&editor->accel);
+
+    if (!alloc_index(editor->accel.bvh.nodes_count, editor->accel.objects_count,
+                     &editor->parents, &editor->slot_leaves))
+        return false;
+
+    index_tree(editor);
+    return true;
+}
+
+/**
+ * Called when the local update couldn't be done
+ * Scene is traced by brute force if even full rebuild fails,
+ * the next edit will try to rebuild again
+ */
+static bool update_failed(scene_editor_t *editor)
+{
+    if (rebuild(editor, NULL))
+        return true;
+
+    editor->scene->accel = NULL;
+    return false;
+}
+
+// local updates
+
+static bool aabb_equal(aabb_t a, aabb_t b)
+{
+    return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z &&
+           a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+}
+
+/**
+ * Recalculates bounds from the node up to the root
+ * Stops at the first node which bounds didn't change
+ */
+static void refit(scene_editor_t *editor, uint32_t node_index)
+{
+    bvh_node_t *nodes = editor->accel.bvh.nodes;
+
+    // wide hierarchy is collapsed again before the next frame
+    accel_drop_wide(&editor->accel);
+
+    while (node_index != NONE)
+    {
+        bvh_node_t *node   = &nodes[node_index];
+        aabb_t      bounds = aabb_empty();
+
+        if (node->count > 0)
+        {
+            for (uint32_t slot = node->first; slot < node->first + node->count; slot++)
+                bounds = aabb_union(bounds, object_bounds(editor->scene,
+                                                          editor->accel.objects[slot]));
+        }
+        else
+            bounds = aabb_union(nodes[node->first].bounds, nodes[node->first + 1].bounds);
+
+        if (aabb_equal(bounds, node->bounds))
+            return;
+
+        node->bounds = bounds;
+        node_index   = editor->parents[node_index];
+    }
+}
+
+/**
+ * Takes the object out of its leaf, the last object of the leaf takes its slot
+ * Emptied leaf is replaced by its sibling
+ */
+static void remove_slot(scene_editor_t *editor, uint32_t slot)
+{
+    bvh_t      *bvh   = &editor->accel.bvh;
+    bvh_node_t *nodes = bvh->nodes;
+
+    accel_drop_wide(&editor->accel);
+
+    uint32_t leaf = editor->slot_leaves[slot];
+    uint32_t last = nodes[leaf].first + nodes[leaf].count - 1;
+
+    if (slot != last)
+        place_object(editor, slot, editor->accel.objects[last], leaf);
+
+    editor->slot_leaves[last] = NONE;
+    editor->garbage++;
+
+    if (--nodes[leaf].count > 0)
+    {
+        refit(editor, leaf);
+        return;
+    }
+
+    uint32_t parent = editor->parents[leaf];
+
+    if (parent == NONE)
+    {
+        // the tree is empty
+        bvh->nodes_count            = 0;
+        editor->accel.objects_count = 0;
+        editor->garbage             = 0;
+        return;
+    }
+
+    uint32_t sibling = nodes[parent].first == leaf ? leaf + 1 : leaf - 1;
+
+    nodes[parent] = nodes[sibling];
+    editor->garbage += 2;
+
+    if (nodes[parent].count > 0)
+    {
+        for (uint32_t i = nodes[parent].first; i < nodes[parent].first + nodes[parent].count; i++)
+            editor->slot_leaves[i] = parent;
+    }
+    else
+    {
+        editor->parents[nodes[parent].first]     = parent;
+        editor->parents[nodes[parent].first + 1] = parent;
+    }
+
+    refit(editor, editor->parents[parent]);
+}
+
+/**
+ * Puts the object into the leaf which grows least on the way down from the root,
+ * splits the leaf if it is full
+ * Fails if there is no memory or the leaf is too deep
+ */
+static bool insert_object(scene_editor_t *editor, object_ref_t object)
+{
+    bvh_t *bvh = &editor->accel.bvh;
+
+    accel_drop_wide(&editor->accel);
+
+    // split leaf gets two children, the new object gets a slot
+    if (!accel_own(&editor->accel) ||
+        !reserve((void **)&bvh->nodes, sizeof(bvh_node_t), (void **)&editor->parents,
+                 sizeof(uint32_t), &editor->nodes_capacity, bvh->nodes_count + 2) ||
+        !reserve((void **)&editor->accel.objects, sizeof(object_ref_t),
+                 (void **)&editor->slot_leaves, sizeof(uint32_t), &editor->slots_capacity,
+                 editor->accel.objects_count + 1))
+        return false;
+
+    bvh_node_t *nodes  = bvh->nodes;
+    aabb_t      bounds = object_bounds(editor->scene, object);
+
+    if (bvh->nodes_count == 0)
+    {
+        nodes[0]           = (bvh_node_t){ bounds, 0, 1 };
+        editor->parents[0] = NONE;
+        bvh->nodes_count   = 1;
+
+        place_object(editor, 0, object, 0);
+        editor->accel.objects_count = 1;
+        return true;
+    }
+
+    uint32_t node  = 0;
+    size_t   depth = 0;
+
+    while (nodes[node].count == 0)
+    {
+        uint32_t left  = nodes[node].first;
+        uint32_t right = left + 1;
+
+        float left_growth  = aabb_half_area(aabb_union(nodes[left ].bounds, bounds)) -
+                             aabb_half_area(nodes[left ].bounds);
+        float right_growth = aabb_half_area(aabb_union(nodes[right].bounds, bounds)) -
+                             aabb_half_area(nodes[right].bounds);
+
+        node = left_growth <= right_growth ? left : right;
+        depth++;
+    }
+
+    uint32_t end = nodes[node].first + nodes[node].count;
+
+    // the slot after the leaf is free, the leaf can just grow
+    if (nodes[node].count < ACCEL_LEAF_SIZE &&
+        (end == editor->accel.objects_count || editor->slot_leaves[end] == NONE))
+    {
+        if (end == editor->accel.objects_count)
+            editor->accel.objects_count++;
+        else
+            editor->garbage--;
+
+        place_object(editor, end, object, node);
+        nodes[node].count++;
+
+        refit(editor, node);
+        return true;
+    }
+
+    if (depth + 1 > EDIT_MAX_DEPTH)
+        return false;
+
+    // old objects go to the left child, the new one to the right one
+
+    uint32_t left = (uint32_t)bvh->nodes_count;
+    uint32_t slot = (uint32_t)editor->accel.objects_count;
+
+    bvh->nodes_count += 2;
+    editor->accel.objects_count++;
+
+    nodes[left]     = nodes[node];
+    nodes[left + 1] = (bvh_node_t){ bounds, slot, 1 };
+
+    for (uint32_t i = nodes[left].first; i < nodes[left].first + nodes[left].count; i++)
+        editor->slot_leaves[i] = left;
+
+    place_object(editor, slot, object, left + 1);
+
+    nodes[node].first = left;
+    nodes[node].count = 0;
+
+    editor->parents[left]     = node;
+    editor->parents[left + 1] = node;
+
+    refit(editor, node);
+    return true;
+}
+
+/**
+ * Rebuilds everything once removed objects leave more garbage than there are objects,
+ * so removals cost O(log n) on average
+ */
+static void collect_garbage(scene_editor_t *editor)
+{
+    if (editor->garbage > object_count(editor->scene) + 64)
+        update_failed(editor);
+}
+
+// editor
+
+bool scene_editor_init(scene_editor_t *editor, scene_t *scene)
+{
+    memset(editor, 0, sizeof(*editor));
+
+    sphere_t   *spheres   = copy_array(scene->spheres  , scene->spheres_count  , sizeof(sphere_t));
+    plane_t    *planes    = copy_array(scene->planes   , scene->planes_count   , sizeof(plane_t));
+    instance_t *instances = copy_array(scene->instances, scene->instances_count,
+                                       sizeof(instance_t));
+    light_t    *lights    = copy_array(scene->lights   , scene->lights_count   , sizeof(light_t));
+
+    uint16_t   *sphere_materials = copy_array(scene->sphere_materials, scene->spheres_count,
+                                              sizeof(uint16_t));
+
+    editor->sphere_slots   = calloc(scene->spheres_count   > 0 ? scene->spheres_count   : 1,
+                                    sizeof(uint32_t));
+    editor->plane_slots    = calloc(scene->planes_count    > 0 ? scene->planes_count    : 1,
+                                    sizeof(uint32_t));
+    editor->mesh_slots     = calloc(scene->meshes_count    > 0 ? scene->meshes_count    : 1,
+                                    sizeof(uint32_t));
+    editor->instance_slots = calloc(scene->instances_count > 0 ? scene->instances_count : 1,
+                                    sizeof(uint32_t));
+
+    if (!spheres || !sphere_materials || !planes || !instances || !lights ||
+        !editor->sphere_slots || !editor->plane_slots || !editor->mesh_slots ||
+        !editor->instance_slots)
+    {
+        free(spheres);
+        free(sphere_materials);
+        free(planes);
+        free(instances);
+        free(lights);
+        free(editor->sphere_slots);
+        free(editor->plane_slots);
+        free(editor->mesh_slots);
+        free(editor->instance_slots);
+
+        memset(editor, 0, sizeof(*editor));
+        return false;
+    }
+
+    scene->spheres          = spheres;
+    scene->sphere_materials = sphere_materials;
+    scene->planes           = planes;
+    scene->instances        = instances;
+    scene->lights           = lights;
+
+    editor->scene              = scene;
+    editor->spheres_capacity   = scene->spheres_count;
+    editor->planes_capacity    = scene->planes_count;
+    editor->instances_capacity = scene->instances_count;
+    editor->lights_capacity    = scene->lights_count;
+
+    if (!rebuild(editor, scene->accel_cache))
+    {
+        scene_editor_destroy(editor);
+        return false;
+    }
+
+    return true;
+}
+
+void scene_editor_destroy(scene_editor_t *editor)
+{
+    scene_t *scene = editor->scene;
+
+    if (scene)
+    {
+        free(scene->spheres);
+        free(scene->sphere_materials);
+        free(scene->planes);
+        free(scene->instances);
+        free(scene->lights);
+
+        scene->spheres          = NULL;
+        scene->sphere_materials = NULL;
+        scene->planes    = NULL;
+        scene->instances = NULL;
+        scene->lights    = NULL;
+
+        scene->spheres_count   = 0;
+        scene->planes_count    = 0;
+        scene->instances_count = 0;
+        scene->lights_count    = 0;
+
+        scene->accel = NULL;
+    }
+
+    accel_destroy(&editor->accel);
+    dirty_region_destroy(&editor->dirty);
+
+    free(editor->parents);
+    free(editor->slot_leaves);
+    free(editor->sphere_slots);
+    free(editor->plane_slots);
+    free(editor->mesh_slots);
+    free(editor->instance_slots);
+
+    memset(editor, 0, sizeof(*editor));
+}
+
+/**
+ * Inserts object which was just appended to the scene
+ */
+static bool add_object(scene_editor_t *editor, object_ref_t object, object_ref_t *out_object)
+{
+    if (out_object)
+        *out_object = object;
+
+    bool ok = true;
+
+    if (!editor->scene->accel || !complete_lazy(editor) || !insert_object(editor, object))
+        ok = update_failed(editor);
+
+    dirty_mark_object(&editor->dirty, editor->scene, object);
+    return ok;
+}
+
+bool scene_add_sphere(scene_editor_t *editor, sphere_t sphere, uint16_t material,
+                      object_ref_t *out_object)
+{
+    scene_t *scene = editor->scene;
+
+    if (material >= scene->materials_count || !reserve_spheres(editor, scene->spheres_count + 1))
+        return false;
+
+    scene->spheres         [scene->spheres_count] = sphere;
+    scene->sphere_materials[scene->spheres_count] = material;
+
+    object_ref_t object = { (uint32_t)scene->spheres_count++, OBJECT_SPHERE };
+    return add_object(editor, object, out_object);
+}
+
+bool scene_add_plane(scene_editor_t *editor, plane_t plane, object_ref_t *out_object)
+{
+    scene_t *scene = editor->scene;
+
+    if (plane.material >= scene->materials_count ||
+        !reserve((void **)&scene->planes, sizeof(plane_t), (void **)&editor->plane_slots,
+                 sizeof(uint32_t), &editor->planes_capacity, scene->planes_count + 1))
+        return false;
+
+    scene->planes[scene->planes_count] = plane;
+
+    object_ref_t object = { (uint32_t)scene->planes_count++, OBJECT_PLANE };
+    return add_object(editor, object, out_object);
+}
+
+bool scene_add_instance(scene_editor_t *editor, instance_t instance, object_ref_t *out_object)
+{
+    scene_t *scene = editor->scene;
+
+    if (instance.material >= scene->materials_count ||
+        !reserve((void **)&scene->instances, sizeof(instance_t),
+                 (void **)&editor->instance_slots, sizeof(uint32_t),
+                 &editor->instances_capacity, scene->instances_count + 1))
+        return false;
+
+    scene->instances[scene->instances_count] = instance;
+
+    object_ref_t object = { (uint32_t)scene->instances_count++, OBJECT_INSTANCE };
+    return add_object(editor, object, out_object);
+}
+
+bool scene_remove_object(scene_editor_t *editor, object_ref_t object)
+{
+    scene_t *scene = editor->scene;
+
+    if (object.kind == OBJECT_MESH)
+        return false;
+
+    dirty_mark_object(&editor->dirty, scene, object);
+
+    bool has_accel = scene->accel != NULL && complete_lazy(editor);
+
+    if (has_accel)
+        remove_slot(editor, *object_slot(editor, object));
+
+    // the last object of the kind moves into the hole
+
+    size_t last = 0;
+
+    switch (object.kind)
+    {
+    case OBJECT_SPHERE:
+        last = --scene->spheres_count;
+        scene->spheres         [object.index] = scene->spheres         [last];
+        scene->sphere_materials[object.index] = scene->sphere_materials[last];
+        break;
+
+    case OBJECT_PLANE:
+        last = --scene->planes_count;
+        scene->planes[object.index] = scene->planes[last];
+        break;
+
+    default:
+        last = --scene->instances_count;
+        scene->instances[object.index] = scene->instances[last];
+        break;
+    }
+
+    if (!has_accel)
+        return update_failed(editor);
+
+    if (object.index != last)
+    {
+        uint32_t slot = *object_slot(editor, (object_ref_t){ (uint32_t)last, object.kind });
+
+        *object_slot(editor, object)  = slot;
+        editor->accel.objects[slot] = object;
+    }
+
+    collect_garbage(editor);
+    return true;
+}
+
+/**
+ * Refits the leaf of the moved object, or reinserts the object if the leaf would grow too much
+ */
+static bool move_in_accel(scene_editor_t *editor, object_ref_t object)
+{
+    scene_t *scene = editor->scene;
+
+    if (!scene->accel || !complete_lazy(editor))
+        return update_failed(editor);
+
+    uint32_t    slot = *object_slot(editor, object);
+    uint32_t    leaf = editor->slot_leaves[slot];
+    bvh_node_t *node = &editor->accel.bvh.nodes[leaf];
+
+    aabb_t grown = aabb_union(node->bounds, object_bounds(scene, object));
+
+    if (aabb_half_area(grown) <= REFIT_MAX_GROWTH * aabb_half_area(node->bounds))
+    {
+        refit(editor, leaf);
+        return true;
+    }
+
+    remove_slot(editor, slot);
+
+    if (!insert_object(editor, object))
+        return update_failed(editor);
+
+    collect_garbage(editor);
+    return true;
+}
+
+bool scene_move_object(scene_editor_t *editor, object_ref_t object, vec3_t position)
+{
+    scene_t *scene = editor->scene;
+
+    if (object.kind == OBJECT_MESH)
+        return false;
+
+    // both where the object was and where it goes
+    dirty_mark_object(&editor->dirty, scene, object);
+
+    switch (object.kind)
+    {
+    case OBJECT_SPHERE:
+        scene->spheres[object.index].position = position;
+        break;
+
+    case OBJECT_PLANE:
+        scene->planes[object.index].position = position;
+        break;
+
+    default:
+        scene->instances[object.index].position = position;
+        break;
+    }
+
+    bool ok = move_in_accel(editor, object);
+
+    dirty_mark_object(&editor->dirty, scene, object);
+    return ok;
+}
+
+/**
+ * Sets material of sphere, plane or mesh, gives false for instances
+ */
+static bool set_material(scene_t *scene, object_ref_t object, uint16_t material)
+{
+    switch (object.kind)
+    {
+    case OBJECT_SPHERE:
+        scene->sphere_materials[object.index] = material;
+        return true;
+
+    case OBJECT_PLANE:
+        scene->planes[object.index].material = material;
+        return true;
+
+    case OBJECT_MESH:
+        scene->meshes[object.index].material = material;
+        return true;
+    }
+
+    return false;
+}
+
+bool scene_set_material(scene_editor_t *editor, object_ref_t object, uint16_t material)
+{
+    if (material >= editor->scene->materials_count ||
+        !set_material(editor->scene, object, material))
+        return false;
+
+    dirty_mark_footprint(&editor->dirty, editor->scene, object);
+    return true;
+}
+
+bool scene_set_instance_material(scene_editor_t *editor, size_t instance, uint16_t material)
+{
+    scene_t *scene = editor->scene;
+
+    if (material >= scene->materials_count)
+        return false;
+
+    scene->instances[instance].material = material;
+
+    dirty_mark_footprint(&editor->dirty, scene, (object_ref_t){ (uint32_t)instance,
+                                                                OBJECT_INSTANCE });
+    return true;
+}
+
+bool scene_add_light(scene_editor_t *editor, light_t light)
+{
+    scene_t *scene = editor->scene;
+
+    if (scene->lights_count + 1 > editor->lights_capacity)
+    {
+        size_t capacity = editor->lights_capacity > 0 ? 2 * editor->lights_capacity : 4;
+
+        light_t *lights = realloc(scene->lights, capacity * sizeof(light_t));
+        if (!lights)
+            return false;
+
+        scene->lights           = lights;
+        editor->lights_capacity = capacity;
+    }
+
+    scene->lights[scene->lights_count++] = light;
+
+    dirty_mark_whole_frame(&editor->dirty);
+    return true;
+}
+
+void scene_remove_light(scene_editor_t *editor, size_t light)
+{
+    scene_t *scene = editor->scene;
+
+    scene->lights[light] = scene->lights[--scene->lights_count];
+
+    dirty_mark_whole_frame(&editor->dirty);
+}
+
+void scene_move_light(scene_editor_t *editor, size_t light, vec3_t position)
+{
+    editor->scene->lights[light].position = position;
+
+    dirty_mark_whole_frame(&editor->dirty);
+}
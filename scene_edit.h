@@ -0,0 +1,113 @@
+#ifndef SCENE_EDIT_H
+#define SCENE_EDIT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "accel.h"
+#include "dirty.h"
+#include "object.h"
+#include "rt.h"
+
+/**
+ * Owner of a live scene which can be edited between frames
+ * Keeps spheres with their materials, planes, instances and lights of the scene
+ * in its own growable arrays
+ * and updates the acceleration structure locally on every edit:
+ * small moves refit the leaf and its ancestors, big moves and additions reinsert
+ * the object into the best fitting leaf. Full rebuild happens only when removed
+ * objects leave more garbage than live entries or the tree gets too deep
+ * Edits drop the wide hierarchy, render() collapses it again
+ * The first hierarchy comes from scene->accel_cache if it is set, its mapped arrays
+ * move to the heap once an insertion has to grow them
+ * Lazy hierarchy is completed by the first edit which changes it
+ *
+ * Every edit also marks the part of the frame it changes in dirty,
+ * the caller clears it once the frame is rendered
+ *
+ * Meshes, prototypes and materials stay owned by the caller
+ */
+typedef struct scene_editor
+{
+    scene_t  *scene;
+    accel_t   accel;
+
+    size_t    spheres_capacity;
+    size_t    planes_capacity;
+    size_t    instances_capacity;
+    size_t    lights_capacity;
+
+    // capacity of accel nodes and objects
+    size_t    nodes_capacity;
+    size_t    slots_capacity;
+
+    // parent of each node, root has none
+    uint32_t *parents;
+    // leaf which holds each slot of accel objects, none for free slots
+    uint32_t *slot_leaves;
+
+    // slot of each object in accel objects, by object kind
+    uint32_t *sphere_slots;
+    uint32_t *plane_slots;
+    uint32_t *mesh_slots;
+    uint32_t *instance_slots;
+
+    // nodes and slots which are no longer used
+    size_t    garbage;
+
+    // changes since the last dirty_region_clear()
+    dirty_region_t dirty;
+} scene_editor_t;
+
+/**
+ * Takes over the scene: copies its spheres, planes, instances and lights,
+ * builds acceleration structure and points scene->accel to it
+ * The scene must outlive the editor
+ */
+bool scene_editor_init(scene_editor_t *editor, scene_t *scene);
+
+/**
+ * Frees copied arrays and acceleration structure, scene is left empty of them
+ */
+void scene_editor_destroy(scene_editor_t *editor);
+
+/**
+ * Material of the sphere, the plane and the instance is an index in scene materials,
+ * adding objects with materials out of range fails
+ */
+bool scene_add_sphere  (scene_editor_t *editor, sphere_t sphere, uint16_t material,
+                        object_ref_t *out_object);
+bool scene_add_plane   (scene_editor_t *editor, plane_t    plane   , object_ref_t *out_object);
+bool scene_add_instance(scene_editor_t *editor, instance_t instance, object_ref_t *out_object);
+
+/**
+ * Removes sphere, plane or instance
+ * The last object of the same kind takes index of the removed one
+ * Meshes can't be removed, prototypes may refer to them
+ */
+bool scene_remove_object(scene_editor_t *editor, object_ref_t object);
+
+/**
+ * Moves center of sphere, plane or instance to position
+ * Meshes can't be moved, their triangles would need rebuild
+ */
+bool scene_move_object(scene_editor_t *editor, object_ref_t object, vec3_t position);
+
+/**
+ * Changes material of sphere, plane or mesh to the one at index material in scene materials
+ * Instances have their own, see scene_set_instance_material()
+ */
+bool scene_set_material(scene_editor_t *editor, object_ref_t object, uint16_t material);
+
+bool scene_set_instance_material(scene_editor_t *editor, size_t instance, uint16_t material);
+
+bool scene_add_light(scene_editor_t *editor, light_t light);
+
+/**
+ * The last light takes index of the removed one
+ */
+void scene_remove_light(scene_editor_t *editor, size_t light);
+
+void scene_move_light(scene_editor_t *editor, size_t light, vec3_t position);
+
+#endif
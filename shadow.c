@@ -0,0 +1,221 @@
+#include <math.h>
+#include <string.h>
+
+#include "shadow.h"
+
+/**
+ * Box scaled by factor from the light, it is still axis aligned
+ */
+static aabb_t scale_from(aabb_t box, aabb_t light, float factor)
+{
+    // l + factor * (b - l) = (1 - factor) * l + factor * b, and 1 - factor <= 0
+    return (aabb_t){ vec_add(vec_mul_num(light.max, 1.f - factor), vec_mul_num(box.min, factor)),
+                     vec_add(vec_mul_num(light.min, 1.f - factor), vec_mul_num(box.max, factor)) };
+}
+
+shadow_volume_t shadow_volume(aabb_t box, const light_t *light, aabb_t receivers)
+{
+    shadow_volume_t volume = {0};
+
+    aabb_t source = light_bounds(light);
+
+    // shadow rays start this far off their surface
+    vec3_t bias = { SHADOW_BIAS, SHADOW_BIAS, SHADOW_BIAS };
+    box = (aabb_t){ vec_sub(box.min, bias), vec_add(box.max, bias) };
+
+    vec3_t gap = { fmaxf(fmaxf(source.min.x - box.max.x, box.min.x - source.max.x), 0.f),
+                   fmaxf(fmaxf(source.min.y - box.max.y, box.min.y - source.max.y), 0.f),
+                   fmaxf(fmaxf(source.min.z - box.max.z, box.min.z - source.max.z), 0.f) };
+
+    vec3_t center = aabb_center(source);
+    float  spread = vec_length(vec_sub(source.max, center));
+
+    float near_dist = vec_length(gap);
+    float far_dist  = 0.f;
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vec3_t point = { corner & 1 ? receivers.max.x : receivers.min.x,
+                         corner & 2 ? receivers.max.y : receivers.min.y,
+                         corner & 4 ? receivers.max.z : receivers.min.z };
+
+        far_dist = fmaxf(far_dist, vec_length(vec_sub(point, center)) + spread);
+    }
+
+    volume.box        = box;
+    volume.source     = source;
+    volume.receivers  = receivers;
+    volume.everywhere = near_dist <= 0.f;
+
+    if (volume.everywhere)
+        return volume;
+
+    volume.scale = fmaxf(far_dist / near_dist, 1.f);
+    volume.step  = powf(volume.scale, 1.f / (float)SHADOW_SEGMENTS);
+
+    return volume;
+}
+
+aabb_t shadow_volume_segment(const shadow_volume_t *volume, int segment)
+{
+    float  from = powf(volume->step, (float)segment);
+    float  to   = segment + 1 < SHADOW_SEGMENTS ? from * volume->step : volume->scale;
+
+    aabb_t hull = aabb_union(scale_from(volume->box, volume->source, from),
+                             scale_from(volume->box, volume->source, to));
+
+    return aabb_intersection(hull, volume->receivers);
+}
+
+// caster lists
+
+/**
+ * Checks if any object under the node other than the caster overlaps the box
+ */
+static bool node_receives(const scene_t *scene, uint32_t node_index, object_ref_t caster,
+                          aabb_t box)
+{
+    const accel_t    *accel = scene->accel;
+    const bvh_node_t *node  = bvh_node(&accel->bvh, node_index);
+
+    if (!aabb_valid(aabb_intersection(node->bounds, box)))
+        return false;
+
+    if (node->count == 0)
+        return node_receives(scene, node->first, caster, box) ||
+               node_receives(scene, node->first + 1, caster, box);
+
+    for (uint32_t i = node->first; i < node->first + node->count; i++)
+    {
+        object_ref_t object = accel_object(accel, i);
+        if (object.kind == caster.kind && object.index == caster.index)
+            continue;
+
+        if (aabb_valid(aabb_intersection(object_bounds(scene, object), box)))
+            return true;
+    }
+
+    return false;
+}
+
+static bool box_receives(const scene_t *scene, object_ref_t caster, aabb_t box)
+{
+    if (scene->accel && scene->accel->bvh.nodes_count > 0)
+        return node_receives(scene, 0, caster, box);
+
+    size_t count = object_count(scene);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        object_ref_t object = object_by_number(scene, i);
+        if (object.kind == caster.kind && object.index == caster.index)
+            continue;
+
+        if (aabb_valid(aabb_intersection(object_bounds(scene, object), box)))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Checks if the shadow of the caster from the light may fall on any other object
+ */
+static bool shadows_others(const scene_t *scene, object_ref_t caster, const light_t *light,
+                           aabb_t receivers)
+{
+    shadow_volume_t volume = shadow_volume(object_bounds(scene, caster), light, receivers);
+
+    if (volume.everywhere)
+        return true;
+
+    for (int i = 0; i < SHADOW_SEGMENTS; i++)
+    {
+        aabb_t segment = shadow_volume_segment(&volume, i);
+
+        if (aabb_valid(segment) && box_receives(scene, caster, segment))
+            return true;
+    }
+
+    return false;
+}
+
+bool shadow_casters_build(shadow_casters_t *casters, const scene_t *scene)
+{
+    shadow_casters_destroy(casters);
+
+    size_t count = object_count(scene);
+
+    object_ref_t *list   = calloc(count > 0 ? count : 1, sizeof(object_ref_t));
+    accel_t      *lights = calloc(scene->lights_count > 0 ? scene->lights_count : 1,
+                                  sizeof(accel_t));
+
+    if (!list || !lights)
+    {
+        free(list);
+        free(lights);
+        return false;
+    }
+
+    casters->lights        = lights;
+    casters->objects_count = count;
+
+    aabb_t receivers = aabb_empty();
+
+    for (size_t i = 0; i < count; i++)
+        receivers = aabb_union(receivers, object_bounds(scene, object_by_number(scene, i)));
+
+    for (size_t i = 0; i < scene->lights_count; i++)
+    {
+        size_t list_count = 0;
+
+        for (size_t j = 0; j < count; j++)
+        {
+            object_ref_t object = object_by_number(scene, j);
+
+            if (object_casts_shadow(scene, object) &&
+                shadows_others(scene, object, &scene->lights[i], receivers))
+                list[list_count++] = object;
+        }
+
+        if (!accel_build_objects(&lights[i], scene, list, list_count))
+        {
+            free(list);
+            shadow_casters_destroy(casters);
+            return false;
+        }
+
+        casters->lights_count++;
+        casters->casters_count += list_count;
+    }
+
+    casters->built = true;
+
+    free(list);
+    return true;
+}
+
+void shadow_casters_destroy(shadow_casters_t *casters)
+{
+    for (size_t i = 0; i < casters->lights_count; i++)
+        accel_destroy(&casters->lights[i]);
+
+    free(casters->lights);
+
+    memset(casters, 0, sizeof(*casters));
+}
+
+bool light_occluded(const scene_t *scene, size_t light, const object_ref_t *receiver,
+                    vec3_t ray_origin, vec3_t ray_dir, float max_dist)
+{
+    const shadow_casters_t *casters = scene->casters;
+
+    if (!casters || !receiver || light >= casters->lights_count)
+        return scene_occluded(scene, ray_origin, ray_dir, max_dist);
+
+    if (object_casts_shadow(scene, *receiver) &&
+        object_occluded(scene, *receiver, ray_origin, ray_dir, max_dist))
+        return true;
+
+    return accel_occluded(scene, &casters->lights[light], ray_origin, ray_dir, max_dist);
+}
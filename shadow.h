@@ -0,0 +1,74 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stdlib.h>
+
+#include "accel.h"
+#include "bvh.h"
+#include "object.h"
+#include "rt.h"
+
+// pieces the shadow volume is cut into, each is bounded by its own box
+#define SHADOW_SEGMENTS 8
+
+/**
+ * Where the box may shadow anything from the light:
+ * inside the box scaled from the light until it leaves the receivers,
+ * area light is taken by its bounds. The way is cut into segments,
+ * hull of the box scaled to both ends of the segment bounds its piece
+ */
+typedef struct shadow_volume
+{
+    // caster box grown by the shadow bias, and the light bounds
+    aabb_t box;
+    aabb_t source;
+    // bounds of everything which can receive the shadow
+    aabb_t receivers;
+
+    // scale of the box at the far end, and ratio of the scales of each segment
+    float  scale;
+    float  step;
+
+    // light inside the box shadows everything
+    bool   everywhere;
+} shadow_volume_t;
+
+shadow_volume_t shadow_volume(aabb_t box, const light_t *light, aabb_t receivers);
+
+/**
+ * Bounds of the segment of the volume inside the receivers, not valid if there are none
+ */
+aabb_t shadow_volume_segment(const shadow_volume_t *volume, int segment);
+
+/**
+ * Per light lists of objects which may shadow any other object, found by their
+ * shadow volumes. Shadow rays of the light traverse a hierarchy over its casters only
+ * Object shadowing itself is left out of the lists, the receiver is tested separately
+ * Lists are valid only for the geometry and lights they were built for
+ */
+typedef struct shadow_casters
+{
+    // hierarchy over the casters of each light
+    accel_t *lights;
+    size_t   lights_count;
+
+    // casters of all lights together, and objects they were chosen from
+    size_t   casters_count;
+    size_t   objects_count;
+
+    bool     built;
+} shadow_casters_t;
+
+bool shadow_casters_build(shadow_casters_t *casters, const scene_t *scene);
+
+void shadow_casters_destroy(shadow_casters_t *casters);
+
+/**
+ * Checks if the shadow ray to the light is blocked by its casters or by the receiver itself
+ * Uses the whole scene if it has no caster lists, receiver may be NULL then
+ * Ray direction must be normalized
+ */
+bool light_occluded(const scene_t *scene, size_t light, const object_ref_t *receiver,
+                    vec3_t ray_origin, vec3_t ray_dir, float max_dist);
+
+#endif
@@ -0,0 +1,170 @@
+#include <math.h>
+#include <string.h>
+
+#include "accel.h"
+#include "object.h"
+#include "shadowmap.h"
+
+// texels around the direction compared by PCF, (2 * radius + 1)^2 of them
+static const int   SHADOW_MAP_PCF_RADIUS = 1;
+// depth tolerance in texel sizes at the fragment distance, covers the PCF footprint
+// on curved casters
+static const float SHADOW_MAP_SLOPE      = 3.f;
+// non casters (discs) a caster ray passes through before it gives up
+static const int   SHADOW_MAP_MAX_SKIPS  = 4;
+
+static float component(vec3_t vec, int axis)
+{
+    return axis == 0 ? vec.x : axis == 1 ? vec.y : vec.z;
+}
+
+/**
+ * Direction through the texel center, face axis is face / 2, negative for odd faces
+ * The other two axes follow it cyclically
+ */
+static vec3_t texel_dir(int face, size_t resolution, size_t x, size_t y)
+{
+    int   axis = face / 2;
+    float res  = (float)resolution;
+
+    float coords[3] = {0};
+    coords[axis]           = face % 2 ? -1.f : 1.f;
+    coords[(axis + 1) % 3] = 2.f * ((float)x + 0.5f) / res - 1.f;
+    coords[(axis + 2) % 3] = 2.f * ((float)y + 0.5f) / res - 1.f;
+
+    return vec_norm((vec3_t){ coords[0], coords[1], coords[2] });
+}
+
+/**
+ * Distance to the nearest shadow caster, INF if there is none
+ */
+static float caster_depth(const scene_t *scene, vec3_t origin, vec3_t dir)
+{
+    float depth = 0.f;
+
+    for (int i = 0; i <= SHADOW_MAP_MAX_SKIPS; i++)
+    {
+        hit_t hit = {0};
+        if (!scene_intersect(scene, origin, dir, INF, &hit))
+            return INF;
+
+        depth += hit.dist;
+
+        if (object_casts_shadow(scene, hit.object))
+            return depth;
+
+        origin = vec_add(origin, vec_mul_num(dir, hit.dist));
+    }
+
+    return INF;
+}
+
+bool shadow_maps_cover(const shadow_maps_t *maps, const scene_t *scene, size_t light)
+{
+    return light < maps->lights_count && scene->lights[light].kind == LIGHT_POINT;
+}
+
+bool shadow_maps_build(shadow_maps_t *maps, const scene_t *scene)
+{
+    size_t res        = maps->resolution;
+    size_t face_size  = res * res;
+    size_t light_size = 6 * face_size;
+    size_t count      = scene->lights_count * light_size;
+
+    if (maps->lights_count != scene->lights_count)
+    {
+        free(maps->depth);
+        maps->lights_count = 0;
+
+        maps->depth = malloc((count > 0 ? count : 1) * sizeof(float));
+        if (!maps->depth)
+            return false;
+
+        maps->lights_count = scene->lights_count;
+    }
+
+    maps->rays = 0;
+
+    for (size_t i = 0; i < scene->lights_count; i++)
+    {
+        const light_t *light = &scene->lights[i];
+
+        if (light->kind != LIGHT_POINT)
+            continue;
+
+        for (int face = 0; face < 6; face++)
+        {
+            float *texels = &maps->depth[i * light_size + (size_t)face * face_size];
+
+            for (size_t y = 0; y < res; y++)
+            {
+                for (size_t x = 0; x < res; x++)
+                    texels[y * res + x] = caster_depth(scene, light->position,
+                                                       texel_dir(face, res, x, y));
+            }
+        }
+
+        maps->rays += light_size;
+    }
+
+    return true;
+}
+
+void shadow_maps_destroy(shadow_maps_t *maps)
+{
+    free(maps->depth);
+
+    size_t resolution = maps->resolution;
+
+    memset(maps, 0, sizeof(*maps));
+    maps->resolution = resolution;
+}
+
+float shadow_maps_visibility(const shadow_maps_t *maps, const scene_t *scene, size_t light,
+                             vec3_t test_point)
+{
+    vec3_t to_point = vec_sub(test_point, scene->lights[light].position);
+    float  dist     = vec_length(to_point);
+
+    // major axis picks the face
+    int axis = 0;
+    for (int i = 1; i < 3; i++)
+    {
+        if (fabsf(component(to_point, i)) > fabsf(component(to_point, axis)))
+            axis = i;
+    }
+
+    float major = component(to_point, axis);
+    int   face  = 2 * axis + (major < 0.f ? 1 : 0);
+
+    size_t res = maps->resolution;
+    float  u   = component(to_point, (axis + 1) % 3) / fabsf(major);
+    float  v   = component(to_point, (axis + 2) % 3) / fabsf(major);
+
+    int x = (int)floorf((u + 1.f) / 2.f * (float)res);
+    int y = (int)floorf((v + 1.f) / 2.f * (float)res);
+
+    const float *texels = &maps->depth[(light * 6 + (size_t)face) * res * res];
+
+    // texel spans about 2 / res radians near the face center
+    float tolerance = SHADOW_MAP_SLOPE * 2.f * dist / (float)res;
+
+    int lit = 0, taps = 0;
+
+    for (int dy = -SHADOW_MAP_PCF_RADIUS; dy <= SHADOW_MAP_PCF_RADIUS; dy++)
+    {
+        for (int dx = -SHADOW_MAP_PCF_RADIUS; dx <= SHADOW_MAP_PCF_RADIUS; dx++)
+        {
+            // taps past the face edge are clamped to it
+            int tx = x + dx < 0 ? 0 : x + dx >= (int)res ? (int)res - 1 : x + dx;
+            int ty = y + dy < 0 ? 0 : y + dy >= (int)res ? (int)res - 1 : y + dy;
+
+            if (dist <= texels[(size_t)ty * res + (size_t)tx] + tolerance)
+                lit++;
+
+            taps++;
+        }
+    }
+
+    return (float)lit / (float)taps;
+}
@@ -0,0 +1,48 @@
+#ifndef SHADOWMAP_H
+#define SHADOWMAP_H
+
+#include <stdlib.h>
+
+#include "rt.h"
+
+/**
+ * Cube shadow maps of point lights, rendered once per frame:
+ * each texel of the six faces holds distance from the light to the nearest
+ * shadow caster in its direction. Fragment is lit if it is not farther
+ * than the casters around its direction, which are filtered by PCF,
+ * so shadow cost doesn't depend on the number of objects
+ * Area lights are not mapped, their shadow rays are traced
+ */
+typedef struct shadow_maps
+{
+    // texels per side of each face
+    size_t resolution;
+
+    // six faces of each light, +x, -x, +y, -y, +z, -z, row by row
+    float *depth;
+    size_t lights_count;
+
+    // caster rays of the last build
+    size_t rays;
+} shadow_maps_t;
+
+/**
+ * Renders maps of all point lights of the scene at the resolution set in maps
+ */
+bool shadow_maps_build(shadow_maps_t *maps, const scene_t *scene);
+
+void shadow_maps_destroy(shadow_maps_t *maps);
+
+/**
+ * Checks if the light has a map
+ */
+bool shadow_maps_cover(const shadow_maps_t *maps, const scene_t *scene, size_t light);
+
+/**
+ * Fraction of the light seen from the shadow ray origin, by depth compare
+ * with the map texels around the direction to it
+ */
+float shadow_maps_visibility(const shadow_maps_t *maps, const scene_t *scene, size_t light,
+                             vec3_t test_point);
+
+#endif
@@ -0,0 +1,225 @@
+#include <math.h>
+#include <string.h>
+
+#include "stress.h"
+
+// box seen by the default camera, the floor is at its bottom
+static const float STRESS_BOX_WIDTH  = 32.f;
+static const float STRESS_BOX_HEIGHT = 16.f;
+static const float STRESS_BOX_TOP    = -9.f;
+static const float STRESS_BOX_NEAR   = 4.f;
+
+// spheres per cluster of the clustered layout
+static const size_t STRESS_CLUSTER_SIZE = 256;
+
+// lights ring above the box
+static const float STRESS_LIGHTS_HEIGHT = -10.f;
+static const float STRESS_LIGHTS_RADIUS = 20.f;
+
+stress_options_t stress_options_default()
+{
+    stress_options_t opts = {0};
+
+    opts.layout  = STRESS_UNIFORM;
+    opts.lights  = 2;
+    opts.seed    = 1;
+    opts.overlap = 0.5f;
+    opts.depth   = 2.f;
+
+    return opts;
+}
+
+bool stress_layout_parse(const char *name, stress_layout_t *out_layout)
+{
+    if (strcmp(name, "uniform") == 0)
+        *out_layout = STRESS_UNIFORM;
+    else if (strcmp(name, "clustered") == 0)
+        *out_layout = STRESS_CLUSTERED;
+    else if (strcmp(name, "grid") == 0)
+        *out_layout = STRESS_GRID;
+    else
+        return false;
+
+    return true;
+}
+
+/**
+ * Deterministic pseudo random number in [0, 1)
+ */
+static float random_unit(uint32_t *io_seed)
+{
+    *io_seed = *io_seed * 1103515245u + 12345u;
+
+    return (float)(*io_seed >> 16 & 0x7fff) / 32768.f;
+}
+
+static vec3_t random_in_box(uint32_t *io_seed, vec3_t min, vec3_t size)
+{
+    float x = random_unit(io_seed);
+    float y = random_unit(io_seed);
+    float z = random_unit(io_seed);
+
+    return (vec3_t){ min.x + size.x * x, min.y + size.y * y, min.z + size.z * z };
+}
+
+static void place_spheres(stress_scene_t *stress, const stress_options_t *opts, vec3_t min,
+                          vec3_t size, float spacing, size_t materials_count)
+{
+    uint32_t seed = opts->seed;
+
+    size_t columns  = (size_t)fmaxf(1.f, floorf(size.x / spacing));
+    size_t rows     = (size_t)fmaxf(1.f, floorf(size.y / spacing));
+    size_t clusters = opts->spheres / STRESS_CLUSTER_SIZE > 0
+                    ? opts->spheres / STRESS_CLUSTER_SIZE : 1;
+
+    vec3_t *centers = NULL;
+
+    if (opts->layout == STRESS_CLUSTERED)
+    {
+        centers = calloc(clusters, sizeof(vec3_t));
+
+        for (size_t i = 0; centers && i < clusters; i++)
+            centers[i] = random_in_box(&seed, min, size);
+    }
+
+    // a cluster fills a ball about as big as its spheres would fill in the uniform layout
+    float spread = spacing * cbrtf((float)STRESS_CLUSTER_SIZE) / 2.f;
+
+    for (size_t i = 0; i < opts->spheres; i++)
+    {
+        vec3_t position;
+
+        if (opts->layout == STRESS_GRID)
+        {
+            size_t layer = columns * rows;
+
+            position = (vec3_t){ min.x + spacing * ((float)(i % columns) + 0.5f),
+                                 min.y + spacing * ((float)(i / columns % rows) + 0.5f),
+                                 min.z + spacing * ((float)(i / layer) + 0.5f) };
+        }
+        else if (opts->layout == STRESS_CLUSTERED && centers)
+        {
+            // sum of uniform numbers is close enough to normal
+            vec3_t offset = random_in_box(&seed, (vec3_t){0}, (vec3_t){ 1.f, 1.f, 1.f });
+            offset = vec_add(offset, random_in_box(&seed, (vec3_t){0}, (vec3_t){ 1.f, 1.f, 1.f }));
+            offset = vec_sub(offset, (vec3_t){ 1.f, 1.f, 1.f });
+
+            position = vec_add(centers[i % clusters], vec_mul_num(offset, spread));
+        }
+        else
+        {
+            position = random_in_box(&seed, min, size);
+        }
+
+        stress->spheres[i]          = (sphere_t){ position, stress->radius };
+        stress->sphere_materials[i] = (uint16_t)(i % materials_count);
+    }
+
+    free(centers);
+}
+
+static void place_lights(stress_scene_t *stress, const scene_t *scene,
+                         const stress_options_t *opts, vec3_t center)
+{
+    light_t template = scene->lights[0];
+
+    float brightness = 2.f / (float)opts->lights;
+
+    template.ambient  = vec_mul_num(template.ambient , brightness);
+    template.diffuse  = vec_mul_num(template.diffuse , brightness);
+    template.specular = vec_mul_num(template.specular, brightness);
+
+    for (size_t i = 0; i < opts->lights; i++)
+    {
+        float angle = 2.f * (float)M_PI * ((float)i + 0.5f) / (float)opts->lights;
+
+        stress->lights[i]          = template;
+        stress->lights[i].position = (vec3_t){ center.x + STRESS_LIGHTS_RADIUS * cosf(angle),
+                                               STRESS_LIGHTS_HEIGHT,
+                                               center.z + STRESS_LIGHTS_RADIUS * sinf(angle) };
+    }
+}
+
+static void place_discs(stress_scene_t *stress, const scene_t *scene,
+                        const stress_options_t *opts, vec3_t min, vec3_t size)
+{
+    // own sequence, so discs don't move spheres of the same seed
+    uint32_t seed = opts->seed ^ 0x5bd1e995u;
+
+    memcpy(stress->planes, scene->planes, scene->planes_count * sizeof(plane_t));
+
+    for (size_t i = 0; i < opts->discs; i++)
+    {
+        vec3_t norm = random_in_box(&seed, (vec3_t){ -1.f, -1.f, -1.f },
+                                           (vec3_t){  2.f,  2.f,  2.f });
+
+        plane_t *disc = &stress->planes[scene->planes_count + i];
+
+        disc->position = random_in_box(&seed, min, size);
+        disc->norm     = vec_length(norm) > EPS ? vec_norm(norm) : (vec3_t){ 0.f, 0.f, -1.f };
+        disc->radius   = 2.f * stress->radius;
+        disc->material = (uint16_t)(i % scene->materials_count);
+    }
+}
+
+bool stress_scene_add(stress_scene_t *stress, scene_t *scene, const stress_options_t *opts)
+{
+    memset(stress, 0, sizeof(*stress));
+
+    size_t spheres_count = opts->spheres > 0 ? opts->spheres : 1;
+    size_t planes_count  = scene->planes_count + opts->discs;
+
+    stress->spheres          = calloc(spheres_count, sizeof(sphere_t));
+    stress->sphere_materials = calloc(spheres_count, sizeof(uint16_t));
+    stress->planes           = calloc(planes_count > 0 ? planes_count : 1, sizeof(plane_t));
+    stress->lights           = calloc(opts->lights > 0 ? opts->lights : 1, sizeof(light_t));
+
+    if (!stress->spheres || !stress->sphere_materials || !stress->planes || !stress->lights)
+    {
+        stress_scene_destroy(stress);
+        return false;
+    }
+
+    // a ray crosses spheres * pi * radius^2 / area of them on average,
+    // and neighbours are diameter / overlap apart
+    float area    = STRESS_BOX_WIDTH * STRESS_BOX_HEIGHT;
+    float radius  = sqrtf(opts->depth * area / ((float)spheres_count * (float)M_PI));
+    float spacing = 2.f * radius / opts->overlap;
+
+    stress->radius    = radius;
+    stress->box_depth = (float)spheres_count * spacing * spacing * spacing / area;
+
+    vec3_t min  = { -STRESS_BOX_WIDTH / 2.f, STRESS_BOX_TOP, STRESS_BOX_NEAR };
+    vec3_t size = { STRESS_BOX_WIDTH, STRESS_BOX_HEIGHT, stress->box_depth };
+
+    place_spheres(stress, opts, min, size, spacing, scene->materials_count);
+
+    if (scene->lights_count > 0)
+        place_lights(stress, scene, opts, vec_add(min, vec_mul_num(size, 0.5f)));
+
+    place_discs(stress, scene, opts, min, size);
+
+    scene->spheres          = stress->spheres;
+    scene->sphere_materials = stress->sphere_materials;
+    scene->spheres_count    = opts->spheres;
+    scene->planes           = stress->planes;
+    scene->planes_count     = planes_count;
+
+    if (scene->lights_count > 0)
+    {
+        scene->lights       = stress->lights;
+        scene->lights_count = opts->lights;
+    }
+
+    return true;
+}
+
+void stress_scene_destroy(stress_scene_t *stress)
+{
+    free(stress->spheres);
+    free(stress->sphere_materials);
+    free(stress->planes);
+    free(stress->lights);
+
+    memset(stress, 0, sizeof(*stress));
+}
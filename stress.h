@@ -0,0 +1,66 @@
+#ifndef STRESS_H
+#define STRESS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "rt.h"
+
+typedef enum stress_layout
+{
+    STRESS_UNIFORM,
+    // groups of spheres around random centers
+    STRESS_CLUSTERED,
+    STRESS_GRID,
+} stress_layout_t;
+
+typedef struct stress_options
+{
+    size_t          spheres;
+    stress_layout_t layout;
+    size_t          lights;
+    size_t          discs;
+
+    // the same seed gives the same scene
+    uint32_t        seed;
+    // sphere diameter relative to the distance between neighbours,
+    // spheres overlap above 1
+    float           overlap;
+    // average number of spheres a primary ray passes through
+    float           depth;
+} stress_options_t;
+
+/**
+ * Arrays of the generated scene, the scene refers to them
+ */
+typedef struct stress_scene
+{
+    sphere_t *spheres;
+    uint16_t *sphere_materials;
+    plane_t  *planes;
+    light_t  *lights;
+
+    // all spheres have this radius, the box they fill is this deep
+    float     radius;
+    float     box_depth;
+} stress_scene_t;
+
+stress_options_t stress_options_default();
+
+/**
+ * Gives layout by its name: uniform, clustered or grid
+ */
+bool stress_layout_parse(const char *name, stress_layout_t *out_layout);
+
+/**
+ * Replaces spheres of the scene by generated ones in a box in front of the default camera,
+ * sized so the spheres overlap and hide each other as much as the options say
+ * Lights are replaced by copies of the first one spread over a ring above the box,
+ * together as bright as two of it, discs are added to the planes
+ * Materials of the scene are picked in turn
+ */
+bool stress_scene_add(stress_scene_t *stress, scene_t *scene, const stress_options_t *opts);
+
+void stress_scene_destroy(stress_scene_t *stress);
+
+#endif
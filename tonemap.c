@@ -0,0 +1,37 @@
+#include <math.h>
+
+#include "tonemap.h"
+
+tonemap_t tonemap_default()
+{
+    return (tonemap_t){ 1.f, false, 1.f };
+}
+
+void tonemap_apply(const tonemap_t *tm, float *io_values, size_t count, unsigned char *out)
+{
+    float exposure = tm->exposure;
+
+    for (size_t i = 0; i < count; i++)
+        io_values[i] *= exposure;
+
+    if (tm->reinhard)
+    {
+        for (size_t i = 0; i < count; i++)
+            io_values[i] /= 1.f + io_values[i];
+    }
+
+    // clamp before gamma, so powf never sees negative values
+    for (size_t i = 0; i < count; i++)
+        io_values[i] = fminf(fmaxf(io_values[i], 0.f), 1.f);
+
+    if (tm->gamma != 1.f)
+    {
+        float inv_gamma = 1.f / tm->gamma;
+
+        for (size_t i = 0; i < count; i++)
+            io_values[i] = powf(io_values[i], inv_gamma);
+    }
+
+    for (size_t i = 0; i < count; i++)
+        out[i] = (unsigned char)(255.f * io_values[i]);
+}
@@ -0,0 +1,30 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * Conversion of linear float colors to 8-bit output
+ * Steps go in the order of fields, then values are clamped to [0, 1] and quantized
+ */
+typedef struct tonemap
+{
+    // colors are multiplied by it first
+    float exposure;
+    // compress [0, inf) into [0, 1) by c / (1 + c)
+    bool  reinhard;
+    // output is c^(1 / gamma), 1 keeps values linear
+    float gamma;
+} tonemap_t;
+
+tonemap_t tonemap_default();
+
+/**
+ * Converts count channel values, io_values is used as scratch
+ * Every step is a separate loop over the whole run, so the compiler vectorizes them,
+ * pass whole rows rather than single pixels
+ */
+void tonemap_apply(const tonemap_t *tm, float *io_values, size_t count, unsigned char *out);
+
+#endif
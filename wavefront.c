@@ -0,0 +1,997 @@
+#include <math.h>
+#include <string.h>
+
+#include "accel.h"
+#include "ao.h"
+#include "lightmap.h"
+#include "shadow.h"
+#include "shadowmap.h"
+#include "wavefront.h"
+
+// rays which walk the scene hierarchy together, one tile of the default size
+#define WAVEFRONT_PACKET 256
+// fewer rays left in a node walk on one by one
+static const size_t WAVEFRONT_MIN_RAYS = 8;
+// deep enough for any hierarchy bvh_valid() accepts
+#define WAVEFRONT_MAX_DEPTH 64
+// passes in a row with nothing to trace but rays waiting for streamed chunks,
+// after them the budget can't hold the chunks those rays need and they read them by themselves
+static const size_t WAVEFRONT_MAX_WAITS = 4;
+
+static bool ray_queue_init(ray_queue_t *queue, size_t capacity)
+{
+    memset(queue, 0, sizeof(*queue));
+
+    queue->org_x     = calloc(capacity, sizeof(float));
+    queue->org_y     = calloc(capacity, sizeof(float));
+    queue->org_z     = calloc(capacity, sizeof(float));
+    queue->dir_x     = calloc(capacity, sizeof(float));
+    queue->dir_y     = calloc(capacity, sizeof(float));
+    queue->dir_z     = calloc(capacity, sizeof(float));
+    queue->dist      = calloc(capacity, sizeof(float));
+    queue->hit_index = calloc(capacity, sizeof(int32_t));
+    queue->hit_kind  = calloc(capacity, sizeof(uint8_t));
+    queue->hit_prim  = calloc(capacity, sizeof(uint32_t));
+    queue->color_r   = calloc(capacity, sizeof(float));
+    queue->color_g   = calloc(capacity, sizeof(float));
+    queue->color_b   = calloc(capacity, sizeof(float));
+    queue->pixel     = calloc(capacity, sizeof(uint32_t));
+
+    queue->capacity  = capacity;
+
+    return queue->org_x   && queue->org_y     && queue->org_z    &&
+           queue->dir_x   && queue->dir_y     && queue->dir_z    &&
+           queue->dist    && queue->hit_index && queue->hit_kind &&
+           queue->hit_prim && queue->color_r  && queue->color_g  &&
+           queue->color_b && queue->pixel;
+}
+
+static void ray_queue_destroy(ray_queue_t *queue)
+{
+    free(queue->org_x);
+    free(queue->org_y);
+    free(queue->org_z);
+    free(queue->dir_x);
+    free(queue->dir_y);
+    free(queue->dir_z);
+    free(queue->dist);
+    free(queue->hit_index);
+    free(queue->hit_kind);
+    free(queue->hit_prim);
+    free(queue->color_r);
+    free(queue->color_g);
+    free(queue->color_b);
+    free(queue->pixel);
+
+    memset(queue, 0, sizeof(*queue));
+}
+
+/**
+ * Copies ray from slot src of one queue to slot dst of another
+ */
+static void ray_queue_copy(ray_queue_t *to, size_t dst, const ray_queue_t *from, size_t src)
+{
+    to->org_x    [dst] = from->org_x    [src];
+    to->org_y    [dst] = from->org_y    [src];
+    to->org_z    [dst] = from->org_z    [src];
+    to->dir_x    [dst] = from->dir_x    [src];
+    to->dir_y    [dst] = from->dir_y    [src];
+    to->dir_z    [dst] = from->dir_z    [src];
+    to->dist     [dst] = from->dist     [src];
+    to->hit_index[dst] = from->hit_index[src];
+    to->hit_kind [dst] = from->hit_kind [src];
+    to->hit_prim [dst] = from->hit_prim [src];
+    to->color_r  [dst] = from->color_r  [src];
+    to->color_g  [dst] = from->color_g  [src];
+    to->color_b  [dst] = from->color_b  [src];
+    to->pixel    [dst] = from->pixel    [src];
+}
+
+/**
+ * Moves ray from slot src to slot dst of the same queue
+ */
+static void ray_queue_move(ray_queue_t *queue, size_t dst, size_t src)
+{
+    ray_queue_copy(queue, dst, queue, src);
+}
+
+static void swap_float(float *values, size_t a, size_t b)
+{
+    float value = values[a];
+    values[a] = values[b];
+    values[b] = value;
+}
+
+static void swap_uint32(uint32_t *values, size_t a, size_t b)
+{
+    uint32_t value = values[a];
+    values[a] = values[b];
+    values[b] = value;
+}
+
+/**
+ * Swaps rays in slots a and b of the same queue
+ */
+static void ray_queue_swap(ray_queue_t *queue, size_t a, size_t b)
+{
+    swap_float (queue->org_x  , a, b);
+    swap_float (queue->org_y  , a, b);
+    swap_float (queue->org_z  , a, b);
+    swap_float (queue->dir_x  , a, b);
+    swap_float (queue->dir_y  , a, b);
+    swap_float (queue->dir_z  , a, b);
+    swap_float (queue->dist   , a, b);
+    swap_float (queue->color_r, a, b);
+    swap_float (queue->color_g, a, b);
+    swap_float (queue->color_b, a, b);
+    swap_uint32(queue->hit_prim, a, b);
+    swap_uint32(queue->pixel  , a, b);
+
+    int32_t hit_index = queue->hit_index[a];
+    queue->hit_index[a] = queue->hit_index[b];
+    queue->hit_index[b] = hit_index;
+
+    uint8_t hit_kind = queue->hit_kind[a];
+    queue->hit_kind[a] = queue->hit_kind[b];
+    queue->hit_kind[b] = hit_kind;
+}
+
+bool wavefront_init(wavefront_t *wf, size_t capacity)
+{
+    memset(wf, 0, sizeof(*wf));
+
+    wf->hit_pos     = calloc(capacity, sizeof(vec3_t));
+    wf->hit_norm    = calloc(capacity, sizeof(vec3_t));
+    wf->hit_mat     = calloc(capacity, sizeof(material_t *));
+    wf->hit_ambient = calloc(capacity, sizeof(float));
+    wf->rays        = calloc(capacity, sizeof(uint32_t));
+    wf->entry_left  = calloc(capacity, sizeof(float));
+    wf->entry_right = calloc(capacity, sizeof(float));
+    wf->far_entries = calloc(WAVEFRONT_MAX_DEPTH * WAVEFRONT_PACKET, sizeof(float));
+    wf->inv_x       = calloc(capacity, sizeof(float));
+    wf->inv_y       = calloc(capacity, sizeof(float));
+    wf->inv_z       = calloc(capacity, sizeof(float));
+
+    if (!ray_queue_init(&wf->primary, capacity) || !ray_queue_init(&wf->shadow, capacity) ||
+        !ray_queue_init(&wf->parked, capacity) ||
+        !wf->hit_pos || !wf->hit_norm || !wf->hit_mat || !wf->hit_ambient ||
+        !wf->rays || !wf->entry_left || !wf->entry_right || !wf->far_entries ||
+        !wf->inv_x || !wf->inv_y || !wf->inv_z)
+    {
+        wavefront_destroy(wf);
+        return false;
+    }
+
+    return true;
+}
+
+void wavefront_destroy(wavefront_t *wf)
+{
+    ray_queue_destroy(&wf->primary);
+    ray_queue_destroy(&wf->shadow);
+    ray_queue_destroy(&wf->parked);
+
+    free(wf->hit_pos);
+    free(wf->hit_norm);
+    free(wf->hit_mat);
+    free(wf->hit_ambient);
+    free(wf->rays);
+    free(wf->entry_left);
+    free(wf->entry_right);
+    free(wf->far_entries);
+    free(wf->inv_x);
+    free(wf->inv_y);
+    free(wf->inv_z);
+    free(wf->streamed);
+
+    memset(wf, 0, sizeof(*wf));
+}
+
+// generate stage
+
+static void generate_primary(ray_queue_t *queue, const camera_t *camera,
+                             const uint32_t *pixel_x, const uint32_t *pixel_y, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; i++)
+    {
+        vec3_t dir = vec_norm(camera_ray_dir(camera, (float)pixel_x[i] + 0.5f,
+                                                     (float)pixel_y[i] + 0.5f));
+
+        queue->org_x    [i] = camera->position.x;
+        queue->org_y    [i] = camera->position.y;
+        queue->org_z    [i] = camera->position.z;
+        queue->dir_x    [i] = dir.x;
+        queue->dir_y    [i] = dir.y;
+        queue->dir_z    [i] = dir.z;
+        queue->dist     [i] = INF;
+        queue->hit_index[i] = -1;
+        queue->pixel    [i] = i;
+    }
+
+    queue->count = pixel_count;
+}
+
+// intersect stage
+
+/**
+ * Same math as ray_sphere_dist(), but for the listed rays of the queue at once
+ * Closest hit mode updates nearest hit, any hit mode sets dist of occluded rays to -1
+ */
+static void intersect_sphere(ray_queue_t *queue, const uint32_t *rays, size_t rays_count,
+                             const sphere_t *sphere, uint32_t index, bool any_hit)
+{
+    const float *restrict org_x     = queue->org_x;
+    const float *restrict org_y     = queue->org_y;
+    const float *restrict org_z     = queue->org_z;
+    const float *restrict dir_x     = queue->dir_x;
+    const float *restrict dir_y     = queue->dir_y;
+    const float *restrict dir_z     = queue->dir_z;
+    float       *restrict dist      = queue->dist;
+    int32_t     *restrict hit_index = queue->hit_index;
+    uint8_t     *restrict hit_kind  = queue->hit_kind;
+
+    float center_x = sphere->position.x;
+    float center_y = sphere->position.y;
+    float center_z = sphere->position.z;
+    float radius2  = sphere->radius * sphere->radius;
+
+    for (size_t k = 0; k < rays_count; k++)
+    {
+        uint32_t i = rays[k];
+
+        float s_x = org_x[i] - center_x;
+        float s_y = org_y[i] - center_y;
+        float s_z = org_z[i] - center_z;
+
+        float a = dir_x[i] * dir_x[i] + dir_y[i] * dir_y[i] + dir_z[i] * dir_z[i];
+        float b = 2 * (s_x * dir_x[i] + s_y * dir_y[i] + s_z * dir_z[i]);
+        float c = s_x * s_x + s_y * s_y + s_z * s_z - radius2;
+        float d = b * b - 4 * a * c;
+
+        float sqrt_d  = sqrtf(d > 0.f ? d : 0.f);
+        float t1      = (-b - sqrt_d) / (2 * a);
+        float t2      = (-b + sqrt_d) / (2 * a);
+        float tangent = -b / (2 * a);
+
+        // the ray touching the sphere hits it once
+        float t = fabsf(d) <= EPS ? tangent
+                : d > EPS         ? (t1 > EPS ? t1 : t2)
+                : 0.f;
+
+        bool  hit = t > EPS;
+
+        if (any_hit)
+        {
+            dist[i] = hit && t - dist[i] < EPS ? -1.f : dist[i];
+        }
+        else
+        {
+            bool closer  = hit && t < dist[i];
+            dist[i]      = closer ? t : dist[i];
+            hit_index[i] = closer ? (int32_t)index : hit_index[i];
+            hit_kind [i] = closer ? OBJECT_SPHERE : hit_kind[i];
+        }
+    }
+}
+
+/**
+ * Same math as ray_disc_dist(), closest hits only
+ */
+static void intersect_plane(ray_queue_t *queue, const uint32_t *rays, size_t rays_count,
+                            const plane_t *plane, uint32_t index)
+{
+    const float *restrict org_x     = queue->org_x;
+    const float *restrict org_y     = queue->org_y;
+    const float *restrict org_z     = queue->org_z;
+    const float *restrict dir_x     = queue->dir_x;
+    const float *restrict dir_y     = queue->dir_y;
+    const float *restrict dir_z     = queue->dir_z;
+    float       *restrict dist      = queue->dist;
+    int32_t     *restrict hit_index = queue->hit_index;
+    uint8_t     *restrict hit_kind  = queue->hit_kind;
+
+    vec3_t pos    = plane->position;
+    vec3_t norm   = plane->norm;
+    float  radius = plane->radius;
+
+    for (size_t k = 0; k < rays_count; k++)
+    {
+        uint32_t i = rays[k];
+
+        float num   = (pos.x - org_x[i]) * norm.x +
+                      (pos.y - org_y[i]) * norm.y +
+                      (pos.z - org_z[i]) * norm.z;
+        float denom = dir_x[i] * norm.x + dir_y[i] * norm.y + dir_z[i] * norm.z;
+        float t     = num / denom;
+
+        float off_x = org_x[i] + dir_x[i] * t - pos.x;
+        float off_y = org_y[i] + dir_y[i] * t - pos.y;
+        float off_z = org_z[i] + dir_z[i] * t - pos.z;
+
+        bool  hit   = t >= EPS &&
+                      sqrtf(off_x * off_x + off_y * off_y + off_z * off_z) - radius <= EPS;
+
+        bool closer  = hit && t < dist[i];
+        dist[i]      = closer ? t : dist[i];
+        hit_index[i] = closer ? (int32_t)index : hit_index[i];
+        hit_kind [i] = closer ? OBJECT_PLANE : hit_kind[i];
+    }
+}
+
+/**
+ * Objects which have no SoA kernel (meshes and instances) are tested ray by ray
+ */
+static void intersect_object(ray_queue_t *queue, const uint32_t *rays, size_t rays_count,
+                             const scene_t *scene, object_ref_t object, bool any_hit)
+{
+    if (any_hit && !object_casts_shadow(scene, object))
+        return;
+
+    for (size_t k = 0; k < rays_count; k++)
+    {
+        uint32_t i = rays[k];
+
+        vec3_t org = { queue->org_x[i], queue->org_y[i], queue->org_z[i] };
+        vec3_t dir = { queue->dir_x[i], queue->dir_y[i], queue->dir_z[i] };
+
+        if (any_hit)
+        {
+            if (queue->dist[i] >= 0.f && object_occluded(scene, object, org, dir, queue->dist[i]))
+                queue->dist[i] = -1.f;
+
+            continue;
+        }
+
+        uint32_t prim = 0;
+        if (object_intersect(scene, object, org, dir, &queue->dist[i], &prim))
+        {
+            queue->hit_index[i] = (int32_t)object.index;
+            queue->hit_kind [i] = (uint8_t)object.kind;
+            queue->hit_prim [i] = prim;
+        }
+    }
+}
+
+/**
+ * Runs the kernel of the object kind over the listed rays, discs don't cast shadows
+ */
+static void intersect_listed(ray_queue_t *queue, const uint32_t *rays, size_t rays_count,
+                             const scene_t *scene, object_ref_t object, bool any_hit)
+{
+    if (object.kind == OBJECT_SPHERE)
+        intersect_sphere(queue, rays, rays_count, &scene->spheres[object.index], object.index,
+                         any_hit);
+    else if (object.kind == OBJECT_PLANE && !any_hit)
+        intersect_plane(queue, rays, rays_count, &scene->planes[object.index], object.index);
+    else if (object.kind != OBJECT_PLANE)
+        intersect_object(queue, rays, rays_count, scene, object, any_hit);
+}
+
+/**
+ * Traversal of a lazy scene hierarchy ray by ray, its nodes are built as rays reach them
+ */
+static void intersect_accel(ray_queue_t *queue, const uint32_t *rays, size_t rays_count,
+                            const scene_t *scene, bool any_hit)
+{
+    for (size_t k = 0; k < rays_count; k++)
+    {
+        uint32_t i = rays[k];
+
+        vec3_t org = { queue->org_x[i], queue->org_y[i], queue->org_z[i] };
+        vec3_t dir = { queue->dir_x[i], queue->dir_y[i], queue->dir_z[i] };
+
+        if (any_hit)
+        {
+            if (scene_occluded(scene, org, dir, queue->dist[i]))
+                queue->dist[i] = -1.f;
+
+            continue;
+        }
+
+        hit_t hit = {0};
+        if (scene_intersect(scene, org, dir, queue->dist[i], &hit))
+        {
+            queue->dist     [i] = hit.dist;
+            queue->hit_index[i] = (int32_t)hit.object.index;
+            queue->hit_kind [i] = (uint8_t)hit.object.kind;
+            queue->hit_prim [i] = hit.prim;
+        }
+    }
+}
+
+/**
+ * Same test as ray_aabb_intersect(), kept here so the loops over rays inline it
+ * Gives entry distance of the ray into the box closer than t_max, or -1 if it misses
+ */
+static float box_entry(aabb_t box, vec3_t org, vec3_t inv_dir, float t_max)
+{
+    float tx1 = (box.min.x - org.x) * inv_dir.x;
+    float tx2 = (box.max.x - org.x) * inv_dir.x;
+    float ty1 = (box.min.y - org.y) * inv_dir.y;
+    float ty2 = (box.max.y - org.y) * inv_dir.y;
+    float tz1 = (box.min.z - org.z) * inv_dir.z;
+    float tz2 = (box.max.z - org.z) * inv_dir.z;
+
+    float t_entry = fmaxf(fmaxf(fminf(tx1, tx2), fminf(ty1, ty2)), fmaxf(fminf(tz1, tz2), 0.f));
+    float t_exit  = fminf(fminf(fmaxf(tx1, tx2), fmaxf(ty1, ty2)), fminf(fmaxf(tz1, tz2), t_max));
+
+    return t_entry <= t_exit ? t_entry : -1.f;
+}
+
+/**
+ * Entry distances of the listed rays into both children closer than their current dist,
+ * by their slots, -1 for the ones they miss
+ * Gives true if more rays reach the left child first than the right one
+ * Boxes of shadow rays are tested with the same tolerance as the objects
+ */
+static bool child_entries(wavefront_t *wf, const ray_queue_t *queue, const uint32_t *rays,
+                          size_t rays_count, aabb_t left, aabb_t right, bool any_hit)
+{
+    float tolerance = any_hit ? EPS : 0.f;
+
+    size_t left_first = 0, right_first = 0;
+
+    for (size_t k = 0; k < rays_count; k++)
+    {
+        uint32_t i = rays[k];
+
+        vec3_t org     = { queue->org_x[i], queue->org_y[i], queue->org_z[i] };
+        vec3_t inv_dir = { wf->inv_x[i], wf->inv_y[i], wf->inv_z[i] };
+        float  t_max   = queue->dist[i] + tolerance;
+
+        float left_entry  = box_entry(left , org, inv_dir, t_max);
+        float right_entry = box_entry(right, org, inv_dir, t_max);
+
+        left_first  += left_entry >= 0.f && (right_entry < 0.f || left_entry <= right_entry);
+        right_first += right_entry >= 0.f && (left_entry < 0.f || right_entry < left_entry);
+
+        wf->entry_left [i] = left_entry;
+        wf->entry_right[i] = right_entry;
+    }
+
+    return left_first >= right_first;
+}
+
+/**
+ * One ray of the queue walking a subtree of the scene hierarchy by itself
+ */
+typedef struct single_query
+{
+    ray_queue_t   *queue;
+    const scene_t *scene;
+    uint32_t       ray;
+    bool           any_hit;
+} single_query_t;
+
+static bool single_leaf(void *ctx, const bvh_node_t *leaf, float *io_t_max)
+{
+    single_query_t *query = ctx;
+    const accel_t  *accel = query->scene->accel;
+
+    for (uint32_t slot = leaf->first; slot < leaf->first + leaf->count; slot++)
+        intersect_listed(query->queue, &query->ray, 1, query->scene, accel_object(accel, slot),
+                         query->any_hit);
+
+    float dist = query->queue->dist[query->ray];
+
+    if (query->any_hit)
+        return dist < 0.f;
+
+    *io_t_max = dist;
+    return false;
+}
+
+/**
+ * Walks the scene hierarchy with a packet of rays at once: a node is entered with the rays
+ * hitting its box, and its leaf objects are tested against all of them by one kernel
+ * The child most rays reach first is visited first, so the hits found there
+ * shorten the rays before the other child is tested
+ * Rays of the packet are the slots from base on, the list holds them in any order
+ * Once few rays are left, they are too far apart to share nodes and walk on one by one
+ */
+static void traverse_packet(wavefront_t *wf, ray_queue_t *queue, uint32_t *rays,
+                            size_t rays_count, uint32_t base, size_t depth,
+                            const scene_t *scene, uint32_t node_index, bool any_hit)
+{
+    const accel_t    *accel = scene->accel;
+    const bvh_node_t *node  = &accel->bvh.nodes[node_index];
+
+    if (node->count > 0)
+    {
+        for (uint32_t slot = node->first; slot < node->first + node->count; slot++)
+            intersect_listed(queue, rays, rays_count, scene, accel_object(accel, slot), any_hit);
+
+        return;
+    }
+
+    if (rays_count < WAVEFRONT_MIN_RAYS)
+    {
+        for (size_t k = 0; k < rays_count; k++)
+        {
+            uint32_t       i     = rays[k];
+            single_query_t query = { queue, scene, i, any_hit };
+
+            vec3_t org = { queue->org_x[i], queue->org_y[i], queue->org_z[i] };
+            vec3_t dir = { queue->dir_x[i], queue->dir_y[i], queue->dir_z[i] };
+
+            bvh_traverse_subtree(&accel->bvh, node_index, org, dir,
+                                 any_hit ? queue->dist[i] + EPS : queue->dist[i],
+                                 single_leaf, &query);
+        }
+
+        return;
+    }
+
+    uint32_t children[2] = { node->first, node->first + 1 };
+    float   *entries [2] = { wf->entry_left, wf->entry_right };
+
+    bool left_near = child_entries(wf, queue, rays, rays_count,
+                                   accel->bvh.nodes[children[0]].bounds,
+                                   accel->bvh.nodes[children[1]].bounds, any_hit);
+
+    int near = left_near ? 0 : 1;
+    int far  = 1 - near;
+
+    // the near child overwrites entries of its rays, their far ones are kept for this depth
+    float  *far_entries = &wf->far_entries[depth * WAVEFRONT_PACKET];
+    size_t  near_count  = 0;
+
+    for (size_t k = 0; k < rays_count; k++)
+    {
+        uint32_t ray = rays[k];
+        if (entries[near][ray] < 0.f)
+            continue;
+
+        far_entries[ray - base] = entries[far][ray];
+
+        rays[k]            = rays[near_count];
+        rays[near_count++] = ray;
+    }
+
+    if (near_count > 0)
+        traverse_packet(wf, queue, rays, near_count, base, depth + 1, scene, children[near],
+                        any_hit);
+
+    // the near child only reordered its rays, they still come first,
+    // a closer hit found there may end them before the far child
+    float  tolerance = any_hit ? EPS : 0.f;
+    size_t far_count = 0;
+
+    for (size_t k = 0; k < rays_count; k++)
+    {
+        uint32_t ray   = rays[k];
+        float    entry = k < near_count ? far_entries[ray - base] : entries[far][ray];
+
+        if (entry < 0.f || entry > queue->dist[ray] + tolerance)
+            continue;
+
+        rays[k]           = rays[far_count];
+        rays[far_count++] = ray;
+    }
+
+    if (far_count > 0)
+        traverse_packet(wf, queue, rays, far_count, base, depth + 1, scene, children[far],
+                        any_hit);
+}
+
+/**
+ * Shadow rays of one light against its caster list, ray by ray
+ * Receiver of each ray is its hit object
+ */
+static void occlude_by_casters(ray_queue_t *queue, const scene_t *scene, size_t light)
+{
+    for (size_t i = 0; i < queue->count; i++)
+    {
+        vec3_t       org      = { queue->org_x[i], queue->org_y[i], queue->org_z[i] };
+        vec3_t       dir      = { queue->dir_x[i], queue->dir_y[i], queue->dir_z[i] };
+        object_ref_t receiver = { (uint32_t)queue->hit_index[i], queue->hit_kind[i] };
+
+        if (light_occluded(scene, light, &receiver, org, dir, queue->dist[i]))
+            queue->dist[i] = -1.f;
+    }
+}
+
+/**
+ * Finds instances of streamed prototypes, there are none if memory for them runs out,
+ * which only makes rays wait for their chunks
+ */
+static void find_streamed(wavefront_t *wf, const scene_t *scene)
+{
+    wf->streamed_count = 0;
+
+    bool any = false;
+    for (size_t i = 0; i < scene->prototypes_count; i++)
+        any = any || scene->prototypes[i].kind == PROTOTYPE_STREAM;
+
+    for (size_t i = 0; any && i < scene->instances_count; i++)
+    {
+        if (scene->prototypes[scene->instances[i].prototype].kind != PROTOTYPE_STREAM)
+            continue;
+
+        if (wf->streamed_count == wf->streamed_capacity)
+        {
+            size_t    capacity = wf->streamed_capacity > 0 ? wf->streamed_capacity * 2 : 4;
+            uint32_t *streamed = realloc(wf->streamed, capacity * sizeof(uint32_t));
+
+            if (!streamed)
+            {
+                wf->streamed_count = 0;
+                return;
+            }
+
+            wf->streamed          = streamed;
+            wf->streamed_capacity = capacity;
+        }
+
+        wf->streamed[wf->streamed_count++] = (uint32_t)i;
+    }
+}
+
+/**
+ * Asks for the streamed chunks the rays reach and moves rays which wait for some
+ * to the end of the queue, gives the count of rays before them
+ */
+static size_t park_streamed(const wavefront_t *wf, ray_queue_t *queue, const scene_t *scene)
+{
+    size_t ready = 0;
+
+    for (size_t i = 0; i < queue->count; i++)
+    {
+        vec3_t org = { queue->org_x[i], queue->org_y[i], queue->org_z[i] };
+        vec3_t dir = { queue->dir_x[i], queue->dir_y[i], queue->dir_z[i] };
+
+        bool waits = false;
+
+        for (size_t j = 0; j < wf->streamed_count; j++)
+        {
+            if (object_prefetch(scene, (object_ref_t){ wf->streamed[j], OBJECT_INSTANCE },
+                                org, dir, queue->dist[i]))
+                waits = true;
+        }
+
+        if (!waits)
+            ray_queue_swap(queue, ready++, i);
+    }
+
+    return ready;
+}
+
+/**
+ * Waits until the loaders of the streamed instances bring more chunks to memory
+ */
+static void wait_streamed(const wavefront_t *wf, const scene_t *scene)
+{
+    for (size_t i = 0; i < wf->streamed_count; i++)
+        object_wait(scene, (object_ref_t){ wf->streamed[i], OBJECT_INSTANCE });
+}
+
+static void intersect_stage(wavefront_t *wf, ray_queue_t *queue, const scene_t *scene,
+                            bool any_hit)
+{
+    uint32_t *rays = wf->rays;
+
+    for (size_t i = 0; i < queue->count; i++)
+        rays[i] = (uint32_t)i;
+
+    if (scene->accel && scene->accel->bvh.lazy)
+    {
+        intersect_accel(queue, rays, queue->count, scene, any_hit);
+        return;
+    }
+
+    if (scene->accel)
+    {
+        for (size_t i = 0; i < queue->count; i++)
+        {
+            wf->inv_x[i] = 1.f / queue->dir_x[i];
+            wf->inv_y[i] = 1.f / queue->dir_y[i];
+            wf->inv_z[i] = 1.f / queue->dir_z[i];
+        }
+
+        for (size_t first = 0; scene->accel->bvh.nodes_count > 0 && first < queue->count;
+             first += WAVEFRONT_PACKET)
+        {
+            size_t count = queue->count - first < WAVEFRONT_PACKET ? queue->count - first
+                                                                   : WAVEFRONT_PACKET;
+
+            traverse_packet(wf, queue, rays + first, count, (uint32_t)first, 0, scene, 0,
+                            any_hit);
+        }
+
+        return;
+    }
+
+    size_t count = object_count(scene);
+
+    for (size_t i = 0; i < count; i++)
+        intersect_listed(queue, rays, queue->count, scene, object_by_number(scene, i), any_hit);
+}
+
+// compaction
+
+/**
+ * Writes background color for rays which missed everything
+ * and removes them from the queue
+ */
+static void compact_misses(ray_queue_t *queue, color_t background, color_t *out_colors)
+{
+    size_t alive = 0;
+
+    for (size_t i = 0; i < queue->count; i++)
+    {
+        if (queue->hit_index[i] < 0)
+        {
+            out_colors[queue->pixel[i]] = background;
+            continue;
+        }
+
+        if (alive != i)
+            ray_queue_move(queue, alive, i);
+
+        alive++;
+    }
+
+    queue->count = alive;
+}
+
+/**
+ * Removes occluded shadow rays from the queue
+ */
+static void compact_occluded(ray_queue_t *queue)
+{
+    size_t alive = 0;
+
+    for (size_t i = 0; i < queue->count; i++)
+    {
+        if (queue->dist[i] < 0.f)
+            continue;
+
+        if (alive != i)
+            ray_queue_move(queue, alive, i);
+
+        alive++;
+    }
+
+    queue->count = alive;
+}
+
+// shade stage
+
+static void shade_hits(wavefront_t *wf, const scene_t *scene, color_t *out_colors)
+{
+    ray_queue_t *queue = &wf->primary;
+
+    for (size_t i = 0; i < queue->count; i++)
+    {
+        vec3_t org = { queue->org_x[i], queue->org_y[i], queue->org_z[i] };
+        vec3_t dir = { queue->dir_x[i], queue->dir_y[i], queue->dir_z[i] };
+
+        hit_t hit = { queue->dist[i],
+                      { (uint32_t)queue->hit_index[i], queue->hit_kind[i] },
+                      queue->hit_prim[i] };
+
+        object_surface(scene, &hit, org, dir, &wf->hit_pos[i], &wf->hit_norm[i], &wf->hit_mat[i]);
+
+        if (scene->ao)
+            wf->hit_ambient[i] = ao_cache_ambient(scene->ao, scene, wf->hit_pos[i], wf->hit_norm[i]);
+
+        out_colors[queue->pixel[i]] = (color_t){0};
+    }
+}
+
+/**
+ * Phong shading of all hits by one light
+ * Ambient term goes straight to the output, direct term is carried by the shadow ray
+ * Area lights need a varying number of shadow rays per hit, so they are sampled
+ * right here, baked discs and mapped lights are looked up here too,
+ * none of them queues a shadow ray
+ */
+static void shade_light(wavefront_t *wf, const scene_t *scene, size_t light_index,
+                        color_t *out_colors)
+{
+    ray_queue_t   *hits   = &wf->primary;
+    ray_queue_t   *shadow = &wf->shadow;
+    const light_t *light  = &scene->lights[light_index];
+
+    size_t queued = 0;
+
+    for (size_t i = 0; i < hits->count; i++)
+    {
+        vec3_t pos       = wf->hit_pos [i];
+        vec3_t norm      = wf->hit_norm[i];
+        vec3_t light_vec = scene->fast_math ? vec_norm_approx(vec_sub(light->position, pos))
+                                            : vec_norm       (vec_sub(light->position, pos));
+
+        color_t ambient = {0}, direct = {0};
+        light_phong(&ambient, &direct, pos, norm, light_vec, wf->hit_mat[i], light,
+                    scene->camera.position, scene->fast_math);
+
+        if (scene->ao)
+            ambient = vec_mul_num(ambient, wf->hit_ambient[i]);
+
+        uint32_t pixel = hits->pixel[i];
+        out_colors[pixel] = vec_add(out_colors[pixel], ambient);
+
+        object_ref_t receiver = { (uint32_t)hits->hit_index[i], hits->hit_kind[i] };
+
+        if (light->kind != LIGHT_POINT ||
+            (scene->lightmaps && lightmap_covers(scene->lightmaps, receiver)) ||
+            (scene->shadow_maps && shadow_maps_cover(scene->shadow_maps, scene, light_index)))
+        {
+            float visibility = light_visibility(scene, light_index, &receiver, pos, norm,
+                                                light_vec);
+            out_colors[pixel] = vec_add(out_colors[pixel], vec_mul_num(direct, visibility));
+            continue;
+        }
+
+        vec3_t test_point = vec_add(pos, vec_mul_num(norm, SHADOW_BIAS));
+        size_t j          = queued++;
+
+        shadow->org_x  [j] = test_point.x;
+        shadow->org_y  [j] = test_point.y;
+        shadow->org_z  [j] = test_point.z;
+        shadow->dir_x  [j] = light_vec.x;
+        shadow->dir_y  [j] = light_vec.y;
+        shadow->dir_z  [j] = light_vec.z;
+        shadow->dist   [j] = vec_length(vec_sub(light->position, test_point));
+        shadow->color_r[j] = direct.x;
+        shadow->color_g[j] = direct.y;
+        shadow->color_b[j] = direct.z;
+        shadow->pixel  [j] = pixel;
+
+        // receiver, it is tested along with the casters of the light
+        shadow->hit_index[j] = hits->hit_index[i];
+        shadow->hit_kind [j] = hits->hit_kind [i];
+    }
+
+    shadow->count = queued;
+}
+
+static void accumulate_unoccluded(const ray_queue_t *shadow, color_t *out_colors)
+{
+    for (size_t i = 0; i < shadow->count; i++)
+    {
+        color_t *color = &out_colors[shadow->pixel[i]];
+
+        color->x += shadow->color_r[i];
+        color->y += shadow->color_g[i];
+        color->z += shadow->color_b[i];
+    }
+}
+
+// streaming
+
+/**
+ * Moves shadow rays which wait for streamed chunks to the parked queue,
+ * as many as it has room for, the others are traced now and read their chunks by themselves
+ */
+static void park_shadows(wavefront_t *wf, const scene_t *scene)
+{
+    ray_queue_t *shadow = &wf->shadow;
+    ray_queue_t *parked = &wf->parked;
+
+    size_t ready = park_streamed(wf, shadow, scene);
+    size_t room  = parked->capacity - parked->count;
+    size_t moved = shadow->count - ready < room ? shadow->count - ready : room;
+
+    for (size_t i = 0; i < moved; i++)
+        ray_queue_copy(parked, parked->count++, shadow, shadow->count - moved + i);
+
+    shadow->count -= moved;
+}
+
+/**
+ * Traces parked shadow rays whose chunks are in memory now, or all of them,
+ * the others stay parked
+ * Gives the count of rays traced
+ */
+static size_t trace_parked(wavefront_t *wf, const scene_t *scene, bool all, color_t *out_colors)
+{
+    ray_queue_t *shadow = &wf->shadow;
+    ray_queue_t *parked = &wf->parked;
+
+    size_t ready = all ? parked->count : park_streamed(wf, parked, scene);
+
+    for (size_t i = 0; i < ready; i++)
+        ray_queue_copy(shadow, i, parked, i);
+
+    for (size_t i = ready; i < parked->count; i++)
+        ray_queue_move(parked, i - ready, i);
+
+    shadow->count  = ready;
+    parked->count -= ready;
+
+    if (ready > 0)
+    {
+        intersect_stage(wf, shadow, scene, true);
+
+        compact_occluded(shadow);
+        accumulate_unoccluded(shadow, out_colors);
+    }
+
+    return ready;
+}
+
+/**
+ * Traces the primary rays in the queue and their shadow rays,
+ * shadow rays waiting for streamed chunks are parked if park is set
+ */
+static void trace_primary(wavefront_t *wf, const scene_t *scene, bool park, color_t *out_colors)
+{
+    intersect_stage(wf, &wf->primary, scene, false);
+
+    compact_misses(&wf->primary, scene->ambient_color, out_colors);
+
+    shade_hits(wf, scene, out_colors);
+
+    for (size_t i = 0; i < scene->lights_count; i++)
+    {
+        shade_light(wf, scene, i, out_colors);
+
+        if (scene->casters)
+            occlude_by_casters(&wf->shadow, scene, i);
+        else
+        {
+            if (park)
+                park_shadows(wf, scene);
+
+            intersect_stage(wf, &wf->shadow, scene, true);
+        }
+
+        compact_occluded(&wf->shadow);
+        accumulate_unoccluded(&wf->shadow, out_colors);
+    }
+}
+
+void wavefront_render(wavefront_t *wf, scene_t scene, const uint32_t *pixel_x,
+                      const uint32_t *pixel_y, size_t pixel_count, color_t *out_colors)
+{
+    if (pixel_count > wf->primary.capacity)
+        pixel_count = wf->primary.capacity;
+
+    generate_primary(&wf->primary, &scene.camera, pixel_x, pixel_y, pixel_count);
+
+    find_streamed(wf, &scene);
+
+    if (wf->streamed_count == 0)
+    {
+        trace_primary(wf, &scene, false, out_colors);
+        return;
+    }
+
+    // rays waiting for streamed chunks are left for later passes over the batch,
+    // they are at the front of the primary queue and in the parked one
+    ray_queue_t *primary = &wf->primary;
+
+    size_t pending = pixel_count;
+    size_t idle    = 0;
+
+    wf->parked.count = 0;
+
+    while (pending > 0 || wf->parked.count > 0)
+    {
+        bool all = idle > WAVEFRONT_MAX_WAITS;
+
+        primary->count = pending;
+
+        size_t ready  = all ? pending : park_streamed(wf, primary, &scene);
+        size_t traced = ready + trace_parked(wf, &scene, all, out_colors);
+
+        if (ready > 0)
+        {
+            primary->count = ready;
+            trace_primary(wf, &scene, !all, out_colors);
+
+            for (size_t i = ready; i < pending; i++)
+                ray_queue_move(primary, i - ready, i);
+
+            pending -= ready;
+        }
+
+        // nothing else to trace until the loader brings more chunks
+        if (traced > 0)
+            idle = 0;
+        else if (++idle <= WAVEFRONT_MAX_WAITS)
+            wait_streamed(wf, &scene);
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "object.h"
+#include "rt.h"
+
+/**
+ * Wavefront ray tracer:
+ * instead of tracing rays one by one recursively, a big batch of rays is moved
+ * through separate stages - generate, intersect, shade, shadow.
+ * Rays live in SoA buffers, so each stage is a tight loop over plain arrays.
+ * Rays which are finished (missed the scene, occluded shadow rays)
+ * are removed from the queue by stream compaction between stages
+ * Intersect stages test spheres and discs by SoA kernels over lists of rays. With
+ * acceleration structure packets of neighbouring rays walk its binary hierarchy together,
+ * and each leaf is tested against the rays which reached it, lazy hierarchies are walked
+ * ray by ray
+ * Rays reaching streamed chunks which are not in memory yet are left out of the pass,
+ * the others are traced and shaded while the loader reads the chunks, and the left out
+ * ones are retried in later passes over the batch once their chunks are in memory
+ */
+
+/**
+ * SoA ray buffer
+ */
+typedef struct ray_queue
+{
+    float    *org_x;
+    float    *org_y;
+    float    *org_z;
+
+    float    *dir_x;
+    float    *dir_y;
+    float    *dir_z;
+
+    // primary rays - distance to the nearest hit
+    // shadow rays  - distance to the light
+    float    *dist;
+
+    // nearest hit object, hit_index is -1 if none
+    int32_t  *hit_index;
+    uint8_t  *hit_kind;
+    // triangle of the hit mesh
+    uint32_t *hit_prim;
+
+    // shadow rays - light contribution if light is not occluded
+    float    *color_r;
+    float    *color_g;
+    float    *color_b;
+
+    // index of the pixel in the batch
+    uint32_t *pixel;
+
+    size_t    count;
+    size_t    capacity;
+} ray_queue_t;
+
+typedef struct wavefront
+{
+    ray_queue_t primary;
+    ray_queue_t shadow;
+    // shadow rays waiting for streamed chunks, traced in later passes
+    ray_queue_t parked;
+
+    // surfaces at the primary hits
+    vec3_t            *hit_pos;
+    vec3_t            *hit_norm;
+    const material_t **hit_mat;
+    // fraction of ambient light reaching the hits, only with ambient occlusion
+    float             *hit_ambient;
+
+    // slots of the rays being intersected, reordered as the batch splits between nodes
+    uint32_t          *rays;
+    // entry distances into children of the node being walked, by slot
+    float             *entry_left;
+    float             *entry_right;
+    // far child entries of the rays walking down the near one, by depth and packet slot
+    float             *far_entries;
+    // inverse directions of the queue being intersected
+    float             *inv_x;
+    float             *inv_y;
+    float             *inv_z;
+
+    // instances of streamed prototypes in the scene of the batch
+    uint32_t          *streamed;
+    size_t             streamed_count;
+    size_t             streamed_capacity;
+} wavefront_t;
+
+/**
+ * Allocates queues for batches up to capacity rays
+ */
+bool wavefront_init(wavefront_t *wf, size_t capacity);
+
+void wavefront_destroy(wavefront_t *wf);
+
+/**
+ * Traces pixels of the frame given by their coordinates
+ * and writes their colors to out_colors in the same order
+ * pixel_count must not exceed capacity of the queues
+ */
+void wavefront_render(wavefront_t *wf, scene_t scene, const uint32_t *pixel_x,
+                      const uint32_t *pixel_y, size_t pixel_count, color_t *out_colors);
+
+#endif